@@ -98,7 +98,11 @@ function ServerHandleUserConnected(connectionID, user) {
     avatarEntity.SetName(avatarEntityName);
     
     if (user != null)
+    {
     	avatarEntity.SetDescription(user.GetProperty("username"));
+        // Replicate the scene to the user from the avatar's viewpoint when the server uses interest management
+        user.SetObserverEntityId(avatarEntity.id);
+    }
 
     var script = avatarEntity.script;
     script.className = "AvatarApp.SimpleAvatar";
@@ -274,7 +274,7 @@ EC_Script* JavascriptModule::FindScriptApplication(EC_Script* instance, const QS
     if (!scene)
         return 0;
     // Get all script components that possibly refer to this application
-    EntityList entities = scene->GetEntitiesWithComponent(EC_Script::TypeNameStatic());
+    EntityList entities = scene->GetEntitiesWithComponent<EC_Script>();
     for (EntityList::iterator i = entities.begin(); i != entities.end(); ++i)
     {
         Entity* entity = i->get();
@@ -438,7 +438,7 @@ void JavascriptModule::CreateScriptObjects(EC_Script* app)
         return;
     QString appName, className;
     // Get all script components that possibly refer to this application
-    EntityList entities = scene->GetEntitiesWithComponent(EC_Script::TypeNameStatic());
+    EntityList entities = scene->GetEntitiesWithComponent<EC_Script>();
     for (EntityList::iterator i = entities.begin(); i != entities.end(); ++i)
     {
         Entity* entity = i->get();
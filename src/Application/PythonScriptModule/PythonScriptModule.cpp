@@ -541,7 +541,7 @@ namespace PythonScript
         Scene *scene = GetFramework()->Scene()->MainCameraScene();
         if (scene)
         {
-            EntityList cameraEnts = scene->GetEntitiesWithComponent(EC_Camera::TypeNameStatic());
+            EntityList cameraEnts = scene->GetEntitiesWithComponent<EC_Camera>();
             EntityList::iterator iter = cameraEnts.begin();
             while (iter != cameraEnts.end())
             {
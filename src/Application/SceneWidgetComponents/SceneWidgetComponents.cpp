@@ -54,7 +54,7 @@ void SceneWidgetComponents::OnMouseEvent(MouseEvent *mEvent)
     float closestDistance = 100000.0;
     EC_WidgetBillboard *closestComponent = 0;
 
-    EntityList ents = framework_->Scene()->MainCameraScene()->GetEntitiesWithComponent(EC_WidgetBillboard::TypeNameStatic());
+    EntityList ents = framework_->Scene()->MainCameraScene()->GetEntitiesWithComponent<EC_WidgetBillboard>();
     EntityList::const_iterator iter = ents.begin();
 
     // Find the closest hit EC_WidgetBillboard
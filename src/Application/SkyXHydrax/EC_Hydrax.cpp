@@ -251,7 +251,7 @@ void EC_Hydrax::Update(float frameTime)
         // Find out if we have SkyX in the scene. If yes, use its sun position.
         if (impl->skyX.expired())
         {
-            EntityList entities = ParentEntity()->ParentScene()->GetEntitiesWithComponent(EC_SkyX::TypeNameStatic());
+            EntityList entities = ParentEntity()->ParentScene()->GetEntitiesWithComponent<EC_SkyX>();
             if (!entities.empty())
                 impl->skyX = (*entities.begin())->GetComponent<EC_SkyX>();
         }
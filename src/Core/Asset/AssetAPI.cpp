@@ -25,6 +25,9 @@
 #include <QFileSystemWatcher>
 #include <QList>
 #include <QMap>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
 
 #include <boost/thread.hpp>
 #include <boost/algorithm/string.hpp>
@@ -526,6 +529,32 @@ AssetUploadTransferPtr AssetAPI::UploadAssetFromFile(const QString &filename, co
     return transfer;
 }
 
+/// Content hash of uploaded data.
+struct AssetAPI::UploadHash
+{
+    std::vector<u8> data; ///< The uploaded data. Released by the hashing thread when it is done.
+    QString hash; ///< The hex-encoded SHA-1 hash, empty until the hashing thread is done. Guarded by mutex.
+    QMutex mutex;
+};
+
+/// Computes the content hash of uploaded data on a worker thread, so that large uploads do not stall the main thread.
+class AssetUploadHashTask : public QRunnable
+{
+public:
+    explicit AssetUploadHashTask(const AssetAPI::UploadHashPtr &uploadHash_) : uploadHash(uploadHash_) {}
+
+    void run()
+    {
+        QString hash = AssetCache::ComputeContentHash(uploadHash->data.empty() ? 0 : &uploadHash->data[0], uploadHash->data.size());
+        QMutexLocker lock(&uploadHash->mutex);
+        uploadHash->hash = hash;
+        std::vector<u8>().swap(uploadHash->data);
+    }
+
+private:
+    AssetAPI::UploadHashPtr uploadHash;
+};
+
 AssetUploadTransferPtr AssetAPI::UploadAssetFromFile(const char *filename, AssetStoragePtr destination, const char *assetName)
 {
     if (!filename || strlen(filename) == 0)
@@ -602,7 +631,16 @@ AssetUploadTransferPtr AssetAPI::UploadAssetFromFileInMemory(const u8 *data, siz
 
     AssetUploadTransferPtr transfer = provider->UploadAssetFromFileInMemory(data, numBytes, destination, assetName);
     if (transfer)
-        currentUploadTransfers[transfer->destinationStorage.lock()->GetFullAssetURL(assetName)] = transfer;
+    {
+        QString assetRef = transfer->destinationStorage.lock()->GetFullAssetURL(assetName);
+        currentUploadTransfers[assetRef] = transfer;
+
+        // Hash the data while it is being uploaded, so that the hash can be announced along with the upload
+        UploadHashPtr uploadHash(new UploadHash);
+        uploadHash->data.assign(data, data + numBytes);
+        uploadHashes[assetRef] = uploadHash;
+        QThreadPool::globalInstance()->start(new AssetUploadHashTask(uploadHash));
+    }
 
     return transfer;
 }
@@ -628,6 +666,7 @@ void AssetAPI::Reset()
     readyTransfers.clear();
     assetDependencies.clear();
     currentUploadTransfers.clear();
+    uploadHashes.clear();
     currentTransfers.clear();
     providers.clear();
 }
@@ -1326,8 +1365,10 @@ void AssetAPI::AssetUploadTransferCompleted(IAssetUploadTransfer *uploadTransfer
     uploadTransfer->EmitTransferCompleted();
 
     QString assetRef = uploadTransfer->AssetRef();
-    
+
+    // The content hash of the upload is available through GetAssetContentHash only while the signal is emitted
     emit AssetUploaded(assetRef);
+    uploadHashes.erase(assetRef);
     
     // We've completed an asset upload transfer. See if there is an asset download transfer that is waiting
     // for this upload to complete. 
@@ -1495,11 +1536,23 @@ int AssetAPI::NumPendingDependencies(AssetPtr asset) const
     return numDependencies;
 }
 
-void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType)
+void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType, const QString &contentHash)
 {
+    // If the same content is already cached, possibly under another asset ref, map the asset ref to it so that the asset is loaded from the cache.
+    if (!contentHash.isEmpty() && assetCache)
+        assetCache->AddAssetRefForContentHash(assetRef, contentHash);
     HandleAssetDiscovery(assetRef, assetType, AssetStoragePtr());
 }
 
+QString AssetAPI::GetAssetContentHash(const QString &assetRef) const
+{
+    std::map<QString, UploadHashPtr, QStringLessThanNoCase>::const_iterator iter = uploadHashes.find(assetRef);
+    if (iter == uploadHashes.end())
+        return "";
+    QMutexLocker lock(&iter->second->mutex);
+    return iter->second->hash;
+}
+
 void AssetAPI::HandleAssetDiscovery(const QString &assetRef, const QString &assetType, AssetStoragePtr storage)
 {
     AssetPtr existing = GetAsset(assetRef);
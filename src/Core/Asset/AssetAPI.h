@@ -374,7 +374,14 @@ public slots:
     bool ShouldReplicateAssetDiscovery(const QString &assetRef);
     
     /// Handle discovery of a new asset through the AssetDiscovery network message
-    void HandleAssetDiscovery(const QString &assetRef, const QString &assetType);
+    /** @param contentHash Hex-encoded SHA-1 hash of the asset data, if known. If the asset cache has the same content, the asset is not downloaded again.
+            Pass only hashes from a trusted source, as the cached content is used without checking. */
+    void HandleAssetDiscovery(const QString &assetRef, const QString &assetType, const QString &contentHash = "");
+
+    /// Returns the hex-encoded SHA-1 hash of the data of an uploaded asset, or an empty string if not known.
+    /** The hash is computed on a worker thread during the upload, and is only available while the AssetUploaded signal is emitted,
+        so that it can be announced along with the upload. If the hashing has not finished by then, the hash is not known. */
+    QString GetAssetContentHash(const QString &assetRef) const;
 
     /// Handle deletion of an asset through the AssetDeleted network message
     void HandleAssetDeleted(const QString &assetRef);
@@ -502,6 +509,12 @@ private:
 
     AssetCache *assetCache;
 
+    friend class AssetUploadHashTask;
+    struct UploadHash;
+    typedef boost::shared_ptr<UploadHash> UploadHashPtr;
+    /// Content hashes of the uploads in progress, by asset ref. An entry is removed when its upload completes.
+    std::map<QString, UploadHashPtr, QStringLessThanNoCase> uploadHashes;
+
     Framework *fw;
 };
 
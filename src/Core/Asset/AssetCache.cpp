@@ -13,15 +13,75 @@
 #include <QDataStream>
 #include <QFileInfo>
 #include <QScopedPointer>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QSet>
+
+#include <algorithm>
+#include <vector>
 
 #include "MemoryLeakCheck.h"
 
+/// Default maximum size of the asset cache in megabytes.
+static const qint64 cDefaultMaximumSizeMB = 1024;
+/// Name of the index file in the cache directory.
+static const char * const cIndexFilename = "cacheindex";
+/// Version of the index file format.
+static const quint32 cIndexVersion = 2;
+/// Delay of the scheduled index saves in milliseconds.
+static const int cIndexSaveDelayMs = 5000;
+
+static uint CurrentTime()
+{
+    return QDateTime::currentDateTime().toTime_t();
+}
+
+#ifndef DISABLE_QNETWORKDISKCACHE
+/// Data file of a download, which computes the content hash of the data as QNetworkAccessManager writes it.
+/** Spreads the hashing over the download, instead of reading the whole file back on the main thread when it is complete. */
+class ContentHashingFile : public QFile
+{
+public:
+    explicit ContentHashingFile(const QString &name) : QFile(name), hasher(QCryptographicHash::Sha1), numHashedBytes(0) {}
+
+    /// Returns the hex-encoded SHA-1 hash of the written data, or an empty string if the file was not written only sequentially from the start.
+    QString ContentHash()
+    {
+        return numHashedBytes == size() ? QString(hasher.result().toHex()) : QString();
+    }
+
+protected:
+    qint64 writeData(const char *data, qint64 len)
+    {
+        qint64 written = QFile::writeData(data, len);
+        if (written > 0)
+        {
+            hasher.addData(data, (int)written);
+            numHashedBytes += written;
+        }
+        return written;
+    }
+
+private:
+    QCryptographicHash hasher;
+    qint64 numHashedBytes;
+};
+#endif
+
 AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) : 
 #ifndef DISABLE_QNETWORKDISKCACHE
     QNetworkDiskCache(0),
 #endif
     assetAPI(owner),
-    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory)))
+    cacheDirectory(GuaranteeTrailingSlash(QDir::fromNativeSeparators(assetCacheDirectory))),
+    totalSize(0),
+    maximumSize(cDefaultMaximumSizeMB * 1024 * 1024),
+    nextAccessOrder(1),
+    evictionBlockedSize(0),
+    indexDirty(false),
+    numHits(0),
+    numMisses(0),
+    numEvictions(0)
 {
     LogInfo("* Asset cache directory: " + cacheDirectory);  
 
@@ -50,22 +110,46 @@ AssetCache::AssetCache(AssetAPI *owner, QString assetCacheDirectory) :
     setCacheDirectory(cacheDirectory);
 #endif
 
+    saveIndexTimer.setSingleShot(true);
+    saveIndexTimer.setInterval(cIndexSaveDelayMs);
+    connect(&saveIndexTimer, SIGNAL(timeout()), SLOT(SaveIndex()));
+
+    LoadIndex();
+
     // Check --clear-asset-cache start param
     if (owner->GetFramework()->HasCommandLineParameter("--clear-asset-cache"))
     {
         LogInfo("AssetCache: Removing all data and metadata files from cache, found 'clear-asset-cache' from start params!");
         ClearAssetCache();
     }
+
+    QStringList sizeParam = owner->GetFramework()->CommandLineParameters("--assetcachesize");
+    if (!sizeParam.isEmpty())
+    {
+        bool ok = false;
+        qint64 sizeMB = sizeParam.last().toLongLong(&ok);
+        if (ok && sizeMB >= 0)
+            SetMaximumSize(sizeMB * 1024 * 1024);
+        else
+            LogError("AssetCache: Invalid value for --assetcachesize: " + sizeParam.last());
+    }
+    else
+        Evict();
+}
+
+AssetCache::~AssetCache()
+{
+    SaveIndex();
 }
 
 #ifndef DISABLE_QNETWORKDISKCACHE
 QIODevice* AssetCache::data(const QUrl &url)
 {
     QScopedPointer<QFile> dataFile;
-    QString absoluteDataFile = GetAbsoluteFilePath(false, url);
-    if (QFile::exists(absoluteDataFile))
+    QString filename = ResolveDataFile(url.toString());
+    if (Touch(filename) && assetDataDir.exists(filename))
     {
-        dataFile.reset(new QFile(absoluteDataFile));
+        dataFile.reset(new QFile(assetDataDir.absoluteFilePath(filename)));
         if (!dataFile->open(QIODevice::ReadWrite))
         {
             dataFile.reset();
@@ -80,27 +164,73 @@ QIODevice* AssetCache::data(const QUrl &url)
 void AssetCache::insert(QIODevice* device)
 {
     // We own this ptr from prepare()
+    QString url;
     QHashIterator<QString, QFile*> it(preparedItems);
     while(it.hasNext())
     {
         it.next();
         if (it.value() == device)
         {
+            url = it.key();
             preparedItems.remove(it.key());
             break;
         }
     }
+
+    // The data written by QNetworkAccessManager has been hashed as it was written. Read it back only if it was not written sequentially.
+    QFile *dataFile = qobject_cast<QFile*>(device);
+    QString hash;
+    QString absoluteDataFile;
+    qint64 size = 0;
+    if (dataFile && !url.isEmpty())
+    {
+        absoluteDataFile = dataFile->fileName();
+        size = dataFile->size();
+        ContentHashingFile *hashingFile = dynamic_cast<ContentHashingFile*>(dataFile);
+        if (hashingFile)
+            hash = hashingFile->ContentHash();
+        if (hash.isEmpty())
+        {
+            QCryptographicHash hasher(QCryptographicHash::Sha1);
+            dataFile->seek(0);
+            while(!dataFile->atEnd())
+                hasher.addData(dataFile->read(64 * 1024));
+            hash = hasher.result().toHex();
+        }
+    }
+
     // Delete later, meaning next qt mainloop cycle, because the asset will 
     // use this ptr to deserialize the content to and IAsset after this call return.
     device->close();
     device->deleteLater();
+
+    // Move the data to the content-addressed file, or drop it if the same content is already in the cache.
+    if (!hash.isEmpty())
+    {
+        QString filename = ContentFilename(hash, url);
+        if (index.contains(filename) && assetDataDir.exists(filename))
+            QFile::remove(absoluteDataFile);
+        else
+        {
+            assetDataDir.remove(filename);
+            if (!QFile::rename(absoluteDataFile, assetDataDir.absoluteFilePath(filename)))
+            {
+                LogError("AssetCache: Failed to move cache entry " + absoluteDataFile + " to " + filename);
+                return;
+            }
+            AddIndexEntry(filename, size, hash);
+        }
+        MapAssetRef(url, filename);
+        Evict(filename);
+    }
 }
 
 QIODevice* AssetCache::prepare(const QNetworkCacheMetaData &metaData)
 {
     if (!WriteMetadata(GetAbsoluteFilePath(true, metaData.url()), metaData))
         return 0;
-    QScopedPointer<QFile> dataFile(new QFile(GetAbsoluteFilePath(false, metaData.url())));
+    // The data is written to a per-URL file, and moved to its content-addressed file in insert().
+    QScopedPointer<QFile> dataFile(new ContentHashingFile(GetAbsoluteFilePath(false, metaData.url())));
     if (!dataFile->open(QIODevice::ReadWrite))
     {
         LogError("AssetCache: Failed not open data file QIODevice::ReadWrite mode for " + metaData.url().toString().toStdString());
@@ -152,6 +282,8 @@ bool AssetCache::remove(const QUrl &url)
     QString absoluteDataFile = GetAbsoluteFilePath(false, url);
     if (QFile::exists(absoluteDataFile))
         success = QFile::remove(absoluteDataFile);
+    // The content-addressed data file is removed when no asset refs map to it anymore
+    UnmapAssetRef(url.toString());
     return success;
 }
 
@@ -187,8 +319,8 @@ void AssetCache::clear()
 
 qint64 AssetCache::expire()
 {
-    // Skip keeping cache at some static size, unlimited for now.
-    return maximumCacheSize() / 2;
+    Evict();
+    return totalSize;
 }
 #endif
 
@@ -197,20 +329,26 @@ QString AssetCache::FindInCache(const QString &assetRef)
     // Deny http:// and https:// asset references to be gotten from cache
     // as the QAccessManager will request it from the overrides above later!
     // You can get the path if you ask directly as a url.
-    if (assetRef.startsWith("http://") || assetRef.startsWith("https://")) ///\todo Remove this. The Asset Cache needs to be protocol agnostic. -jj.
+    // However, if the content hash of the asset has been announced to us and we have that content, the cached data is known to be current.
+    if ((assetRef.startsWith("http://") || assetRef.startsWith("https://")) && !verifiedRefs.contains(AssetAPI::SanitateAssetRef(assetRef))) ///\todo Remove this. The Asset Cache needs to be protocol agnostic. -jj.
         return "";
 
-    QString absolutePath = assetDataDir.absolutePath() + "/" + AssetAPI::SanitateAssetRef(assetRef);
-    if (QFile::exists(absolutePath))
-        return absolutePath;
+    QString filename = ResolveDataFile(assetRef);
+    if (Touch(filename))
+    {
+        if (assetDataDir.exists(filename))
+            return assetDataDir.absoluteFilePath(filename);
+        // The file has been removed from outside.
+        RemoveIndexEntry(filename);
+    }
     return "";
 }
 
 QString AssetCache::GetDiskSourceByRef(const QString &assetRef)
 {
-    QString absolutePath = assetDataDir.absolutePath() + "/" + AssetAPI::SanitateAssetRef(assetRef);
-    if (QFile::exists(absolutePath))
-        return absolutePath;
+    QString filename = ResolveDataFile(assetRef);
+    if (!filename.isEmpty() && assetDataDir.exists(filename))
+        return assetDataDir.absoluteFilePath(filename);
     return "";
 }
 
@@ -223,20 +361,52 @@ QString AssetCache::StoreAsset(AssetPtr asset)
 {
     std::vector<u8> data;
     asset->SerializeTo(data);
-    return StoreAsset(&data[0], data.size(), asset->Name());
+    return StoreAsset(data.empty() ? 0 : &data[0], data.size(), asset->Name());
 }
 
 QString AssetCache::StoreAsset(const u8 *data, size_t numBytes, const QString &assetName)
 {
-    QString absolutePath = GetAbsoluteDataFilePath(assetName);
-#ifdef DISABLE_QNETWORKDISKCACHE // Don't store duplicate assets, but only if not using QNetworkDiskCache.
-    if (QFile::exists(absolutePath))
-        return absolutePath;
-#endif
-    bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath.toStdString().c_str());
-    if (success)
-        return absolutePath;
-    return "";
+    // Identical data stored for several asset refs is kept in the cache only once.
+    QString hash = ComputeContentHash(data, numBytes);
+    QString filename = ContentFilename(hash, assetName);
+    QString absolutePath = assetDataDir.absoluteFilePath(filename);
+    if (!index.contains(filename) || !QFile::exists(absolutePath))
+    {
+        bool success = SaveAssetFromMemoryToFile(data, numBytes, absolutePath.toStdString().c_str());
+        if (!success)
+            return "";
+        AddIndexEntry(filename, numBytes, hash);
+    }
+    else
+        MarkAccessed(index.find(filename));
+    MapAssetRef(assetName, filename);
+    Evict(filename);
+    return absolutePath;
+}
+
+QString AssetCache::StoreAssetFile(const QString &sourceFilename, const QString &assetName, const QString &contentHash)
+{
+    QString filename = ContentFilename(contentHash, assetName);
+    QString absolutePath = assetDataDir.absoluteFilePath(filename);
+    if (!index.contains(filename) || !QFile::exists(absolutePath))
+    {
+        qint64 size = QFileInfo(sourceFilename).size();
+        assetDataDir.remove(filename);
+        if (!QFile::rename(sourceFilename, absolutePath))
+        {
+            LogError("AssetCache: Failed to move " + sourceFilename + " to cache entry " + filename);
+            return "";
+        }
+        AddIndexEntry(filename, size, contentHash);
+    }
+    else
+    {
+        QFile::remove(sourceFilename);
+        MarkAccessed(index.find(filename));
+    }
+    MapAssetRef(assetName, filename);
+    Evict(filename);
+    return absolutePath;
 }
 
 void AssetCache::DeleteAsset(const QString &assetRef)
@@ -249,6 +419,8 @@ void AssetCache::DeleteAsset(const QUrl &assetUrl)
 #ifndef DISABLE_QNETWORKDISKCACHE
     if (!remove(assetUrl))
         LogWarning("AssetCache: AssetCache::DeleteAsset Failed to delete asset " + assetUrl.toString().toStdString());
+#else
+    UnmapAssetRef(assetUrl.toString());
 #endif
 }
 
@@ -258,6 +430,363 @@ void AssetCache::ClearAssetCache()
 #ifndef DISABLE_QNETWORKDISKCACHE
     ClearDirectory(assetMetaDataDir.absolutePath());
 #endif
+    index.clear();
+    lruOrder.clear();
+    refToFile.clear();
+    verifiedRefs.clear();
+    totalSize = 0;
+    evictionBlockedSize = 0;
+    indexDirty = true;
+    SaveIndex();
+}
+
+QString AssetCache::GetContentHash(const QString &assetRef)
+{
+    CacheIndex::const_iterator iter = index.find(ResolveDataFile(assetRef));
+    return iter != index.end() ? iter->hash : QString();
+}
+
+bool AssetCache::AddAssetRefForContentHash(const QString &assetRef, const QString &hash)
+{
+    if (hash.isEmpty())
+        return false;
+
+    QString sanitatedRef = AssetAPI::SanitateAssetRef(assetRef);
+    QString filename = ContentFilename(hash.toLower(), assetRef);
+    if (index.contains(filename) && assetDataDir.exists(filename))
+    {
+        MapAssetRef(assetRef, filename);
+        verifiedRefs.insert(sanitatedRef);
+        return true;
+    }
+
+    // The content has changed, so the data cached for the ref is stale.
+    verifiedRefs.remove(sanitatedRef);
+    CacheIndex::const_iterator iter = index.find(ResolveDataFile(assetRef));
+    if (iter != index.end() && !iter->hash.isEmpty() && iter->hash.compare(hash, Qt::CaseInsensitive) != 0)
+        DeleteAsset(assetRef);
+    return false;
+}
+
+QString AssetCache::ComputeContentHash(const u8 *data, size_t numBytes)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData((const char*)data, (int)numBytes), QCryptographicHash::Sha1).toHex();
+}
+
+QString AssetCache::ContentHashOfLoadedData(const QString &assetRef, const QString &diskSource, const u8 *data, size_t numBytes)
+{
+    // The size check catches a cached file that was changed from outside after it was hashed
+    QString filename = ResolveDataFile(assetRef);
+    CacheIndex::const_iterator iter = index.find(filename);
+    if (iter != index.end() && !iter->hash.isEmpty() && iter->size == (qint64)numBytes && !diskSource.isEmpty() &&
+        QDir::cleanPath(diskSource) == QDir::cleanPath(assetDataDir.absoluteFilePath(filename)))
+        return iter->hash;
+    return ComputeContentHash(data, numBytes);
+}
+
+void AssetCache::SetMaximumSize(qint64 bytes)
+{
+    maximumSize = std::max<qint64>(bytes, 0);
+    evictionBlockedSize = 0;
+    Evict();
+}
+
+QVariantMap AssetCache::GetStatistics() const
+{
+    QVariantMap stats;
+    stats["hits"] = numHits;
+    stats["misses"] = numMisses;
+    stats["evictions"] = numEvictions;
+    stats["entries"] = index.size();
+    stats["assetRefs"] = refToFile.size();
+    stats["totalSize"] = totalSize;
+    stats["maximumSize"] = maximumSize;
+    return stats;
+}
+
+void AssetCache::LoadIndex()
+{
+    index.clear();
+    lruOrder.clear();
+    refToFile.clear();
+    verifiedRefs.clear();
+    totalSize = 0;
+    indexDirty = false;
+
+    QFile indexFile(cacheDirectory + cIndexFilename);
+    if (indexFile.open(QIODevice::ReadOnly))
+    {
+        QDataStream indexStream(&indexFile);
+        quint32 version = 0;
+        quint32 numEntries = 0;
+        indexStream >> version >> numEntries;
+        if (version == cIndexVersion || version == 1)
+        {
+            for(quint32 i = 0; i < numEntries && indexStream.status() == QDataStream::Ok; ++i)
+            {
+                QString filename;
+                CacheEntry entry;
+                indexStream >> filename;
+                if (version == 1)
+                {
+                    // Version 1 stored a single asset ref per file
+                    QString assetRef;
+                    indexStream >> assetRef;
+                    if (!assetRef.isEmpty())
+                        entry.assetRefs << assetRef;
+                }
+                else
+                    indexStream >> entry.assetRefs;
+                indexStream >> entry.size >> entry.lastAccess >> entry.hash;
+                if (indexStream.status() == QDataStream::Ok)
+                    index[filename] = entry;
+            }
+            if (version != cIndexVersion)
+                indexDirty = true;
+        }
+        else
+            LogWarning("AssetCache: Unsupported index file version " + QString::number(version) + ", rebuilding the index.");
+    }
+
+    // Reconcile the index with the data files, in case it was not saved on the last run. Only the files that are not in the index are examined.
+    QSet<QString> dataFiles = assetDataDir.entryList(QDir::Files | QDir::NoDotAndDotDot).toSet();
+    for(CacheIndex::iterator iter = index.begin(); iter != index.end();)
+    {
+        if (!dataFiles.contains(iter.key()))
+        {
+            iter = index.erase(iter);
+            indexDirty = true;
+        }
+        else
+        {
+            totalSize += iter->size;
+            foreach(const QString &assetRef, iter->assetRefs)
+                refToFile[AssetAPI::SanitateAssetRef(assetRef)] = iter.key();
+            ++iter;
+        }
+    }
+    foreach(const QString &filename, dataFiles)
+        if (!index.contains(filename))
+        {
+            QFileInfo fileInfo(assetDataDir.absoluteFilePath(filename));
+            CacheEntry entry;
+            entry.size = fileInfo.size();
+            entry.lastAccess = fileInfo.lastModified().toTime_t();
+            index[filename] = entry;
+            totalSize += entry.size;
+            indexDirty = true;
+        }
+
+    // Order the entries by their last access, this is the only time the whole index is sorted
+    std::vector<std::pair<uint, QString> > entriesByAge;
+    entriesByAge.reserve(index.size());
+    for(CacheIndex::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        entriesByAge.push_back(std::make_pair(iter->lastAccess, iter.key()));
+    std::sort(entriesByAge.begin(), entriesByAge.end());
+    for(size_t i = 0; i < entriesByAge.size(); ++i)
+    {
+        index[entriesByAge[i].second].accessOrder = nextAccessOrder;
+        lruOrder.insert(nextAccessOrder++, entriesByAge[i].second);
+    }
+}
+
+void AssetCache::SaveIndex()
+{
+    if (!indexDirty)
+        return;
+
+    // Write to a temporary file first so that a failed write does not destroy the old index.
+    const QString indexFilename = cacheDirectory + cIndexFilename;
+    QFile indexFile(indexFilename + ".tmp");
+    if (!indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("AssetCache::SaveIndex: Could not open index file " + indexFile.fileName() + " for writing.");
+        return;
+    }
+
+    QDataStream indexStream(&indexFile);
+    indexStream << cIndexVersion << (quint32)index.size();
+    for(CacheIndex::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        indexStream << iter.key() << iter->assetRefs << iter->size << iter->lastAccess << iter->hash;
+    indexFile.close();
+
+    QFile::remove(indexFilename);
+    if (!QFile::rename(indexFile.fileName(), indexFilename))
+    {
+        LogError("AssetCache::SaveIndex: Could not replace index file " + indexFilename);
+        return;
+    }
+    indexDirty = false;
+}
+
+void AssetCache::ScheduleSaveIndex()
+{
+    if (!saveIndexTimer.isActive())
+        saveIndexTimer.start();
+}
+
+void AssetCache::MarkAccessed(CacheIndex::iterator iter)
+{
+    if (iter == index.end())
+        return;
+    if (iter->accessOrder != 0)
+        lruOrder.remove(iter->accessOrder);
+    iter->accessOrder = nextAccessOrder++;
+    lruOrder.insert(iter->accessOrder, iter.key());
+    iter->lastAccess = CurrentTime();
+    indexDirty = true;
+}
+
+QString AssetCache::ContentFilename(const QString &hash, const QString &assetRef) const
+{
+    // Keep the suffix of the asset, as some asset loaders look at the suffix of the disk source.
+    QString suffix = QFileInfo(AssetAPI::ExtractFilenameFromAssetRef(assetRef)).suffix();
+    return suffix.isEmpty() ? hash : hash + "." + AssetAPI::SanitateAssetRef(suffix);
+}
+
+QString AssetCache::ResolveDataFile(const QString &assetRef) const
+{
+    QString sanitatedRef = AssetAPI::SanitateAssetRef(assetRef);
+    QHash<QString, QString>::const_iterator iter = refToFile.find(sanitatedRef);
+    if (iter != refToFile.end())
+        return iter.value();
+    // Files stored by older versions are named by the asset ref
+    if (index.contains(sanitatedRef))
+        return sanitatedRef;
+    return "";
+}
+
+void AssetCache::AddIndexEntry(const QString &filename, qint64 size, const QString &hash)
+{
+    CacheIndex::iterator iter = index.find(filename);
+    if (iter == index.end())
+        iter = index.insert(filename, CacheEntry());
+    totalSize += size - iter->size;
+    iter->size = size;
+    iter->hash = hash;
+    MarkAccessed(iter);
+}
+
+void AssetCache::RemoveIndexEntry(const QString &filename)
+{
+    CacheIndex::iterator iter = index.find(filename);
+    if (iter != index.end())
+    {
+        foreach(const QString &assetRef, iter->assetRefs)
+        {
+            QString sanitatedRef = AssetAPI::SanitateAssetRef(assetRef);
+            refToFile.remove(sanitatedRef);
+            verifiedRefs.remove(sanitatedRef);
+        }
+        totalSize -= iter->size;
+        lruOrder.remove(iter->accessOrder);
+        index.erase(iter);
+        indexDirty = true;
+    }
+}
+
+void AssetCache::MapAssetRef(const QString &assetRef, const QString &filename)
+{
+    QString sanitatedRef = AssetAPI::SanitateAssetRef(assetRef);
+    QString oldFilename = ResolveDataFile(assetRef);
+    if (oldFilename == filename)
+        return;
+    if (!oldFilename.isEmpty())
+        UnmapAssetRef(assetRef);
+
+    CacheIndex::iterator iter = index.find(filename);
+    if (iter == index.end())
+        return;
+    iter->assetRefs << assetRef;
+    refToFile[sanitatedRef] = filename;
+    indexDirty = true;
+    // The data files are named by their content, so the index is the only record of the asset ref. Save it soon, so that it survives a crash.
+    ScheduleSaveIndex();
+}
+
+void AssetCache::UnmapAssetRef(const QString &assetRef)
+{
+    QString sanitatedRef = AssetAPI::SanitateAssetRef(assetRef);
+    QString filename = ResolveDataFile(assetRef);
+    refToFile.remove(sanitatedRef);
+    verifiedRefs.remove(sanitatedRef);
+    CacheIndex::iterator iter = index.find(filename);
+    if (iter == index.end())
+        return;
+
+    for(int i = iter->assetRefs.size() - 1; i >= 0; --i)
+        if (AssetAPI::SanitateAssetRef(iter->assetRefs[i]) == sanitatedRef)
+            iter->assetRefs.removeAt(i);
+    indexDirty = true;
+    ScheduleSaveIndex();
+
+    // Remove the data when no asset refs use it anymore
+    if (iter->assetRefs.isEmpty())
+    {
+        assetDataDir.remove(filename);
+        RemoveIndexEntry(filename);
+    }
+}
+
+bool AssetCache::Touch(const QString &filename)
+{
+    CacheIndex::iterator iter = filename.isEmpty() ? index.end() : index.find(filename);
+    if (iter == index.end())
+    {
+        ++numMisses;
+        return false;
+    }
+    ++numHits;
+    MarkAccessed(iter);
+    return true;
+}
+
+void AssetCache::Evict(const QString &keepFile)
+{
+    if (maximumSize <= 0 || totalSize <= maximumSize)
+        return;
+
+    // If the entries in use kept the last eviction from reaching its target, scan them again only after the cache has grown by another tenth
+    if (evictionBlockedSize > 0 && totalSize < evictionBlockedSize + maximumSize / 10)
+        return;
+
+    // Evict down to 90% of the maximum size, so that eviction does not need to be done again on every store
+    const qint64 targetSize = maximumSize - maximumSize / 10;
+    const uint numEvictionsBefore = numEvictions;
+    for(QMap<quint64, QString>::iterator lruIter = lruOrder.begin(); lruIter != lruOrder.end() && totalSize > targetSize;)
+    {
+        const QString filename = lruIter.value();
+        ++lruIter; // RemoveIndexEntry() removes the current item from lruOrder
+        if (filename == keepFile)
+            continue;
+        CacheIndex::iterator iter = index.find(filename);
+        // Do not remove the disk sources of loaded assets
+        bool inUse = false;
+        foreach(const QString &assetRef, iter->assetRefs)
+            if (assetAPI->GetAsset(assetRef))
+            {
+                inUse = true;
+                break;
+            }
+        if (inUse)
+            continue;
+
+        if (!assetDataDir.remove(filename) && assetDataDir.exists(filename))
+        {
+            LogWarning("AssetCache: Failed to evict cache entry " + assetDataDir.absoluteFilePath(filename));
+            continue;
+        }
+#ifndef DISABLE_QNETWORKDISKCACHE
+        foreach(const QString &assetRef, iter->assetRefs)
+            QFile::remove(GetAbsoluteFilePath(true, QUrl(assetRef, QUrl::TolerantMode)));
+#endif
+        RemoveIndexEntry(filename);
+        ++numEvictions;
+    }
+
+    evictionBlockedSize = totalSize > targetSize ? totalSize : 0;
+    if (numEvictions != numEvictionsBefore)
+        ScheduleSaveIndex();
 }
 
 #ifndef DISABLE_QNETWORKDISKCACHE
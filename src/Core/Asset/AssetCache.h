@@ -11,6 +11,12 @@
 #include <QUrl>
 #include <QDir>
 #include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVariant>
+#include <QMap>
+#include <QTimer>
 
 #include "CoreTypes.h"
 #include "AssetFwd.h"
@@ -18,9 +24,17 @@
 #ifndef DISABLE_QNETWORKDISKCACHE
 class QNetworkDiskCache;
 #endif
-/// Implements a disk cache for asset files to avoid re-downloading assets between runs.
+/// Implements a content-addressed disk cache for asset files to avoid re-downloading assets between runs.
 /** Subclassing QNetworkDiskCache has the main goal of separating metadata from the raw asset data. The basic implementation of QNetworkDiskCache
-    will store both in the same file. That did not work very well with our asset system as we need absolute paths to loaded assets for various purpouses. */
+    will store both in the same file. That did not work very well with our asset system as we need absolute paths to loaded assets for various purpouses.
+
+    The data files are named by the SHA-1 hash of their content, and asset refs map to the data files. Identical data under
+    several asset refs, for example the same texture from several storages, is stored only once.
+    The cache keeps an index of its entries with the size, last access time and content hash of each data file. The index is saved
+    to the cache directory a few seconds after it changes, and on exit, so that the cache can be opened without examining every file
+    and the asset refs of the data files survive a crash. When the total size of the data files
+    exceeds the maximum size, the least recently used entries are evicted. The maximum size can be given in megabytes with the
+    --assetcachesize command line parameter; 0 means unlimited. */
 #ifndef DISABLE_QNETWORKDISKCACHE
 class AssetCache : public QNetworkDiskCache
 #else
@@ -31,6 +45,21 @@ class AssetCache : public QObject
 
 public:
     explicit AssetCache(AssetAPI *owner, QString assetCacheDirectory);
+    ~AssetCache();
+
+    /// Returns the hex-encoded SHA-1 hash of the given data, as used by the cache.
+    static QString ComputeContentHash(const u8 *data, size_t numBytes);
+
+    /// Returns the hex-encoded SHA-1 hash of asset data that was loaded from the given disk source.
+    /** If the disk source is the cached data file of the asset ref, the hash is taken from the index, so that the data does not need to be hashed again.
+        Otherwise the hash is computed from the data. */
+    QString ContentHashOfLoadedData(const QString &assetRef, const QString &diskSource, const u8 *data, size_t numBytes);
+
+    /// Moves a file to the cache as the data of the given asset ref, without reading the file.
+    /** Used for derived data, such as processed forms of assets, whose content is determined by a key that is already known.
+        @param contentHash Hex-encoded SHA-1 hash which identifies the content in place of the hash of the file. It must change whenever the content does.
+        @return The absolute path to the cache entry, or an empty string if the file could not be moved. */
+    QString StoreAssetFile(const QString &filename, const QString &assetName, const QString &contentHash);
 
 #ifndef DISABLE_QNETWORKDISKCACHE
     /// Allocates new QFile*, it is the callers responsibility to free the memory once done with it.
@@ -62,8 +91,8 @@ public:
     /// QNetworkDiskCache override. Don't call directly, used by QNetworkAccessManager.
     virtual void clear();
 
-    /// Checks if asset cache is currently over the maximum limit.
-    /// This call is ignored untill we decide to limit the disk cache size.
+    /// Evicts least recently used entries if the asset cache is currently over the maximum limit.
+    /// @return The size of the cache after the eviction.
     /// QNetworkDiskCache override. Don't call directly, used by QNetworkAccessManager.
     virtual qint64 expire();
 #endif
@@ -103,6 +132,31 @@ public slots:
 
     /// Returns cache directory
     const QString& CacheDirectory() const { return cacheDirectory; }
+
+    /// Sets the maximum total size of the cached asset data in bytes. 0 means unlimited.
+    /** If the cache is over the new limit, the least recently used entries are evicted immediately. */
+    void SetMaximumSize(qint64 bytes);
+
+    /// Returns the maximum total size of the cached asset data in bytes, or 0 if unlimited.
+    qint64 MaximumSize() const { return maximumSize; }
+
+    /// Returns the total size of the cached asset data in bytes.
+    qint64 TotalSize() const { return totalSize; }
+
+    /// Returns the hex-encoded SHA-1 hash of the cached data of the given asset, or an empty string if the asset is not in the cache.
+    QString GetContentHash(const QString &assetRef);
+
+    /// Maps an asset ref to cached data with the given content hash, if such data is in the cache.
+    /** Used when the content hash of an asset is announced, for example in an asset discovery message, so that
+        the asset does not need to be downloaded if the same content is already cached under another asset ref.
+        If the data is not in the cache, and the data cached for the asset ref has a different hash, the stale data is removed.
+        The hash is trusted as is, so it must come from a trusted source, such as the server.
+        @return Whether the content was found from the cache. */
+    bool AddAssetRefForContentHash(const QString &assetRef, const QString &hash);
+
+    /// Returns the cache statistics: hits, misses, evictions, entries, assetRefs, totalSize and maximumSize.
+    /** The hit, miss and eviction counts are for the current run. */
+    QVariantMap GetStatistics() const;
     
 private slots:
 #ifndef DISABLE_QNETWORKDISKCACHE
@@ -118,7 +172,72 @@ private slots:
     /// Removes all files from a directory. Will not delete the folder itself or any subfolders it has.
     void ClearDirectory(const QString &absoluteDirPath);
 
+    /// Writes the index to the cache directory, if it has changed.
+    void SaveIndex();
+
 private:
+    /// Asset cache index entry.
+    struct CacheEntry
+    {
+        CacheEntry() : size(0), lastAccess(0), accessOrder(0) {}
+        QStringList assetRefs; ///< The asset refs which map to the data.
+        qint64 size; ///< Size of the data file in bytes.
+        uint lastAccess; ///< Time of the last store or hit, in seconds since epoch.
+        quint64 accessOrder; ///< Key of the entry in lruOrder, 0 if not set.
+        QString hash; ///< Hex-encoded SHA-1 hash of the data. Empty if not known.
+    };
+    /// Data file name -> index entry.
+    typedef QHash<QString, CacheEntry> CacheIndex;
+
+    /// Returns the content-addressed data file name for data with the given hash, stored for the given asset ref.
+    QString ContentFilename(const QString &hash, const QString &assetRef) const;
+
+    /// Returns the name of the data file of an asset ref, or an empty string if the asset ref is not in the cache.
+    QString ResolveDataFile(const QString &assetRef) const;
+
+    /// Reads the index from the cache directory and reconciles it with the data files.
+    void LoadIndex();
+
+    /// Saves the index after a short delay, so that several changes are written at once.
+    void ScheduleSaveIndex();
+
+    /// Sets the last access time of an index entry to now, and moves it to the end of lruOrder.
+    void MarkAccessed(CacheIndex::iterator iter);
+
+    /// Adds or updates an index entry for a data file that was just written.
+    void AddIndexEntry(const QString &filename, qint64 size, const QString &hash);
+
+    /// Removes the index entry of a data file, and the asset ref mappings to it. Does not remove the file.
+    void RemoveIndexEntry(const QString &filename);
+
+    /// Maps an asset ref to a data file in the index. The previous data file of the asset ref is removed if no other asset ref maps to it.
+    void MapAssetRef(const QString &assetRef, const QString &filename);
+
+    /// Removes the mapping of an asset ref. The data file is removed if no other asset ref maps to it.
+    void UnmapAssetRef(const QString &assetRef);
+
+    /// Marks a data file accessed and counts a cache hit. If the file is not in the index, counts a cache miss.
+    /** @return Whether the file was in the index. */
+    bool Touch(const QString &filename);
+
+    /// Evicts least recently used entries until the cache is below the maximum size.
+    /** @param keepFile Data file name which is not evicted, usually the one which was just stored. */
+    void Evict(const QString &keepFile = QString());
+
+    CacheIndex index; ///< Asset cache index.
+    QMap<quint64, QString> lruOrder; ///< Access order -> data file name, least recently used first.
+    quint64 nextAccessOrder; ///< Access order given to the next accessed entry.
+    qint64 evictionBlockedSize; ///< Total size after the last eviction that could not reach its target because of entries in use, 0 otherwise.
+    QTimer saveIndexTimer; ///< Delays the index saves scheduled by ScheduleSaveIndex().
+    QHash<QString, QString> refToFile; ///< Sanitated asset ref -> data file name.
+    QSet<QString> verifiedRefs; ///< Sanitated asset refs whose cached content has been announced to be current, see AddAssetRefForContentHash.
+    qint64 totalSize; ///< Total size of the data files in the index.
+    qint64 maximumSize; ///< Maximum total size of the data files, 0 for unlimited.
+    bool indexDirty; ///< Whether the index has changed since it was loaded or saved.
+    uint numHits; ///< Number of cache hits.
+    uint numMisses; ///< Number of cache misses.
+    uint numEvictions; ///< Number of evicted entries.
+
     /// Cache directory, passed here from AssetAPI in the ctor.
     QString cacheDirectory;
 
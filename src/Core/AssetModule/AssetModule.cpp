@@ -10,6 +10,7 @@
 #include "Profiler.h"
 #include "CoreException.h"
 #include "AssetAPI.h"
+#include "AssetCache.h"
 #include "LocalAssetStorage.h"
 #include "ConsoleAPI.h"
 #include "Application.h"
@@ -85,6 +86,10 @@ void AssetModule::Initialize()
     framework_->Console()->RegisterCommand(
         "DumpAssets", "Lists all assets known to the Asset API", 
         this, SLOT(ConsoleDumpAssets()));
+
+    framework_->Console()->RegisterCommand(
+        "AssetCacheStats", "Prints the asset cache size and hit, miss and eviction counts to console",
+        this, SLOT(ConsoleAssetCacheStats()));
     
     ProcessCommandLineOptions();
 
@@ -291,7 +296,18 @@ void AssetModule::HandleKristalliMessage(kNet::MessageConnection* source, kNet::
     {
     case cAssetDiscoveryMessage:
         {
-            MsgAssetDiscovery msg(data, numBytes);
+            MsgAssetDiscovery msg;
+            kNet::DataDeserializer dd(data, numBytes);
+            try
+            {
+                msg.DeserializeFrom(dd);
+            }
+            catch(kNet::NetException &)
+            {
+                // Older versions end the message before contentHash, which is then left empty
+                if (numBytes != 1 + msg.assetRef.size() + 1 + msg.assetType.size())
+                    throw;
+            }
             HandleAssetDiscovery(source, msg);
         }
         break;
@@ -308,6 +324,7 @@ void AssetModule::HandleAssetDiscovery(kNet::MessageConnection* source, MsgAsset
 {
     QString assetRef = QString::fromStdString(BufferToString(msg.assetRef));
     QString assetType = QString::fromStdString(BufferToString(msg.assetType));
+    QString contentHash = QString::fromStdString(BufferToString(msg.contentHash));
     
     // Check for possible malicious discovery message and ignore it. Otherwise let AssetAPI handle
     if (!framework_->Asset()->ShouldReplicateAssetDiscovery(assetRef))
@@ -317,12 +334,18 @@ void AssetModule::HandleAssetDiscovery(kNet::MessageConnection* source, MsgAsset
     TundraLogic::TundraLogicModule* tundra = framework_->GetModule<TundraLogic::TundraLogicModule>();
     KristalliProtocol::KristalliProtocolModule *kristalli = framework_->GetModule<KristalliProtocol::KristalliProtocolModule>();
     if (tundra->IsServer())
+    {
+        // Content hashes are trusted only from the server, which computes them from the data it uploads. A client could announce
+        // the hash of other cached content under any asset ref, so the hash sent by a client is dropped here and not replicated.
+        msg.contentHash.clear();
+        contentHash.clear();
         foreach(UserConnectionPtr userConn, kristalli->GetUserConnections())
             if (userConn->connection != source)
                 userConn->connection->Send(msg);
+    }
 
     // Then let assetAPI handle locally
-    framework_->Asset()->HandleAssetDiscovery(assetRef, assetType);
+    framework_->Asset()->HandleAssetDiscovery(assetRef, assetType, contentHash);
 }
 
 void AssetModule::HandleAssetDeleted(kNet::MessageConnection* source, MsgAssetDeleted& msg)
@@ -358,9 +381,10 @@ void AssetModule::OnAssetUploaded(const QString& assetRef)
     msg.assetRef = StringToBuffer(assetRef.toStdString());
     /// \todo Would preferably need the assettype as well
     
-    // If we are server, send to everyone
+    // If we are server, send to everyone, along with the content hash, as only the server is trusted with it
     if (tundra->IsServer())
     {
+        msg.contentHash = StringToBuffer(framework_->Asset()->GetAssetContentHash(assetRef).toStdString());
         foreach(UserConnectionPtr userConn, kristalli->GetUserConnections())
             userConn->connection->Send(msg);
     }
@@ -439,6 +463,21 @@ void AssetModule::ConsoleDumpAssets()
     }
 }
 
+void AssetModule::ConsoleAssetCacheStats()
+{
+    AssetCache *cache = framework_->Asset()->GetAssetCache();
+    if (!cache)
+    {
+        LogInfo("Asset cache is disabled.");
+        return;
+    }
+    QVariantMap stats = cache->GetStatistics();
+    LogInfo("Asset cache " + cache->CacheDirectory() + ": " + stats["entries"].toString() + " files for " + stats["assetRefs"].toString() + " asset refs, " +
+        QString::number(stats["totalSize"].toLongLong() / 1024) + " KB of " +
+        (cache->MaximumSize() > 0 ? QString::number(cache->MaximumSize() / 1024) + " KB" : QString("unlimited")));
+    LogInfo("Hits: " + stats["hits"].toString() + ", misses: " + stats["misses"].toString() + ", evictions: " + stats["evictions"].toString());
+}
+
 extern "C"
 {
 DLLEXPORT void TundraPluginMain(Framework *fw)
@@ -46,6 +46,8 @@ public slots:
 
     void ConsoleDumpAssets();
 
+    void ConsoleAssetCacheStats();
+
     /// Loads from all the registered local storages all assets that have the given suffix.
     /// Type can also be optionally specified
     /// \todo Will be replaced with AssetStorage's GetAllAssetsRefs / GetAllAssets functionality
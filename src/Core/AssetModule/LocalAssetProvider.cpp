@@ -22,17 +22,66 @@
 #include <QFileInfo>
 #include <QFileSystemWatcher>
 #include <QMap>
+#include <QRunnable>
+#include <QMutexLocker>
+
+#include <cstdio>
 
 #include "MemoryLeakCheck.h"
 
+/// Maximum number of threads reading asset files. File reads are mostly bound by the disk, so more threads would not help.
+static const int cMaxFileLoadThreads = 4;
+/// Default maximum number of asset downloads completed per frame.
+static const int cDefaultMaxCompletionsPerFrame = 64;
+
+/// Reads an asset file on a file loader thread.
+class LocalAssetFileLoadTask : public QRunnable
+{
+public:
+    LocalAssetFileLoadTask(LocalAssetProvider *provider_, const LocalAssetProvider::PendingFileLoadPtr &load_) :
+        provider(provider_),
+        load(load_)
+    {
+    }
+
+    void run()
+    {
+        // Do not use LoadFileToVector here, as it logs and logging is not thread-safe. The failure is reported on the main thread.
+        load->success = false;
+        FILE *handle = fopen(load->nativeFilename.c_str(), "rb");
+        if (handle)
+        {
+            fseek(handle, 0, SEEK_END);
+            long numBytes = ftell(handle);
+            if (numBytes > 0)
+            {
+                fseek(handle, 0, SEEK_SET);
+                load->data.resize(numBytes);
+                load->success = (long)fread(&load->data[0], sizeof(u8), numBytes, handle) == numBytes;
+            }
+            fclose(handle);
+        }
+        provider->FileLoadFinished(load);
+    }
+
+private:
+    LocalAssetProvider *provider;
+    LocalAssetProvider::PendingFileLoadPtr load;
+};
+
 LocalAssetProvider::LocalAssetProvider(Framework* framework_)
-:framework(framework_)
+:framework(framework_),
+numFileLoadsInProgress(0),
+maxCompletionsPerFrame(cDefaultMaxCompletionsPerFrame)
 {
     enableRequestsOutsideStorages = framework_->HasCommandLineParameter("--accept_unknown_local_sources");
+    fileLoadThreads.setMaxThreadCount(cMaxFileLoadThreads);
 }
 
 LocalAssetProvider::~LocalAssetProvider()
 {
+    // The loader threads access this object, so wait for them before it is destroyed
+    fileLoadThreads.waitForDone();
 }
 
 QString LocalAssetProvider::Name()
@@ -267,8 +316,15 @@ AssetUploadTransferPtr LocalAssetProvider::UploadAssetFromFileInMemory(const u8
     return transfer;
 }
 
+void LocalAssetProvider::FileLoadFinished(const PendingFileLoadPtr &load)
+{
+    QMutexLocker lock(&finishedFileLoadsMutex);
+    finishedFileLoads.push_back(load);
+}
+
 void LocalAssetProvider::CompletePendingFileDownloads()
 {
+    // Find the files of the new downloads and start reading them on the loader threads
     while(pendingDownloads.size() > 0)
     {
         AssetTransferPtr transfer = pendingDownloads.back();
@@ -306,23 +362,56 @@ void LocalAssetProvider::CompletePendingFileDownloads()
                 file = QFileInfo(GuaranteeTrailingSlash(path) + path_filename);
             }
         }
-        QString absoluteFilename = file.absoluteFilePath();
 
-        bool success = LoadFileToVector(absoluteFilename.toStdString().c_str(), transfer->rawAssetData);
-        if (!success)
+        PendingFileLoadPtr load(new PendingFileLoad);
+        load->transfer = transfer;
+        load->storage = storage;
+        load->absoluteFilename = file.absoluteFilePath();
+        load->nativeFilename = load->absoluteFilename.toStdString();
+        load->success = false;
+        ++numFileLoadsInProgress;
+        fileLoadThreads.start(new LocalAssetFileLoadTask(this, load));
+    }
+
+    if (numFileLoadsInProgress == 0)
+        return;
+
+    // Take the finished file reads, at most maxCompletionsPerFrame of them
+    std::list<PendingFileLoadPtr> finished;
+    {
+        QMutexLocker lock(&finishedFileLoadsMutex);
+        if (maxCompletionsPerFrame <= 0 || (int)finishedFileLoads.size() <= maxCompletionsPerFrame)
+            finished.swap(finishedFileLoads);
+        else
         {
-            QString reason = "Failed to read asset data for asset \"" + ref + "\" from file \"" + absoluteFilename + "\"";
+            std::list<PendingFileLoadPtr>::iterator last = finishedFileLoads.begin();
+            std::advance(last, maxCompletionsPerFrame);
+            finished.splice(finished.end(), finishedFileLoads, finishedFileLoads.begin(), last);
+        }
+    }
+
+    for(std::list<PendingFileLoadPtr>::iterator iter = finished.begin(); iter != finished.end(); ++iter)
+    {
+        PendingFileLoadPtr load = *iter;
+        AssetTransferPtr transfer = load->transfer;
+        --numFileLoadsInProgress;
+
+        if (!load->success)
+        {
+            QString reason = "Failed to read asset data for asset \"" + transfer->source.ref + "\" from file \"" + load->absoluteFilename + "\"";
 //            AssetModule::LogError(reason);
             framework->Asset()->AssetTransferFailed(transfer.get(), reason);
             continue;
         }
-        
+
+        transfer->rawAssetData.swap(load->data);
+
         // Tell the Asset API that this asset should not be cached into the asset cache, and instead the original filename should be used
         // as a disk source, rather than generating a cache file for it.
-        transfer->SetCachingBehavior(false, absoluteFilename);
+        transfer->SetCachingBehavior(false, load->absoluteFilename);
 
-        transfer->storage = storage;
-//        AssetModule::LogDebug("Downloaded asset \"" + ref + "\" from file " + absoluteFilename.toStdString());
+        transfer->storage = load->storage;
+//        AssetModule::LogDebug("Downloaded asset \"" + transfer->source.ref + "\" from file " + load->absoluteFilename);
 
         // Signal the Asset API that this asset is now successfully downloaded.
         framework->Asset()->AssetTransferCompleted(transfer.get());
@@ -477,6 +566,8 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
         LocalAssetStoragePtr storage = FindStorageForPath(file);
         if (storage)
         {
+            storage->UpdateFileIndexForFile(file);
+
             if (!storage->AutoDiscoverable())
             {
                 LogWarning("Received file change notification for storage of which auto-discovery is false.");
@@ -520,6 +611,8 @@ void LocalAssetProvider::CheckForPendingFileSystemChanges()
         LocalAssetStoragePtr storage = FindStorageForPath(path);
         if (storage)
         {
+            storage->UpdateFileIndexForDirectory(path);
+
             if (!storage->AutoDiscoverable())
             {
                 LogWarning("Received directory change notification for storage of which auto-discovery is false.");
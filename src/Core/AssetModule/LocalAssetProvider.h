@@ -8,6 +8,10 @@
 #include "AssetFwd.h"
 
 #include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+
+#include <list>
 
 class LocalAssetStorage;
 
@@ -67,14 +71,38 @@ public:
     /// Returns LocalAssetStorage for specific @c path. The @c path can be root directory of storage or any of its subdirectories.
     LocalAssetStoragePtr FindStorageForPath(const QString &path) const;
 
+    /// Sets the maximum number of asset downloads completed per frame. 0 means unlimited.
+    /** File reads are done on worker threads, but the loaded assets are handed to the Asset API on the main thread.
+        Limiting the completions per frame keeps the main loop responsive when a large number of assets is loaded at once. */
+    void SetMaxCompletionsPerFrame(int maxCompletions) { maxCompletionsPerFrame = maxCompletions; }
+
+    /// Returns the maximum number of asset downloads completed per frame.
+    int MaxCompletionsPerFrame() const { return maxCompletionsPerFrame; }
+
 private:
     Q_DISABLE_COPY(LocalAssetProvider)
+    friend class LocalAssetFileLoadTask;
+
+    /// An asset file read done on the file loader threads.
+    struct PendingFileLoad
+    {
+        AssetTransferPtr transfer; ///< The transfer to complete. Only accessed on the main thread.
+        LocalAssetStoragePtr storage; ///< The storage the file was found in, or null. Only accessed on the main thread.
+        QString absoluteFilename; ///< Full path of the file.
+        std::string nativeFilename; ///< Full path of the file, for the loader thread.
+        std::vector<u8> data; ///< Receives the file data.
+        bool success; ///< Whether the file was read successfully.
+    };
+    typedef boost::shared_ptr<PendingFileLoad> PendingFileLoadPtr;
+
+    /// Called on a file loader thread when a file read has finished.
+    void FileLoadFinished(const PendingFileLoadPtr &load);
 
     /// Finds a path where the file localFilename can be found. Searches through all local storages.
     /// @param storage [out] Receives the local storage that contains the asset.
     QString GetPathForAsset(const QString &localFilename, LocalAssetStoragePtr *storage) const;
 
-    /// Takes all the pending file download transfers and finishes them.
+    /// Starts file reads for all the pending file download transfers, and finishes the transfers whose files have been read.
     void CompletePendingFileDownloads();
 
     /// Takes all the pending file upload transfers and finishes them.
@@ -90,6 +118,12 @@ private:
     QSet<QString> changedFiles; ///< Pending file changes.
     QSet<QString> changedDirectories; ///< Pending directory changes.
 
+    QThreadPool fileLoadThreads; ///< Threads which read the asset files.
+    std::list<PendingFileLoadPtr> finishedFileLoads; ///< File reads finished by the loader threads, to be completed on the main thread.
+    QMutex finishedFileLoadsMutex; ///< Guards finishedFileLoads.
+    int numFileLoadsInProgress; ///< Number of file reads started but not completed yet.
+    int maxCompletionsPerFrame; ///< Maximum number of downloads to complete per frame, 0 for unlimited.
+
     /// If true, assets outside any known local storages are allowed. Otherwise, requests to them will fail.
     bool enableRequestsOutsideStorages;
 
@@ -11,13 +11,35 @@
 
 #include <QFileSystemWatcher>
 #include <QDir>
+#include <QSet>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// A filename missing from the index is searched from the directories again if the index is older than this, in seconds.
+    /** Files can appear without a change notification, if the storage has no live update or they are in a new subdirectory
+        that is not watched. The limit keeps repeated requests of a missing asset from rescanning the tree each time. */
+    const double cFileIndexMissRecheckInterval = 2.0;
+
+    /// Returns the fileIndex key of a file name or path.
+    /** File names are case-insensitive on Windows and Mac OS X file systems, so the key is lowercase there, to match the lookups QFile::exists() does. */
+    QString FileIndexKey(const QString &fileName)
+    {
+#if defined(WIN32) || defined(__APPLE__)
+        return fileName.toLower();
+#else
+        return fileName;
+#endif
+    }
+}
+
 LocalAssetStorage::LocalAssetStorage(bool writable_, bool liveUpdate_, bool autoDiscoverable_) :
     recursive(true),
-    changeWatcher(0)
+    changeWatcher(0),
+    fileIndexValid(false),
+    fileIndexBuildTime(0)
 {
     // Override the parameters for the base class.
     writable = writable_;
@@ -70,6 +92,22 @@ QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool re
     if (!recursive || !recursiveLookup)
         return "";
 
+    // Plain filenames are looked up from the filename index. Names with a relative path need a directory search.
+    if (!assetname.contains('/') && !assetname.contains('\\'))
+    {
+        if (!fileIndexValid)
+            BuildFileIndex();
+        QHash<QString, QString>::const_iterator iter = fileIndex.find(FileIndexKey(assetname));
+        if (iter == fileIndex.end() &&
+            (double)(GetCurrentClockTime() - fileIndexBuildTime) > cFileIndexMissRecheckInterval * GetCurrentClockFreq())
+        {
+            // The file may have been added after the index was built, without a change notification.
+            BuildFileIndex();
+            iter = fileIndex.find(FileIndexKey(assetname));
+        }
+        return iter != fileIndex.end() ? iter.value() : "";
+    }
+
     foreach(const QString &str, DirectorySearch(directory, recursive, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks))
     {
         QFileInfo file(GuaranteeTrailingSlash(str) + assetname);
@@ -79,6 +117,80 @@ QString LocalAssetStorage::GetFullPathForAsset(const QString &assetname, bool re
     return "";
 }
 
+void LocalAssetStorage::BuildFileIndex()
+{
+    PROFILE(LocalAssetStorage_BuildFileIndex);
+    fileIndex.clear();
+    foreach(const QString &str, DirectorySearch(directory, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+    {
+        QFileInfo file(str);
+        // If the same filename exists in several subdirectories, the first one found is used.
+        if (!fileIndex.contains(FileIndexKey(file.fileName())))
+            fileIndex.insert(FileIndexKey(file.fileName()), file.dir().path());
+    }
+    fileIndexValid = true;
+    fileIndexBuildTime = GetCurrentClockTime();
+}
+
+void LocalAssetStorage::InvalidateFileIndex()
+{
+    fileIndex.clear();
+    fileIndexValid = false;
+}
+
+void LocalAssetStorage::UpdateFileIndexForDirectory(const QString &path)
+{
+    // Watch new subdirectories, so that files added to them later update the index too.
+    if (changeWatcher && recursive)
+    {
+        const QStringList watchedDirs = changeWatcher->directories();
+        foreach(const QString &dir, DirectorySearch(path, true, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+            if (!watchedDirs.contains(dir))
+                changeWatcher->addPath(dir);
+    }
+
+    if (!fileIndexValid)
+        return;
+
+    // Add the new files of the directory and its subdirectories.
+    QSet<QString> currentFiles;
+    foreach(const QString &str, DirectorySearch(path, recursive, QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks))
+    {
+        QFileInfo file(str);
+        currentFiles.insert(FileIndexKey(file.absoluteFilePath()));
+        if (!fileIndex.contains(FileIndexKey(file.fileName())))
+            fileIndex.insert(FileIndexKey(file.fileName()), file.dir().path());
+    }
+
+    // If files were removed from the directory, another file with the same name might have been shadowed by them, so rebuild the index on next lookup.
+    const QString dirPath = QDir(path).path();
+    for(QHash<QString, QString>::const_iterator iter = fileIndex.begin(); iter != fileIndex.end(); ++iter)
+    {
+        const QString &fileDir = iter.value();
+        if ((fileDir == dirPath || (recursive && fileDir.startsWith(GuaranteeTrailingSlash(dirPath)))) &&
+            !currentFiles.contains(FileIndexKey(QFileInfo(GuaranteeTrailingSlash(fileDir) + iter.key()).absoluteFilePath())))
+        {
+            InvalidateFileIndex();
+            return;
+        }
+    }
+}
+
+void LocalAssetStorage::UpdateFileIndexForFile(const QString &absoluteFilename)
+{
+    if (!fileIndexValid)
+        return;
+
+    QFileInfo file(absoluteFilename);
+    if (file.exists())
+    {
+        if (!fileIndex.contains(FileIndexKey(file.fileName())))
+            fileIndex.insert(FileIndexKey(file.fileName()), file.dir().path());
+    }
+    else if (fileIndex.contains(FileIndexKey(file.fileName())))
+        InvalidateFileIndex(); // The removed file might have shadowed another file with the same name.
+}
+
 QString LocalAssetStorage::GetFullAssetURL(const QString &localName)
 {
     QString filename;
@@ -4,8 +4,10 @@
 
 #include "AssetModuleApi.h"
 #include "IAssetStorage.h"
+#include "HighPerfClock.h"
 
 #include <QMap>
+#include <QHash>
 
 class QFileSystemWatcher;
 class AssetAPI;
@@ -41,6 +43,17 @@ public:
     ///\todo Evaluate if could be removed. Now both AssetAPI and LocalAssetStorage manage list of asset refs.
     QStringList assetRefs;
 
+    /// Updates the filename index after a change in the given directory of the storage.
+    /** Called by LocalAssetProvider when the directory change listener reports a change. */
+    void UpdateFileIndexForDirectory(const QString &path);
+
+    /// Updates the filename index after a change to the given file of the storage.
+    /** Called by LocalAssetProvider when the directory change listener reports a change. */
+    void UpdateFileIndexForFile(const QString &absoluteFilename);
+
+    /// Discards the filename index. It will be rebuilt on the next recursive lookup.
+    void InvalidateFileIndex();
+
     QFileSystemWatcher *changeWatcher;
 
 public slots:
@@ -86,4 +99,17 @@ private:
     Q_DISABLE_COPY(LocalAssetStorage)
 
     friend class LocalAssetProvider;
+
+    /// Scans the storage directory tree and builds the filename index.
+    void BuildFileIndex();
+
+    /// Filename -> directory containing the file, for all the files in the storage directory tree. Used for recursive lookups.
+    /** The filenames are lowercase on platforms with case-insensitive file names. */
+    QHash<QString, QString> fileIndex;
+
+    /// Whether fileIndex has been built.
+    bool fileIndexValid;
+
+    /// Time when fileIndex was last built, see GetCurrentClockTime.
+    tick_t fileIndexBuildTime;
 };
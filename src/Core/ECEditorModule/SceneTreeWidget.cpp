@@ -19,6 +19,7 @@
 #include "SceneImporter.h"
 
 #include "Entity.h"
+#include "SceneBinaryFormat.h"
 #include "ConfigAPI.h"
 #include "ECEditorWindow.h"
 #include "ECEditorModule.h"
@@ -48,8 +49,6 @@
 #include <QLabel>
 #include <QDialog>
 
-#include <kNet/DataSerializer.h>
-
 #include "MemoryLeakCheck.h"
 
 // Menu
@@ -1212,45 +1211,41 @@ void SceneTreeWidget::SaveSelectionDialogClosed(int result)
         files[0].append(fileExtension);
     }
 
-    QFile file(files[0]);
-    if (!file.open(QIODevice::WriteOnly))
-    {
-        LogError("Could not open file " + files[0] + " for writing.");
-        return;
-    }
-
-    QByteArray bytes;
-
     if (fileExtension == cTundraXmlFileExtension)
     {
-        bytes = GetSelectionAsXml().toAscii();
+        QFile file(files[0]);
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            LogError("Could not open file " + files[0] + " for writing.");
+            return;
+        }
+        file.write(GetSelectionAsXml().toAscii());
+        file.close();
     }
     else
     {
-        // Handle all other as binary.
-        SceneTreeWidgetSelection sel = SelectedItems();
-        if (!sel.IsEmpty())
+        // Handle all other as binary. The entities are written one at a time, so there is no size limit.
+        SceneBinaryWriter writer(files[0]);
+        if (!writer.IsOpen())
         {
-            // Assume 4MB max for now
-            bytes.resize(4 * 1024 * 1024);
-            kNet::DataSerializer dest(bytes.data(), bytes.size());
-
-            dest.Add<u32>(sel.entities.size());
+            LogError("Could not open file " + files[0] + " for writing.");
+            return;
+        }
 
-            foreach(EntityItem *eItem, sel.entities)
+        SceneTreeWidgetSelection sel = SelectedItems();
+        foreach(EntityItem *eItem, sel.entities)
+        {
+            EntityPtr entity = eItem->Entity();
+            assert(entity);
+            if (entity && !writer.WriteEntity(*entity))
             {
-                EntityPtr entity = eItem->Entity();
-                assert(entity);
-                if (entity)
-                    entity->SerializeToBinary(dest);
+                LogError("Failed to write " + entity->ToString() + " to " + files[0] + ".");
+                break;
             }
-
-            bytes.resize(dest.BytesFilled());
         }
-    }
 
-    file.write(bytes);
-    file.close();
+        writer.Finish();
+    }
 }
 
 void SceneTreeWidget::SaveSceneDialogClosed(int result)
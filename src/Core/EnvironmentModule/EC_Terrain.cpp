@@ -11,6 +11,7 @@
 #include "Renderer.h"
 #include "Entity.h"
 #include "Scene.h"
+#include "ChangeRequest.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
 #include "AssetAPI.h"
@@ -23,7 +24,16 @@
 #include "Profiler.h"
 #include "OgreRenderingModule.h"
 #include "OgreWorld.h"
+#include "TerrainLodRenderer.h"
+#include "Framework.h"
+#include "FrameAPI.h"
+#include "Math/float4x4.h"
+#include "Math/MathConstants.h"
+#include "Math/MathFunc.h"
+#include "Math/BatchOps.h"
+#include "Geometry/Ray.h"
 #include <Ogre.h>
+#include <QtEndian>
 #include <utility>
 
 #include "MemoryLeakCheck.h"
@@ -42,16 +52,24 @@ EC_Terrain::EC_Terrain(Scene* scene) :
     vScale(this, "Tex. V scale"),
     patchWidth(1),
     patchHeight(1),
-    rootNode(0)
+    rootNode(0),
+    editedMinX(0),
+    editedMinY(0),
+    editedMaxX(-1),
+    editedMaxY(-1)
 {
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
 
     connect(this, SIGNAL(ParentEntitySet()), this, SLOT(UpdateSignals()));
 
+    if (framework && framework->HasCommandLineParameter("--terrain16bit"))
+        heights.SetFormat(TerrainHeightField::Format_Short);
+
     xPatches.Set(1, AttributeChange::Disconnected);
     yPatches.Set(1, AttributeChange::Disconnected);
     patches.resize(1);
+    heights.Resize(cPatchSize, cPatchSize, 0.f);
     MakePatchFlat(0, 0, 0.f);
     uScale.Set(0.13f, AttributeChange::Disconnected);
     vScale.Set(0.13f, AttributeChange::Disconnected);
@@ -59,10 +77,28 @@ EC_Terrain::EC_Terrain(Scene* scene) :
 
     heightMapAsset = boost::shared_ptr<AssetRefListener>(new AssetRefListener);
     connect(heightMapAsset.get(), SIGNAL(Loaded(AssetPtr)), this, SLOT(TerrainAssetLoaded(AssetPtr)));
+
+    if (framework && framework->HasCommandLineParameter("--terrainlod"))
+    {
+        float maxPixelError = 2.f;
+        QStringList maxPixelErrorParam = framework->CommandLineParameters("--terrainlod");
+        if (!maxPixelErrorParam.isEmpty())
+        {
+            bool ok = false;
+            float value = maxPixelErrorParam.last().toFloat(&ok);
+            if (ok && value > 0.f)
+                maxPixelError = value;
+            else
+                LogError("EC_Terrain: Invalid value for --terrainlod: " + maxPixelErrorParam.last());
+        }
+        lodRenderer = boost::shared_ptr<TerrainLodRenderer>(new TerrainLodRenderer(this, world_, maxPixelError));
+        connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(UpdateLod()));
+    }
 }
 
 EC_Terrain::~EC_Terrain()
 {
+    emit HeightsAboutToChange();
     Destroy();
 }
 
@@ -79,14 +115,21 @@ void EC_Terrain::UpdateSignals()
     {    
         connect(parent, SIGNAL(ComponentAdded(IComponent*, AttributeChange::Type)), this, SLOT(AttachTerrainRootNode()), Qt::UniqueConnection);
         connect(parent, SIGNAL(ComponentRemoved(IComponent*, AttributeChange::Type)), this, SLOT(AttachTerrainRootNode()), Qt::UniqueConnection); // The Attach function also handles detaches.
+
+        parent->ConnectAction("TerrainBrush", this, SLOT(OnBrushAction(const QString &, const QString &, const QString &, const QStringList &)));
+        parent->ConnectAction("TerrainSetHeights", this, SLOT(OnSetHeightsAction(const QString &, const QString &, const QString &, const QStringList &)));
+        parent->ConnectAction("TerrainHeights", this, SLOT(OnHeightsAction(const QString &, const QString &, const QString &, const QStringList &)));
+        parent->ConnectAction("TerrainRequestHeights", this, SLOT(OnRequestHeightsAction()));
     }
 }
 
 void EC_Terrain::MakePatchFlat(int x, int y, float heightValue)
 {
     Patch &patch = GetPatch(x, y);
-    patch.heightData.clear();
-    patch.heightData.insert(patch.heightData.end(), cPatchSize*cPatchSize, heightValue);
+    emit HeightsAboutToChange();
+    for(int mapY = y * cPatchSize; mapY < (y + 1) * cPatchSize; ++mapY)
+        for(int mapX = x * cPatchSize; mapX < (x + 1) * cPatchSize; ++mapX)
+            heights.Set(mapX, mapY, heightValue);
     patch.patch_geometry_dirty = true;
 }
 
@@ -101,14 +144,18 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
 {
     PROFILE(EC_Terrain_ResizeTerrain);
 
-    const int maxPatchSize = 32;
-    // Do an artificial limit to a preset N patches per side. (This limit is way too large already for the current terrain vertex LOD management.)
-    newPatchWidth = max(1, min(maxPatchSize, newPatchWidth));
-    newPatchHeight = max(1, min(maxPatchSize, newPatchHeight));
+    // Do an artificial limit to a preset N patches per side. The limit does not depend on the renderer, so that the server and
+    // the clients agree on the size of the height field whichever of them draws the terrain with --terrainlod.
+    newPatchWidth = max(1, min((int)cMaxPatchesPerSide, newPatchWidth));
+    newPatchHeight = max(1, min((int)cMaxPatchesPerSide, newPatchHeight));
 
     if (newPatchWidth == patchWidth && newPatchHeight == patchHeight)
         return;
 
+    if (!lodRenderer && !world_.expired() && (newPatchWidth > cMaxPatchesPerSideWithoutLod || newPatchHeight > cMaxPatchesPerSideWithoutLod))
+        LogWarning("EC_Terrain: drawing a terrain of " + QString::number(newPatchWidth) + "x" + QString::number(newPatchHeight) +
+            " patches with one mesh per patch. Use --terrainlod to draw large terrains.");
+
     // If the width changes, we need to also regenerate the old right-most column to generate the new seams. (If we are shrinking, this is not necessary)
     if (patchWidth < newPatchWidth)
         for(int y = 0; y < patchHeight; ++y)
@@ -133,21 +180,13 @@ void EC_Terrain::ResizeTerrain(int newPatchWidth, int newPatchHeight)
         for(int x = 0; x < min(patchWidth, newPatchWidth); ++x)
             newPatches[y * newPatchWidth + x] = GetPatch(x, y);
     patches = newPatches;
-    int oldPatchWidth = patchWidth;
-    int oldPatchHeight = patchHeight;
     patchWidth = newPatchWidth;
     patchHeight = newPatchHeight;
 
-    // Init any new patches to flat planes with the given fixed height.
-
+    // Init any new patches to flat planes with the given fixed height. The new patches are dirty by default.
     const float initialPatchHeight = 0.f;
-
-    for(int y = oldPatchHeight; y < newPatchHeight; ++y)
-        for(int x = 0; x < patchWidth; ++x)
-            MakePatchFlat(x, y, initialPatchHeight);
-    for(int x = oldPatchWidth; x < newPatchWidth; ++x) // We have some overlap here with above, but it's ok since DestroyPatch is benign.
-        for(int y = 0; y < patchHeight; ++y)
-            MakePatchFlat(x, y, initialPatchHeight);
+    emit HeightsAboutToChange();
+    heights.Resize(VerticesWidth(), VerticesHeight(), initialPatchHeight);
 
     // Tell each patch which coordinate in the grid they lie in.
     for(int y = 0; y < patchHeight; ++y)
@@ -205,6 +244,9 @@ void EC_Terrain::MaterialAssetLoaded(AssetPtr asset_)
 
     currentMaterial = material->getName().c_str();
 
+    if (lodRenderer)
+        lodRenderer->SetMaterial(TerrainMaterialName());
+
     // Also, we need to update each geometry patch to use the new material.
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
@@ -222,7 +264,12 @@ void EC_Terrain::TerrainAssetLoaded(AssetPtr asset_)
     }
 
     if (assetData)
+    {
         LoadFromDataInMemory((const char*)&assetData->data[0], assetData->data.size());
+        // The heightmap does not contain the edits the server has made since it was loaded, so ask for them.
+        if (!HasEditAuthority())
+            ParentEntity()->Exec(EntityAction::Server, "TerrainRequestHeights");
+    }
     if (textureData)
     {
         if (textureData->DiskSource().isEmpty())
@@ -289,6 +336,9 @@ void EC_Terrain::DestroyPatch(int x, int y)
 
 void EC_Terrain::Destroy()
 {
+    if (lodRenderer)
+        lodRenderer->Destroy();
+
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
             DestroyPatch(x, y);
@@ -318,7 +368,7 @@ float EC_Terrain::GetPoint(int x, int y) const
     if (y >= cPatchSize * patchHeight)
         y = cPatchSize * patchHeight - 1;
 
-    return GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)];
+    return heights.Get(x, y);
 }
 
 void EC_Terrain::SetPointHeight(int x, int y, float height)
@@ -326,7 +376,298 @@ void EC_Terrain::SetPointHeight(int x, int y, float height)
     if (x < 0 || y < 0 || x >= cPatchSize * patchWidth || y >= cPatchSize * patchHeight)
         return; // Out of bounds signals are silently ignored.
 
-    GetPatch(x / cPatchSize, y / cPatchSize).heightData[(y % cPatchSize) * cPatchSize + (x % cPatchSize)] = height;
+    emit HeightsAboutToChange();
+    heights.Set(x, y, height);
+}
+
+namespace
+{
+    /// Largest number of map vertices per side of the rectangle sent in one TerrainHeights or TerrainSetHeights action.
+    const int cMaxReplicatedRegionSize = 64;
+
+    /// Largest brush radius in map vertices accepted in a TerrainBrush action, so that one small action cannot make the server rewrite and replicate the whole terrain.
+    const float cMaxActionBrushRadius = 4.f * EC_Terrain::cPatchSize;
+
+    /// Encodes height values as an entity action parameter.
+    QString EncodeHeights(const std::vector<float> &heights)
+    {
+        if (heights.empty())
+            return QString();
+        return QString(qCompress(QByteArray((const char*)&heights[0], (int)(heights.size() * sizeof(float)))).toBase64());
+    }
+
+    /// Returns whether a width x height rectangle at (x, y) overlaps a terrain of the given size in map vertices, and is no larger than it.
+    /** Limiting the size first keeps the vertex and byte counts of the rectangle from overflowing. */
+    bool IsValidRegion(int x, int y, int width, int height, int verticesWidth, int verticesHeight)
+    {
+        return width > 0 && height > 0 && width <= verticesWidth && height <= verticesHeight &&
+            x > -width && y > -height && x < verticesWidth && y < verticesHeight;
+    }
+
+    /// Decodes the height values of a width x height rectangle from an entity action parameter.
+    /** The rectangle must have been checked with IsValidRegion(). Fails if the data is malformed or contains non-finite heights. */
+    bool DecodeHeights(const QString &data, int width, int height, std::vector<float> &heights)
+    {
+        const int numBytes = width * height * (int)sizeof(float);
+        QByteArray compressed = QByteArray::fromBase64(data.toAscii());
+        // qUncompress() allocates the size stored in the first four bytes, so check it before uncompressing
+        if (compressed.size() < 4 || qFromBigEndian<quint32>((const uchar*)compressed.constData()) != (quint32)numBytes)
+            return false;
+        QByteArray bytes = qUncompress(compressed);
+        if (bytes.size() != numBytes)
+            return false;
+        heights.resize(width * height);
+        memcpy(&heights[0], bytes.constData(), bytes.size());
+        for(size_t i = 0; i < heights.size(); ++i)
+            if (!IsFinite(heights[i]))
+                return false;
+        return true;
+    }
+}
+
+bool EC_Terrain::HasEditAuthority() const
+{
+    Entity *entity = ParentEntity();
+    return !entity || entity->IsLocal() || !entity->ParentScene() || entity->ParentScene()->IsAuthority();
+}
+
+void EC_Terrain::SetHeights(int x, int y, int width, int height, const std::vector<float> &values)
+{
+    if (width <= 0 || height <= 0 || width > VerticesWidth() || height > VerticesHeight() || (int)values.size() != width * height)
+    {
+        LogError("EC_Terrain::SetHeights: Expected " + QString::number(width) + "x" + QString::number(height) + " height values, got " + QString::number(values.size()) + ".");
+        return;
+    }
+
+    if (!HasEditAuthority())
+    {
+        // Send large rectangles in blocks, as the server does not accept larger ones
+        for(int blockY = 0; blockY < height; blockY += cMaxReplicatedRegionSize)
+            for(int blockX = 0; blockX < width; blockX += cMaxReplicatedRegionSize)
+            {
+                const int blockWidth = min(cMaxReplicatedRegionSize, width - blockX);
+                const int blockHeight = min(cMaxReplicatedRegionSize, height - blockY);
+                std::vector<float> blockValues(blockWidth * blockHeight);
+                for(int j = 0; j < blockHeight; ++j)
+                    for(int i = 0; i < blockWidth; ++i)
+                        blockValues[j * blockWidth + i] = values[(blockY + j) * width + blockX + i];
+
+                QStringList params;
+                params << QString::number(x + blockX) << QString::number(y + blockY) << QString::number(blockWidth) << QString::number(blockHeight) << EncodeHeights(blockValues);
+                ParentEntity()->Exec(EntityAction::Server, "TerrainSetHeights", params);
+            }
+        return;
+    }
+
+    ApplyHeights(x, y, width, height, values);
+    ReplicateHeights(x, y, width, height);
+}
+
+void EC_Terrain::ApplyBrush(float x, float y, float radius, float strength)
+{
+    if (!IsFinite(x) || !IsFinite(y) || !IsFinite(radius) || !IsFinite(strength) || radius <= 0.f)
+        return;
+
+    if (!HasEditAuthority())
+    {
+        ParentEntity()->Exec(EntityAction::Server, "TerrainBrush", QStringList() << QString::number(x) << QString::number(y)
+            << QString::number(radius) << QString::number(strength));
+        return;
+    }
+
+    // Clip in floating point, so that a brush far outside the terrain does not overflow the integer coordinates
+    const float left = max(0.f, floor(x - radius));
+    const float top = max(0.f, floor(y - radius));
+    const float right = min((float)(VerticesWidth() - 1), ceil(x + radius));
+    const float bottom = min((float)(VerticesHeight() - 1), ceil(y + radius));
+    if (right < left || bottom < top)
+        return;
+
+    const int x0 = (int)left;
+    const int y0 = (int)top;
+    const int x1 = (int)right;
+    const int y1 = (int)bottom;
+
+    const int width = x1 - x0 + 1;
+    const int height = y1 - y0 + 1;
+    std::vector<float> values(width * height);
+    for(int j = 0; j < height; ++j)
+        for(int i = 0; i < width; ++i)
+        {
+            const float dx = x0 + i - x;
+            const float dy = y0 + j - y;
+            // Smooth falloff that reaches zero with a zero slope at the brush radius
+            const float t = max(0.f, 1.f - (dx*dx + dy*dy) / (radius*radius));
+            values[j * width + i] = GetPoint(x0 + i, y0 + j) + strength * t * t;
+        }
+
+    SetHeights(x0, y0, width, height, values);
+}
+
+void EC_Terrain::ApplyHeights(int x, int y, int width, int height, const std::vector<float> &values)
+{
+    PROFILE(EC_Terrain_ApplyHeights);
+
+    // Clip the rectangle to the terrain
+    const int x0 = max(0, x);
+    const int y0 = max(0, y);
+    const int x1 = min(VerticesWidth() - 1, x + width - 1);
+    const int y1 = min(VerticesHeight() - 1, y + height - 1);
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    bool changed = false;
+    for(int mapY = y0; mapY <= y1; ++mapY)
+        for(int mapX = x0; mapX <= x1; ++mapX)
+        {
+            const float value = values[(mapY - y) * width + mapX - x];
+            if (heights.Get(mapX, mapY) != value)
+            {
+                if (!changed)
+                    emit HeightsAboutToChange();
+                heights.Set(mapX, mapY, value);
+                changed = true;
+            }
+        }
+    if (!changed)
+        return;
+
+    // A vertex also changes the normals of its neighbors, and the vertices on the first row and column of a patch are the seam vertices of the previous patch
+    const int patchX0 = max(0, x0 - 2) / cPatchSize;
+    const int patchY0 = max(0, y0 - 2) / cPatchSize;
+    const int patchX1 = min(patchWidth - 1, (x1 + 1) / cPatchSize);
+    const int patchY1 = min(patchHeight - 1, (y1 + 1) / cPatchSize);
+    for(int patchY = patchY0; patchY <= patchY1; ++patchY)
+        for(int patchX = patchX0; patchX <= patchX1; ++patchX)
+            GetPatch(patchX, patchY).patch_geometry_dirty = true;
+
+    if (HasEditAuthority())
+    {
+        if (editedMaxX < editedMinX)
+        {
+            editedMinX = x0;
+            editedMinY = y0;
+            editedMaxX = x1;
+            editedMaxY = y1;
+        }
+        else
+        {
+            editedMinX = min(editedMinX, x0);
+            editedMinY = min(editedMinY, y0);
+            editedMaxX = max(editedMaxX, x1);
+            editedMaxY = max(editedMaxY, y1);
+        }
+    }
+
+    RegenerateDirtyPatches();
+
+    emit HeightsChanged(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+void EC_Terrain::ReplicateHeights(int x, int y, int width, int height, EntityAction::ExecTypeField recipients)
+{
+    Entity *entity = ParentEntity();
+    if (!entity || entity->IsLocal())
+        return;
+
+    const int x0 = max(0, x);
+    const int y0 = max(0, y);
+    const int x1 = min(VerticesWidth() - 1, x + width - 1);
+    const int y1 = min(VerticesHeight() - 1, y + height - 1);
+
+    // Send large rectangles in blocks, so that a single action does not hold up the connection
+    for(int blockY = y0; blockY <= y1; blockY += cMaxReplicatedRegionSize)
+        for(int blockX = x0; blockX <= x1; blockX += cMaxReplicatedRegionSize)
+        {
+            const int blockWidth = min(cMaxReplicatedRegionSize, x1 - blockX + 1);
+            const int blockHeight = min(cMaxReplicatedRegionSize, y1 - blockY + 1);
+            std::vector<float> values(blockWidth * blockHeight);
+            for(int j = 0; j < blockHeight; ++j)
+                for(int i = 0; i < blockWidth; ++i)
+                    values[j * blockWidth + i] = GetPoint(blockX + i, blockY + j);
+
+            QStringList params;
+            params << QString::number(blockX) << QString::number(blockY) << QString::number(blockWidth) << QString::number(blockHeight) << EncodeHeights(values);
+            entity->Exec(recipients, "TerrainHeights", params);
+        }
+}
+
+bool EC_Terrain::AllowEdit()
+{
+    ChangeRequest req;
+    emit AboutToEditHeights(&req);
+    return req.allowed;
+}
+
+void EC_Terrain::OnBrushAction(const QString &x, const QString &y, const QString &radius, const QStringList &rest)
+{
+    // Edits are only accepted by the server, which replicates the result
+    if (!HasEditAuthority() || rest.size() < 1)
+        return;
+
+    const float brushX = x.toFloat();
+    const float brushY = y.toFloat();
+    const float brushRadius = radius.toFloat();
+    const float strength = rest[0].toFloat();
+    if (!IsFinite(brushX) || !IsFinite(brushY) || !IsFinite(brushRadius) || !IsFinite(strength))
+    {
+        LogError("EC_Terrain: Received malformed TerrainBrush action.");
+        return;
+    }
+    if (!AllowEdit())
+        return;
+
+    ApplyBrush(brushX, brushY, min(brushRadius, cMaxActionBrushRadius), strength);
+}
+
+void EC_Terrain::OnSetHeightsAction(const QString &x, const QString &y, const QString &width, const QStringList &rest)
+{
+    if (!HasEditAuthority() || rest.size() < 2)
+        return;
+
+    const int mapX = x.toInt();
+    const int mapY = y.toInt();
+    const int w = width.toInt();
+    const int h = rest[0].toInt();
+    std::vector<float> values;
+    // Clients send large edits in blocks, so a larger rectangle is not a real edit
+    if (!IsValidRegion(mapX, mapY, w, h, VerticesWidth(), VerticesHeight()) || w * h > cMaxReplicatedRegionSize * cMaxReplicatedRegionSize ||
+        !DecodeHeights(rest[1], w, h, values))
+    {
+        LogError("EC_Terrain: Received malformed TerrainSetHeights action.");
+        return;
+    }
+    if (!AllowEdit())
+        return;
+    SetHeights(mapX, mapY, w, h, values);
+}
+
+void EC_Terrain::OnHeightsAction(const QString &x, const QString &y, const QString &width, const QStringList &rest)
+{
+    // The server is the authority on the heights, so it ignores the heights sent by others
+    if (HasEditAuthority() || rest.size() < 2)
+        return;
+
+    const int mapX = x.toInt();
+    const int mapY = y.toInt();
+    const int w = width.toInt();
+    const int h = rest[0].toInt();
+    std::vector<float> values;
+    if (!IsValidRegion(mapX, mapY, w, h, VerticesWidth(), VerticesHeight()) || !DecodeHeights(rest[1], w, h, values))
+    {
+        LogError("EC_Terrain: Received malformed TerrainHeights action.");
+        return;
+    }
+    ApplyHeights(mapX, mapY, w, h, values);
+}
+
+void EC_Terrain::OnRequestHeightsAction()
+{
+    if (!HasEditAuthority() || editedMaxX < editedMinX)
+        return;
+
+    // Only the client that loaded the heightmap lacks the edits, the others have received them already
+    ReplicateHeights(editedMinX, editedMinY, editedMaxX - editedMinX + 1, editedMaxY - editedMinY + 1, EntityAction::Sender);
 }
 
 namespace
@@ -617,12 +958,15 @@ bool EC_Terrain::SaveToFile(QString filename)
 
     assert(sizeof(float) == 4);
 
+    // The file stores the heights patch by patch
+    float patchData[cPatchSize*cPatchSize];
     for(u32 i = 0; i < xPatches*yPatches; ++i)
     {
-        if (patches[i].heightData.size() < cPatchSize*cPatchSize)
-            patches[i].heightData.resize(cPatchSize*cPatchSize);
+        for(int y = 0; y < cPatchSize; ++y)
+            for(int x = 0; x < cPatchSize; ++x)
+                patchData[y*cPatchSize+x] = heights.Get(patches[i].x*cPatchSize + x, patches[i].y*cPatchSize + y);
 
-        fwrite(&patches[i].heightData[0], sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
+        fwrite(patchData, sizeof(float), cPatchSize*cPatchSize, handle); ///< \todo Check read error.
     }
     fflush(handle);
     if (ferror(handle))
@@ -678,24 +1022,32 @@ bool EC_Terrain::LoadFromDataInMemory(const char *data, size_t numBytes)
 
     assert(sizeof(float) == 4);
 
-    // Load the new data.
+    // Load the new data. The file stores the heights patch by patch, so reorder them row by row.
+    const int verticesWidth = xPatches * cPatchSize;
+    std::vector<float> newHeights(xPatches * yPatches * cPatchSize * cPatchSize);
     for(size_t i = 0; i < newPatches.size(); ++i)
     {
-        newPatches[i].heightData.resize(cPatchSize*cPatchSize);
         newPatches[i].patch_geometry_dirty = true;
         if (offset+cPatchSize*cPatchSize*sizeof(float) > numBytes)
             throw Exception("Not enough bytes to deserialize!");
 
-        memcpy(&newPatches[i].heightData[0], data + offset, cPatchSize*cPatchSize*sizeof(float));
+        for(int y = 0; y < cPatchSize; ++y)
+            memcpy(&newHeights[(newPatches[i].y*cPatchSize + y) * verticesWidth + newPatches[i].x*cPatchSize], data + offset + y*cPatchSize*sizeof(float), cPatchSize*sizeof(float));
         offset += cPatchSize*cPatchSize*sizeof(float);
     }
 
     // The terrain asset loaded ok. We are good to set that terrain as the active terrain.
     Destroy();
 
+    // The edits made so far were made to the previous terrain.
+    editedMinX = editedMinY = 0;
+    editedMaxX = editedMaxY = -1;
+
     patches = newPatches;
     patchWidth = xPatches;
     patchHeight = yPatches;
+    emit HeightsAboutToChange();
+    heights.Assign(VerticesWidth(), VerticesHeight(), newHeights.empty() ? 0 : &newHeights[0]);
 
     // Re-do all the geometry on the GPU.
     RegenerateDirtyTerrainPatches();
@@ -780,13 +1132,15 @@ bool EC_Terrain::LoadFromImageFile(QString filename, float offset, float scale)
     yPatches.Set(image.getHeight() / cPatchSize, AttributeChange::Disconnected);
     ResizeTerrain(xPatches.Get(), yPatches.Get());
 
-    for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
-        for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
+    std::vector<float> values(VerticesWidth() * VerticesHeight());
+    for(int y = 0; y < VerticesHeight(); ++y)
+        for(int x = 0; x < VerticesWidth(); ++x)
         {
             Ogre::ColourValue c = image.getColourAt(x, y, 0);
-            float height = offset + scale * (c.r + c.g + c.b) / 3.f; // Treat the image as a grayscale heightmap field with the color in range [0,1].
-            SetPointHeight(x, y, height);
+            values[y * VerticesWidth() + x] = offset + scale * (c.r + c.g + c.b) / 3.f; // Treat the image as a grayscale heightmap field with the color in range [0,1].
         }
+    emit HeightsAboutToChange();
+    heights.Assign(VerticesWidth(), VerticesHeight(), &values[0]);
 
     xPatches.Changed(AttributeChange::LocalOnly);
     yPatches.Changed(AttributeChange::LocalOnly);
@@ -946,38 +1300,6 @@ void GetUnskinnedMeshGeometry(
     }
 }
 
-float FindClosestRayIntersection(const Ogre::Ray &ray, const std::vector<Ogre::Vector3> &vertices, const std::vector<uint> &indices)
-{
-    using namespace std;
-
-    float distance = 1e9f;
-    for(size_t i = 0; i+2 < indices.size(); i += 3)
-    {
-        std::pair<bool, Ogre::Real> hit = Ogre::Math::intersects(ray, vertices[indices[i]],
-            vertices[indices[i+1]], vertices[indices[i+2]], true, true);
-        if (hit.first && hit.second >= 0.f)
-            distance = min(distance, hit.second);
-    }
-    return distance;
-}
-
-void ComputeAABB(const std::vector<Ogre::Vector3> &vertices, Ogre::Vector3 &minExtents, Ogre::Vector3 &maxExtents)
-{
-    minExtents = Ogre::Vector3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    maxExtents = Ogre::Vector3(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-
-    for(size_t i = 0; i < vertices.size(); ++i)
-    {
-        minExtents.x = min(minExtents.x, vertices[i].x);
-        minExtents.y = min(minExtents.y, vertices[i].y);
-        minExtents.z = min(minExtents.z, vertices[i].z);
-
-        maxExtents.x = max(maxExtents.x, vertices[i].x);
-        maxExtents.y = max(maxExtents.y, vertices[i].y);
-        maxExtents.z = max(maxExtents.z, vertices[i].z);
-    }
-}
-
 void EC_Terrain::GenerateFromSceneEntity(QString entityName)
 {
     Entity *parentEntity = ParentEntity();
@@ -1041,16 +1363,34 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     std::vector<uint> submeshstartindex;
 
     GetUnskinnedMeshGeometry(mesh, vertices, indices, submeshstartindex);
+    if (vertices.empty())
+    {
+        LogError("Mesh " + ogreMeshResourceName + " has no geometry to generate the terrain from.");
+        return;
+    }
 
+    // Transform the vertices as structure of arrays, so that the batch kernels of the math library can process them.
+    std::vector<float> xs(vertices.size()), ys(vertices.size()), zs(vertices.size());
     for(size_t i = 0; i < vertices.size(); ++i)
     {
-        Ogre::Vector4 v = transform * Ogre::Vector4(vertices[i].x, vertices[i].y, vertices[i].z, 1.f);
-        vertices[i] = Ogre::Vector3(v.x, v.y, v.z);
+        xs[i] = vertices[i].x;
+        ys[i] = vertices[i].y;
+        zs[i] = vertices[i].z;
     }
+    const int numVertices = (int)vertices.size();
+    BatchTransformPos(float4x4(transform).Float3x4Part(), &xs[0], &ys[0], &zs[0], &xs[0], &ys[0], &zs[0], numVertices);
 
-    Ogre::Vector3 minExtents;
-    Ogre::Vector3 maxExtents;
-    ComputeAABB(vertices, minExtents, maxExtents);
+    const AABB bounds = BatchMinimalEnclosingAABB(&xs[0], &ys[0], &zs[0], numVertices);
+    const float3 minExtents = bounds.minPoint;
+    const float3 maxExtents = bounds.maxPoint;
+
+    TriangleArray triangles;
+    triangles.Reserve((int)(indices.size() / 3));
+    for(size_t i = 0; i+2 < indices.size(); i += 3)
+    {
+        const uint a = indices[i], b = indices[i+1], c = indices[i+2];
+        triangles.Add(float3(xs[a], ys[a], zs[a]), float3(xs[b], ys[b], zs[b]), float3(xs[c], ys[c], zs[c]));
+    }
 
     // Note: heightmap X & Y correspond to X & Z world axes, while height is world Y.
     // So we expect a mesh where Y also represent height values
@@ -1063,7 +1403,8 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     yPatches.Set(yVertices/cPatchSize, AttributeChange::Disconnected);
     ResizeTerrain(xVertices/cPatchSize, yVertices/cPatchSize);
 
-    MakeTerrainFlat(1e9f);
+    // Collect the heights to a separate map first, as the 1e9 marker of the vertices the mesh does not cover would not survive a quantized height field.
+    std::vector<float> values(xVertices * yVertices, 1e9f);
 
     float minHeight = std::numeric_limits<float>::max();
     float maxHeight = -std::numeric_limits<float>::max();
@@ -1073,21 +1414,25 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
     for(int y = 0; y < yVertices; ++y)
         for(int x = 0; x < xVertices; ++x)
         {
-            Ogre::Ray r(Ogre::Vector3(minExtents.x + x, raycastHeight, minExtents.z + y), Ogre::Vector3(0,-1.f,0));
-            float height = FindClosestRayIntersection(r, vertices, indices);
-            if (height < 1e8f)
+            Ray r(float3(minExtents.x + x, raycastHeight, minExtents.z + y), float3(0,-1.f,0));
+            float distance, u, v;
+            if (BatchRaycastTriangles(r, triangles, 0, triangles.Size(), false, FLOAT_INF, distance, u, v) >= 0)
             {
-                height = raycastHeight - height;
-                SetPointHeight(x, y, height);
+                const float height = raycastHeight - distance;
+                values[y * xVertices + x] = height;
                 minHeight = min(minHeight, height);
                 maxHeight = max(maxHeight, height);
             }
         }
 
-    for(int y = 0; y < yVertices; ++y)
-        for(int x = 0; x < xVertices; ++x)
-            if (GetPoint(x, y) >= 1e8f)
-                SetPointHeight(x, y, minHeight);
+    for(size_t i = 0; i < values.size(); ++i)
+        if (values[i] >= 1e8f)
+            values[i] = minHeight;
+
+    // The terrain may have been resized smaller than the mesh, if it exceeds the terrain size limit.
+    emit HeightsAboutToChange();
+    heights.Assign(xVertices, yVertices, values.empty() ? 0 : &values[0]);
+    heights.Resize(VerticesWidth(), VerticesHeight(), minHeight);
 
     // Adjust offset so that we always have the lowest point of the terrain at height 0.
     RemapHeightValues(0.f, maxHeight - minHeight);
@@ -1104,9 +1449,13 @@ void EC_Terrain::GenerateFromOgreMesh(QString ogreMeshResourceName, const Ogre::
 
 void EC_Terrain::AffineTransform(float scale, float offset)
 {
-    for(int y = 0; y < yPatches.Get() * cPatchSize; ++y)
-        for(int x = 0; x < xPatches.Get() * cPatchSize; ++x)
-            SetPointHeight(x, y, GetPoint(x, y) * scale + offset);
+    std::vector<float> values;
+    heights.CopyTo(values);
+    for(size_t i = 0; i < values.size(); ++i)
+        values[i] = values[i] * scale + offset;
+    emit HeightsAboutToChange();
+    heights.Assign(heights.Width(), heights.Height(), values.empty() ? 0 : &values[0]);
+    DirtyAllTerrainPatches();
 }
 
 void EC_Terrain::RemapHeightValues(float minHeight, float maxHeight)
@@ -1239,17 +1588,13 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
     }
     assert(node);
 
-    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
-    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
-        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
-
     Ogre::ManualObject *manual = sceneMgr->createManualObject(world->GetUniqueObjectName("EC_Terrain_manual"));
     manual->setCastShadows(false);
 
     manual->clear();
     manual->estimateVertexCount((cPatchSize+1)*(cPatchSize+1));
     manual->estimateIndexCount((cPatchSize+1)*(cPatchSize+1)*3*2);
-    manual->begin(terrainMaterial->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+    manual->begin(TerrainMaterialName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
 
     const float vertexSpacingX = 1.f;
     const float vertexSpacingY = 1.f;
@@ -1322,8 +1667,8 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
                 Y = 0;
             }
 
-            pos.y = thisPatch->heightData[Y*cPatchVertexWidth+X];
-// Opensim:            pos.z = thisPatch->heightData[Y*cPatchVertexWidth+X];
+            pos.y = heights.Get(thisPatch->x*cPatchSize + X, thisPatch->y*cPatchSize + Y);
+// Opensim:            pos.z = heights.Get(thisPatch->x*cPatchSize + X, thisPatch->y*cPatchSize + Y);
 
             manual->position(pos);
             manual->normal(CalculateNormal(thisPatch->x, thisPatch->y, X, Y));
@@ -1378,6 +1723,14 @@ void EC_Terrain::GenerateTerrainGeometryForOnePatch(int patchX, int patchY)
     patch.patch_geometry_dirty = false;
 }
 
+std::string EC_Terrain::TerrainMaterialName() const
+{
+    Ogre::MaterialPtr terrainMaterial = Ogre::MaterialManager::getSingleton().getByName(currentMaterial.toStdString().c_str());
+    if (!terrainMaterial.get()) // If we could not find the material we were supposed to use, just use the default system terrain material.
+        terrainMaterial = OgreRenderer::GetOrCreateLitTexturedMaterial("Rex/TerrainPCF");
+    return terrainMaterial->getName();
+}
+
 void EC_Terrain::CreateRootNode()
 {
     // If we already have the patch root node, no need to re-create it.
@@ -1431,30 +1784,23 @@ void EC_Terrain::CreateOgreTerrainPatchNode(Ogre::SceneNode *&node, int patchX,
 
 float EC_Terrain::GetTerrainMinHeight() const
 {
-    float minHeight = std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            minHeight = min(minHeight, patches[i].heightData[j]);
-
+    float minHeight;
+    float maxHeight;
+    heights.GetRange(minHeight, maxHeight);
     return minHeight;
 }
 
 float EC_Terrain::GetTerrainMaxHeight() const
 {
-    float maxHeight = -std::numeric_limits<float>::max();
-
-    for(size_t i = 0; i < patches.size(); ++i)
-        for(size_t j = 0; j < patches[i].heightData.size(); ++j)
-            maxHeight = max(maxHeight, patches[i].heightData[j]);
-
+    float minHeight;
+    float maxHeight;
+    heights.GetRange(minHeight, maxHeight);
     return maxHeight;
 }
 
 void EC_Terrain::GetTerrainHeightRange(float &minHeight, float &maxHeight) const
 {
-    minHeight = GetTerrainMinHeight();
-    maxHeight = GetTerrainMaxHeight();
+    heights.GetRange(minHeight, maxHeight);
 }
 
 void EC_Terrain::DirtyAllTerrainPatches()
@@ -1463,40 +1809,43 @@ void EC_Terrain::DirtyAllTerrainPatches()
         patches[i].patch_geometry_dirty = true;
 }
 
-void EC_Terrain::RegenerateDirtyTerrainPatches()
+bool EC_Terrain::AllPatchesLoaded() const
 {
-    PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
-
     for(int y = 0; y < patchHeight; ++y)
         for(int x = 0; x < patchWidth; ++x)
-        {
-            EC_Terrain::Patch &scenePatch = GetPatch(x, y);
-            if (!scenePatch.patch_geometry_dirty || scenePatch.heightData.size() == 0)
-                continue;
+            if (!PatchExists(x,y) || (GetPatch(x,y).node == 0 && !(lodRenderer && lodRenderer->IsPatchGenerated(x, y))))
+                return false;
 
-            bool neighborsLoaded = true;
+    return true;
+}
 
-            const int neighbors[8][2] = 
-            { 
-                { -1, -1 }, { -1, 0 }, { -1, 1 },
-                {  0, -1 },            {  0, 1 },
-                {  1, -1 }, {  1, 0 }, {  1, 1 }
-            };
+void EC_Terrain::RegenerateDirtyTerrainPatches()
+{
+    RegenerateDirtyPatches();
 
-            for(int i = 0; i < 8; ++i)
-            {
-                int nX = x + neighbors[i][0];
-                int nY = y + neighbors[i][1];
-                if (nX >= 0 && nX < patchWidth &&
-                    nY >= 0 && nY < patchHeight &&
-                    GetPatch(nX, nY).heightData.size() == 0)
-                {
-                    neighborsLoaded = false;
-                    break;
-                }
-            }
+    emit TerrainRegenerated();
+}
+
+void EC_Terrain::RegenerateDirtyPatches()
+{
+    PROFILE(EC_Terrain_RegenerateDirtyTerrainPatches);
 
-            if (neighborsLoaded)
+    if (lodRenderer)
+    {
+        if (ViewEnabled() && !world_.expired())
+        {
+            CreateRootNode();
+            lodRenderer->RegenerateDirtyChunks(rootNode, TerrainMaterialName());
+            AttachTerrainRootNode();
+        }
+        return;
+    }
+
+    for(int y = 0; y < patchHeight; ++y)
+        for(int x = 0; x < patchWidth; ++x)
+        {
+            // The heights of all the patches, including the neighbors that make up the seams, are always present in the height field.
+            if (GetPatch(x, y).patch_geometry_dirty)
                 GenerateTerrainGeometryForOnePatch(x, y);
         }
     
@@ -1505,6 +1854,15 @@ void EC_Terrain::RegenerateDirtyTerrainPatches()
     AttachTerrainRootNode();
 
     ///\todo If this terrain only exists for physics heightfield purposes, don't create GPU resources for it at all.
+}
 
-    emit TerrainRegenerated();
+void EC_Terrain::UpdateLod()
+{
+    if (!lodRenderer || world_.expired())
+        return;
+    OgreWorldPtr world = world_.lock();
+    Ogre::Camera *camera = world->GetRenderer() ? world->GetRenderer()->MainOgreCamera() : 0;
+    // The main camera may be in another scene
+    if (camera && camera->getSceneManager() == world->GetSceneManager())
+        lodRenderer->UpdateLod(camera);
 }
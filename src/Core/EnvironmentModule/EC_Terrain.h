@@ -10,8 +10,12 @@
 #include "AssetFwd.h"
 #include "AssetRefListener.h"
 #include "OgreModuleFwd.h"
+#include "TerrainHeightField.h"
+#include "EntityAction.h"
 
 namespace Ogre { class Matrix4; }
+class TerrainLodRenderer;
+class ChangeRequest;
 
 /// Adds a heightmap-based terrain to the scene.
 /**
@@ -84,12 +88,16 @@ public:
     /// Each patch is a square containing this many vertices per side.
     static const int cPatchSize = 16;
 
+    /// Largest number of patches per side of the terrain. Part of the data model, so it is the same whichever renderer is used.
+    static const int cMaxPatchesPerSide = 256;
+
+    /// Number of patches per side above which the terrain should be drawn with --terrainlod, as each patch is a separate mesh otherwise.
+    static const int cMaxPatchesPerSideWithoutLod = 32;
+
     /// Describes a single patch that is present in the scene.
-    /** A patch can be in one of the following three states:
-        - not loaded. The height data nor the GPU data is present, but the Patch struct itself is initialized. heightData.size() == 0, node == entity == 0. meshGeometryName == "".
-        - heightmap data loaded. The heightData vector contains the heightmap data, but the visible GPU vertex data itself has not been generated yet, due to the neighbors
-          of this patch not being present yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
-        - fully loaded. The GPU data is also loaded and the node, entity and meshGeometryName fields specify the used GPU resources. */
+    /** The heights of all the patches are stored in the height field of the terrain, see HeightField(). A patch can be in one of the following two states:
+        - not generated. The visible GPU vertex data has not been generated yet. node == entity == 0, meshGeometryName == "". patch_geometry_dirty == true.
+        - generated. The node, entity and meshGeometryName fields specify the used GPU resources. */
     struct Patch
     {
         Patch():x(0),y(0), node(0), entity(0), patch_geometry_dirty(true) {}
@@ -100,10 +108,6 @@ public:
         /// Y-coordinate on the grid of patches. In the range [0, EC_Terrain::PatchHeight()].
         int y;
 
-        /// Typically this will be a 16x16 array of height values in world coordinates.
-        /// If the length is zero, this patch hasn't been loaded in yet.
-        std::vector<float> heightData;
-
         /// Ogre -specific: Store a reference to the actual render hierarchy node.
         Ogre::SceneNode *node;
 
@@ -114,12 +118,8 @@ public:
         std::string meshGeometryName;
 
         /// If true, the CPU-side heightmap data has changed, but we haven't yet updated
-        /// the GPU-side geometry resources since the neighboring patches haven't been loaded
-        /// in yet.
+        /// the GPU-side geometry resources.
         bool patch_geometry_dirty;
-
-        /// Call only when you've checked that this patch has been loaded in.
-        float GetHeightValue(int x, int y) const { return heightData[y*cPatchSize+x]; }
     };
     
     /// @return The patch at given (x,y) coordinates. Pass in values in range [0, PatchWidth()/PatchHeight[.
@@ -151,6 +151,19 @@ public:
 
     float3 CalculateNormal(int mapX, int mapY) const { return CalculateNormal( (int) mapX / cPatchSize, (int) mapY / cPatchSize, mapX % cPatchSize, mapY % cPatchSize); }
 
+    /// Sets the heights of a rectangle of map vertices, and replicates the change over the network.
+    /** On the server, or for a local entity, the heights are applied immediately, the patches they touch are regenerated and
+        HeightsChanged() is emitted. The server then sends the new heights of the rectangle to the clients. On a client the edit is
+        sent to the server, and the terrain changes when the result is replicated back.
+        @param x Map X coordinate of the first vertex of the rectangle.
+        @param y Map Y coordinate of the first vertex of the rectangle.
+        @param heights width*height height values, row by row. Vertices outside the terrain are ignored. */
+    void SetHeights(int x, int y, int width, int height, const std::vector<float> &heights);
+
+    /// Returns the heights of the whole terrain, in map vertex coordinates.
+    /** The height field may be written to or reallocated by any function that changes the terrain. HeightsAboutToChange() is emitted before that. */
+    const TerrainHeightField &HeightField() const { return heights; }
+
 public slots:
     /// Returns true if the given patch exists, i.e. whether the given coordinates are within the current terrain patch dimensions.
     /** This function does not tell whether the data for the patch is actually loaded on the CPU or the GPU. */
@@ -160,15 +173,7 @@ public slots:
     }
 
     /// Returns true if all the patches on the terrain are loaded on the CPU, i.e. if all the terrain height data has been streamed in from the server side.
-    bool AllPatchesLoaded() const
-    {
-        for(int y = 0; y < patchHeight; ++y)
-            for(int x = 0; x < patchWidth; ++x)
-                if (!PatchExists(x,y) || GetPatch(x,y).heightData.size() == 0 || GetPatch(x,y).node == 0)
-                    return false;
-
-        return true;
-    }
+    bool AllPatchesLoaded() const;
 
     /// Returns the height value on the given terrain grid point.
     /// @param x In the range [0, EC_Terrain::PatchWidth * EC_Terrain::cPatchSize [.
@@ -179,6 +184,15 @@ public slots:
     /// but does not immediately recreate the GPU surfaces. Use the RegenerateDirtyTerrainPatches() function
     /// to regenerate the visible Ogre mesh geometry.
     void SetPointHeight(int x, int y, float height);
+
+    /// Raises the terrain around the given map point with a smooth falloff, or lowers it if strength is negative.
+    /** The stroke is applied and replicated like SetHeights(): on a client it is sent to the server, which applies it and
+        replicates the resulting heights to all the clients.
+        @param x Map X coordinate of the brush center.
+        @param y Map Y coordinate of the brush center.
+        @param radius Radius of the brush in map vertices.
+        @param strength Height change at the brush center. */
+    void ApplyBrush(float x, float y, float radius, float strength);
     
     /// Returns the point on the terrain in world space that lies on top of the given world space coordinate.
     /// @param point The point in world space to get the corresponding map point (in world space) for.
@@ -340,6 +354,19 @@ signals:
     /// Emitted when the terrain data is regenerated.
     void TerrainRegenerated();
 
+    /// Emitted when the heights of a rectangle of map vertices have been changed by SetHeights() or ApplyBrush().
+    /** The patches of the rectangle have already been regenerated. TerrainRegenerated() is not emitted for these edits,
+        so that listeners can update only the changed region. */
+    void HeightsChanged(int x, int y, int width, int height);
+
+    /// Emitted on the server before a height edit sent by a client is applied, i.e. for the TerrainBrush and TerrainSetHeights actions.
+    /** Call req->Deny() to refuse the edit. The client that sent the edit is given by the GetActionSender() function of the server. */
+    void AboutToEditHeights(ChangeRequest *req);
+
+    /// Emitted before the height field is written to, resized or reallocated.
+    /** Lets the users that read the height field from another thread finish first. */
+    void HeightsAboutToChange();
+
 private slots:
     /// Emitted when the parrent entity has been set.
     void UpdateSignals();
@@ -354,6 +381,21 @@ private slots:
     /** Additionally re-applies the visibility of each terrain patch that is currently attached to the terrain node. */
     void AttachTerrainRootNode();
 
+    /// Chooses the level of detail of the terrain patches for the main camera, if the terrain is drawn with the LOD renderer.
+    void UpdateLod();
+
+    /// Handles the TerrainBrush entity action, a brush stroke sent by a client to the server.
+    void OnBrushAction(const QString &x, const QString &y, const QString &radius, const QStringList &rest);
+
+    /// Handles the TerrainSetHeights entity action, a height edit sent by a client to the server.
+    void OnSetHeightsAction(const QString &x, const QString &y, const QString &width, const QStringList &rest);
+
+    /// Handles the TerrainHeights entity action, the heights of an edited rectangle replicated by the server.
+    void OnHeightsAction(const QString &x, const QString &y, const QString &width, const QStringList &rest);
+
+    /// Handles the TerrainRequestHeights entity action, sent by a client that has loaded the heightmap, by sending it all the edits made since the load.
+    void OnRequestHeightsAction();
+
 private:
     /// Creates the patch parent/root node if it does not exist.
     /** After this function returns, the 'root' member node will exist, unless Ogre rendering subsystem fails. */
@@ -379,6 +421,26 @@ private:
 
     void GenerateTerrainGeometryForOnePatch(int patchX, int patchY);
 
+    /// Returns the name of the Ogre material to draw the terrain with.
+    std::string TerrainMaterialName() const;
+
+    /// Regenerates the dirty patches, without emitting TerrainRegenerated().
+    void RegenerateDirtyPatches();
+
+    /// Returns whether height edits are applied locally, i.e. whether this is the server or the entity is local.
+    bool HasEditAuthority() const;
+
+    /// Writes the given heights, regenerates the patches they change and emits HeightsChanged().
+    /** Heights that are equal to the current ones cause no regeneration, so that replicated edits can be applied more than once. */
+    void ApplyHeights(int x, int y, int width, int height, const std::vector<float> &heights);
+
+    /// Sends the current heights of the given rectangle of map vertices to the clients.
+    /** @param recipients EntityAction::Peers to send the heights to all the clients, or EntityAction::Sender to send them only to the client whose action is being handled. */
+    void ReplicateHeights(int x, int y, int width, int height, EntityAction::ExecTypeField recipients = EntityAction::Peers);
+
+    /// Returns whether a height edit sent by a client may be applied, as decided by the handlers of AboutToEditHeights().
+    bool AllowEdit();
+
     boost::shared_ptr<AssetRefListener> heightMapAsset;
 
     /// For all terrain patches, we maintain a global parent/root node to be able to transform the whole terrain at one go.
@@ -396,7 +458,20 @@ private:
 
     /// Stores the actual height patches.
     std::vector<Patch> patches;
+
+    /// Heights of all the patches, VerticesWidth() x VerticesHeight().
+    TerrainHeightField heights;
     
     /// Ogre world for referring to the Ogre scene manager
     OgreWorldWeakPtr world_;
+
+    /// Bounding rectangle of the map vertices edited since the heightmap was loaded, in inclusive map coordinates. Empty if editedMaxX < editedMinX.
+    /** Replicated to the clients that load the heightmap after the edits. */
+    int editedMinX;
+    int editedMinY;
+    int editedMaxX;
+    int editedMaxY;
+
+    /// Draws the terrain as level of detail chunks instead of one mesh per patch. Null unless enabled with --terrainlod.
+    boost::shared_ptr<TerrainLodRenderer> lodRenderer;
 };
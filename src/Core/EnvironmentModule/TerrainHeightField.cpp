@@ -0,0 +1,152 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TerrainHeightField.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+TerrainHeightField::TerrainHeightField() :
+    width_(0),
+    height_(0),
+    format_(Format_Float),
+    scale_(1.f),
+    offset_(0.f),
+    revision_(0)
+{
+}
+
+void TerrainHeightField::SetFormat(Format format)
+{
+    if (format == format_)
+        return;
+
+    std::vector<float> heights;
+    CopyTo(heights);
+    format_ = format;
+    Assign(width_, height_, heights.empty() ? 0 : &heights[0]);
+}
+
+void TerrainHeightField::Set(int x, int y, float height)
+{
+    const size_t i = (size_t)y * width_ + x;
+    if (format_ == Format_Float)
+    {
+        floats_[i] = height;
+        return;
+    }
+
+    const float q = floor((height - offset_) / scale_ + 0.5f);
+    if (q >= -cMaxQuantized && q <= cMaxQuantized)
+    {
+        shorts_[i] = (s16)q;
+        return;
+    }
+
+    // The height does not fit in the current range, so requantize the whole map over a range that also contains it
+    std::vector<float> heights;
+    CopyTo(heights);
+    heights[i] = height;
+    float minHeight;
+    float maxHeight;
+    GetRange(minHeight, maxHeight);
+    Quantize(&heights[0], heights.size(), std::min(minHeight, height), std::max(maxHeight, height));
+    ++revision_;
+}
+
+void TerrainHeightField::Assign(int width, int height, const float *heights)
+{
+    width_ = std::max(0, width);
+    height_ = std::max(0, height);
+    const size_t count = (size_t)width_ * height_;
+    if (format_ == Format_Float)
+    {
+        floats_.assign(heights, heights + count);
+        std::vector<s16>().swap(shorts_);
+    }
+    else
+    {
+        float minHeight = 0.f;
+        float maxHeight = 0.f;
+        if (count > 0)
+        {
+            minHeight = *std::min_element(heights, heights + count);
+            maxHeight = *std::max_element(heights, heights + count);
+        }
+        Quantize(heights, count, minHeight, maxHeight);
+        std::vector<float>().swap(floats_);
+    }
+    ++revision_;
+}
+
+void TerrainHeightField::Resize(int width, int height, float fillHeight)
+{
+    width = std::max(0, width);
+    height = std::max(0, height);
+    std::vector<float> heights((size_t)width * height, fillHeight);
+    for(int y = 0; y < std::min(height, height_); ++y)
+        for(int x = 0; x < std::min(width, width_); ++x)
+            heights[(size_t)y * width + x] = Get(x, y);
+    Assign(width, height, heights.empty() ? 0 : &heights[0]);
+}
+
+void TerrainHeightField::CopyTo(std::vector<float> &heights) const
+{
+    if (format_ == Format_Float)
+    {
+        heights = floats_;
+        return;
+    }
+
+    heights.resize(shorts_.size());
+    for(size_t i = 0; i < shorts_.size(); ++i)
+        heights[i] = offset_ + shorts_[i] * scale_;
+}
+
+void TerrainHeightField::GetRange(float &minHeight, float &maxHeight) const
+{
+    if (width_ == 0 || height_ == 0)
+    {
+        minHeight = maxHeight = 0.f;
+        return;
+    }
+
+    if (format_ == Format_Float)
+    {
+        minHeight = *std::min_element(floats_.begin(), floats_.end());
+        maxHeight = *std::max_element(floats_.begin(), floats_.end());
+    }
+    else
+    {
+        minHeight = offset_ + *std::min_element(shorts_.begin(), shorts_.end()) * scale_;
+        maxHeight = offset_ + *std::max_element(shorts_.begin(), shorts_.end()) * scale_;
+    }
+}
+
+const void *TerrainHeightField::Data() const
+{
+    if (format_ == Format_Float)
+        return floats_.empty() ? 0 : &floats_[0];
+    return shorts_.empty() ? 0 : &shorts_[0];
+}
+
+void TerrainHeightField::Quantize(const float *heights, size_t count, float minHeight, float maxHeight)
+{
+    // Leave room around the current heights, so that editing the terrain does not requantize it at every change
+    const float slack = std::max(1.f, (maxHeight - minHeight) * 0.25f);
+    const float low = minHeight - slack;
+    const float high = maxHeight + slack;
+    offset_ = (low + high) * 0.5f;
+    scale_ = (high - low) / (2.f * cMaxQuantized);
+
+    shorts_.resize(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        const float q = floor((heights[i] - offset_) / scale_ + 0.5f);
+        shorts_[i] = (s16)std::max<float>(-cMaxQuantized, std::min<float>(cMaxQuantized, q));
+    }
+}
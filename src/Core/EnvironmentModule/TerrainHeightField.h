@@ -0,0 +1,86 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "EnvironmentModuleApi.h"
+#include "CoreTypes.h"
+
+#include <vector>
+
+/// Height map of EC_Terrain, stored row by row in one contiguous array of either floats or 16-bit quantized values.
+/** The physics heightfield of EC_RigidBody reads the array in place, so the terrain heights are stored only once.
+    In Format_Short a stored value q represents the height Offset() + q * Scale(). Writing a height outside the
+    representable range requantizes the whole map over a wider range, which changes Revision(). */
+class ENVIRONMENT_MODULE_API TerrainHeightField
+{
+public:
+    enum Format
+    {
+        Format_Float = 0, ///< 32-bit floats.
+        Format_Short ///< 16-bit integers quantized over the height range of the map. Half the memory of Format_Float.
+    };
+
+    /// Largest magnitude of a stored value in Format_Short.
+    static const int cMaxQuantized = 32767;
+
+    TerrainHeightField();
+
+    /// Returns the number of vertices per row.
+    int Width() const { return width_; }
+
+    /// Returns the number of rows.
+    int Height() const { return height_; }
+
+    Format GetFormat() const { return format_; }
+
+    /// Changes the storage format, converting the current heights.
+    void SetFormat(Format format);
+
+    /// Returns the height of the given vertex. The coordinates must be inside the map.
+    float Get(int x, int y) const
+    {
+        const size_t i = (size_t)y * width_ + x;
+        return format_ == Format_Float ? floats_[i] : offset_ + shorts_[i] * scale_;
+    }
+
+    /// Sets the height of the given vertex. The coordinates must be inside the map.
+    void Set(int x, int y, float height);
+
+    /// Replaces the map with the given width*height heights, row by row.
+    void Assign(int width, int height, const float *heights);
+
+    /// Resizes the map, keeping the heights of the area that remains and filling the rest with the given height.
+    void Resize(int width, int height, float fillHeight);
+
+    /// Copies the heights to the given vector, row by row.
+    void CopyTo(std::vector<float> &heights) const;
+
+    /// Returns the lowest and highest height of the map. Iterates through the whole map.
+    void GetRange(float &minHeight, float &maxHeight) const;
+
+    /// Returns the heights as stored: width*height floats in Format_Float, or s16 values in Format_Short, row by row.
+    const void *Data() const;
+
+    /// Returns the height difference of consecutive stored values in Format_Short.
+    float Scale() const { return scale_; }
+
+    /// Returns the height represented by the stored value 0 in Format_Short.
+    float Offset() const { return offset_; }
+
+    /// Returns a number that changes whenever the map is reallocated, resized, converted or requantized.
+    /** Single heights written with Set() without requantizing leave the revision unchanged. */
+    u32 Revision() const { return revision_; }
+
+private:
+    /// Quantizes the given heights to shorts_ over a range that contains [minHeight, maxHeight] with room to grow.
+    void Quantize(const float *heights, size_t count, float minHeight, float maxHeight);
+
+    int width_;
+    int height_;
+    Format format_;
+    std::vector<float> floats_;
+    std::vector<s16> shorts_;
+    float scale_;
+    float offset_;
+    u32 revision_;
+};
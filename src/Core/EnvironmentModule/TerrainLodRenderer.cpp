@@ -0,0 +1,472 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TerrainLodRenderer.h"
+#include "EC_Terrain.h"
+#include "OgreWorld.h"
+#include "Entity.h"
+#include "Profiler.h"
+#include "Math/MathFunc.h"
+
+#include <Ogre.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// Collapses a coordinate on a patch edge to the closest vertex of the given step.
+    int SnapToStep(int coord, int step)
+    {
+        return (coord + step / 2) / step * step;
+    }
+
+    /// Maps the vertices of a patch to the vertex buffer of its chunk, collapsing the edge vertices of the finer patch where two levels meet.
+    struct PatchVertexMapper
+    {
+        int patchX0; ///< Map coordinates of the first vertex of the patch
+        int patchY0;
+        int chunkX0; ///< Map coordinates of the first vertex of the chunk
+        int chunkY0;
+        int chunkWidth;
+        int lastX; ///< Map coordinates of the last vertex of the terrain
+        int lastY;
+        int edgeSteps[4]; ///< Vertex steps of the edges y == 0, y == size, x == 0 and x == size
+
+        u16 Index(int x, int y) const
+        {
+            const int size = EC_Terrain::cPatchSize;
+            if (x % size != 0)
+            {
+                if (y == 0)
+                    x = SnapToStep(x, edgeSteps[0]);
+                else if (y == size)
+                    x = SnapToStep(x, edgeSteps[1]);
+            }
+            else if (y % size != 0)
+                y = SnapToStep(y, edgeSteps[x == 0 ? 2 : 3]);
+
+            // The last patches of the terrain are one vertex short, so their far edge collapses to the last vertex
+            const int mapX = std::min(patchX0 + x, lastX);
+            const int mapY = std::min(patchY0 + y, lastY);
+            return (u16)((mapY - chunkY0) * chunkWidth + mapX - chunkX0);
+        }
+    };
+
+    void AddTriangle(std::vector<u16> &indices, u16 a, u16 b, u16 c)
+    {
+        // Skip the triangles that the edge collapses made degenerate
+        if (a == b || b == c || a == c)
+            return;
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+}
+
+TerrainLodRenderer::TerrainLodRenderer(EC_Terrain *terrain, OgreWorldWeakPtr world, float maxPixelError) :
+    terrain_(terrain),
+    world_(world),
+    maxPixelError_(maxPixelError),
+    rootNode_(0),
+    patchWidth_(0),
+    patchHeight_(0),
+    chunksWidth_(0),
+    chunksHeight_(0)
+{
+}
+
+TerrainLodRenderer::~TerrainLodRenderer()
+{
+    Destroy();
+}
+
+void TerrainLodRenderer::Destroy()
+{
+    for(size_t i = 0; i < chunks_.size(); ++i)
+        DestroyChunk(chunks_[i]);
+    chunks_.clear();
+    patchLods_.clear();
+    patchWidth_ = patchHeight_ = 0;
+    chunksWidth_ = chunksHeight_ = 0;
+    rootNode_ = 0;
+}
+
+bool TerrainLodRenderer::IsPatchGenerated(int patchX, int patchY) const
+{
+    return patchX >= 0 && patchY >= 0 && patchX < patchWidth_ && patchY < patchHeight_ && GetPatchLod(patchX, patchY).generated;
+}
+
+void TerrainLodRenderer::SetMaterial(const std::string &materialName)
+{
+    for(size_t i = 0; i < chunks_.size(); ++i)
+        if (chunks_[i].entity)
+            chunks_[i].entity->setMaterialName(materialName);
+}
+
+void TerrainLodRenderer::RegenerateDirtyChunks(Ogre::SceneNode *rootNode, const std::string &materialName)
+{
+    PROFILE(TerrainLodRenderer_RegenerateDirtyChunks);
+
+    const int patchWidth = terrain_->PatchWidth();
+    const int patchHeight = terrain_->PatchHeight();
+    if (patchWidth != patchWidth_ || patchHeight != patchHeight_)
+    {
+        // The chunk layout depends on the size of the terrain, so start over
+        Destroy();
+        patchWidth_ = patchWidth;
+        patchHeight_ = patchHeight;
+        chunksWidth_ = (patchWidth + cChunkSize - 1) / cChunkSize;
+        chunksHeight_ = (patchHeight + cChunkSize - 1) / cChunkSize;
+        chunks_.resize(chunksWidth_ * chunksHeight_);
+        patchLods_.resize(patchWidth * patchHeight);
+        terrain_->DirtyAllTerrainPatches();
+    }
+    rootNode_ = rootNode;
+
+    // Find the chunks to build before building any, as a dirty patch on the border of a chunk also changes the seam vertices
+    // and the normals of the neighboring chunks.
+    std::vector<int> dirtyChunks;
+    for(int cy = 0; cy < chunksHeight_; ++cy)
+        for(int cx = 0; cx < chunksWidth_; ++cx)
+        {
+            const int x0 = std::max(0, cx * cChunkSize - 1);
+            const int y0 = std::max(0, cy * cChunkSize - 1);
+            const int x1 = std::min(patchWidth_ - 1, (cx + 1) * cChunkSize);
+            const int y1 = std::min(patchHeight_ - 1, (cy + 1) * cChunkSize);
+            bool dirty = false;
+            for(int y = y0; y <= y1 && !dirty; ++y)
+                for(int x = x0; x <= x1 && !dirty; ++x)
+                    dirty = terrain_->GetPatch(x, y).patch_geometry_dirty;
+            if (dirty)
+                dirtyChunks.push_back(cy * chunksWidth_ + cx);
+        }
+
+    for(size_t i = 0; i < dirtyChunks.size(); ++i)
+        BuildChunk(dirtyChunks[i] % chunksWidth_, dirtyChunks[i] / chunksWidth_, rootNode, materialName);
+
+    for(size_t i = 0; i < dirtyChunks.size(); ++i)
+    {
+        const int cx = dirtyChunks[i] % chunksWidth_;
+        const int cy = dirtyChunks[i] / chunksWidth_;
+        for(int y = cy * cChunkSize; y < std::min(patchHeight_, (cy + 1) * cChunkSize); ++y)
+            for(int x = cx * cChunkSize; x < std::min(patchWidth_, (cx + 1) * cChunkSize); ++x)
+                terrain_->GetPatch(x, y).patch_geometry_dirty = false;
+    }
+}
+
+void TerrainLodRenderer::BuildChunk(int chunkX, int chunkY, Ogre::SceneNode *rootNode, const std::string &materialName)
+{
+    PROFILE(TerrainLodRenderer_BuildChunk);
+
+    if (world_.expired())
+        return;
+    OgreWorldPtr world = world_.lock();
+    Ogre::SceneManager *sceneMgr = world->GetSceneManager();
+    if (!sceneMgr)
+        return;
+
+    Chunk &chunk = chunks_[chunkY * chunksWidth_ + chunkX];
+    DestroyChunk(chunk);
+
+    const int size = EC_Terrain::cPatchSize;
+    const int verticesWidth = terrain_->VerticesWidth();
+    const int verticesHeight = terrain_->VerticesHeight();
+    const int firstPatchX = chunkX * cChunkSize;
+    const int firstPatchY = chunkY * cChunkSize;
+    const int lastPatchX = std::min(patchWidth_, firstPatchX + cChunkSize);
+    const int lastPatchY = std::min(patchHeight_, firstPatchY + cChunkSize);
+
+    // The chunk includes the first vertex row and column of the next chunks to close the seams, except at the edges of the terrain
+    chunk.firstX = firstPatchX * size;
+    chunk.firstY = firstPatchY * size;
+    chunk.width = std::min(lastPatchX * size, verticesWidth - 1) - chunk.firstX + 1;
+    chunk.height = std::min(lastPatchY * size, verticesHeight - 1) - chunk.firstY + 1;
+
+    for(int y = firstPatchY; y < lastPatchY; ++y)
+        for(int x = firstPatchX; x < lastPatchX; ++x)
+        {
+            ComputePatchErrors(x, y);
+            PatchLod &lod = GetPatchLod(x, y);
+            lod.generated = true;
+            lod.edgeKey = 0xFFFFFFFF;
+        }
+
+    chunk.mesh = Ogre::MeshManager::getSingleton().createManual(world->GetUniqueObjectName("EC_Terrain_chunkmesh"),
+        Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+
+    Ogre::VertexData *vertexData = new Ogre::VertexData();
+    chunk.mesh->sharedVertexData = vertexData;
+    vertexData->vertexCount = chunk.width * chunk.height;
+    // Same vertex layout as the patches built with Ogre::ManualObject, as the terrain materials expect
+    Ogre::VertexDeclaration *decl = vertexData->vertexDeclaration;
+    size_t offset = 0;
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT3, Ogre::VES_NORMAL).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
+    offset += decl->addElement(0, offset, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+
+    // No shadow copy in system memory: at the largest terrain size the copies alone would not fit a 32-bit process.
+    // Raycasts read the buffers back like they read the meshes of the patches drawn without LOD.
+    Ogre::HardwareVertexBufferSharedPtr vertexBuffer = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        offset, vertexData->vertexCount, Ogre::HardwareBuffer::HBU_STATIC_WRITE_ONLY, false);
+    vertexData->vertexBufferBinding->setBinding(0, vertexBuffer);
+
+    const float uScale = terrain_->uScale.Get();
+    const float vScale = terrain_->vScale.Get();
+    float minHeight = FLT_MAX;
+    float maxHeight = -FLT_MAX;
+    float *dst = static_cast<float*>(vertexBuffer->lock(Ogre::HardwareBuffer::HBL_DISCARD));
+    for(int y = 0; y < chunk.height; ++y)
+        for(int x = 0; x < chunk.width; ++x)
+        {
+            const int mapX = chunk.firstX + x;
+            const int mapY = chunk.firstY + y;
+            const float height = terrain_->GetPoint(mapX, mapY);
+            const float3 normal = terrain_->CalculateNormal(mapX, mapY);
+            minHeight = std::min(minHeight, height);
+            maxHeight = std::max(maxHeight, height);
+
+            *dst++ = (float)x;
+            *dst++ = height;
+            *dst++ = (float)y;
+            *dst++ = normal.x;
+            *dst++ = normal.y;
+            *dst++ = normal.z;
+            // The UV set 0 contains the diffuse texture UV map, and the UV set 1 the blend mask UV map that stretches once across the whole terrain
+            *dst++ = mapX * uScale;
+            *dst++ = mapY * vScale;
+            *dst++ = (float)mapX / (verticesWidth - 1);
+            *dst++ = (float)mapY / (verticesHeight - 1);
+        }
+    vertexBuffer->unlock();
+
+    Ogre::SubMesh *subMesh = chunk.mesh->createSubMesh();
+    subMesh->useSharedVertices = true;
+    subMesh->setMaterialName(materialName);
+    // BuildIndices creates the index buffer in the size the current levels need
+    subMesh->indexData->indexStart = 0;
+    subMesh->indexData->indexCount = 0;
+    BuildIndices(chunk, chunkX, chunkY);
+
+    const Ogre::Vector3 boundsMax((float)(chunk.width - 1), maxHeight, (float)(chunk.height - 1));
+    chunk.mesh->_setBounds(Ogre::AxisAlignedBox(Ogre::Vector3(0.f, minHeight, 0.f), boundsMax));
+    chunk.mesh->_setBoundingSphereRadius(Ogre::Vector3(boundsMax.x, std::max(fabs(minHeight), fabs(maxHeight)), boundsMax.z).length());
+    chunk.mesh->load();
+
+    chunk.entity = sceneMgr->createEntity(world->GetUniqueObjectName("EC_Terrain_chunkentity"), chunk.mesh->getName());
+    chunk.entity->setUserAny(Ogre::Any(terrain_->ParentEntity()));
+    chunk.entity->setCastShadows(false);
+    // Set UserAny also on subentities
+    for(uint i = 0; i < chunk.entity->getNumSubEntities(); ++i)
+        chunk.entity->getSubEntity(i)->setUserAny(chunk.entity->getUserAny());
+
+    chunk.node = sceneMgr->createSceneNode(world->GetUniqueObjectName("EC_Terrain_chunk"));
+    if (rootNode)
+        rootNode->addChild(chunk.node);
+    else
+        sceneMgr->getRootSceneNode()->addChild(chunk.node);
+    chunk.node->setPosition((float)chunk.firstX, 0.f, (float)chunk.firstY);
+    chunk.node->attachObject(chunk.entity);
+}
+
+void TerrainLodRenderer::DestroyChunk(Chunk &chunk)
+{
+    if (!world_.expired())
+    {
+        Ogre::SceneManager *sceneMgr = world_.lock()->GetSceneManager();
+        if (chunk.node)
+        {
+            chunk.node->detachAllObjects();
+            if (chunk.node->getParentSceneNode())
+                chunk.node->getParentSceneNode()->removeChild(chunk.node);
+            sceneMgr->destroySceneNode(chunk.node);
+        }
+        if (chunk.entity)
+            sceneMgr->destroyEntity(chunk.entity);
+    }
+    chunk.node = 0;
+    chunk.entity = 0;
+
+    if (!chunk.mesh.isNull())
+    {
+        std::string meshName = chunk.mesh->getName();
+        chunk.mesh.setNull();
+        try
+        {
+            Ogre::MeshManager::getSingleton().remove(meshName);
+        }
+        catch(...) {}
+    }
+    chunk.indicesDirty = true;
+}
+
+void TerrainLodRenderer::ComputePatchErrors(int patchX, int patchY)
+{
+    const int size = EC_Terrain::cPatchSize;
+    const int stride = size + 1;
+    // Heights of the patch and its seam vertices. GetPoint clamps to the terrain, as the vertices do at the terrain edges.
+    float heights[stride * stride];
+    for(int y = 0; y <= size; ++y)
+        for(int x = 0; x <= size; ++x)
+            heights[y * stride + x] = terrain_->GetPoint(patchX * size + x, patchY * size + y);
+
+    PatchLod &lod = GetPatchLod(patchX, patchY);
+    lod.minHeight = *std::min_element(heights, heights + stride * stride);
+    lod.maxHeight = *std::max_element(heights, heights + stride * stride);
+    lod.error[0] = 0.f;
+
+    // Compare each vertex left out by a level to the triangle of the level it lies on. The triangles split each cell along the same diagonal as BuildIndices.
+    for(int level = 1; level < cNumLevels; ++level)
+    {
+        const int step = 1 << level;
+        float error = 0.f;
+        for(int cy = 0; cy < size; cy += step)
+            for(int cx = 0; cx < size; cx += step)
+            {
+                const float h00 = heights[cy * stride + cx];
+                const float h10 = heights[cy * stride + cx + step];
+                const float h01 = heights[(cy + step) * stride + cx];
+                const float h11 = heights[(cy + step) * stride + cx + step];
+                for(int j = 0; j <= step; ++j)
+                    for(int i = 0; i <= step; ++i)
+                    {
+                        const float u = (float)i / step;
+                        const float v = (float)j / step;
+                        const float interpolated = (u + v <= 1.f) ? h00 + u * (h10 - h00) + v * (h01 - h00) :
+                            h11 + (1.f - u) * (h01 - h11) + (1.f - v) * (h10 - h11);
+                        error = std::max(error, fabs(heights[(cy + j) * stride + cx + i] - interpolated));
+                    }
+            }
+        // Keep the errors non-decreasing, so that a coarser level is never chosen over a finer one that is not good enough
+        lod.error[level] = std::max(error, lod.error[level - 1]);
+    }
+}
+
+int TerrainLodRenderer::EdgeLevel(int patchX, int patchY, int neighborX, int neighborY) const
+{
+    const int level = GetPatchLod(patchX, patchY).level;
+    if (neighborX < 0 || neighborY < 0 || neighborX >= patchWidth_ || neighborY >= patchHeight_)
+        return level;
+    const PatchLod &neighbor = GetPatchLod(neighborX, neighborY);
+    if (!neighbor.generated)
+        return level;
+    return std::max(level, neighbor.level);
+}
+
+void TerrainLodRenderer::BuildIndices(Chunk &chunk, int chunkX, int chunkY)
+{
+    if (chunk.mesh.isNull())
+        return;
+
+    const int size = EC_Terrain::cPatchSize;
+    PatchVertexMapper mapper;
+    mapper.chunkX0 = chunk.firstX;
+    mapper.chunkY0 = chunk.firstY;
+    mapper.chunkWidth = chunk.width;
+    mapper.lastX = terrain_->VerticesWidth() - 1;
+    mapper.lastY = terrain_->VerticesHeight() - 1;
+
+    indices_.clear();
+    const int firstPatchX = chunkX * cChunkSize;
+    const int firstPatchY = chunkY * cChunkSize;
+    for(int py = firstPatchY; py < std::min(patchHeight_, firstPatchY + cChunkSize); ++py)
+        for(int px = firstPatchX; px < std::min(patchWidth_, firstPatchX + cChunkSize); ++px)
+        {
+            const int step = 1 << GetPatchLod(px, py).level;
+            mapper.patchX0 = px * size;
+            mapper.patchY0 = py * size;
+            mapper.edgeSteps[0] = 1 << EdgeLevel(px, py, px, py - 1);
+            mapper.edgeSteps[1] = 1 << EdgeLevel(px, py, px, py + 1);
+            mapper.edgeSteps[2] = 1 << EdgeLevel(px, py, px - 1, py);
+            mapper.edgeSteps[3] = 1 << EdgeLevel(px, py, px + 1, py);
+
+            for(int y = 0; y < size; y += step)
+                for(int x = 0; x < size; x += step)
+                {
+                    // Note: winding needs to be flipped when terrain X axis goes along world X axis and terrain Y axis along world Z
+                    const u16 topLeft = mapper.Index(x, y);
+                    const u16 topRight = mapper.Index(x + step, y);
+                    const u16 bottomLeft = mapper.Index(x, y + step);
+                    const u16 bottomRight = mapper.Index(x + step, y + step);
+                    AddTriangle(indices_, bottomLeft, topRight, topLeft);
+                    AddTriangle(indices_, bottomLeft, bottomRight, topRight);
+                }
+        }
+
+    // Size the index buffer to the current levels instead of the full resolution, as most chunks are far away and coarse.
+    // The slack and the shrink threshold keep small level changes from reallocating it.
+    Ogre::IndexData *indexData = chunk.mesh->getSubMesh(0)->indexData;
+    const size_t numIndices = std::max<size_t>(indices_.size(), 6);
+    if (indexData->indexBuffer.isNull() || indexData->indexBuffer->getNumIndexes() < numIndices ||
+        indexData->indexBuffer->getNumIndexes() > 4 * numIndices)
+        indexData->indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT,
+            numIndices + numIndices / 2, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY, false);
+    if (!indices_.empty())
+        indexData->indexBuffer->writeData(0, indices_.size() * sizeof(u16), &indices_[0], true);
+    indexData->indexCount = indices_.size();
+    chunk.indicesDirty = false;
+}
+
+void TerrainLodRenderer::UpdateLod(Ogre::Camera *camera)
+{
+    if (!camera || chunks_.empty())
+        return;
+
+    PROFILE(TerrainLodRenderer_UpdateLod);
+
+    // Distances and errors are compared in the space of the terrain
+    Ogre::Vector3 cameraPos = camera->getDerivedPosition();
+    if (rootNode_)
+        cameraPos = rootNode_->convertWorldToLocalPosition(cameraPos);
+
+    // An error of e at the distance d covers e * projectionScale / d pixels of the viewport
+    const float viewportHeight = camera->getViewport() ? (float)camera->getViewport()->getActualHeight() : 768.f;
+    const float projectionScale = viewportHeight / (2.f * tan(camera->getFOVy().valueRadians() * 0.5f));
+    const float errorPerDistance = maxPixelError_ / projectionScale;
+
+    const int size = EC_Terrain::cPatchSize;
+    for(int y = 0; y < patchHeight_; ++y)
+        for(int x = 0; x < patchWidth_; ++x)
+        {
+            PatchLod &lod = GetPatchLod(x, y);
+            if (!lod.generated)
+                continue;
+            const Ogre::Vector3 closest(Clamp(cameraPos.x, (float)(x * size), (float)((x + 1) * size)),
+                Clamp(cameraPos.y, lod.minHeight, lod.maxHeight), Clamp(cameraPos.z, (float)(y * size), (float)((y + 1) * size)));
+            const float allowedError = cameraPos.distance(closest) * errorPerDistance;
+            int level = 0;
+            while(level + 1 < cNumLevels && lod.error[level + 1] <= allowedError)
+                ++level;
+            lod.level = level;
+        }
+
+    // The triangles of a patch depend on its own level and the levels of its neighbors, so compare both to find the chunks to rebuild
+    for(int y = 0; y < patchHeight_; ++y)
+        for(int x = 0; x < patchWidth_; ++x)
+        {
+            PatchLod &lod = GetPatchLod(x, y);
+            if (!lod.generated)
+                continue;
+            const u32 key = (u32)lod.level | ((u32)EdgeLevel(x, y, x, y - 1) << 4) | ((u32)EdgeLevel(x, y, x, y + 1) << 8) |
+                ((u32)EdgeLevel(x, y, x - 1, y) << 12) | ((u32)EdgeLevel(x, y, x + 1, y) << 16);
+            if (key != lod.edgeKey)
+            {
+                lod.edgeKey = key;
+                chunks_[(y / cChunkSize) * chunksWidth_ + x / cChunkSize].indicesDirty = true;
+            }
+        }
+
+    for(int cy = 0; cy < chunksHeight_; ++cy)
+        for(int cx = 0; cx < chunksWidth_; ++cx)
+        {
+            Chunk &chunk = chunks_[cy * chunksWidth_ + cx];
+            if (chunk.indicesDirty && !chunk.mesh.isNull())
+                BuildIndices(chunk, cx, cy);
+        }
+}
@@ -0,0 +1,113 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "OgreModuleFwd.h"
+
+#include <OgreMesh.h>
+
+#include <vector>
+#include <string>
+
+class EC_Terrain;
+
+/// Renders the patches of an EC_Terrain as geomipmapped chunks, with a level of detail chosen per patch by camera distance.
+/** The terrain is drawn in chunks of cChunkSize x cChunkSize patches, each one Ogre entity and one draw call. The vertex buffer of a chunk holds
+    the full-resolution grid of its patches, and its index buffer is rebuilt whenever the level of a patch in it or next to it changes.
+    Each patch uses the coarsest level whose geometric error, projected to the screen at the distance of the camera, is within the allowed pixel error.
+    Where a patch borders a coarser patch, the vertices on the shared edge are collapsed to those of the coarser patch, so that there are no cracks. */
+class TerrainLodRenderer
+{
+public:
+    /// Number of patches per side of a chunk.
+    static const int cChunkSize = 8;
+    /// Number of levels of detail per patch. Level n uses every 2^n:th vertex of the patch.
+    static const int cNumLevels = 5;
+
+    /// @param maxPixelError Largest allowed on-screen error of the simplified geometry, in pixels.
+    TerrainLodRenderer(EC_Terrain *terrain, OgreWorldWeakPtr world, float maxPixelError);
+    ~TerrainLodRenderer();
+
+    /// Rebuilds the chunks that contain or border dirty patches, and clears the dirty flags of their patches.
+    /** If the number of patches of the terrain has changed, rebuilds all the chunks.
+        @param rootNode Terrain root node the chunk nodes are attached to. */
+    void RegenerateDirtyChunks(Ogre::SceneNode *rootNode, const std::string &materialName);
+
+    /// Chooses the level of each patch for the given camera, and rebuilds the index buffers of the chunks where the levels changed.
+    void UpdateLod(Ogre::Camera *camera);
+
+    /// Sets the material of all the chunks.
+    void SetMaterial(const std::string &materialName);
+
+    /// Destroys all the chunks and their GPU resources.
+    void Destroy();
+
+    /// Returns whether the GPU geometry of the given patch has been created.
+    bool IsPatchGenerated(int patchX, int patchY) const;
+
+private:
+    /// Chunk of patches drawn with one entity.
+    struct Chunk
+    {
+        Chunk() : node(0), entity(0), firstX(0), firstY(0), width(0), height(0), indicesDirty(true) {}
+
+        Ogre::SceneNode *node;
+        Ogre::Entity *entity;
+        Ogre::MeshPtr mesh;
+        /// Map coordinates of the first vertex of the chunk.
+        int firstX;
+        int firstY;
+        /// Number of vertices per side of the chunk.
+        int width;
+        int height;
+        /// Whether the index buffer needs to be rebuilt for the current levels of the patches.
+        bool indicesDirty;
+    };
+
+    /// Level of detail state of a patch.
+    struct PatchLod
+    {
+        PatchLod() : minHeight(0.f), maxHeight(0.f), level(0), edgeKey(0), generated(false) {}
+
+        /// Largest height difference between the full-resolution patch and each level, non-decreasing by level.
+        float error[cNumLevels];
+        float minHeight;
+        float maxHeight;
+        /// Current level.
+        int level;
+        /// Level of the patch and the levels of its four edges, packed. Used to find the patches whose triangles have changed.
+        u32 edgeKey;
+        /// Whether the chunk of the patch has been built.
+        bool generated;
+    };
+
+    /// Creates the vertex buffer and the entity of a chunk, and computes the errors of its patches.
+    void BuildChunk(int chunkX, int chunkY, Ogre::SceneNode *rootNode, const std::string &materialName);
+    /// Destroys the GPU resources of a chunk.
+    void DestroyChunk(Chunk &chunk);
+    /// Rebuilds the index buffer of a chunk from the current levels of the patches.
+    void BuildIndices(Chunk &chunk, int chunkX, int chunkY);
+    /// Computes the error and height range of each level of a patch.
+    void ComputePatchErrors(int patchX, int patchY);
+    /// Returns the level of the given edge of a patch: the level of the patch or of the neighbor across the edge, whichever is coarser.
+    int EdgeLevel(int patchX, int patchY, int neighborX, int neighborY) const;
+
+    PatchLod &GetPatchLod(int patchX, int patchY) { return patchLods_[patchY * patchWidth_ + patchX]; }
+    const PatchLod &GetPatchLod(int patchX, int patchY) const { return patchLods_[patchY * patchWidth_ + patchX]; }
+
+    EC_Terrain *terrain_;
+    OgreWorldWeakPtr world_;
+    float maxPixelError_;
+    /// Terrain root node the chunks were last attached to.
+    Ogre::SceneNode *rootNode_;
+    /// Number of patches of the terrain the chunks were built for.
+    int patchWidth_;
+    int patchHeight_;
+    int chunksWidth_;
+    int chunksHeight_;
+    std::vector<Chunk> chunks_;
+    std::vector<PatchLod> patchLods_;
+    /// Index data scratch buffer, reused between rebuilds.
+    std::vector<u16> indices_;
+};
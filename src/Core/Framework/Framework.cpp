@@ -168,18 +168,33 @@ Framework::Framework(int argc_, char** argv_) :
     cmdLineDescs.commands["--fpslimit"] = "Specifies the fps cap to use in rendering. Default: 60. Pass in 0 to disable"; // OgreRenderingModule
     cmdLineDescs.commands["--run"] = "Run script on startup"; // JavaScriptModule
     cmdLineDescs.commands["--file"] = "Load scene on startup. Accepts absolute and relative paths, local:// and http:// are accepted and fetched via the AssetAPI."; // TundraLogicModule & AssetModule
+    cmdLineDescs.commands["--progressiveload"] = "Loads a .tbin startup scene this many entities per frame, so that the server can serve clients before the whole scene is loaded."; // TundraLogicModule
     cmdLineDescs.commands["--storage"] = "Adds the given directory as a local storage directory on startup"; // AssetModule
     cmdLineDescs.commands["--config"] = "Specifies the startup configration file to use. Multiple config files are supported, f.ex. '--config plugins.xml --config MyCustomAddons.xml"; // Framework
     cmdLineDescs.commands["--connect"] = "Connects to a Tundra server automatically. Syntax: '--connect serverIp;port;protocol;name;password'. Password is optional.";
     cmdLineDescs.commands["--login"] = "Automatically login to server using provided data. Url syntax: {tundra|http|https}://host[:port]/?username=x[&password=y&avatarurl=z&protocol={udp|tcp}]. Minimum information needed to try a connection in the url are host and username";
     cmdLineDescs.commands["--netrate"] = "Specifies the number of network updates per second. Default: 30."; // TundraLogicModule
+    cmdLineDescs.commands["--netbandwidth"] = "Specifies the maximum scene sync bandwidth per connection in kilobytes per second. Default: derived from the connection when it is saturated."; // TundraLogicModule
+    cmdLineDescs.commands["--interestradius"] = "Server replicates to each client only the entities within this distance of the client's observer entity. Default: no limit."; // TundraLogicModule
+    cmdLineDescs.commands["--netfullprecision"] = "Disables the quantized network encoding of transforms and velocities. Default: quantized if both peers support it."; // TundraLogicModule
+    cmdLineDescs.commands["--networldbounds"] = "Server world bounds for quantizing replicated positions. Syntax: '--networldbounds minX,minY,minZ,maxX,maxY,maxZ'. Default: -4096 to 4096 on each axis."; // TundraLogicModule
+    cmdLineDescs.commands["--netextrapolation"] = "Client extrapolates interpolated attributes when a network update is late, at most this fraction of the update interval (0 - 0.9). Default: 0, no extrapolation."; // TundraLogicModule
+    cmdLineDescs.commands["--maxtexturesize"] = "Specifies the largest texture width or height to load, in pixels. Larger textures are loaded from a smaller mip level. Default: 0, no limit."; // OgreRenderingModule
+    cmdLineDescs.commands["--textureprocessing"] = "Converts loaded textures on a background thread to a mipmapped form, DXT compressed except for normal maps, stored in the asset cache. Later loads use it without decoding."; // OgreRenderingModule
     cmdLineDescs.commands["--noassetcache"] = "Disable asset cache.";
     cmdLineDescs.commands["--assetcachedir"] = "Specify asset cache directory to use.";
     cmdLineDescs.commands["--clear-asset-cache"] = "At the start of Tundra, remove all data and metadata files from asset cache.";
+    cmdLineDescs.commands["--assetcachesize"] = "Specify the maximum size of the asset cache in megabytes. Least recently used assets are evicted when the cache exceeds it. 0 means unlimited. The default is 1024.";
+    cmdLineDescs.commands["--profilercapture"] = "Starts recording the profiling blocks of the given number of most recent frames at startup. Export them with the 'profilerexport' console command. Requires a build with profiling enabled."; // Framework
     cmdLineDescs.commands["--loglevel"] = "Sets the current log level: 'error', 'warning', 'info', 'debug'";
     cmdLineDescs.commands["--logfile"] = "Sets logging file. Usage example: '--logfile TundraLogFile.txt";
     cmdLineDescs.commands["--physicsrate"] = "Specifies the number of physics simulation steps per second. Default: 60"; // PhysicsModule
     cmdLineDescs.commands["--physicsmaxsteps"] = "Specifies the maximum number of physics simulation steps in one frame to limit CPU usage. If the limit would be exceeded, physics will appear to slow down. Default: 6"; // PhysicsModule
+    cmdLineDescs.commands["--physicsbroadphase"] = "Specifies the physics broadphase: 'dbvt' (dynamic AABB trees), 'sap' (sweep and prune, for mostly static scenes) or 'simple'. Default: dbvt"; // PhysicsModule
+    cmdLineDescs.commands["--physicssolveriterations"] = "Specifies the number of physics constraint solver iterations per simulation step. Default: 10"; // PhysicsModule
+    cmdLineDescs.commands["--physicsthread"] = "Runs the physics simulation on a dedicated thread in parallel with the rest of the frame. The scene lags the simulation by one frame."; // PhysicsModule
+    cmdLineDescs.commands["--terrainlod"] = "Draws terrains as level of detail chunks chosen by camera distance, recommended for terrains of more than 32x32 patches. Optionally specifies the allowed on-screen error in pixels. Default: 2"; // EnvironmentModule
+    cmdLineDescs.commands["--terrain16bit"] = "Stores terrain heights as 16-bit quantized values instead of floats, which halves the memory used by the heights."; // EnvironmentModule
     
 
     if (HasCommandLineParameter("--help"))
@@ -246,6 +261,24 @@ Framework::Framework(int argc_, char** argv_) :
         input = new InputAPI(this);
         console = new ConsoleAPI(this);
         console->RegisterCommand("exit", "Shuts down gracefully.", this, SLOT(Exit()));
+        console->RegisterCommand("profilercapture", "Starts recording the profiling blocks of all threads, keeping the given number of most recent frames. Usage: profilercapture(numFrames)",
+            profilerQObj, SLOT(StartCapture(int)));
+        console->RegisterCommand("profilerstopcapture", "Stops recording the profiling blocks.", profilerQObj, SLOT(StopCapture()));
+        console->RegisterCommand("profilerexport", "Writes the recorded profiling blocks to a Chrome trace event file. Usage: profilerexport(filename)",
+            profilerQObj, SLOT(ExportCapture(const QString &)));
+        console->RegisterCommand("mathbenchmark", "Measures the core math operations with the scalar and the SSE code paths. Usage: mathbenchmark(iterations)",
+            profilerQObj, SLOT(BenchmarkMath(int)));
+#ifdef PROFILING
+        QStringList captureParam = CommandLineParameters("--profilercapture");
+        if (captureParam.size() > 0)
+        {
+            int numFrames = captureParam.last().toInt();
+            if (numFrames > 0)
+                profiler->StartCapture(numFrames);
+            else
+                LogWarning("Erroneous frame count given with --profilercapture: " + captureParam.last() + ". Ignoring.");
+        }
+#endif
 
         // Initialize SceneAPI.
         scene->Initialise();
@@ -294,6 +327,9 @@ void Framework::ProcessOneFrame()
     if (exitSignal == true)
         return; // We've accidentally ended up to update a frame, but we're actually quitting.
 
+#ifdef PROFILING
+    profiler->MarkFrame();
+#endif
     PROFILE(Framework_ProcessOneFrame);
 
     static tick_t clockFreq;
@@ -309,12 +345,18 @@ void Framework::ProcessOneFrame()
     double frametime = ((double)currClockTime - (double)lastClockTime) / (double) clockFreq;
     lastClockTime = currClockTime;
 
+#ifdef PROFILING
+    // Modules are only appended, so intern the update block names of new modules only.
+    for(size_t i = moduleUpdateBlockIds.size(); i < modules.size(); ++i)
+        moduleUpdateBlockIds.push_back(Profiler::InternBlockName(("Module_" + modules[i]->Name() + "_Update").toStdString()));
+#endif
+
     for(size_t i = 0; i < modules.size(); ++i)
     {
         try
         {
 #ifdef PROFILING
-            ProfilerSection ps(("Module_" + modules[i]->Name() + "_Update").toStdString());
+            ProfilerSection ps(moduleUpdateBlockIds[i]);
 #endif
             modules[i]->Update(frametime);
         }
@@ -393,6 +435,9 @@ void Framework::Go()
 
     // Delete all modules.
     modules.clear();
+#ifdef PROFILING
+    moduleUpdateBlockIds.clear();
+#endif
 
     // Now that each module has been deleted, they've closed all their windows as well. Tear down the main UI.
     ui->Reset();
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "FrameworkFwd.h"
+#include "CoreTypes.h"
 
 #include <QObject>
 #include <QStringList>
@@ -160,6 +161,7 @@ private:
     bool exitSignal; ///< If true, exit application.
 #ifdef PROFILING
     Profiler *profiler; ///< Profiler.
+    std::vector<u32> moduleUpdateBlockIds; ///< Interned profiling block ids of the module Update() calls, parallel to modules.
 #endif
     ProfilerQObj *profilerQObj; ///< We keep this QObject always alive, even when profiling is not enabled, so that scripts don't have to check whether profiling is enabled or disabled.
     bool headless; ///< Are we running in the headless mode.
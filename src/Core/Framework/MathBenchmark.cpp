@@ -0,0 +1,247 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "MathBenchmark.h"
+#include "HighPerfClock.h"
+
+#include "Math/MathFunc.h"
+#include "Math/float3.h"
+#include "Math/float4.h"
+#include "Math/float3x3.h"
+#include "Math/float3x4.h"
+#include "Math/float4x4.h"
+#include "Math/Quat.h"
+#include "Math/Matrix.inl"
+#include "Math/ScalarMath.h"
+#include "Math/SSEMath.h"
+#include "Algorithm/Random/LCG.h"
+
+#include <string.h>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+
+/// Number of distinct inputs the operations cycle through. Small enough for the inputs and outputs to stay in the L1 cache.
+const int cNumInputs = 64;
+
+/// Fills the given array with random values in [-1, 1].
+void RandomFill(LCG &lcg, std::vector<float> &values, int count)
+{
+    values.resize(count);
+    for(int i = 0; i < count; ++i)
+        values[i] = lcg.Float(-1.f, 1.f);
+}
+
+/// Fills the given array with cNumInputs random unit quaternions.
+void RandomQuats(LCG &lcg, std::vector<float> &values)
+{
+    values.resize(cNumInputs * 4);
+    for(int i = 0; i < cNumInputs; ++i)
+    {
+        float *q = &values[i * 4];
+        float lengthSq = 0.f;
+        while(lengthSq < 1e-2f)
+        {
+            for(int j = 0; j < 4; ++j)
+                q[j] = lcg.Float(-1.f, 1.f);
+            lengthSq = q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3];
+        }
+        const float invLength = 1.f / sqrt(lengthSq);
+        for(int j = 0; j < 4; ++j)
+            q[j] *= invLength;
+    }
+}
+
+/// Fills the given array with cNumInputs random well-conditioned matrices of 4 columns and the given number of rows.
+void RandomInvertible(LCG &lcg, std::vector<float> &values, int rows)
+{
+    RandomFill(lcg, values, cNumInputs * rows * 4);
+    for(int i = 0; i < cNumInputs; ++i)
+        for(int j = 0; j < rows; ++j)
+            values[i * rows * 4 + j * 5] += 4.f; // Dominant diagonal
+}
+
+/// Fills the given array with cNumInputs random affine transforms of 4 columns and the given number of rows.
+/** Each has a uniform scale between 0.001 and 1000 and a translation of up to 100 units, like the world transforms of
+    scenes with models in different units, to check that both code paths invert matrices of any scale. */
+void RandomScaledAffine(LCG &lcg, std::vector<float> &values, int rows)
+{
+    RandomInvertible(lcg, values, rows);
+    for(int i = 0; i < cNumInputs; ++i)
+    {
+        float *m = &values[i * rows * 4];
+        const float scale = pow(10.f, lcg.Float(-3.f, 3.f));
+        for(int j = 0; j < 3; ++j)
+        {
+            for(int k = 0; k < 3; ++k)
+                m[j * 4 + k] *= scale;
+            m[j * 4 + 3] *= 100.f;
+        }
+        if (rows == 4)
+        {
+            m[12] = m[13] = m[14] = 0.f;
+            m[15] = 1.f;
+        }
+    }
+}
+
+typedef void (*BinaryKernel)(float *out, const float *a, const float *b);
+typedef void (*TransformKernel)(float *out, const float *m, float x, float y, float z, float w);
+typedef void (*SlerpKernel)(float *out, const float *a, const float *b, float t);
+typedef bool (*InverseKernel)(float *m, float epsilon);
+
+/// Computes out[i] = a[i] * b[i+1]. The kernel is a template parameter, so that the call can be inlined like in the math types.
+template<BinaryKernel Kernel, int OutSize, int ASize, int BSize>
+struct BinaryOp
+{
+    static void Run(int i, float *out, const float *a, const float *b)
+    {
+        Kernel(out + i * OutSize, a + i * ASize, b + ((i + 1) % cNumInputs) * BSize);
+    }
+};
+
+/// Computes out[i] = m[i] * (v[i].xyz, 1).
+template<TransformKernel Kernel>
+struct TransformPosOp
+{
+    static void Run(int i, float *out, const float *m, const float *v)
+    {
+        const float *p = v + i * 4;
+        Kernel(out + i * 4, m + i * 12, p[0], p[1], p[2], 1.f);
+    }
+};
+
+/// Computes out[i] = slerp(a[i], b[i+1], t), with t taken from the input too, so that it is not a constant.
+template<SlerpKernel Kernel>
+struct SlerpOp
+{
+    static void Run(int i, float *out, const float *a, const float *b)
+    {
+        Kernel(out + i * 4, a + i * 4, b + ((i + 1) % cNumInputs) * 4, 0.5f + 0.5f * a[((i + 2) % cNumInputs) * 4]);
+    }
+};
+
+/// Computes out[i] = inverse(m[i]).
+template<InverseKernel Kernel, int Size>
+struct InverseOp
+{
+    static void Run(int i, float *out, const float *m, const float *)
+    {
+        memcpy(out + i * Size, m + i * Size, Size * sizeof(float));
+        Kernel(out + i * Size, 1e-6f);
+    }
+};
+
+/// The scalar reference of float4x4::Inverse.
+bool mat4x4_inverse_scalar(float *m, float)
+{
+    return InverseMatrix(*reinterpret_cast<float4x4*>(m));
+}
+
+/// The scalar reference of float3x4::Inverse, which inverts the matrix as a float4x4.
+bool mat3x4_inverse_scalar(float *m, float)
+{
+    float4x4 temp(*reinterpret_cast<float3x4*>(m));
+    bool success = InverseMatrix(temp);
+    *reinterpret_cast<float3x4*>(m) = temp.Float3x4Part();
+    return success;
+}
+
+/// Runs the operation the given number of times, cycling through the inputs, and returns the average time of one operation in nanoseconds.
+template<typename Op>
+double Measure(int iterations, std::vector<float> &out, const std::vector<float> &a, const std::vector<float> &b)
+{
+    // Warm up the caches and the branch predictors
+    for(int i = 0; i < cNumInputs; ++i)
+        Op::Run(i, &out[0], &a[0], &b[0]);
+
+    tick_t start = GetCurrentClockTime();
+    for(int i = 0, input = 0; i < iterations; ++i)
+    {
+        Op::Run(input, &out[0], &a[0], &b[0]);
+        if (++input == cNumInputs)
+            input = 0;
+    }
+    tick_t elapsed = GetCurrentClockTime() - start;
+    return (double)elapsed * 1e9 / GetCurrentClockFreq() / iterations;
+}
+
+/// Measures the scalar and the SSE variant of an operation with the same inputs, and compares their outputs.
+template<typename ScalarOp, typename SSEOp>
+MathBenchmarkResult Compare(const char *name, int iterations, int outSize, const std::vector<float> &a, const std::vector<float> &b)
+{
+    MathBenchmarkResult result;
+    result.name = name;
+    result.maxError = 0.f;
+
+    std::vector<float> scalarOut(cNumInputs * outSize);
+    result.scalarNsecs = Measure<ScalarOp>(iterations, scalarOut, a, b);
+#ifdef MATH_SSE
+    std::vector<float> sseOut(cNumInputs * outSize);
+    result.sseNsecs = Measure<SSEOp>(iterations, sseOut, a, b);
+    for(size_t i = 0; i < scalarOut.size(); ++i)
+        result.maxError = Max(result.maxError, Abs(scalarOut[i] - sseOut[i]) / Max(1.f, Abs(scalarOut[i])));
+#else
+    result.sseNsecs = -1.0;
+#endif
+    return result;
+}
+
+}
+
+#ifndef MATH_SSE
+// Without MATH_SSE the SSE kernels do not exist. The scalar kernels stand in for them, and only the scalar path is measured.
+#define mat4x4_mul_sse mat4x4_mul_scalar
+#define mat3x4_mul_sse mat3x4_mul_scalar
+#define mat4x4_mul_vec4_sse mat4x4_mul_vec4_scalar
+#define mat3x4_transform_sse mat3x4_transform_scalar
+#define mat4x4_inverse_sse mat4x4_inverse_scalar
+#define mat3x4_inverse_sse mat3x4_inverse_scalar
+#define quat_mul_sse quat_mul_scalar
+#define quat_slerp_sse quat_slerp_scalar
+#endif
+
+std::vector<MathBenchmarkResult> RunMathBenchmarks(int iterations)
+{
+    std::vector<MathBenchmarkResult> results;
+    if (iterations <= 0)
+        return results;
+
+    LCG lcg(12345);
+    std::vector<float> m1, m2, v, invertible4, invertible3, scaled4, scaled3, q1, q2;
+    RandomFill(lcg, m1, cNumInputs * 16);
+    RandomFill(lcg, m2, cNumInputs * 16);
+    RandomFill(lcg, v, cNumInputs * 4);
+    RandomInvertible(lcg, invertible4, 4);
+    RandomInvertible(lcg, invertible3, 3);
+    RandomScaledAffine(lcg, scaled4, 4);
+    RandomScaledAffine(lcg, scaled3, 3);
+    RandomQuats(lcg, q1);
+    RandomQuats(lcg, q2);
+
+    results.push_back(Compare<BinaryOp<mat4x4_mul_scalar, 16, 16, 16>, BinaryOp<mat4x4_mul_sse, 16, 16, 16> >(
+        "float4x4 * float4x4", iterations, 16, m1, m2));
+    results.push_back(Compare<BinaryOp<mat3x4_mul_scalar, 12, 12, 12>, BinaryOp<mat3x4_mul_sse, 12, 12, 12> >(
+        "float3x4 * float3x4", iterations, 12, m1, m2));
+    results.push_back(Compare<BinaryOp<mat4x4_mul_vec4_scalar, 4, 16, 4>, BinaryOp<mat4x4_mul_vec4_sse, 4, 16, 4> >(
+        "float4x4 * float4", iterations, 4, m1, v));
+    results.push_back(Compare<TransformPosOp<mat3x4_transform_scalar>, TransformPosOp<mat3x4_transform_sse> >(
+        "float3x4::TransformPos", iterations, 4, m1, v));
+    results.push_back(Compare<InverseOp<mat4x4_inverse_scalar, 16>, InverseOp<mat4x4_inverse_sse, 16> >(
+        "float4x4::Inverse", iterations, 16, invertible4, invertible4));
+    results.push_back(Compare<InverseOp<mat3x4_inverse_scalar, 12>, InverseOp<mat3x4_inverse_sse, 12> >(
+        "float3x4::Inverse", iterations, 12, invertible3, invertible3));
+    results.push_back(Compare<InverseOp<mat4x4_inverse_scalar, 16>, InverseOp<mat4x4_inverse_sse, 16> >(
+        "float4x4::Inverse scaled", iterations, 16, scaled4, scaled4));
+    results.push_back(Compare<InverseOp<mat3x4_inverse_scalar, 12>, InverseOp<mat3x4_inverse_sse, 12> >(
+        "float3x4::Inverse scaled", iterations, 12, scaled3, scaled3));
+    results.push_back(Compare<BinaryOp<quat_mul_scalar, 4, 4, 4>, BinaryOp<quat_mul_sse, 4, 4, 4> >(
+        "Quat * Quat", iterations, 4, q1, q2));
+    results.push_back(Compare<SlerpOp<quat_slerp_scalar>, SlerpOp<quat_slerp_sse> >(
+        "Quat::Slerp", iterations, 4, q1, q2));
+    return results;
+}
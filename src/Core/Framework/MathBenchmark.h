@@ -0,0 +1,23 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// Timing of one math library operation with the scalar reference kernel of ScalarMath.h and the SSE kernel of SSEMath.h.
+struct MathBenchmarkResult
+{
+    /// Name of the operation, e.g. "float4x4 * float4x4".
+    std::string name;
+    /// Average time of one operation with the scalar kernel, in nanoseconds.
+    double scalarNsecs;
+    /// Average time of one operation with the SSE kernel, in nanoseconds, or a negative value if the math library was built without MATH_SSE.
+    double sseNsecs;
+    /// Largest difference between the results of the scalar and the SSE kernel for the same input, relative to the magnitude of the scalar result when it is above 1.
+    float maxError;
+};
+
+/// Runs each core matrix and quaternion operation the given number of times on random input with both code paths, and returns their timings.
+/** Both paths process the same inputs, and their results are compared to verify that the SSE kernels agree with the scalar reference. */
+std::vector<MathBenchmarkResult> RunMathBenchmarks(int iterations);
@@ -6,9 +6,14 @@
 #include "CoreDefines.h"
 #include "CoreStringUtils.h"
 #include "HighPerfClock.h"
+#include "LoggingFunctions.h"
+#include "MathBenchmark.h"
 #include "MemoryLeakCheck.h"
 #include "Math/MathFunc.h"
 
+#include <QFile>
+#include <QTextStream>
+
 #include <iostream>
 #include <utility>
 
@@ -23,30 +28,106 @@ bool ProfilerBlock::QueryCapability()
 #endif
 }
 
-void Profiler::StartBlock(const std::string &name)
+namespace
+{
+    /// Maps profiling block names to ids. Id 0 is reserved for the thread root blocks.
+    struct BlockNameRegistry
+    {
+        BlockNameRegistry() : names(1) {}
+
+        boost::mutex mutex;
+        std::map<std::string, u32> ids;
+        std::vector<std::string> names;
+    };
+
+    BlockNameRegistry &GetBlockNameRegistry()
+    {
+        static BlockNameRegistry registry;
+        return registry;
+    }
+
+    /// Constructs the registry during static initialization, before any thread can race to construct it in GetBlockNameRegistry.
+    BlockNameRegistry &blockNameRegistryInit = GetBlockNameRegistry();
+
+    /// Returns the id of a block name, allocating a new id if needed. The caller holds the registry lock.
+    u32 InternBlockNameLocked(BlockNameRegistry &registry, const std::string &name)
+    {
+        std::map<std::string, u32>::const_iterator iter = registry.ids.find(name);
+        if (iter != registry.ids.end())
+            return iter->second;
+    
+        u32 blockId = (u32)registry.names.size();
+        registry.names.push_back(name);
+        registry.ids[name] = blockId;
+        return blockId;
+    }
+
+    /// The thread data is owned by the Profiler, so boost::thread_specific_ptr must not delete it.
+    void EmptyThreadDataDeletor(ProfilerThreadData *) {}
+}
+
+u32 Profiler::InternBlockName(const std::string &name)
+{
+    BlockNameRegistry &registry = GetBlockNameRegistry();
+    boost::mutex::scoped_lock lock(registry.mutex);
+    return InternBlockNameLocked(registry, name);
+}
+
+u32 Profiler::InternBlockId(volatile u32 &cachedId, const char *name)
+{
+    BlockNameRegistry &registry = GetBlockNameRegistry();
+    boost::mutex::scoped_lock lock(registry.mutex);
+    // Check again under the lock, another thread may have interned the name after the unlocked read in BlockId.
+    u32 blockId = cachedId;
+    if (blockId == 0)
+    {
+        blockId = InternBlockNameLocked(registry, name);
+        cachedId = blockId;
+    }
+    return blockId;
+}
+
+std::string Profiler::BlockName(u32 blockId)
+{
+    BlockNameRegistry &registry = GetBlockNameRegistry();
+    boost::mutex::scoped_lock lock(registry.mutex);
+    return blockId < registry.names.size() ? registry.names[blockId] : std::string();
+}
+
+Profiler::Profiler() :
+    root_("Root"),
+    threadData_(&EmptyThreadDataDeletor),
+    capturing_(false),
+    numFramesCaptured_(0)
+{
+}
+
+void Profiler::StartBlock(u32 blockId)
 {
 #ifdef PROFILING
+    ProfilerThreadData *thread = GetOrCreateThreadData();
+
     // Get the current topmost profiling node in the stack, or 
-    // if none exists, get the root node or create a new root node.
+    // if none exists, get the root node.
     // This will be the parent node of the new block we're starting.
-    ProfilerNodeTree *parent = current_node_;
+    ProfilerNodeTree *parent = thread->current;
     if (!parent)
     {
-        parent = GetOrCreateThreadRootBlock();
-        current_node_ = parent;
+        parent = thread->root.get();
+        thread->current = parent;
     }
     assert(parent);
 
-    // If parent name == new block name, we assume that we're
+    // If parent id == new block id, we assume that we're
     // recursively re-entering the same function (with a single
     // profiling block).
-    ProfilerNodeTree *node = (name != parent->Name()) ? parent->GetChild(name) : parent;
+    ProfilerNodeTree *node = (blockId != parent->BlockId()) ? parent->GetChild(blockId) : parent;
 
     // We're entering this PROFILE() block for the first time,
     // need to allocate the memory for it.
     if (!node)
     {
-        node = new ProfilerNode(name);
+        node = new ProfilerNode(BlockName(blockId), blockId);
         parent->AddChild(boost::shared_ptr<ProfilerNodeTree>(node));
     }
 
@@ -59,28 +140,39 @@ void Profiler::StartBlock(const std::string &name)
         parent->recursion_++; // handle recursion
     else
     {
-        current_node_ = node;
+        thread->current = node;
 
         checked_static_cast<ProfilerNode*>(node)->block_.Start();
     }
+
+    if (capturing_)
+    {
+        if (!thread->events)
+            thread->events = new ProfilerEvent[ProfilerThreadData::cCaptureBufferSize];
+        thread->RecordEvent(blockId, ProfilerEvent::BlockBegin, GetCurrentClockTime());
+    }
 #endif
 }
 
-void Profiler::EndBlock(const std::string &name)
+void Profiler::EndBlock(u32 blockId)
 {
 #ifdef PROFILING
     using namespace std;
 
-    ProfilerNodeTree *treeNode = current_node_;
+    ProfilerThreadData *thread = threadData_.get();
+    ProfilerNodeTree *treeNode = thread ? thread->current : 0;
     if (!treeNode)
         return;
-    assert (treeNode->Name() == name && "New profiling block started before old one ended!");
+    assert (treeNode->BlockId() == blockId && "New profiling block started before old one ended!");
 
     ProfilerNode* node = checked_static_cast<ProfilerNode*>(treeNode);
     node->block_.Stop();
     node->num_called_total_++;
     node->num_called_current_++;
 
+    if (capturing_ && thread->events)
+        thread->RecordEvent(blockId, ProfilerEvent::BlockEnd, node->block_.end_time_);
+
     double elapsed = node->block_.ElapsedTimeSeconds();
 
     node->elapsed_current_ += elapsed;
@@ -100,7 +192,7 @@ void Profiler::EndBlock(const std::string &name)
         --node->recursion_;
     else
     {
-        current_node_ = node->Parent();
+        thread->current = node->Parent();
     }
 #endif
 }
@@ -122,26 +214,85 @@ void ProfilerQObj::EndBlock()
     Profiler *p = fw ? fw->GetProfiler() : 0;
     if (p)
     {
-        ProfilerNodeTree *treeNode = p->current_node_;
+        ProfilerThreadData *thread = p->threadData_.get();
+        ProfilerNodeTree *treeNode = thread ? thread->current : 0;
         if (!treeNode)
             return;
-        p->EndBlock(treeNode->Name());
+        p->EndBlock(treeNode->BlockId());
     }
 #endif
 }
 
+void ProfilerQObj::StartCapture(int numFrames)
+{
+#ifdef PROFILING
+    Framework *fw = Framework::Instance();
+    Profiler *p = fw ? fw->GetProfiler() : 0;
+    if (p)
+        p->StartCapture(numFrames);
+#else
+    LogWarning("ProfilerQObj::StartCapture: Profiling is not enabled in this build.");
+#endif
+}
+
+void ProfilerQObj::StopCapture()
+{
+#ifdef PROFILING
+    Framework *fw = Framework::Instance();
+    Profiler *p = fw ? fw->GetProfiler() : 0;
+    if (p)
+        p->StopCapture();
+#endif
+}
+
+void ProfilerQObj::ExportCapture(const QString &filename)
+{
+#ifdef PROFILING
+    Framework *fw = Framework::Instance();
+    Profiler *p = fw ? fw->GetProfiler() : 0;
+    if (p && p->ExportCapture(filename))
+        LogInfo("Wrote profiler capture to " + filename);
+#else
+    LogWarning("ProfilerQObj::ExportCapture: Profiling is not enabled in this build.");
+#endif
+}
+
+void ProfilerQObj::BenchmarkMath(int iterations)
+{
+    if (iterations <= 0)
+    {
+        LogError("ProfilerQObj::BenchmarkMath: the number of iterations must be positive.");
+        return;
+    }
+
+    std::vector<MathBenchmarkResult> results = RunMathBenchmarks(iterations);
+    LogInfo("Math benchmark with " + QString::number(iterations) + " iterations, nanoseconds per operation:");
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const MathBenchmarkResult &r = results[i];
+        QString line = QString(r.name.c_str()).leftJustified(24) + " scalar " + QString::number(r.scalarNsecs, 'f', 2);
+        if (r.sseNsecs >= 0.0)
+            line += ", SSE " + QString::number(r.sseNsecs, 'f', 2) + " (" + QString::number(r.scalarNsecs / r.sseNsecs, 'f', 2) +
+                "x), max difference " + QString::number(r.maxError, 'g', 3);
+        else
+            line += ", SSE not enabled in this build";
+        LogInfo(line);
+    }
+}
+
 ProfilerNodeTree *Profiler::GetThreadRootBlock()
 { 
-    return thread_specific_root_;
+    ProfilerThreadData *thread = threadData_.get();
+    return thread ? thread->root.get() : 0;
 }
 
 ProfilerNodeTree *Profiler::GetOrCreateThreadRootBlock()
 { 
 #ifdef PROFILING // If not profiling, never create the root block so the getter will always return 0.
-    if (!thread_specific_root_)
-        return CreateThreadRootBlock();
+    return GetOrCreateThreadData()->root.get();
+#else
+    return 0;
 #endif
-    return thread_specific_root_;
 }
 
 std::string Profiler::GetThisThreadRootBlockName()
@@ -195,27 +346,34 @@ float ProfilerNode::TotalCustomSpentInChildren() const
 ProfilerNodeTree *Profiler::CreateThreadRootBlock()
 {
 #ifdef PROFILING
+    assert(!threadData_.get());
+    return CreateThreadData()->root.get();
+#else
+    return 0;
+#endif
+}
+
+ProfilerThreadData *Profiler::CreateThreadData()
+{
     ProfilerBlock::QueryCapability();
     
     std::string rootObjectName = GetThisThreadRootBlockName();
 
-    ProfilerNodeTree *root = new ProfilerNodeTree(rootObjectName);
-    assert(!thread_specific_root_);
-    thread_specific_root_ = root;
-
     // Each thread root block is added as a child of a dummy node root_ owned by
     // this Profiler. The root_ object doesn't own the memory of its children,
     // but just weakly refers to them an allows easy access for printing the
     // profiling data in each thread.
     mutex_.lock();
+    ProfilerThreadData *thread = new ProfilerThreadData(rootObjectName, (u32)threads_.size());
+    ProfilerNodeTree *root = thread->root.get();
     root_.AddChild(boost::shared_ptr<ProfilerNodeTree>(root, &EmptyDeletor));
     root->MarkAsRootBlock(this);
     thread_root_nodes_.push_back(root);
+    threads_.push_back(thread);
     mutex_.unlock();
-    return root;
-#else
-    return 0;
-#endif
+
+    threadData_.reset(thread);
+    return thread;
 }
 
 void Profiler::RemoveThreadRootBlock(ProfilerNodeTree *rootBlock)
@@ -262,7 +420,165 @@ void Profiler::Reset()
     mutex_.unlock();
 }
 
+void Profiler::StartCapture(int numFrames)
+{
+    if (numFrames < 1)
+        numFrames = 1;
+    frameStartTimes_.clear();
+    frameStartTimes_.resize(numFrames, 0);
+    numFramesCaptured_ = 0;
+    capturing_ = true;
+}
+
+void Profiler::StopCapture()
+{
+    capturing_ = false;
+}
+
+void Profiler::MarkFrame()
+{
+    if (!capturing_ || frameStartTimes_.empty())
+        return;
+    frameStartTimes_[numFramesCaptured_ % frameStartTimes_.size()] = GetCurrentClockTime();
+    ++numFramesCaptured_;
+}
+
+namespace
+{
+    /// A block paired from the begin and end events of a capture.
+    struct CapturedBlock
+    {
+        s64 begin;
+        s64 end;
+        u32 blockId;
+    };
+
+    std::string EscapeJson(const std::string &str)
+    {
+        std::string escaped;
+        escaped.reserve(str.length());
+        for(size_t i = 0; i < str.length(); ++i)
+        {
+            char c = str[i];
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ((unsigned char)c < 0x20)
+                escaped += ' ';
+            else
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    /// Copies the valid events of a thread's capture ring buffer in recording order and pairs them to blocks.
+    void CollectCapturedBlocks(const ProfilerThreadData &thread, s64 windowStart, std::vector<CapturedBlock> &dst)
+    {
+        const ProfilerEvent *events = thread.events;
+        if (!events)
+            return;
+
+        const u32 mask = ProfilerThreadData::cCaptureBufferSize - 1;
+        const u32 writtenBefore = thread.numEventsWritten;
+        const u32 numEvents = thread.eventBufferFull ? ProfilerThreadData::cCaptureBufferSize : writtenBefore;
+        std::vector<ProfilerEvent> copy(numEvents);
+        for(u32 i = 0; i < numEvents; ++i)
+            copy[i] = events[(writtenBefore - numEvents + i) & mask];
+
+        // The owning thread keeps recording while we copy. Discard the events it may have overwritten meanwhile.
+        const u32 numOverwritten = std::min(thread.numEventsWritten - writtenBefore, numEvents);
+
+        std::vector<CapturedBlock> stack;
+        for(u32 i = numOverwritten; i < numEvents; ++i)
+        {
+            const ProfilerEvent &e = copy[i];
+            if (e.type == ProfilerEvent::BlockBegin)
+            {
+                CapturedBlock block = { e.time, 0, e.blockId };
+                stack.push_back(block);
+            }
+            else if (!stack.empty() && stack.back().blockId == e.blockId)
+            {
+                CapturedBlock block = stack.back();
+                stack.pop_back();
+                block.end = e.time;
+                if (block.end >= windowStart)
+                    dst.push_back(block);
+            }
+            else
+                stack.clear(); // The begin event of this block is older than the buffer.
+        }
+    }
+}
+
+bool Profiler::ExportCapture(const QString &filename)
+{
+    if (numFramesCaptured_ == 0)
+    {
+        LogError("Profiler::ExportCapture: No frames captured. Use StartCapture first.");
+        return false;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LogError("Profiler::ExportCapture: Failed to open \"" + filename + "\" for writing.");
+        return false;
+    }
+
+    const u32 numFrames = std::min<u32>(numFramesCaptured_, frameStartTimes_.size());
+    const u32 oldestFrame = numFramesCaptured_ - numFrames;
+    const s64 windowStart = frameStartTimes_[oldestFrame % frameStartTimes_.size()];
+    const double ticksToMicroSeconds = 1000000.0 / (double)GetCurrentClockFreq();
+
+    QTextStream out(&file);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+
+    for(u32 i = oldestFrame; i < numFramesCaptured_; ++i)
+    {
+        out << (first ? "" : ",\n") << "{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":"
+            << QString::number((frameStartTimes_[i % frameStartTimes_.size()] - windowStart) * ticksToMicroSeconds, 'f', 3) << "}";
+        first = false;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<u32, std::string> names;
+    std::vector<CapturedBlock> blocks;
+    for(size_t i = 0; i < threads_.size(); ++i)
+    {
+        const ProfilerThreadData &thread = *threads_[i];
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.threadIndex
+            << ",\"args\":{\"name\":\"" << EscapeJson(thread.root->Name()).c_str() << "\"}}";
+
+        blocks.clear();
+        CollectCapturedBlocks(thread, windowStart, blocks);
+        for(size_t j = 0; j < blocks.size(); ++j)
+        {
+            const CapturedBlock &block = blocks[j];
+            std::map<u32, std::string>::iterator name = names.find(block.blockId);
+            if (name == names.end())
+                name = names.insert(std::make_pair(block.blockId, EscapeJson(BlockName(block.blockId)))).first;
+            out << ",\n{\"name\":\"" << name->second.c_str() << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.threadIndex
+                << ",\"ts\":" << QString::number((block.begin - windowStart) * ticksToMicroSeconds, 'f', 3)
+                << ",\"dur\":" << QString::number((block.end - block.begin) * ticksToMicroSeconds, 'f', 3) << "}";
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
 Profiler::~Profiler()
 {
     Reset();
+    // The thread root blocks are detached, so they can be freed without notifying back.
+    mutex_.lock();
+    for(size_t i = 0; i < threads_.size(); ++i)
+        delete threads_[i];
+    threads_.clear();
+    mutex_.unlock();
 }
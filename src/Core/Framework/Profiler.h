@@ -22,8 +22,12 @@
 /** Name of the profiling block must be unique in the scope, so do not use the name of the function
     as the name of the profiling block!
 
+    The name is interned to a block id only once per call site, so entering the block does not allocate or compare strings.
+    The cached id is a constant-initialized static, so the compiler emits no thread-unsafe initialization guard for it,
+    see Profiler::BlockId.
+
     @param x Unique name for the profiling block, use without quotes, f.ex. PROFILE(name_of_the_block) */
-#define PROFILE(x) ProfilerSection x ## __profiler__(#x);
+#define PROFILE(x) static volatile u32 x ## __profilerid__ = 0; ProfilerSection x ## __profiler__(Profiler::BlockId(x ## __profilerid__, #x));
 
 /// Optionally ends the current profiling block
 /** Use when you wish to end a profiling block before it goes out of scope. */
@@ -92,6 +96,7 @@ public:
 
 private:
     friend class ProfilerNode;
+    friend class Profiler;
     /// default constructor
     ProfilerBlock() {}
 
@@ -109,8 +114,8 @@ class ProfilerNodeTree
 public:
     typedef std::list<boost::shared_ptr<ProfilerNodeTree> > NodeList;
 
-    /// constructor that takes a name for the node
-    explicit ProfilerNodeTree(const std::string &name) : name_(name), parent_(0), recursion_(0), owner_(0) {}
+    /// constructor that takes a name and the interned block id for the node
+    explicit ProfilerNodeTree(const std::string &name, u32 blockId = 0) : name_(name), blockId_(blockId), parent_(0), recursion_(0), owner_(0) {}
 
     /// destructor
     virtual ~ProfilerNodeTree()
@@ -159,9 +164,24 @@ public:
         return 0;
     }
 
+    /// Returns a child node by interned block id
+    /** @param blockId Block id of the child node, see Profiler::InternBlockName.
+        @return Child node or 0 if the node was not child */
+    ProfilerNodeTree* GetChild(u32 blockId)
+    {
+        assert (blockId != blockId_);
+        for(NodeList::iterator it = children_.begin() ; it != children_.end() ; ++it)
+            if ((*it)->blockId_ == blockId)
+                return (*it).get();
+        return 0;
+    }
+
     /// Returns the name of this node
     const std::string &Name() const { return name_; }
 
+    /// Returns the interned block id of this node, or 0 for the thread root blocks.
+    u32 BlockId() const { return blockId_; }
+
     /// Returns the parent of this node
     ProfilerNodeTree *Parent() { return parent_; }
 
@@ -184,6 +204,8 @@ private:
     Profiler *owner_;
     /// Name of this node
     const std::string name_;
+    /// Interned block id of this node
+    const u32 blockId_;
 
     /// helper counter for recursion
     int recursion_;
@@ -194,9 +216,9 @@ typedef boost::shared_ptr<ProfilerNodeTree> ProfilerNodeTreePtr;
 class ProfilerNode : public ProfilerNodeTree
 {
 public:
-    /// constructor that takes a name for the node
-    explicit ProfilerNode(const std::string &name) : 
-    ProfilerNodeTree(name),
+    /// constructor that takes a name and the interned block id for the node
+    ProfilerNode(const std::string &name, u32 blockId) : 
+    ProfilerNodeTree(name, blockId),
         num_called_total_(0),
         num_called_(0),
         num_called_current_(0),
@@ -282,6 +304,68 @@ namespace
     void EmptyDeletor(ProfilerNodeTree *node) { }
 }
 
+/// A raw begin or end timestamp of a profiling block, recorded when the profiler is capturing.
+struct ProfilerEvent
+{
+    enum Type
+    {
+        BlockBegin,
+        BlockEnd
+    };
+
+    /// Value of GetCurrentClockTime() at the event.
+    s64 time;
+    /// Interned id of the block.
+    u32 blockId;
+    /// Either BlockBegin or BlockEnd.
+    u32 type;
+};
+
+/// Profiling state of a single thread.
+/** Only the owning thread writes to its data, so starting and ending profiling blocks takes no locks.
+    The data is owned by the Profiler and stays alive until the Profiler is destroyed. */
+struct ProfilerThreadData
+{
+    ProfilerThreadData(const std::string &rootName, u32 index) :
+        root(new ProfilerNodeTree(rootName)),
+        current(0),
+        threadIndex(index),
+        events(0),
+        numEventsWritten(0),
+        eventBufferFull(false)
+    {
+    }
+
+    ~ProfilerThreadData() { delete[] events; }
+
+    /// Appends an event to the capture ring buffer, overwriting the oldest event when the buffer is full.
+    void RecordEvent(u32 blockId, ProfilerEvent::Type type, s64 time)
+    {
+        ProfilerEvent &e = events[numEventsWritten & (cCaptureBufferSize - 1)];
+        e.time = time;
+        e.blockId = blockId;
+        e.type = type;
+        if (((++numEventsWritten) & (cCaptureBufferSize - 1)) == 0)
+            eventBufferFull = true;
+    }
+
+    /// Number of events in the capture ring buffer of each thread. Must be a power of two.
+    static const u32 cCaptureBufferSize = 1 << 18;
+
+    /// Root profiling block of this thread.
+    ProfilerNodeTreePtr root;
+    /// The current topmost profiling block in the stack of this thread.
+    ProfilerNodeTree *current;
+    /// Sequential index of this thread in the order the threads started profiling. Used as the thread id in exported captures.
+    u32 threadIndex;
+    /// Capture ring buffer of cCaptureBufferSize events. Allocated by the owning thread when it first records an event.
+    ProfilerEvent * volatile events;
+    /// Total number of events written. The next write position is numEventsWritten modulo cCaptureBufferSize.
+    volatile u32 numEventsWritten;
+    /// True when the ring buffer has wrapped around at least once.
+    volatile bool eventBufferFull;
+};
+
 /// Provides profiling access for scripts.
 /** @cond PRIVATE */
 class ProfilerQObj : public QObject
@@ -291,6 +375,16 @@ class ProfilerQObj : public QObject
 public slots:
     void BeginBlock(const QString &name);
     void EndBlock();
+
+    /// Starts recording the raw begin and end timestamps of all profiling blocks, keeping the last @c numFrames frames.
+    void StartCapture(int numFrames);
+    /// Stops recording. The recorded frames remain available for ExportCapture.
+    void StopCapture();
+    /// Writes the recorded frames to a file in the Chrome trace event format (chrome://tracing, Perfetto, speedscope).
+    void ExportCapture(const QString &filename);
+
+    /// Measures the core math operations with the scalar and the SSE code paths, and prints the timings.
+    void BenchmarkMath(int iterations);
 };
 /** @endcond */
 
@@ -311,17 +405,37 @@ public slots:
     thread specific profiling data. 
 
     Locks are not used when dealing with profiling blocks, as they might skew
-    the data too much.
+    the data too much. The only lock a thread takes is when it starts profiling for the first time.
 
-    \todo A memory leak around here somewhere of several kilobytes. */
+    Capturing: StartCapture() makes each thread record the raw begin and end timestamps of its blocks
+    into a fixed-size per-thread ring buffer, and the main thread record the start of each frame with MarkFrame().
+    ExportCapture() writes the blocks of the last captured frames to a Chrome trace event JSON file for offline analysis. */
 class Profiler
 {
 public:
-    Profiler() :current_node_(0), root_("Root"), thread_specific_root_(0)
+    Profiler();
+
+    ~Profiler();
+
+    /// Returns a process-wide unique id for a profiling block name, allocating a new id if the name has not been seen before.
+    /** The PROFILE macro calls this only once per call site. Takes a lock, so don't call this every frame. Threadsafe. */
+    static u32 InternBlockName(const std::string &name);
+
+    /// Returns the block id cached at a PROFILE call site, interning the name on the first call.
+    /** cachedId is 0 until the name has been interned, as 0 is never the id of a named block. Threadsafe. */
+    static u32 BlockId(volatile u32 &cachedId, const char *name)
     {
+        // The id is a plain number and the names are only read under the registry lock, so an aligned
+        // volatile read that sees either 0 or the final id is enough here.
+        u32 id = cachedId;
+        return id != 0 ? id : InternBlockId(cachedId, name);
     }
 
-    ~Profiler();
+    /// Interns the name and stores its id to cachedId, unless another thread did so first. Called by BlockId. Threadsafe.
+    static u32 InternBlockId(volatile u32 &cachedId, const char *name);
+
+    /// Returns the name of an interned block id, or an empty string if the id is unknown. Threadsafe.
+    static std::string BlockName(u32 blockId);
 
     /// Start a profiling block.
     /** Normally you don't use this directly, instead you use the macro PROFILE.
@@ -332,12 +446,18 @@ public:
         recursion support.
 
         Re-entrant. */
-    void StartBlock(const std::string &name);
+    void StartBlock(u32 blockId);
 
     /// End the profiling block
     /** Each StartBlock() should have a matching EndBlock(). Recursion is supported.
         Re-entrant. */
-    void EndBlock(const std::string &name);
+    void EndBlock(u32 blockId);
+
+    /// Start a profiling block by name. Interns the name on each call, prefer StartBlock(u32).
+    void StartBlock(const std::string &name) { StartBlock(InternBlockName(name)); }
+
+    /// End a profiling block by name.
+    void EndBlock(const std::string &name) { EndBlock(InternBlockName(name)); }
 
     /// Reset profiling data for the current thread. Don't call directly, use RESETPROFILER macro instead.
     void ThreadedReset();
@@ -370,25 +490,60 @@ public:
 
     void Reset();
 
+    /// Starts recording raw block timestamps of all threads.
+    /** @param numFrames Number of most recent frames ExportCapture() writes out. The amount of data kept per thread is
+            also bounded by ProfilerThreadData::cCaptureBufferSize events. */
+    void StartCapture(int numFrames);
+
+    /// Stops recording raw block timestamps. The data recorded so far is kept.
+    void StopCapture();
+
+    /// Returns whether the raw block timestamps are being recorded.
+    bool IsCapturing() const { return capturing_; }
+
+    /// Marks the start of a new frame in the capture. Called by the Framework at the start of each main loop frame.
+    void MarkFrame();
+
+    /// Writes the blocks of the captured frames to a file in the Chrome trace event JSON format.
+    /** Should be called from the main thread. Blocks that other threads are recording while the export runs may be left out.
+        @return True if the file was written. */
+    bool ExportCapture(const QString &filename);
+
 private:
+    /// Returns the profiling data of the calling thread, creating it if the thread has not profiled before.
+    ProfilerThreadData *GetOrCreateThreadData()
+    {
+        ProfilerThreadData *data = threadData_.get();
+        return data ? data : CreateThreadData();
+    }
+
+    ProfilerThreadData *CreateThreadData();
+
     /// The single global root node object.
     /// This is a dummy root node that doesn't track any  timing statistics, but just contains
     /// all the root blocks of each thread as its children.
     /// This root_ node doesn't own any of the memory of any of its children, those are owned 
-    /// and freed by each thread separately Namely, freeing all instances inside the 
-    /// thread_specific_root_ will cause all blocks to be freed.
+    /// by the ProfilerThreadData of each thread.
     ProfilerNodeTree root_;
 
-    /// Contains the root profile block for each thread.
-    ProfilerNodeTree *thread_specific_root_;
-    /// Points to the current topmost profile block in the stack for each thread.
-    ProfilerNodeTree *current_node_;
+    /// Profiling data of the calling thread. Doesn't own the data, see threads_.
+    boost::thread_specific_ptr<ProfilerThreadData> threadData_;
+
+    /// Profiling data of all threads that have profiled, owned by this Profiler. Guarded by mutex_.
+    std::vector<ProfilerThreadData*> threads_;
 
     /// container for all the root profile nodes for each thread.
     std::list<ProfilerNodeTree*> thread_root_nodes_;
 
     boost::mutex mutex_;
 
+    /// If true, threads record raw begin and end timestamps of their blocks.
+    volatile bool capturing_;
+    /// Ring buffer of the start times of the most recent captured frames. Only accessed from the main thread.
+    std::vector<s64> frameStartTimes_;
+    /// Total number of frames marked since the capture was started.
+    u32 numFramesCaptured_;
+
     friend class ProfilerQObj;
 };
 
@@ -396,10 +551,10 @@ private:
 class ProfilerSection
 {
 public:
-    explicit ProfilerSection(const std::string &name) : name_(name), destroyed_(false)
+    explicit ProfilerSection(u32 blockId) : blockId_(blockId), destroyed_(false)
     {
         assert(Framework::Instance() && "Cannot get Framework instance! Did you forget to call Framework::SetInstance(fw); in your TundraPluginMain?");
-        GetProfiler()->StartBlock(name);
+        GetProfiler()->StartBlock(blockId);
     }
 
     ~ProfilerSection()
@@ -415,7 +570,7 @@ public:
     {
         assert (Framework::Instance() && "Trying to profile before profiler initialized.");
 
-        GetProfiler()->EndBlock(name_);
+        GetProfiler()->EndBlock(blockId_);
         destroyed_ = true;
     }
     static Profiler *GetProfiler()
@@ -432,8 +587,8 @@ private:
     ProfilerSection(); // N/I
     ProfilerSection(const ProfilerSection &rhs);
 
-    /// Name of this profiling section
-    const std::string name_;
+    /// Interned block id of this profiling section
+    const u32 blockId_;
 
     /// True if this section has explicitly been destroyed before it run out of scope
     bool destroyed_;
@@ -0,0 +1,308 @@
+/** @file BatchOps.cpp
+	@brief Kernels that process whole arrays of points, boxes and triangles stored as structure of arrays. */
+#include <limits>
+
+#include "Math/BatchOps.h"
+#include "Math/MathFunc.h"
+#include "Math/float3x4.h"
+#include "Math/SSEMath.h"
+#include "Geometry/Frustum.h"
+#include "Geometry/Plane.h"
+#include "Geometry/Ray.h"
+
+MATH_BEGIN_NAMESPACE
+
+void BatchTransformPos(const float3x4 &m, const float *x, const float *y, const float *z, float *outX, float *outY, float *outZ, int count)
+{
+	int i = 0;
+#ifdef MATH_SSE
+	const __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]), m03 = _mm_set1_ps(m[0][3]);
+	const __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]), m13 = _mm_set1_ps(m[1][3]);
+	const __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]), m23 = _mm_set1_ps(m[2][3]);
+	for(; i + 4 <= count; i += 4)
+	{
+		const __m128 X = _mm_loadu_ps(x + i);
+		const __m128 Y = _mm_loadu_ps(y + i);
+		const __m128 Z = _mm_loadu_ps(z + i);
+		_mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, X), _mm_mul_ps(m01, Y)), _mm_add_ps(_mm_mul_ps(m02, Z), m03)));
+		_mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, X), _mm_mul_ps(m11, Y)), _mm_add_ps(_mm_mul_ps(m12, Z), m13)));
+		_mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, X), _mm_mul_ps(m21, Y)), _mm_add_ps(_mm_mul_ps(m22, Z), m23)));
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		const float X = x[i], Y = y[i], Z = z[i];
+		outX[i] = m[0][0] * X + m[0][1] * Y + m[0][2] * Z + m[0][3];
+		outY[i] = m[1][0] * X + m[1][1] * Y + m[1][2] * Z + m[1][3];
+		outZ[i] = m[2][0] * X + m[2][1] * Y + m[2][2] * Z + m[2][3];
+	}
+}
+
+void BatchTransformDir(const float3x4 &m, const float *x, const float *y, const float *z, float *outX, float *outY, float *outZ, int count)
+{
+	int i = 0;
+#ifdef MATH_SSE
+	const __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+	const __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+	const __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]);
+	for(; i + 4 <= count; i += 4)
+	{
+		const __m128 X = _mm_loadu_ps(x + i);
+		const __m128 Y = _mm_loadu_ps(y + i);
+		const __m128 Z = _mm_loadu_ps(z + i);
+		_mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, X), _mm_mul_ps(m01, Y)), _mm_mul_ps(m02, Z)));
+		_mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, X), _mm_mul_ps(m11, Y)), _mm_mul_ps(m12, Z)));
+		_mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, X), _mm_mul_ps(m21, Y)), _mm_mul_ps(m22, Z)));
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		const float X = x[i], Y = y[i], Z = z[i];
+		outX[i] = m[0][0] * X + m[0][1] * Y + m[0][2] * Z;
+		outY[i] = m[1][0] * X + m[1][1] * Y + m[1][2] * Z;
+		outZ[i] = m[2][0] * X + m[2][1] * Y + m[2][2] * Z;
+	}
+}
+
+AABB BatchMinimalEnclosingAABB(const float *x, const float *y, const float *z, int count)
+{
+	AABB aabb;
+	aabb.SetNegativeInfinity();
+	int i = 0;
+#ifdef MATH_SSE
+	if (count >= 4)
+	{
+		__m128 minX = _mm_loadu_ps(x), minY = _mm_loadu_ps(y), minZ = _mm_loadu_ps(z);
+		__m128 maxX = minX, maxY = minY, maxZ = minZ;
+		for(i = 4; i + 4 <= count; i += 4)
+		{
+			const __m128 X = _mm_loadu_ps(x + i);
+			const __m128 Y = _mm_loadu_ps(y + i);
+			const __m128 Z = _mm_loadu_ps(z + i);
+			minX = _mm_min_ps(minX, X); maxX = _mm_max_ps(maxX, X);
+			minY = _mm_min_ps(minY, Y); maxY = _mm_max_ps(maxY, Y);
+			minZ = _mm_min_ps(minZ, Z); maxZ = _mm_max_ps(maxZ, Z);
+		}
+		float lanes[6][4];
+		_mm_storeu_ps(lanes[0], minX); _mm_storeu_ps(lanes[1], minY); _mm_storeu_ps(lanes[2], minZ);
+		_mm_storeu_ps(lanes[3], maxX); _mm_storeu_ps(lanes[4], maxY); _mm_storeu_ps(lanes[5], maxZ);
+		for(int j = 0; j < 4; ++j)
+		{
+			aabb.minPoint.x = Min(aabb.minPoint.x, lanes[0][j]);
+			aabb.minPoint.y = Min(aabb.minPoint.y, lanes[1][j]);
+			aabb.minPoint.z = Min(aabb.minPoint.z, lanes[2][j]);
+			aabb.maxPoint.x = Max(aabb.maxPoint.x, lanes[3][j]);
+			aabb.maxPoint.y = Max(aabb.maxPoint.y, lanes[4][j]);
+			aabb.maxPoint.z = Max(aabb.maxPoint.z, lanes[5][j]);
+		}
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		aabb.minPoint.x = Min(aabb.minPoint.x, x[i]);
+		aabb.minPoint.y = Min(aabb.minPoint.y, y[i]);
+		aabb.minPoint.z = Min(aabb.minPoint.z, z[i]);
+		aabb.maxPoint.x = Max(aabb.maxPoint.x, x[i]);
+		aabb.maxPoint.y = Max(aabb.maxPoint.y, y[i]);
+		aabb.maxPoint.z = Max(aabb.maxPoint.z, z[i]);
+	}
+	return aabb;
+}
+
+int BatchCullAABBs(const Frustum &frustum, const float *minX, const float *minY, const float *minZ,
+	const float *maxX, const float *maxY, const float *maxZ, int count, u8 *outVisible)
+{
+	// The normals of the frustum planes point outwards. A box is outside a plane if its corner furthest along the
+	// negative normal is outside, and that corner takes its components from the minimum or the maximum point depending
+	// only on the signs of the normal, so the arrays to read can be chosen per plane instead of per box.
+	Plane planes[6];
+	frustum.GetPlanes(planes);
+	const float *cornerX[6], *cornerY[6], *cornerZ[6];
+	for(int p = 0; p < 6; ++p)
+	{
+		cornerX[p] = planes[p].normal.x >= 0.f ? minX : maxX;
+		cornerY[p] = planes[p].normal.y >= 0.f ? minY : maxY;
+		cornerZ[p] = planes[p].normal.z >= 0.f ? minZ : maxZ;
+	}
+
+	int numVisible = 0;
+	int i = 0;
+#ifdef MATH_SSE
+	__m128 nx[6], ny[6], nz[6], d[6];
+	for(int p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm_set1_ps(planes[p].normal.x);
+		ny[p] = _mm_set1_ps(planes[p].normal.y);
+		nz[p] = _mm_set1_ps(planes[p].normal.z);
+		d[p] = _mm_set1_ps(planes[p].d);
+	}
+	for(; i + 4 <= count; i += 4)
+	{
+		__m128 outside = _mm_setzero_ps();
+		for(int p = 0; p < 6; ++p)
+		{
+			const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(cornerX[p] + i)), _mm_mul_ps(ny[p], _mm_loadu_ps(cornerY[p] + i))),
+			                               _mm_mul_ps(nz[p], _mm_loadu_ps(cornerZ[p] + i)));
+			outside = _mm_or_ps(outside, _mm_cmpgt_ps(dist, d[p]));
+		}
+		const int outsideBits = _mm_movemask_ps(outside);
+		for(int j = 0; j < 4; ++j)
+		{
+			const u8 visible = (outsideBits & (1 << j)) ? 0 : 1;
+			outVisible[i + j] = visible;
+			numVisible += visible;
+		}
+	}
+#endif
+	for(; i < count; ++i)
+	{
+		u8 visible = 1;
+		for(int p = 0; p < 6; ++p)
+			if (planes[p].normal.x * cornerX[p][i] + planes[p].normal.y * cornerY[p][i] + planes[p].normal.z * cornerZ[p][i] > planes[p].d)
+			{
+				visible = 0;
+				break;
+			}
+		outVisible[i] = visible;
+		numVisible += visible;
+	}
+	return numVisible;
+}
+
+void TriangleArray::Clear()
+{
+	v0x.clear(); v0y.clear(); v0z.clear();
+	e1x.clear(); e1y.clear(); e1z.clear();
+	e2x.clear(); e2y.clear(); e2z.clear();
+}
+
+void TriangleArray::Reserve(int count)
+{
+	v0x.reserve(count); v0y.reserve(count); v0z.reserve(count);
+	e1x.reserve(count); e1y.reserve(count); e1z.reserve(count);
+	e2x.reserve(count); e2y.reserve(count); e2z.reserve(count);
+}
+
+void TriangleArray::Add(const float3 &a, const float3 &b, const float3 &c)
+{
+	v0x.push_back(a.x); v0y.push_back(a.y); v0z.push_back(a.z);
+	e1x.push_back(b.x - a.x); e1y.push_back(b.y - a.y); e1z.push_back(b.z - a.z);
+	e2x.push_back(c.x - a.x); e2y.push_back(c.y - a.y); e2z.push_back(c.z - a.z);
+}
+
+float3 TriangleArray::Vertex(int triangle, int vertex) const
+{
+	float3 v(v0x[triangle], v0y[triangle], v0z[triangle]);
+	if (vertex == 1)
+		v += float3(e1x[triangle], e1y[triangle], e1z[triangle]);
+	else if (vertex == 2)
+		v += float3(e2x[triangle], e2y[triangle], e2z[triangle]);
+	return v;
+}
+
+int BatchRaycastTriangles(const Ray &ray, const TriangleArray &triangles, int first, int count, bool cullBackFaces,
+	float maxDistance, float &outDistance, float &outU, float &outV)
+{
+	if (count <= 0)
+		return -1;
+	const float epsilon = std::numeric_limits<float>::epsilon();
+	const float dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	const float ox = ray.pos.x, oy = ray.pos.y, oz = ray.pos.z;
+	const float *v0x = &triangles.v0x[0], *v0y = &triangles.v0y[0], *v0z = &triangles.v0z[0];
+	const float *e1x = &triangles.e1x[0], *e1y = &triangles.e1y[0], *e1z = &triangles.e1z[0];
+	const float *e2x = &triangles.e2x[0], *e2y = &triangles.e2y[0], *e2z = &triangles.e2z[0];
+
+	float closest = maxDistance;
+	int closestIndex = -1;
+	int i = first;
+	const int end = first + count;
+#ifdef MATH_SSE
+	const __m128 DX = _mm_set1_ps(dx), DY = _mm_set1_ps(dy), DZ = _mm_set1_ps(dz);
+	const __m128 OX = _mm_set1_ps(ox), OY = _mm_set1_ps(oy), OZ = _mm_set1_ps(oz);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 eps = _mm_set1_ps(epsilon);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	for(; i + 4 <= end; i += 4)
+	{
+		const __m128 E1X = _mm_loadu_ps(e1x + i), E1Y = _mm_loadu_ps(e1y + i), E1Z = _mm_loadu_ps(e1z + i);
+		const __m128 E2X = _mm_loadu_ps(e2x + i), E2Y = _mm_loadu_ps(e2y + i), E2Z = _mm_loadu_ps(e2z + i);
+
+		// p = dir x e2, det = e1 . p
+		const __m128 PX = _mm_sub_ps(_mm_mul_ps(DY, E2Z), _mm_mul_ps(DZ, E2Y));
+		const __m128 PY = _mm_sub_ps(_mm_mul_ps(DZ, E2X), _mm_mul_ps(DX, E2Z));
+		const __m128 PZ = _mm_sub_ps(_mm_mul_ps(DX, E2Y), _mm_mul_ps(DY, E2X));
+		const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(E1X, PX), _mm_mul_ps(E1Y, PY)), _mm_mul_ps(E1Z, PZ));
+		__m128 mask = _mm_cmpgt_ps(cullBackFaces ? det : _mm_and_ps(det, absMask), eps);
+		if (!_mm_movemask_ps(mask))
+			continue;
+		// The lanes with a zero determinant divide to inf or NaN, but they are already masked out.
+		const __m128 invDet = _mm_div_ps(one, det);
+
+		// s = origin - v0, u = (s . p) / det
+		const __m128 SX = _mm_sub_ps(OX, _mm_loadu_ps(v0x + i));
+		const __m128 SY = _mm_sub_ps(OY, _mm_loadu_ps(v0y + i));
+		const __m128 SZ = _mm_sub_ps(OZ, _mm_loadu_ps(v0z + i));
+		const __m128 U = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(SX, PX), _mm_mul_ps(SY, PY)), _mm_mul_ps(SZ, PZ)), invDet);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(U, zero), _mm_cmple_ps(U, one)));
+
+		// q = s x e1, v = (dir . q) / det, t = (e2 . q) / det
+		const __m128 QX = _mm_sub_ps(_mm_mul_ps(SY, E1Z), _mm_mul_ps(SZ, E1Y));
+		const __m128 QY = _mm_sub_ps(_mm_mul_ps(SZ, E1X), _mm_mul_ps(SX, E1Z));
+		const __m128 QZ = _mm_sub_ps(_mm_mul_ps(SX, E1Y), _mm_mul_ps(SY, E1X));
+		const __m128 V = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(DX, QX), _mm_mul_ps(DY, QY)), _mm_mul_ps(DZ, QZ)), invDet);
+		const __m128 T = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(E2X, QX), _mm_mul_ps(E2Y, QY)), _mm_mul_ps(E2Z, QZ)), invDet);
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(V, zero), _mm_cmple_ps(_mm_add_ps(U, V), one)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(T, zero), _mm_cmplt_ps(T, _mm_set1_ps(closest))));
+
+		const int hitBits = _mm_movemask_ps(mask);
+		if (!hitBits)
+			continue;
+		float t[4], u[4], v[4];
+		_mm_storeu_ps(t, T);
+		_mm_storeu_ps(u, U);
+		_mm_storeu_ps(v, V);
+		for(int j = 0; j < 4; ++j)
+			if ((hitBits & (1 << j)) && t[j] < closest)
+			{
+				closest = t[j];
+				closestIndex = i + j;
+				outU = u[j];
+				outV = v[j];
+			}
+	}
+#endif
+	for(; i < end; ++i)
+	{
+		const float px = dy * e2z[i] - dz * e2y[i];
+		const float py = dz * e2x[i] - dx * e2z[i];
+		const float pz = dx * e2y[i] - dy * e2x[i];
+		const float det = e1x[i] * px + e1y[i] * py + e1z[i] * pz;
+		if ((cullBackFaces ? det : Abs(det)) <= epsilon)
+			continue;
+		const float invDet = 1.f / det;
+		const float sx = ox - v0x[i], sy = oy - v0y[i], sz = oz - v0z[i];
+		const float u = (sx * px + sy * py + sz * pz) * invDet;
+		if (u < 0.f || u > 1.f)
+			continue;
+		const float qx = sy * e1z[i] - sz * e1y[i];
+		const float qy = sz * e1x[i] - sx * e1z[i];
+		const float qz = sx * e1y[i] - sy * e1x[i];
+		const float v = (dx * qx + dy * qy + dz * qz) * invDet;
+		if (v < 0.f || u + v > 1.f)
+			continue;
+		const float t = (e2x[i] * qx + e2y[i] * qy + e2z[i] * qz) * invDet;
+		if (t < 0.f || t >= closest)
+			continue;
+		closest = t;
+		closestIndex = i;
+		outU = u;
+		outV = v;
+	}
+
+	if (closestIndex >= 0)
+		outDistance = closest;
+	return closestIndex;
+}
+
+MATH_END_NAMESPACE
@@ -0,0 +1,70 @@
+/** @file BatchOps.h
+	@brief Kernels that process whole arrays of points, boxes and triangles stored as structure of arrays.
+
+	The data is stored with each component in its own array (x[], y[], z[]) instead of an array of float3, so that
+	the kernels can process four elements per instruction. When built with MATH_SSE the kernels use SSE, otherwise
+	their loops are plain scalar code. The arrays need no alignment. */
+#pragma once
+
+#include <vector>
+
+#include "Types.h"
+#include "Math/MathFwd.h"
+#include "Math/float3.h"
+#include "Geometry/AABB.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// Transforms count points by m, reading them from the x, y and z arrays and writing them to the out arrays. The out arrays may alias the input arrays.
+void BatchTransformPos(const float3x4 &m, const float *x, const float *y, const float *z, float *outX, float *outY, float *outZ, int count);
+
+/// Transforms count directions by m, ignoring its translation. The out arrays may alias the input arrays.
+void BatchTransformDir(const float3x4 &m, const float *x, const float *y, const float *z, float *outX, float *outY, float *outZ, int count);
+
+/// Returns the smallest AABB that contains the count points of the x, y and z arrays.
+/** If count is zero, returns an AABB with its minimum at +inf and maximum at -inf, see AABB::SetNegativeInfinity(). */
+AABB BatchMinimalEnclosingAABB(const float *x, const float *y, const float *z, int count);
+
+/// Tests count AABBs against the frustum and writes 1 to outVisible for each that may intersect it, and 0 for each that is outside.
+/** The boxes are given by the arrays of the components of their minimum and maximum points. The test is conservative: a box
+	is culled only when it is entirely outside one of the six planes of the frustum, so a few boxes near the corners of the
+	frustum pass although they are outside.
+	@return The number of boxes that may intersect the frustum. */
+int BatchCullAABBs(const Frustum &frustum, const float *minX, const float *minY, const float *minZ,
+	const float *maxX, const float *maxY, const float *maxZ, int count, u8 *outVisible);
+
+/// Triangles stored as structure of arrays: the first vertex and the two edges from it, each component in its own array.
+/** The edge form is what the ray intersection test needs, so it is computed once when the triangle is added. */
+class TriangleArray
+{
+public:
+	/// Returns the number of triangles.
+	int Size() const { return (int)v0x.size(); }
+
+	void Clear();
+
+	void Reserve(int count);
+
+	/// Appends the triangle (a, b, c).
+	void Add(const float3 &a, const float3 &b, const float3 &c);
+
+	/// Returns vertex 0, 1 or 2 of the given triangle.
+	float3 Vertex(int triangle, int vertex) const;
+
+	std::vector<float> v0x, v0y, v0z; ///< The first vertices.
+	std::vector<float> e1x, e1y, e1z; ///< The edges from the first vertex to the second.
+	std::vector<float> e2x, e2y, e2z; ///< The edges from the first vertex to the third.
+};
+
+/// Finds the closest of the triangles [first, first + count) of the array hit by the ray, using the Moller-Trumbore test.
+/** @param cullBackFaces If true, only triangles whose vertices are counterclockwise as seen from the ray are hit.
+	@param maxDistance Only hits closer than this along the ray are considered. The ray direction need not be normalized,
+		the distances are in units of its length.
+	@param outDistance [out] The distance of the closest hit along the ray.
+	@param outU [out] The barycentric coordinate of the hit towards the second vertex of the triangle.
+	@param outV [out] The barycentric coordinate of the hit towards the third vertex of the triangle.
+	@return The index of the hit triangle, or -1 if nothing was hit, in which case the out parameters are not changed. */
+int BatchRaycastTriangles(const Ray &ray, const TriangleArray &triangles, int first, int count, bool cullBackFaces,
+	float maxDistance, float &outDistance, float &outU, float &outV);
+
+MATH_END_NAMESPACE
@@ -25,6 +25,8 @@
 #include "Algorithm/Random/LCG.h"
 #include "assume.h"
 #include "Math/MathFunc.h"
+#include "Math/ScalarMath.h"
+#include "Math/SSEMath.h"
 
 MATH_BEGIN_NAMESPACE
 
@@ -226,31 +228,13 @@ Quat Quat::Slerp(const Quat &q2, float t) const
 	assume(IsNormalized());
 	assume(q2.IsNormalized());
 
-	float angle = this->Dot(q2);
-	float sign = 1.f; // Multiply by a sign of +/-1 to guarantee we rotate the shorter arc.
-	if (angle < 0.f)
-	{
-		angle = -angle;
-		sign = -1.f;
-	}
-
-	float a;
-	float b;
-	if (angle <= 0.97f) // perform spherical linear interpolation.
-	{
-		angle = acos(angle); // After this, angle is in the range pi/2 -> 0 as the original angle variable ranged from 0 -> 1.
-
-		float c = 1.f / sin(angle);
-		a = sin((1.f - t) * angle) * c;
-		b = sin(angle * t) * c;
-	}
-	else // If angle is close to taking the denominator to zero, resort to linear interpolation (and normalization).
-	{
-		a = 1.f - t;
-		b = t;
-	}
-	
-	return (*this * (a * sign) + q2 * b).Normalized();
+	Quat r;
+#ifdef MATH_SSE
+	quat_slerp_sse(r.ptr(), ptr(), q2.ptr(), t);
+#else
+	quat_slerp_scalar(r.ptr(), ptr(), q2.ptr(), t);
+#endif
+	return r;
 }
 
 Quat Quat::Slerp(const Quat &a, const Quat &b, float t)
@@ -589,10 +573,13 @@ Quat Quat::operator /(float scalar) const
 
 Quat Quat::operator *(const Quat &r) const
 {
-	return Quat(w*r.x + x*r.w + y*r.z - z*r.y,
-	            w*r.y - x*r.z + y*r.w + z*r.x,
-	            w*r.z + x*r.y - y*r.x + z*r.w,
-	            w*r.w - x*r.x - y*r.y - z*r.z);
+	Quat q;
+#ifdef MATH_SSE
+	quat_mul_sse(q.ptr(), ptr(), r.ptr());
+#else
+	quat_mul_scalar(q.ptr(), ptr(), r.ptr());
+#endif
+	return q;
 }
 
 Quat Quat::operator /(const Quat &rhs) const
@@ -0,0 +1,337 @@
+/** @file SSEMath.h
+	@brief SSE implementations of the core matrix and quaternion operations.
+
+	The SSE code paths are selected at build time: define MATH_SSE to use SSE2, and MATH_SSE41 to also use the SSE4.1
+	dot product instruction. Without them, the math types use the scalar kernels of ScalarMath.h, which are also
+	the reference the SSE kernels are measured and verified against, see Framework/MathBenchmark.h.
+
+	All the kernels operate on the row-major float arrays of float4x4, float3x4 and Quat, which have no alignment
+	guarantees, so the data is loaded and stored unaligned. Note that the first three rows of a float4x4 have the same
+	layout as a float3x4. */
+#pragma once
+
+#if defined(MATH_SSE41) && !defined(MATH_SSE)
+#define MATH_SSE
+#endif
+
+#ifdef MATH_SSE
+
+#if !defined(__SSE2__) && !defined(_M_X64) && !(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#error "MATH_SSE requires a compiler targeting SSE2. Enable it with -msse2 or /arch:SSE2."
+#endif
+
+#include <emmintrin.h>
+#ifdef MATH_SSE41
+#include <smmintrin.h>
+#endif
+
+#include <math.h>
+
+#include "Math/MathNamespace.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// Builds the immediate operand of _mm_shuffle_ps that picks the lanes x, y, z and w.
+#define MATH_SHUFFLE(x, y, z, w) (((w) << 6) | ((z) << 4) | ((y) << 2) | (x))
+
+/// Returns a vector with all lanes set to lane i of v.
+#define MATH_BROADCAST(v, i) _mm_shuffle_ps((v), (v), MATH_SHUFFLE(i, i, i, i))
+
+/// Returns the sum of the lanes of v in every lane.
+inline __m128 sum_xyzw_ps(__m128 v)
+{
+	__m128 s = _mm_add_ps(v, _mm_shuffle_ps(v, v, MATH_SHUFFLE(1, 0, 3, 2))); // (x+y, y+x, z+w, w+z)
+	return _mm_add_ps(s, _mm_shuffle_ps(s, s, MATH_SHUFFLE(2, 3, 0, 1)));
+}
+
+/// Returns the four-component dot product of a and b in every lane.
+inline __m128 dot4_ps(__m128 a, __m128 b)
+{
+#ifdef MATH_SSE41
+	return _mm_dp_ps(a, b, 0xFF);
+#else
+	return sum_xyzw_ps(_mm_mul_ps(a, b));
+#endif
+}
+
+/// Returns the product of the lanes of v in every lane.
+inline __m128 mul_xyzw_ps(__m128 v)
+{
+	__m128 p = _mm_mul_ps(v, _mm_shuffle_ps(v, v, MATH_SHUFFLE(1, 0, 3, 2))); // (x*y, y*x, z*w, w*z)
+	return _mm_mul_ps(p, _mm_shuffle_ps(p, p, MATH_SHUFFLE(2, 3, 0, 1)));
+}
+
+/// Returns the singularity threshold of the squared determinant of the 4x4 matrix with the rows r0, r1, r2 and r3 in the lowest lane.
+/** The threshold is epsilon^2 times the smaller of the product of the squared lengths of the rows and that of the columns.
+	Both products bound det^2 (Hadamard's inequality), so the test det^2 <= threshold does not depend on the scale of the
+	matrix. The columns give the tighter bound for affine matrices with a large translation and a small scale. */
+inline __m128 singular_det_sq_threshold_ps(__m128 r0, __m128 r1, __m128 r2, __m128 r3, float epsilon)
+{
+	__m128 s0 = _mm_mul_ps(r0, r0);
+	__m128 s1 = _mm_mul_ps(r1, r1);
+	__m128 s2 = _mm_mul_ps(r2, r2);
+	__m128 s3 = _mm_mul_ps(r3, r3);
+	const __m128 columnsSq = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+	_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+	const __m128 rowsSq = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+	return _mm_mul_ss(_mm_set_ss(epsilon * epsilon), _mm_min_ss(mul_xyzw_ps(rowsSq), mul_xyzw_ps(columnsSq)));
+}
+
+/// Returns the cross product of the xyz parts of a and b. The w lane is a.w*b.w - a.w*b.w, which is zero for finite input.
+inline __m128 cross_ps(__m128 a, __m128 b)
+{
+	__m128 aYZX = _mm_shuffle_ps(a, a, MATH_SHUFFLE(1, 2, 0, 3));
+	__m128 bYZX = _mm_shuffle_ps(b, b, MATH_SHUFFLE(1, 2, 0, 3));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b)); // The cross product in the order (z, x, y).
+	return _mm_shuffle_ps(c, c, MATH_SHUFFLE(1, 2, 0, 3));
+}
+
+/// Returns the dot products of the rows r0, r1, r2 and r3 with v in the lanes x, y, z and w.
+/** Uses a transpose instead of four SSE4.1 dot products, which measured slower because of the latency of dpps. */
+inline __m128 mul_rows_vec4_ps(__m128 r0, __m128 r1, __m128 r2, __m128 r3, __m128 v)
+{
+	__m128 p0 = _mm_mul_ps(r0, v);
+	__m128 p1 = _mm_mul_ps(r1, v);
+	__m128 p2 = _mm_mul_ps(r2, v);
+	__m128 p3 = _mm_mul_ps(r3, v);
+	_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+	return _mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3));
+}
+
+/// Computes out = m1 * m2 for the row-major 4x4 matrices m1 and m2. out may alias m1 or m2.
+inline void mat4x4_mul_sse(float *out, const float *m1, const float *m2)
+{
+	const __m128 r0 = _mm_loadu_ps(m2);
+	const __m128 r1 = _mm_loadu_ps(m2 + 4);
+	const __m128 r2 = _mm_loadu_ps(m2 + 8);
+	const __m128 r3 = _mm_loadu_ps(m2 + 12);
+
+	__m128 out4[4];
+	for(int i = 0; i < 4; ++i)
+	{
+		// Row i of the product is the combination of the rows of m2 weighted by row i of m1.
+		const __m128 a = _mm_loadu_ps(m1 + 4*i);
+		out4[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(MATH_BROADCAST(a, 0), r0), _mm_mul_ps(MATH_BROADCAST(a, 1), r1)),
+		                     _mm_add_ps(_mm_mul_ps(MATH_BROADCAST(a, 2), r2), _mm_mul_ps(MATH_BROADCAST(a, 3), r3)));
+	}
+	for(int i = 0; i < 4; ++i)
+		_mm_storeu_ps(out + 4*i, out4[i]);
+}
+
+/// Computes out = m1 * m2 for the row-major 3x4 matrices m1 and m2, both with an implicit last row (0,0,0,1). out may alias m1 or m2.
+inline void mat3x4_mul_sse(float *out, const float *m1, const float *m2)
+{
+	const __m128 r0 = _mm_loadu_ps(m2);
+	const __m128 r1 = _mm_loadu_ps(m2 + 4);
+	const __m128 r2 = _mm_loadu_ps(m2 + 8);
+	const __m128 maskW = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+	__m128 out3[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		// The implicit last row of m2 adds the translation of row i of m1 to the w lane.
+		const __m128 a = _mm_loadu_ps(m1 + 4*i);
+		out3[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(MATH_BROADCAST(a, 0), r0), _mm_mul_ps(MATH_BROADCAST(a, 1), r1)),
+		                     _mm_add_ps(_mm_mul_ps(MATH_BROADCAST(a, 2), r2), _mm_and_ps(a, maskW)));
+	}
+	for(int i = 0; i < 3; ++i)
+		_mm_storeu_ps(out + 4*i, out3[i]);
+}
+
+/// Computes out = m * v for the row-major 4x4 matrix m and the 4-vector v. out may alias v.
+inline void mat4x4_mul_vec4_sse(float *out, const float *m, const float *v)
+{
+	__m128 r = mul_rows_vec4_ps(_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), _mm_loadu_ps(m + 12), _mm_loadu_ps(v));
+	_mm_storeu_ps(out, r);
+}
+
+/// Computes the first three components of m * (x,y,z,w) for the row-major 3x4 matrix m, and stores them to out.
+inline void mat3x4_transform_sse(float *out, const float *m, float x, float y, float z, float w)
+{
+	__m128 r = mul_rows_vec4_ps(_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), _mm_setzero_ps(), _mm_set_ps(w, z, y, x));
+	// Store only three floats, the destination is usually a float3.
+	_mm_storel_pi((__m64*)out, r);
+	_mm_store_ss(out + 2, _mm_movehl_ps(r, r));
+}
+
+/// Returns the 2x2 product a * b of the 2x2 matrices stored row-major in the lanes (_00, _01, _10, _11).
+inline __m128 mat2x2_mul_ps(__m128 a, __m128 b)
+{
+	return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, MATH_SHUFFLE(0, 3, 0, 3))),
+	                  _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(2, 1, 2, 1))));
+}
+
+/// Returns the 2x2 product adj(a) * b, where adj is the adjugate.
+inline __m128 mat2x2_adj_mul_ps(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(3, 3, 0, 0)), b),
+	                  _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(2, 3, 0, 1))));
+}
+
+/// Returns the 2x2 product a * adj(b), where adj is the adjugate.
+inline __m128 mat2x2_mul_adj_ps(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, MATH_SHUFFLE(3, 0, 3, 0))),
+	                  _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(2, 1, 2, 1))));
+}
+
+/// Inverts the row-major 4x4 matrix m in place.
+/** Computes the inverse blockwise from the four 2x2 submatrices and their adjugates.
+	@param epsilon The matrix is considered singular if |det| is at most epsilon times the product of the lengths of its rows
+		or of its columns, see singular_det_sq_threshold_ps.
+	@return False if the matrix is singular, in which case m is left unchanged. */
+inline bool mat4x4_inverse_sse(float *m, float epsilon = 1e-6f)
+{
+	const __m128 row0 = _mm_loadu_ps(m);
+	const __m128 row1 = _mm_loadu_ps(m + 4);
+	const __m128 row2 = _mm_loadu_ps(m + 8);
+	const __m128 row3 = _mm_loadu_ps(m + 12);
+
+	// The submatrices | A B |
+	//                 | C D |
+	const __m128 A = _mm_movelh_ps(row0, row1);
+	const __m128 B = _mm_movehl_ps(row1, row0);
+	const __m128 C = _mm_movelh_ps(row2, row3);
+	const __m128 D = _mm_movehl_ps(row3, row2);
+
+	// The determinants (|A|, |B|, |C|, |D|).
+	const __m128 detSub = _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(row0, row2, MATH_SHUFFLE(0, 2, 0, 2)), _mm_shuffle_ps(row1, row3, MATH_SHUFFLE(1, 3, 1, 3))),
+		_mm_mul_ps(_mm_shuffle_ps(row0, row2, MATH_SHUFFLE(1, 3, 1, 3)), _mm_shuffle_ps(row1, row3, MATH_SHUFFLE(0, 2, 0, 2))));
+	const __m128 detA = MATH_BROADCAST(detSub, 0);
+	const __m128 detB = MATH_BROADCAST(detSub, 1);
+	const __m128 detC = MATH_BROADCAST(detSub, 2);
+	const __m128 detD = MATH_BROADCAST(detSub, 3);
+
+	const __m128 D_C = mat2x2_adj_mul_ps(D, C);
+	const __m128 A_B = mat2x2_adj_mul_ps(A, B);
+
+	// The adjugates of the blocks of the inverse, scaled by |M|.
+	__m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), mat2x2_mul_ps(B, D_C));
+	__m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), mat2x2_mul_ps(C, A_B));
+	__m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), mat2x2_mul_adj_ps(D, A_B));
+	__m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), mat2x2_mul_adj_ps(A, D_C));
+
+	// |M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C)
+	const __m128 tr = sum_xyzw_ps(_mm_mul_ps(A_B, _mm_shuffle_ps(D_C, D_C, MATH_SHUFFLE(0, 2, 1, 3))));
+	const __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+
+	if (_mm_comile_ss(_mm_mul_ss(det, det), singular_det_sq_threshold_ps(row0, row1, row2, row3, epsilon)))
+		return false;
+
+	const __m128 rcpDet = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det);
+	X = _mm_mul_ps(X, rcpDet);
+	Y = _mm_mul_ps(Y, rcpDet);
+	Z = _mm_mul_ps(Z, rcpDet);
+	W = _mm_mul_ps(W, rcpDet);
+
+	// Undo the adjugates and interleave the blocks back to rows.
+	_mm_storeu_ps(m, _mm_shuffle_ps(X, Y, MATH_SHUFFLE(3, 1, 3, 1)));
+	_mm_storeu_ps(m + 4, _mm_shuffle_ps(X, Y, MATH_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(m + 8, _mm_shuffle_ps(Z, W, MATH_SHUFFLE(3, 1, 3, 1)));
+	_mm_storeu_ps(m + 12, _mm_shuffle_ps(Z, W, MATH_SHUFFLE(2, 0, 2, 0)));
+	return true;
+}
+
+/// Inverts the row-major 3x4 matrix m in place, treating it as an affine 4x4 matrix with the last row (0,0,0,1).
+/** The inverse of the linear part has the columns (r1 x r2, r2 x r0, r0 x r1) / det, where r0, r1 and r2 are its rows.
+	@param epsilon The matrix is considered singular if |det| of its linear part is at most epsilon times the product of the
+		lengths of the rows or of the columns of the linear part, see singular_det_sq_threshold_ps.
+	@return False if the matrix is singular, in which case m is left unchanged. */
+inline bool mat3x4_inverse_sse(float *m, float epsilon = 1e-6f)
+{
+	const __m128 row0 = _mm_loadu_ps(m);
+	const __m128 row1 = _mm_loadu_ps(m + 4);
+	const __m128 row2 = _mm_loadu_ps(m + 8);
+	const __m128 maskXYZ = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+
+	__m128 c0 = _mm_and_ps(cross_ps(row1, row2), maskXYZ);
+	__m128 c1 = _mm_and_ps(cross_ps(row2, row0), maskXYZ);
+	__m128 c2 = _mm_and_ps(cross_ps(row0, row1), maskXYZ);
+
+	const __m128 det = dot4_ps(row0, c0);
+	// The linear part extended with the row and column (0,0,0,1) has the same determinant.
+	const __m128 threshold = singular_det_sq_threshold_ps(_mm_and_ps(row0, maskXYZ), _mm_and_ps(row1, maskXYZ), _mm_and_ps(row2, maskXYZ),
+		_mm_set_ps(1.f, 0.f, 0.f, 0.f), epsilon);
+	if (_mm_comile_ss(_mm_mul_ss(det, det), threshold))
+		return false;
+
+	const __m128 rcpDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+	c0 = _mm_mul_ps(c0, rcpDet);
+	c1 = _mm_mul_ps(c1, rcpDet);
+	c2 = _mm_mul_ps(c2, rcpDet);
+
+	// The translation of the inverse is -inv(linear part) * t, a combination of the columns.
+	const __m128 t = _mm_set_ps(0.f, m[11], m[7], m[3]);
+	__m128 c3 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, MATH_BROADCAST(t, 0)), _mm_mul_ps(c1, MATH_BROADCAST(t, 1))), _mm_mul_ps(c2, MATH_BROADCAST(t, 2)));
+	c3 = _mm_sub_ps(_mm_setzero_ps(), c3);
+
+	// The columns transposed are the rows of the inverse.
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_mm_storeu_ps(m, c0);
+	_mm_storeu_ps(m + 4, c1);
+	_mm_storeu_ps(m + 8, c2);
+	return true;
+}
+
+/// Computes the quaternion product out = q1 * q2 of the quaternions stored as (x, y, z, w). out may alias q1 or q2.
+inline void quat_mul_sse(float *out, const float *q1, const float *q2)
+{
+	const __m128 a = _mm_loadu_ps(q1);
+	const __m128 b = _mm_loadu_ps(q2);
+	const __m128 signW = _mm_castsi128_ps(_mm_set_epi32(0x80000000, 0, 0, 0));
+	const __m128 signXYZW = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+	// (w*b.x, w*b.y, w*b.z, w*b.w)
+	__m128 r = _mm_mul_ps(MATH_BROADCAST(a, 3), b);
+	// (x*b.w, y*b.w, z*b.w, -x*b.x)
+	r = _mm_add_ps(r, _mm_xor_ps(signW, _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(0, 1, 2, 0)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(3, 3, 3, 0)))));
+	// (y*b.z, z*b.x, x*b.y, -y*b.y)
+	r = _mm_add_ps(r, _mm_xor_ps(signW, _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(1, 2, 0, 1)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(2, 0, 1, 1)))));
+	// -(z*b.y, x*b.z, y*b.x, z*b.z)
+	r = _mm_add_ps(r, _mm_xor_ps(signXYZW, _mm_mul_ps(_mm_shuffle_ps(a, a, MATH_SHUFFLE(2, 0, 1, 2)), _mm_shuffle_ps(b, b, MATH_SHUFFLE(1, 2, 0, 2)))));
+	_mm_storeu_ps(out, r);
+}
+
+/// Computes the spherical linear interpolation of the unit quaternions q1 and q2 stored as (x, y, z, w), along the shorter arc.
+/** Matches Quat::Slerp: falls back to normalized linear interpolation when the quaternions are nearly parallel. out may alias q1 or q2. */
+inline void quat_slerp_sse(float *out, const float *q1, const float *q2, float t)
+{
+	const __m128 a = _mm_loadu_ps(q1);
+	const __m128 b = _mm_loadu_ps(q2);
+
+	float angle;
+	_mm_store_ss(&angle, dot4_ps(a, b));
+	float sign = 1.f; // Multiply by a sign of +/-1 to guarantee we rotate the shorter arc.
+	if (angle < 0.f)
+	{
+		angle = -angle;
+		sign = -1.f;
+	}
+
+	float wa;
+	float wb;
+	if (angle <= 0.97f)
+	{
+		angle = acos(angle);
+		const float c = 1.f / sin(angle);
+		wa = sin((1.f - t) * angle) * c;
+		wb = sin(angle * t) * c;
+	}
+	else
+	{
+		wa = 1.f - t;
+		wb = t;
+	}
+
+	__m128 r = _mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(wa * sign)), _mm_mul_ps(b, _mm_set1_ps(wb)));
+	r = _mm_div_ps(r, _mm_sqrt_ps(dot4_ps(r, r)));
+	_mm_storeu_ps(out, r);
+}
+
+#undef MATH_BROADCAST
+#undef MATH_SHUFFLE
+
+MATH_END_NAMESPACE
+
+#endif
@@ -0,0 +1,105 @@
+/** @file ScalarMath.h
+	@brief Scalar implementations of the core matrix and quaternion operations.
+
+	These are the code paths of float4x4, float3x4 and Quat when the library is built without MATH_SSE, and the
+	reference the kernels of SSEMath.h are measured and verified against. The kernels have the same signatures as
+	their SSE counterparts and operate on the same row-major float arrays. The scalar reference of the matrix
+	inverses is the generic InverseMatrix of Matrix.inl. */
+#pragma once
+
+#include <math.h>
+
+#include "Math/MathNamespace.h"
+
+MATH_BEGIN_NAMESPACE
+
+/// Computes out = m1 * m2 for the row-major 4x4 matrices m1 and m2. out may alias m1 or m2.
+inline void mat4x4_mul_scalar(float *out, const float *m1, const float *m2)
+{
+	float r[16];
+	for(int i = 0; i < 4; ++i)
+		for(int j = 0; j < 4; ++j)
+			r[4*i+j] = m1[4*i] * m2[j] + m1[4*i+1] * m2[4+j] + m1[4*i+2] * m2[8+j] + m1[4*i+3] * m2[12+j];
+	for(int i = 0; i < 16; ++i)
+		out[i] = r[i];
+}
+
+/// Computes out = m1 * m2 for the row-major 3x4 matrices m1 and m2, both with an implicit last row (0,0,0,1). out may alias m1 or m2.
+inline void mat3x4_mul_scalar(float *out, const float *m1, const float *m2)
+{
+	float r[12];
+	for(int i = 0; i < 3; ++i)
+	{
+		for(int j = 0; j < 4; ++j)
+			r[4*i+j] = m1[4*i] * m2[j] + m1[4*i+1] * m2[4+j] + m1[4*i+2] * m2[8+j];
+		r[4*i+3] += m1[4*i+3];
+	}
+	for(int i = 0; i < 12; ++i)
+		out[i] = r[i];
+}
+
+/// Computes out = m * v for the row-major 4x4 matrix m and the 4-vector v. out may alias v.
+inline void mat4x4_mul_vec4_scalar(float *out, const float *m, const float *v)
+{
+	const float x = v[0], y = v[1], z = v[2], w = v[3];
+	for(int i = 0; i < 4; ++i)
+		out[i] = m[4*i] * x + m[4*i+1] * y + m[4*i+2] * z + m[4*i+3] * w;
+}
+
+/// Computes the first three components of m * (x,y,z,w) for the row-major 3x4 matrix m, and stores them to out.
+inline void mat3x4_transform_scalar(float *out, const float *m, float x, float y, float z, float w)
+{
+	for(int i = 0; i < 3; ++i)
+		out[i] = m[4*i] * x + m[4*i+1] * y + m[4*i+2] * z + m[4*i+3] * w;
+}
+
+/// Computes the quaternion product out = q1 * q2 of the quaternions stored as (x, y, z, w). out may alias q1 or q2.
+inline void quat_mul_scalar(float *out, const float *q1, const float *q2)
+{
+	const float x = q1[0], y = q1[1], z = q1[2], w = q1[3];
+	const float rx = q2[0], ry = q2[1], rz = q2[2], rw = q2[3];
+	out[0] = w*rx + x*rw + y*rz - z*ry;
+	out[1] = w*ry - x*rz + y*rw + z*rx;
+	out[2] = w*rz + x*ry - y*rx + z*rw;
+	out[3] = w*rw - x*rx - y*ry - z*rz;
+}
+
+/// Computes the spherical linear interpolation of the unit quaternions q1 and q2 stored as (x, y, z, w), along the shorter arc.
+/** Implementation based on the math in the book Watt, Policarpo. 3D Games: Real-time rendering and Software Technology, pp. 383-386.
+	Falls back to normalized linear interpolation when the quaternions are nearly parallel. out may alias q1 or q2. */
+inline void quat_slerp_scalar(float *out, const float *q1, const float *q2, float t)
+{
+	float angle = q1[0]*q2[0] + q1[1]*q2[1] + q1[2]*q2[2] + q1[3]*q2[3];
+	float sign = 1.f; // Multiply by a sign of +/-1 to guarantee we rotate the shorter arc.
+	if (angle < 0.f)
+	{
+		angle = -angle;
+		sign = -1.f;
+	}
+
+	float a;
+	float b;
+	if (angle <= 0.97f) // perform spherical linear interpolation.
+	{
+		angle = acos(angle); // After this, angle is in the range pi/2 -> 0 as the original angle variable ranged from 0 -> 1.
+
+		float c = 1.f / sin(angle);
+		a = sin((1.f - t) * angle) * c;
+		b = sin(angle * t) * c;
+	}
+	else // If angle is close to taking the denominator to zero, resort to linear interpolation (and normalization).
+	{
+		a = 1.f - t;
+		b = t;
+	}
+	a *= sign;
+
+	float r[4];
+	for(int i = 0; i < 4; ++i)
+		r[i] = q1[i] * a + q2[i] * b;
+	const float invLength = 1.f / sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2] + r[3]*r[3]);
+	for(int i = 0; i < 4; ++i)
+		out[i] = r[i] * invLength;
+}
+
+MATH_END_NAMESPACE
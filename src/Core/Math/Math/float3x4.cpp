@@ -24,6 +24,8 @@
 #include "Math/float3x4.h"
 #include "Math/float4x4.h"
 #include "Matrix.inl"
+#include "Math/ScalarMath.h"
+#include "Math/SSEMath.h"
 #include "Math/Quat.h"
 #include "Algorithm/Random/LCG.h"
 #include "Geometry/Plane.h"
@@ -810,9 +812,20 @@ bool float3x4::Inverse()
 #ifdef MATH_ASSERT_CORRECTNESS
 	float3x4 orig = *this;
 #endif
+#ifdef MATH_SSE
+	bool success = mat3x4_inverse_sse(ptr());
+	if (!success)
+	{
+		// Retry with Gauss's method to accept the same matrices as the scalar build, see float4x4::Inverse.
+		float4x4 temp(*this);
+		success = InverseMatrix(temp);
+		*this = temp.Float3x4Part();
+	}
+#else
 	float4x4 temp(*this); ///@todo It is possible optimize to avoid copying here by writing the inverse function specifically for float3x4.
 	bool success = temp.Inverse();
 	*this = temp.Float3x4Part();
+#endif
 	mathassert(!success || (orig * *this).IsIdentity());
 	return success;
 }
@@ -970,9 +983,13 @@ float3 float3x4::TransformPos(const float3 &pointVector) const
 
 float3 float3x4::TransformPos(float x, float y, float z) const
 {
-	return float3(DOT3_xyz(v[0], x,y,z) + v[0][3],
-				  DOT3_xyz(v[1], x,y,z) + v[1][3],
-				  DOT3_xyz(v[2], x,y,z) + v[2][3]);
+	float3 r;
+#ifdef MATH_SSE
+	mat3x4_transform_sse(r.ptr(), ptr(), x, y, z, 1.f);
+#else
+	mat3x4_transform_scalar(r.ptr(), ptr(), x, y, z, 1.f);
+#endif
+	return r;
 }
 
 float3 float3x4::TransformDir(const float3 &directionVector) const
@@ -982,17 +999,25 @@ float3 float3x4::TransformDir(const float3 &directionVector) const
 
 float3 float3x4::TransformDir(float x, float y, float z) const
 {
-	return float3(DOT3_xyz(v[0], x,y,z),
-				  DOT3_xyz(v[1], x,y,z),
-				  DOT3_xyz(v[2], x,y,z));
+	float3 r;
+#ifdef MATH_SSE
+	mat3x4_transform_sse(r.ptr(), ptr(), x, y, z, 0.f);
+#else
+	mat3x4_transform_scalar(r.ptr(), ptr(), x, y, z, 0.f);
+#endif
+	return r;
 }
 
 float4 float3x4::Transform(const float4 &vector) const
 {
-	return float4(DOT4(v[0], vector),
-				  DOT4(v[1], vector),
-				  DOT4(v[2], vector),
-				  vector.w);
+	float4 r;
+#ifdef MATH_SSE
+	mat3x4_transform_sse(r.ptr(), ptr(), vector.x, vector.y, vector.z, vector.w);
+#else
+	mat3x4_transform_scalar(r.ptr(), ptr(), vector.x, vector.y, vector.z, vector.w);
+#endif
+	r.w = vector.w;
+	return r;
 }
 
 void float3x4::BatchTransformPos(float3 *pointArray, int numPoints) const
@@ -1103,25 +1128,11 @@ float3x4 float3x4::operator *(const float3x3 &rhs) const
 float3x4 float3x4::operator *(const float3x4 &rhs) const
 {
 	float3x4 r;
-	const float *c0 = rhs.ptr();
-	const float *c1 = rhs.ptr() + 1;
-	const float *c2 = rhs.ptr() + 2;
-	const float *c3 = rhs.ptr() + 3;
-	r[0][0] = DOT3STRIDED(v[0], c0, 4);
-	r[0][1] = DOT3STRIDED(v[0], c1, 4);
-	r[0][2] = DOT3STRIDED(v[0], c2, 4);
-	r[0][3] = DOT3STRIDED(v[0], c3, 4) + v[0][3];
-
-	r[1][0] = DOT3STRIDED(v[1], c0, 4);
-	r[1][1] = DOT3STRIDED(v[1], c1, 4);
-	r[1][2] = DOT3STRIDED(v[1], c2, 4);
-	r[1][3] = DOT3STRIDED(v[1], c3, 4) + v[1][3];
-
-	r[2][0] = DOT3STRIDED(v[2], c0, 4);
-	r[2][1] = DOT3STRIDED(v[2], c1, 4);
-	r[2][2] = DOT3STRIDED(v[2], c2, 4);
-	r[2][3] = DOT3STRIDED(v[2], c3, 4) + v[2][3];
-
+#ifdef MATH_SSE
+	mat3x4_mul_sse(r.ptr(), ptr(), rhs.ptr());
+#else
+	mat3x4_mul_scalar(r.ptr(), ptr(), rhs.ptr());
+#endif
 	return r;
 }
 
@@ -496,7 +496,8 @@ public:
 		If the determinant is negative, the basis is said to be "negatively" oriented (or left-handed)." */
 	float Determinant() const;
 
-	/// Inverts this matrix using the generic Gauss's method.
+	/// Inverts this matrix using the generic Gauss's method, or with the cross products of the rows when built with MATH_SSE.
+	/// Matrices the SSE method finds singular are retried with Gauss's method, so both builds accept the same matrices.
 	/// @return Returns true on success, false otherwise.
 	bool Inverse();
 
@@ -24,6 +24,8 @@
 #include "Math/float3x4.h"
 #include "Math/float4x4.h"
 #include "Matrix.inl"
+#include "Math/ScalarMath.h"
+#include "Math/SSEMath.h"
 #include "Math/Quat.h"
 #include "TransformOps.h"
 #include "Geometry/Plane.h"
@@ -1150,6 +1152,10 @@ bool float4x4::Inverse()
 	mathassert(!(success == false && Abs(Determinant4()) > 1e-3f));
 	mathassert(!success || (copy * *this).IsIdentity());
 	return success;
+#elif defined(MATH_SSE)
+	// Gauss's method tests each pivot, the SSE kernel the determinant, so retry a rejected matrix with Gauss's
+	// method to accept the same matrices as the scalar build.
+	return mat4x4_inverse_sse(ptr()) || InverseMatrix(*this);
 #else
 	return InverseMatrix(*this);
 #endif
@@ -1299,9 +1305,13 @@ float3 float4x4::TransformPos(const float3 &pointVector) const
 
 float3 float4x4::TransformPos(float x, float y, float z) const
 {
-	return float3(DOT4POS_xyz(Row(0), x,y,z),
-				  DOT4POS_xyz(Row(1), x,y,z),
-				  DOT4POS_xyz(Row(2), x,y,z));
+	float3 r;
+#ifdef MATH_SSE
+	mat3x4_transform_sse(r.ptr(), ptr(), x, y, z, 1.f);
+#else
+	mat3x4_transform_scalar(r.ptr(), ptr(), x, y, z, 1.f);
+#endif
+	return r;
 }
 
 float3 float4x4::TransformDir(const float3 &directionVector) const
@@ -1311,17 +1321,24 @@ float3 float4x4::TransformDir(const float3 &directionVector) const
 
 float3 float4x4::TransformDir(float x, float y, float z) const
 {
-	return float3(DOT4DIR_xyz(Row(0), x,y,z),
-				  DOT4DIR_xyz(Row(1), x,y,z),
-				  DOT4DIR_xyz(Row(2), x,y,z));
+	float3 r;
+#ifdef MATH_SSE
+	mat3x4_transform_sse(r.ptr(), ptr(), x, y, z, 0.f);
+#else
+	mat3x4_transform_scalar(r.ptr(), ptr(), x, y, z, 0.f);
+#endif
+	return r;
 }
 
 float4 float4x4::Transform(const float4 &vector) const
 {
-	return float4(DOT4(Row(0), vector),
-				  DOT4(Row(1), vector),
-				  DOT4(Row(2), vector),
-				  DOT4(Row(3), vector));
+	float4 r;
+#ifdef MATH_SSE
+	mat4x4_mul_vec4_sse(r.ptr(), ptr(), vector.ptr());
+#else
+	mat4x4_mul_vec4_scalar(r.ptr(), ptr(), vector.ptr());
+#endif
+	return r;
 }
 
 void float4x4::TransformPos(float3 *pointArray, int numPoints) const
@@ -1467,30 +1484,11 @@ float4x4 float4x4::operator *(const float3x4 &rhs) const
 float4x4 float4x4::operator *(const float4x4 &rhs) const
 {
 	float4x4 r;
-	const float *c0 = rhs.ptr();
-	const float *c1 = rhs.ptr() + 1;
-	const float *c2 = rhs.ptr() + 2;
-	const float *c3 = rhs.ptr() + 3;
-	r[0][0] = DOT4STRIDED(v[0], c0, 4);
-	r[0][1] = DOT4STRIDED(v[0], c1, 4);
-	r[0][2] = DOT4STRIDED(v[0], c2, 4);
-	r[0][3] = DOT4STRIDED(v[0], c3, 4);
-
-	r[1][0] = DOT4STRIDED(v[1], c0, 4);
-	r[1][1] = DOT4STRIDED(v[1], c1, 4);
-	r[1][2] = DOT4STRIDED(v[1], c2, 4);
-	r[1][3] = DOT4STRIDED(v[1], c3, 4);
-
-	r[2][0] = DOT4STRIDED(v[2], c0, 4);
-	r[2][1] = DOT4STRIDED(v[2], c1, 4);
-	r[2][2] = DOT4STRIDED(v[2], c2, 4);
-	r[2][3] = DOT4STRIDED(v[2], c3, 4);
-
-	r[3][0] = DOT4STRIDED(v[3], c0, 4);
-	r[3][1] = DOT4STRIDED(v[3], c1, 4);
-	r[3][2] = DOT4STRIDED(v[3], c2, 4);
-	r[3][3] = DOT4STRIDED(v[3], c3, 4);
-
+#ifdef MATH_SSE
+	mat4x4_mul_sse(r.ptr(), ptr(), rhs.ptr());
+#else
+	mat4x4_mul_scalar(r.ptr(), ptr(), rhs.ptr());
+#endif
 	return r;
 }
 
@@ -569,7 +569,8 @@ public:
 	/// Returns true on success.
 	bool LUDecompose(float4x4 &outLower, float4x4 &outUpper) const;
 
-	/// Inverts this matrix using the generic Gauss's method.
+	/// Inverts this matrix using the generic Gauss's method, or with the 2x2 block method of SSEMath.h when built with MATH_SSE.
+	/// Matrices the SSE method finds singular are retried with Gauss's method, so both builds accept the same matrices.
 	/// @return Returns true on success, false otherwise.
 	bool Inverse();
 
@@ -12,6 +12,7 @@
 #include "EC_Mesh.h"
 #include "OgreSkeletonAsset.h"
 #include "OgreMeshAsset.h"
+#include "MeshBvh.h"
 #include "OgreMaterialAsset.h"
 #include "IAssetTransfer.h"
 #include "AssetAPI.h"
@@ -1471,3 +1472,60 @@ bool EC_Mesh::Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance,
     
     return closestDistance >= 0.0f;
 }
+
+bool EC_Mesh::Raycast(const Ray& ray, float* distance, unsigned* subMeshIndex, unsigned* triangleIndex, float3* hitPosition, float3* normal, float2* uv) const
+{
+    if (!entity_)
+        return false;
+    
+    const MeshBvh *bvh = RaycastBvh();
+    if (!bvh)
+        return Raycast(entity_, ray, distance, subMeshIndex, triangleIndex, hitPosition, normal, uv);
+    
+    PROFILE(EC_Mesh_RaycastBvh)
+    
+    Ogre::SceneNode *node = entity_->getParentSceneNode();
+    if (!node)
+        return false;
+    
+    assume(!float3(node->_getDerivedScale()).IsZero());
+    float3x4 localToWorld = float3x4::FromTRS(node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+    assume(localToWorld.IsColOrthogonal());
+    
+    Ray localRay = ray;
+    localRay.Transform(localToWorld.Inverted());
+    
+    MeshBvhHit hit;
+    if (!bvh->Raycast(localRay, hit))
+        return false;
+    
+    float3 worldHitPoint = localToWorld.TransformPos(hit.pos);
+    if (subMeshIndex)
+        *subMeshIndex = hit.subMeshIndex;
+    if (triangleIndex)
+        *triangleIndex = hit.triangleIndex;
+    if (distance)
+        *distance = (worldHitPoint - ray.pos).Length();
+    if (hitPosition)
+        *hitPosition = worldHitPoint;
+    if (uv && hit.hasUv)
+        *uv = hit.uv;
+    if (normal)
+    {
+        *normal = localToWorld.TransformDir(hit.normal);
+        normal->Normalize();
+    }
+    
+    return true;
+}
+
+const MeshBvh *EC_Mesh::RaycastBvh(bool build) const
+{
+    if (!entity_)
+        return 0;
+    // The hierarchy holds the bind pose of the asset's mesh, so animated vertices and clones must be tested directly
+    OgreMeshAsset *asset = dynamic_cast<OgreMeshAsset*>(meshAsset->Asset().get());
+    if (!asset || entity_->hasSkeleton() || entity_->hasVertexAnimation() || entity_->getMesh().get() != asset->ogreMesh.get())
+        return 0;
+    return asset->Bvh(build);
+}
@@ -20,6 +20,8 @@ namespace Ogre
     class Bone;
 }
 
+class MeshBvh;
+
 /// Ogre mesh entity component
 /**
 <table class="header">
@@ -406,6 +408,16 @@ public slots:
 public:
     /// Raycast into an Ogre mesh entity using a world-space ray. Returns true if a hit happens, in which case the fields (which are not null) are filled appropriately
     static bool Raycast(Ogre::Entity* meshEntity, const Ray& ray, float* distance = 0, unsigned* subMeshIndex = 0, unsigned* triangleIndex = 0, float3* hitPosition = 0, float3* normal = 0, float2* uv = 0);
+
+    /// Raycast into the mesh entity of this component using a world-space ray, with the same results as the static Raycast.
+    /** Uses the raycast hierarchy shared through the mesh asset, see OgreMeshAsset::Bvh. Skinned, morphed and cloned meshes
+        fall back to testing every triangle of the current vertex data. */
+    bool Raycast(const Ray& ray, float* distance = 0, unsigned* subMeshIndex = 0, unsigned* triangleIndex = 0, float3* hitPosition = 0, float3* normal = 0, float2* uv = 0) const;
+
+    /// Returns the raycast hierarchy of the mesh asset if it matches the current geometry of the mesh entity, building it on first use.
+    /** Returns null for skinned, morphed and cloned meshes, and when no mesh is set.
+        @param build If false, returns null instead of building the hierarchy if it does not exist yet. */
+    const MeshBvh *RaycastBvh(bool build = true) const;
     
 signals:
     /// Emitted before the Ogre mesh entity is about to be destroyed
@@ -183,13 +183,14 @@ EC_Placeable::EC_Placeable(Scene* scene) :
     if (scene)
         world_ = scene->GetWorld<OgreWorld>();
     
-    // Enable network interpolation for the transform
+    // Enable network interpolation and the quantized network encoding for the transform
     static AttributeMetadata transAttrData;
     static AttributeMetadata nonDesignableAttrData;
     static bool metadataInitialized = false;
     if(!metadataInitialized)
     {
         transAttrData.interpolation = AttributeMetadata::Interpolate;
+        transAttrData.networkEncoding = AttributeMetadata::Quantized;
         nonDesignableAttrData.designable = false;
         metadataInitialized = true;
     }
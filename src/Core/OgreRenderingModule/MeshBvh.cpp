@@ -0,0 +1,304 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+#include "MeshBvh.h"
+#include "Geometry/Ray.h"
+#include "Math/MathConstants.h"
+
+#include <Ogre.h>
+
+#include <algorithm>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    /// Maximum number of triangles in a leaf node.
+    const u32 cMaxLeafSize = 4;
+    /// Maximum depth of the traversal stack. Median splits keep the depth at log2 of the triangle count.
+    const int cMaxStackDepth = 64;
+
+    /// Orders triangles by their centroid on one axis.
+    struct CentroidLess
+    {
+        CentroidLess(const std::vector<float3> &centroids_, int axis_) : centroids(centroids_), axis(axis_) {}
+        bool operator()(u32 a, u32 b) const { return centroids[a][axis] < centroids[b][axis]; }
+        const std::vector<float3> &centroids;
+        int axis;
+    };
+
+    /// Slab test of a ray against a box, with the reciprocal of the ray direction precomputed.
+    /** Returns true if the ray enters the box before maxDistance, in which case tNear is the entry distance. */
+    inline bool IntersectBox(const AABB &box, const float3 &pos, const float3 &invDir, float maxDistance, float &tNear)
+    {
+        float t1 = (box.minPoint.x - pos.x) * invDir.x;
+        float t2 = (box.maxPoint.x - pos.x) * invDir.x;
+        float tMin = std::min(t1, t2);
+        float tMax = std::max(t1, t2);
+        t1 = (box.minPoint.y - pos.y) * invDir.y;
+        t2 = (box.maxPoint.y - pos.y) * invDir.y;
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+        t1 = (box.minPoint.z - pos.z) * invDir.z;
+        t2 = (box.maxPoint.z - pos.z) * invDir.z;
+        tMin = std::max(tMin, std::min(t1, t2));
+        tMax = std::min(tMax, std::max(t1, t2));
+        tNear = tMin;
+        return tMax >= std::max(tMin, 0.f) && tMin <= maxDistance;
+    }
+}
+
+MeshBvh::MeshBvh(const Ogre::Mesh &mesh)
+{
+    u32 sharedBase = 0;
+    if (mesh.sharedVertexData)
+        sharedBase = CopyVertices(mesh.sharedVertexData);
+
+    subMeshHasUv_.resize(mesh.getNumSubMeshes(), false);
+    for(unsigned short i = 0; i < mesh.getNumSubMeshes(); ++i)
+    {
+        const Ogre::SubMesh *submesh = mesh.getSubMesh(i);
+        const Ogre::VertexData *vertexData = submesh->useSharedVertices ? mesh.sharedVertexData : submesh->vertexData;
+        const Ogre::IndexData *indexData = submesh->indexData;
+        if (!vertexData || !indexData || indexData->indexBuffer.isNull() || !indexData->indexCount)
+            continue;
+        if (!vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION))
+            continue; // No position element, can not raycast
+        subMeshHasUv_[i] = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES) != 0;
+
+        u32 base = submesh->useSharedVertices ? sharedBase : CopyVertices(vertexData);
+        u32 numVertices = (u32)vertexData->vertexCount;
+
+        Ogre::HardwareIndexBufferSharedPtr ibuf = indexData->indexBuffer;
+        bool use32BitIndices = (ibuf->getType() == Ogre::HardwareIndexBuffer::IT_32BIT);
+        const u8 *data = static_cast<const u8 *>(ibuf->lock(Ogre::HardwareBuffer::HBL_READ_ONLY)) + indexData->indexStart * ibuf->getIndexSize();
+        const u32 *pLong = reinterpret_cast<const u32 *>(data);
+        const u16 *pShort = reinterpret_cast<const u16 *>(data);
+
+        for(u32 j = 0; j + 2 < indexData->indexCount; j += 3)
+        {
+            Face face;
+            for(int k = 0; k < 3; ++k)
+                face.indices[k] = use32BitIndices ? pLong[j + k] : pShort[j + k];
+            if (face.indices[0] >= numVertices || face.indices[1] >= numVertices || face.indices[2] >= numVertices)
+                continue;
+            for(int k = 0; k < 3; ++k)
+                face.indices[k] += base;
+            face.subMesh = i;
+            face.firstIndex = j;
+            faces_.push_back(face);
+        }
+        ibuf->unlock();
+    }
+
+    if (faces_.empty())
+        return;
+
+    std::vector<float3> centroids(faces_.size());
+    std::vector<u32> order(faces_.size());
+    for(size_t i = 0; i < faces_.size(); ++i)
+    {
+        const Face &face = faces_[i];
+        centroids[i] = (positions_[face.indices[0]] + positions_[face.indices[1]] + positions_[face.indices[2]]) / 3.f;
+        order[i] = (u32)i;
+    }
+
+    nodes_.reserve(2 * faces_.size() / cMaxLeafSize + 1);
+    Build(centroids, order, 0, (u32)faces_.size());
+
+    // Store the triangles in the order of the leaves
+    std::vector<Face> ordered(faces_.size());
+    for(size_t i = 0; i < order.size(); ++i)
+        ordered[i] = faces_[order[i]];
+    faces_.swap(ordered);
+
+    // The leaves test their triangles with the batch kernel, which reads them as structure of arrays
+    triangles_.Reserve((int)faces_.size());
+    for(size_t i = 0; i < faces_.size(); ++i)
+        triangles_.Add(positions_[faces_[i].indices[0]], positions_[faces_[i].indices[1]], positions_[faces_[i].indices[2]]);
+}
+
+u32 MeshBvh::CopyVertices(const Ogre::VertexData *vertexData)
+{
+    u32 base = (u32)positions_.size();
+    const Ogre::VertexElement *posElem = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_POSITION);
+    if (!posElem || !vertexData->vertexCount)
+        return base;
+
+    positions_.resize(base + vertexData->vertexCount);
+    texCoords_.resize(base + vertexData->vertexCount, float2::zero);
+
+    Ogre::HardwareVertexBufferSharedPtr vbufPos = vertexData->vertexBufferBinding->getBuffer(posElem->getSource());
+    const u8 *posData = static_cast<const u8 *>(vbufPos->lock(Ogre::HardwareBuffer::HBL_READ_ONLY));
+    size_t posSize = vbufPos->getVertexSize();
+    const u8 *pos = posData + vertexData->vertexStart * posSize + posElem->getOffset();
+    for(size_t i = 0; i < vertexData->vertexCount; ++i, pos += posSize)
+    {
+        const float *v = reinterpret_cast<const float *>(pos);
+        positions_[base + i] = float3(v[0], v[1], v[2]);
+    }
+
+    // Texcoord element is not mandatory
+    const Ogre::VertexElement *texElem = vertexData->vertexDeclaration->findElementBySemantic(Ogre::VES_TEXTURE_COORDINATES);
+    if (texElem)
+    {
+        // Check if the texcoord buffer is different than the position buffer, in that case lock it separately
+        Ogre::HardwareVertexBufferSharedPtr vbufTex = vertexData->vertexBufferBinding->getBuffer(texElem->getSource());
+        const u8 *texData = vbufTex != vbufPos ? static_cast<const u8 *>(vbufTex->lock(Ogre::HardwareBuffer::HBL_READ_ONLY)) : posData;
+        size_t texSize = vbufTex->getVertexSize();
+        const u8 *tex = texData + vertexData->vertexStart * texSize + texElem->getOffset();
+        for(size_t i = 0; i < vertexData->vertexCount; ++i, tex += texSize)
+        {
+            const float *t = reinterpret_cast<const float *>(tex);
+            texCoords_[base + i] = float2(t[0], t[1]);
+        }
+        if (vbufTex != vbufPos)
+            vbufTex->unlock();
+    }
+
+    vbufPos->unlock();
+    return base;
+}
+
+u32 MeshBvh::Build(const std::vector<float3> &centroids, std::vector<u32> &order, u32 first, u32 count)
+{
+    u32 nodeIndex = (u32)nodes_.size();
+    nodes_.push_back(Node());
+
+    AABB bounds;
+    bounds.SetNegativeInfinity();
+    AABB centroidBounds;
+    centroidBounds.SetNegativeInfinity();
+    for(u32 i = first; i < first + count; ++i)
+    {
+        const Face &face = faces_[order[i]];
+        for(int k = 0; k < 3; ++k)
+            bounds.Enclose(positions_[face.indices[k]]);
+        centroidBounds.Enclose(centroids[order[i]]);
+    }
+
+    float3 extent = centroidBounds.Size();
+    int axis = extent.MaxElementIndex();
+    // Make a leaf if the triangles are few, or can not be separated by their centroids
+    if (count <= cMaxLeafSize || extent[axis] <= 0.f)
+    {
+        Node &node = nodes_[nodeIndex];
+        node.bounds = bounds;
+        node.first = first;
+        node.count = count;
+        return nodeIndex;
+    }
+
+    u32 half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, CentroidLess(centroids, axis));
+    Build(centroids, order, first, half);
+    u32 right = Build(centroids, order, first + half, count - half);
+
+    // The node array may have grown during the recursion, so index it only now
+    Node &node = nodes_[nodeIndex];
+    node.bounds = bounds;
+    node.first = right;
+    node.count = 0;
+    return nodeIndex;
+}
+
+bool MeshBvh::Raycast(const Ray &ray, MeshBvhHit &hit) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const float3 invDir(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+    float closest = FLOAT_INF;
+    const Face *closestFace = 0;
+    float closestU = 0.f;
+    float closestV = 0.f;
+
+    std::pair<u32, float> stack[cMaxStackDepth];
+    int stackSize = 0;
+    float tNear;
+    if (!IntersectBox(nodes_[0].bounds, ray.pos, invDir, closest, tNear))
+        return false;
+    stack[stackSize++] = std::make_pair(0u, tNear);
+
+    while(stackSize > 0)
+    {
+        const std::pair<u32, float> entry = stack[--stackSize];
+        if (entry.second > closest)
+            continue; // A closer hit has been found after this node was pushed
+        const Node &node = nodes_[entry.first];
+
+        if (node.count > 0)
+        {
+            // Only front faces are hit, as in EC_Mesh::Raycast
+            float t, u, v;
+            int index = BatchRaycastTriangles(ray, triangles_, (int)node.first, (int)node.count, true, closest, t, u, v);
+            if (index >= 0)
+            {
+                closest = t;
+                closestFace = &faces_[index];
+                closestU = u;
+                closestV = v;
+            }
+            continue;
+        }
+
+        // Visit the nearer child first by pushing it last
+        u32 left = entry.first + 1;
+        u32 right = node.first;
+        float tLeft, tRight;
+        bool hitLeft = IntersectBox(nodes_[left].bounds, ray.pos, invDir, closest, tLeft);
+        bool hitRight = IntersectBox(nodes_[right].bounds, ray.pos, invDir, closest, tRight);
+        if (stackSize + 2 > cMaxStackDepth)
+            break; // Can not happen with median splits, but never overrun the stack
+        if (hitLeft && hitRight)
+        {
+            if (tLeft <= tRight)
+            {
+                stack[stackSize++] = std::make_pair(right, tRight);
+                stack[stackSize++] = std::make_pair(left, tLeft);
+            }
+            else
+            {
+                stack[stackSize++] = std::make_pair(left, tLeft);
+                stack[stackSize++] = std::make_pair(right, tRight);
+            }
+        }
+        else if (hitLeft)
+            stack[stackSize++] = std::make_pair(left, tLeft);
+        else if (hitRight)
+            stack[stackSize++] = std::make_pair(right, tRight);
+    }
+
+    if (!closestFace)
+        return false;
+
+    const float3 &v0 = positions_[closestFace->indices[0]];
+    const float3 &v1 = positions_[closestFace->indices[1]];
+    const float3 &v2 = positions_[closestFace->indices[2]];
+    hit.distance = closest;
+    hit.subMeshIndex = closestFace->subMesh;
+    hit.triangleIndex = closestFace->firstIndex;
+    hit.pos = ray.GetPoint(closest);
+    hit.normal = (v1 - v0).Cross(v2 - v0);
+    hit.hasUv = subMeshHasUv_[closestFace->subMesh];
+    if (hit.hasUv)
+        hit.uv = texCoords_[closestFace->indices[0]] * (1.f - closestU - closestV) +
+            texCoords_[closestFace->indices[1]] * closestU + texCoords_[closestFace->indices[2]] * closestV;
+    else
+        hit.uv = float2::zero;
+    return true;
+}
+
+AABB MeshBvh::Bounds() const
+{
+    if (nodes_.empty())
+        return AABB(float3::zero, float3::zero);
+    return nodes_[0].bounds;
+}
+
+size_t MeshBvh::MemoryUsage() const
+{
+    return positions_.capacity() * sizeof(float3) + texCoords_.capacity() * sizeof(float2) +
+        faces_.capacity() * sizeof(Face) + nodes_.capacity() * sizeof(Node) + triangles_.v0x.capacity() * 9 * sizeof(float);
+}
@@ -0,0 +1,81 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+#include "Math/float2.h"
+#include "Math/float3.h"
+#include "Geometry/AABB.h"
+#include "Geometry/Ray.h"
+#include "Math/BatchOps.h"
+
+#include <vector>
+
+namespace Ogre { class Mesh; class VertexData; }
+
+/// Result of a MeshBvh raycast.
+struct MeshBvhHit
+{
+    float distance; ///< Ray parameter of the hit, ie. the hit is at Ray::GetPoint(distance).
+    unsigned subMeshIndex; ///< Index of the submesh that was hit.
+    unsigned triangleIndex; ///< Position of the first index of the triangle in the index buffer of the submesh.
+    float3 pos; ///< Hit position in the space of the mesh.
+    float3 normal; ///< Unnormalized face normal of the triangle in the space of the mesh.
+    float2 uv; ///< Interpolated texture coordinates, or zero if the submesh has none.
+    bool hasUv; ///< Whether the submesh has texture coordinates.
+};
+
+/// Bounding volume hierarchy over the triangles of a mesh, for fast triangle-accurate raycasts.
+/** Built from a CPU-side copy of the vertex positions and texture coordinates, so raycasts do not lock the hardware buffers.
+    The geometry is the bind pose, so skinned and morphed meshes should be raycast through their animated vertex data instead.
+    Built and cached per mesh asset, see OgreMeshAsset::Bvh. */
+class OGRE_MODULE_API MeshBvh
+{
+public:
+    /// Copies the geometry of a mesh and builds the hierarchy.
+    explicit MeshBvh(const Ogre::Mesh &mesh);
+
+    /// Finds the closest front-facing triangle hit by a ray given in the space of the mesh.
+    /** Back faces are not hit, same as with EC_Mesh::Raycast.
+        @return false if nothing was hit */
+    bool Raycast(const Ray &ray, MeshBvhHit &hit) const;
+
+    /// Returns the number of triangles.
+    size_t NumTriangles() const { return faces_.size(); }
+
+    /// Returns the bounding box of the mesh, or a degenerate box if it has no triangles.
+    AABB Bounds() const;
+
+    /// Returns the approximate number of bytes used by the copied geometry and the hierarchy.
+    size_t MemoryUsage() const;
+
+private:
+    /// Node of the hierarchy. Inner nodes have their left child right after them.
+    struct Node
+    {
+        AABB bounds;
+        u32 first; ///< First triangle of a leaf, or the index of the right child of an inner node.
+        u32 count; ///< Number of triangles of a leaf, 0 for inner nodes.
+    };
+
+    /// Triangle of the mesh.
+    struct Face
+    {
+        u32 indices[3]; ///< Indices to the copied vertices.
+        u32 subMesh;
+        u32 firstIndex; ///< Position of the first index in the index buffer of the submesh.
+    };
+
+    /// Copies the vertices of one vertex data. Returns the index of the first copied vertex.
+    u32 CopyVertices(const Ogre::VertexData *vertexData);
+    /// Builds the node for the triangles order[first, first + count) and its children, partitioning the order. Returns the node index.
+    u32 Build(const std::vector<float3> &centroids, std::vector<u32> &order, u32 first, u32 count);
+
+    std::vector<float3> positions_;
+    std::vector<float2> texCoords_;
+    std::vector<bool> subMeshHasUv_;
+    std::vector<Face> faces_; ///< Triangles in the order of the leaves.
+    TriangleArray triangles_; ///< Vertices and edges of faces_, in the same order.
+    std::vector<Node> nodes_;
+};
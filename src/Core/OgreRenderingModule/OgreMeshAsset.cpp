@@ -3,6 +3,7 @@
 #include "StableHeaders.h"
 #include "DebugOperatorNew.h"
 #include "OgreMeshAsset.h"
+#include "MeshBvh.h"
 #include "OgreRenderingModule.h"
 #include "AssetAPI.h"
 #include "AssetCache.h"
@@ -15,6 +16,15 @@
 #include "LoggingFunctions.h"
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// Returns the asset cache ref under which the processed form of mesh data with the given content hash is stored.
+    QString ProcessedMeshRef(const QString &sourceHash)
+    {
+        return QString("processedmesh://%1.%2/%3.mesh").arg(OgreMeshAsset::cProcessedMeshVersion).arg(OGRE_VERSION).arg(sourceHash);
+    }
+}
+
 OgreMeshAsset::~OgreMeshAsset()
 {
     Unload();
@@ -63,11 +73,48 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
         ogreMesh->setAutoBuildEdgeLists(false);
     }
 
+    AssetCache *cache = assetAPI->GetAssetCache();
+    QString processedRef;
+    if (cache)
+        processedRef = ProcessedMeshRef(cache->ContentHashOfLoadedData(Name(), DiskSource(), data_, numBytes));
+    if (processedRef.isEmpty() || !LoadProcessedMesh(processedRef))
+    {
+        if (!ImportMesh(data_, numBytes))
+            return false;
+        ProcessMesh();
+        if (!processedRef.isEmpty())
+            StoreProcessedMesh(processedRef);
+    }
+    
     try
     {
-        std::vector<u8> tempData(data_, data_ + numBytes);
+        // Assign default materials that won't complain
+        SetDefaultMaterial();
+        // Set asset references the mesh has
+        //ResetReferences();
+    }
+    catch(Ogre::Exception &e)
+    {
+        ::LogError("Failed to create mesh " + this->Name() + ": " + QString(e.what()));
+        Unload();
+        return false;
+    }
+
+    //internal_name_ = AssetAPI::SanitateAssetRef(id_);
+    //LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
+
+    // We did a synchronous load, must call AssetLoadCompleted here.
+    assetAPI->AssetLoadCompleted(Name());
+    return true;
+}
+
+bool OgreMeshAsset::ImportMesh(const u8 *data, size_t numBytes)
+{
+    try
+    {
+        // The stream only reads the data, so it can be used without a copy
 #include "DisableMemoryLeakCheck.h"
-        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)&tempData[0], numBytes, false));
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)data, numBytes, false, true));
 #include "EnableMemoryLeakCheck.h"
         Ogre::MeshSerializer serializer;
         serializer.importMesh(stream, ogreMesh.getPointer()); // Note: importMesh *adds* submeshes to an existing mesh. It doesn't replace old ones.
@@ -77,6 +124,12 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
         LogError(QString("OgreMeshAsset::DeserializeFromData: Ogre::MeshSerializer::importMesh failed: ") + e.what());
         return false;
     }
+    return true;
+}
+
+void OgreMeshAsset::ProcessMesh()
+{
+    PROFILE(OgreMeshAsset_ProcessMesh);
     
     // Generate tangents to mesh
     try
@@ -99,27 +152,58 @@ bool OgreMeshAsset::DeserializeFromData(const u8 *data_, size_t numBytes, const
         }
     }
     catch(...) {}
-        
+}
+
+bool OgreMeshAsset::LoadProcessedMesh(const QString &processedRef)
+{
+    QString processedFile = assetAPI->GetAssetCache()->FindInCache(processedRef);
+    if (processedFile.isEmpty())
+        return false;
+    
+    PROFILE(OgreMeshAsset_LoadProcessedMesh);
+    QFile file(processedFile);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        return false;
+    // Map the file so that the data is read straight from the page cache
+    const uchar *data = file.map(0, file.size());
+    if (!data)
+        return false;
+    
+    bool success = ImportMesh(data, (size_t)file.size());
+    file.unmap((uchar*)data);
+    if (!success)
+    {
+        LogWarning("OgreMeshAsset: Discarding unreadable processed mesh of " + Name());
+        assetAPI->GetAssetCache()->DeleteAsset(processedRef);
+        // importMesh may have added some of the submeshes already, so recreate the mesh
+        std::string meshName = ogreMesh->getName();
+        ogreMesh.setNull();
+        Ogre::MeshManager::getSingleton().remove(meshName);
+        ogreMesh = Ogre::MeshManager::getSingleton().createManual(meshName, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+        ogreMesh->setAutoBuildEdgeLists(false);
+    }
+    return success;
+}
+
+void OgreMeshAsset::StoreProcessedMesh(const QString &processedRef)
+{
+    PROFILE(OgreMeshAsset_StoreProcessedMesh);
+    // Ogre can only serialize meshes to files, so serialize next to the cache data and move the file in, without reading it back.
+    // The processed form is determined by its ref, which contains the hash of the source, so the ref identifies the content.
+    AssetCache *cache = assetAPI->GetAssetCache();
+    QString tempFilename = cache->CacheDirectory() + "processedmesh.tmp";
     try
     {
-        // Assign default materials that won't complain
-        SetDefaultMaterial();
-        // Set asset references the mesh has
-        //ResetReferences();
+        Ogre::MeshSerializer serializer;
+        serializer.exportMesh(ogreMesh.get(), tempFilename.toStdString());
+        QByteArray refData = processedRef.toUtf8();
+        cache->StoreAssetFile(tempFilename, processedRef, AssetCache::ComputeContentHash((const u8*)refData.constData(), refData.size()));
     }
-    catch(Ogre::Exception &e)
+    catch(std::exception &e)
     {
-        ::LogError("Failed to create mesh " + this->Name() + ": " + QString(e.what()));
-        Unload();
-        return false;
+        LogWarning("OgreMeshAsset: Failed to store processed mesh of " + Name() + ": " + QString(e.what()));
     }
-
-    //internal_name_ = AssetAPI::SanitateAssetRef(id_);
-    //LogDebug("Ogre mesh " + this->Name().toStdString() + " created");
-
-    // We did a synchronous load, must call AssetLoadCompleted here.
-    assetAPI->AssetLoadCompleted(Name());
-    return true;
+    QFile::remove(tempFilename);
 }
 
 void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
@@ -164,6 +248,7 @@ void OgreMeshAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, con
 
 void OgreMeshAsset::DoUnload()
 {
+    bvh_.reset();
     if (ogreMesh.isNull())
         return;
 
@@ -225,3 +310,13 @@ bool OgreMeshAsset::SerializeTo(std::vector<u8> &data, const QString &serializat
     }
     return true;
 }
+
+const MeshBvh *OgreMeshAsset::Bvh(bool build)
+{
+    if (build && !bvh_ && !ogreMesh.isNull())
+    {
+        PROFILE(OgreMeshAsset_BuildBvh);
+        bvh_ = boost::shared_ptr<MeshBvh>(new MeshBvh(*ogreMesh));
+    }
+    return bvh_.get();
+}
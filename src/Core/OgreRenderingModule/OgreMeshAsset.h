@@ -9,7 +9,12 @@
 #include <OgreMesh.h>
 #include <OgreResourceBackgroundQueue.h>
 
+class MeshBvh;
+
 /// Represents an Ogre .mesh loaded to the GPU.
+/** When a mesh is loaded synchronously, the processed mesh (with tangents and submesh extremes generated) is written to the asset cache,
+    keyed by the content hash of the source data and the processing version. Later loads of the same data read the processed mesh
+    directly from the memory-mapped cache file without processing it again. */
 class OGRE_MODULE_API OgreMeshAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
@@ -39,8 +44,17 @@ public:
 
     void SetDefaultMaterial();
 
+    /// Version of the processing done to loaded meshes. Bump when the processing changes, so that stale processed meshes are not used.
+    static const int cProcessedMeshVersion = 1;
+
     bool IsLoaded() const;
 
+    /// Returns the raycast hierarchy of the mesh, building it on first use from a CPU-side copy of the geometry.
+    /** Shared by all EC_Mesh components using this asset, and released when the asset is unloaded.
+        @param build If false, returns null instead of building the hierarchy if it does not exist yet.
+        @return null if the mesh is not loaded */
+    const MeshBvh *Bvh(bool build = true);
+
     /// This points to the loaded mesh asset, if it is present.
     Ogre::MeshPtr ogreMesh;
 
@@ -51,6 +65,22 @@ public:
     //QString ogreAssetName;
 
     //std::vector<QString> originalMaterials;
+
+private:
+    /// Imports mesh data to ogreMesh.
+    bool ImportMesh(const u8 *data, size_t numBytes);
+
+    /// Generates tangents and submesh extremes to ogreMesh.
+    void ProcessMesh();
+
+    /// Loads the processed mesh from the asset cache, if it is there.
+    bool LoadProcessedMesh(const QString &processedRef);
+
+    /// Writes ogreMesh to the asset cache as the processed mesh.
+    void StoreProcessedMesh(const QString &processedRef);
+
+    /// Raycast hierarchy, built on demand.
+    boost::shared_ptr<MeshBvh> bvh_;
 };
 
 typedef boost::shared_ptr<OgreMeshAsset> OgreMeshAssetPtr;
@@ -21,6 +21,7 @@
 #include "OgreSkeletonAsset.h"
 #include "OgreMaterialAsset.h"
 #include "TextureAsset.h"
+#include "TextureProcessor.h"
 
 #include "Application.h"
 #include "VersionInfo.h"
@@ -34,6 +35,8 @@
 #include "SceneAPI.h"
 #include "IComponentFactory.h"
 
+#include <QRunnable>
+
 #include "MemoryLeakCheck.h"
 
 namespace OgreRenderer
@@ -41,13 +44,56 @@ namespace OgreRenderer
 
 std::string OgreRenderingModule::CACHE_RESOURCE_GROUP = "CACHED_ASSETS_GROUP";
 
+/// Maximum number of threads processing textures, so that the processing leaves cores for the main and Ogre's loader threads.
+static const int cMaxTextureProcessingThreads = 2;
+
+/// Decodes and processes a texture on a texture processing thread.
+class TextureProcessTask : public QRunnable
+{
+public:
+    TextureProcessTask(OgreRenderingModule *module_, const OgreRenderingModule::PendingTextureProcessPtr &process_) :
+        module(module_),
+        process(process_)
+    {
+    }
+
+    void run()
+    {
+        // Do not log here, as logging is not thread-safe. The failure is reported on the main thread.
+        process->success = false;
+        try
+        {
+#include "DisableMemoryLeakCheck.h"
+            Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&process->source[0], process->source.size(), false, true));
+#include "EnableMemoryLeakCheck.h"
+            Ogre::Image image;
+            image.load(stream);
+            process->success = TextureProcessor::Process(image, process->compress, process->processed);
+        }
+        catch(Ogre::Exception &)
+        {
+        }
+        process->source.clear();
+        module->TextureProcessFinished(process);
+    }
+
+private:
+    OgreRenderingModule *module;
+    OgreRenderingModule::PendingTextureProcessPtr process;
+};
+
 OgreRenderingModule::OgreRenderingModule() : 
-    IModule("OgreRendering")
+    IModule("OgreRendering"),
+    maxTextureSize(0),
+    textureProcessing(false)
 {
+    textureProcessingThreads.setMaxThreadCount(cMaxTextureProcessingThreads);
 }
 
 OgreRenderingModule::~OgreRenderingModule()
 {
+    // The processing threads access this object, so wait for them before it is destroyed
+    textureProcessingThreads.waitForDone();
 }
 
 void OgreRenderingModule::Load()
@@ -63,6 +109,10 @@ void OgreRenderingModule::Load()
     framework_->Scene()->RegisterComponentFactory(ComponentFactoryPtr(new GenericComponentFactory<EC_SelectionBox>));
     framework_->Scene()->RegisterComponentFactory(ComponentFactoryPtr(new GenericComponentFactory<EC_Material>));
 
+    // Register the batch raycast types also to the Qt meta type system, so that OgreWorld::RaycastBatch can be invoked from Python.
+    qRegisterMetaType<QList<Ray> >("QList<Ray>");
+    qRegisterMetaType<QList<RaycastResult*> >("QList<RaycastResult*>");
+
     // Create asset type factories for each asset OgreRenderingModule provides to the system.
     framework_->Asset()->RegisterAssetTypeFactory(AssetTypeFactoryPtr(new GenericAssetFactory<OgreMeshAsset>("OgreMesh")));
 
@@ -131,6 +181,18 @@ void OgreRenderingModule::Initialize()
             Ogre::ResourceGroupManager::getSingleton().addResourceLocation(cacheResourceDir, "FileSystem", CACHE_RESOURCE_GROUP);
     }
 
+    textureProcessing = framework_->HasCommandLineParameter("--textureprocessing");
+    QStringList maxTextureSizeParam = framework_->CommandLineParameters("--maxtexturesize");
+    if (!maxTextureSizeParam.isEmpty())
+    {
+        bool ok = false;
+        uint size = maxTextureSizeParam.last().toUInt(&ok);
+        if (ok)
+            maxTextureSize = size;
+        else
+            LogError("OgreRenderingModule: Invalid value for --maxtexturesize: " + maxTextureSizeParam.last());
+    }
+
     framework_->Console()->RegisterCommand("RenderStats", "Prints out render statistics.",
         this, SLOT(ConsoleStats()));
     framework_->Console()->RegisterCommand("SetMaterialAttribute", "Sets an attribute on a material asset",
@@ -139,6 +201,11 @@ void OgreRenderingModule::Initialize()
 
 void OgreRenderingModule::Uninitialize()
 {
+    // Ogre is shut down below, so the processing threads must not decode anymore
+    textureProcessingThreads.waitForDone();
+    finishedTextureProcesses.clear();
+    texturesInProcessing.clear();
+
     // We're shutting down. Force a release of all loaded asset objects from the Asset API so that 
     // no refs to Ogre assets remain - below 'renderer.reset()' is going to delete Ogre::Root.
     framework_->Asset()->ForgetAllAssets();
@@ -147,6 +214,51 @@ void OgreRenderingModule::Uninitialize()
     framework_->RegisterRenderer(0);
 }
 
+void OgreRenderingModule::Update(f64 /*frametime*/)
+{
+    if (texturesInProcessing.isEmpty())
+        return;
+
+    std::list<PendingTextureProcessPtr> finished;
+    {
+        QMutexLocker lock(&finishedTextureProcessesMutex);
+        finished.swap(finishedTextureProcesses);
+    }
+    AssetCache *cache = framework_->Asset()->GetAssetCache();
+    for(std::list<PendingTextureProcessPtr>::iterator iter = finished.begin(); iter != finished.end(); ++iter)
+    {
+        PendingTextureProcessPtr process = *iter;
+        texturesInProcessing.remove(process->processedRef);
+        if (!process->success)
+        {
+            LogDebug("OgreRenderingModule: Texture for " + process->processedRef + " could not be processed, it is loaded without processing.");
+            unprocessableTextures.insert(process->processedRef);
+        }
+        else if (cache)
+            cache->StoreAsset(&process->processed[0], process->processed.size(), process->processedRef);
+    }
+}
+
+void OgreRenderingModule::ProcessTexture(const QString &processedRef, const u8 *data, size_t numBytes, bool compress)
+{
+    if (!data || numBytes == 0 || texturesInProcessing.contains(processedRef) || unprocessableTextures.contains(processedRef))
+        return;
+
+    PendingTextureProcessPtr process(new PendingTextureProcess);
+    process->processedRef = processedRef;
+    process->source.assign(data, data + numBytes);
+    process->compress = compress;
+    process->success = false;
+    texturesInProcessing.insert(processedRef);
+    textureProcessingThreads.start(new TextureProcessTask(this, process));
+}
+
+void OgreRenderingModule::TextureProcessFinished(const PendingTextureProcessPtr &process)
+{
+    QMutexLocker lock(&finishedTextureProcessesMutex);
+    finishedTextureProcesses.push_back(process);
+}
+
 void OgreRenderingModule::ConsoleStats()
 {
     if (framework_->IsHeadless())
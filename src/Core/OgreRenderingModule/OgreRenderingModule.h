@@ -5,6 +5,15 @@
 #include "IModule.h"
 #include "OgreModuleApi.h"
 #include "OgreModuleFwd.h"
+#include "CoreTypes.h"
+
+#include <QThreadPool>
+#include <QMutex>
+#include <QSet>
+
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <vector>
 
 namespace OgreRenderer
 {
@@ -27,10 +36,25 @@ namespace OgreRenderer
         virtual void Load();
         virtual void Initialize();
         virtual void Uninitialize();
+        virtual void Update(f64 frametime);
 
         /// Returns the renderer.
         RendererPtr GetRenderer() const { return renderer; }
 
+        /// Returns the largest texture width or height to load, or 0 if there is no limit. Set with the --maxtexturesize command line parameter.
+        /** Textures with a processed mip chain are loaded from the largest mip level within the limit. */
+        uint MaxTextureSize() const { return maxTextureSize; }
+
+        /// Returns whether loaded textures are converted to a processed form and stored in the asset cache, see TextureAsset.
+        /** Enabled with the --textureprocessing command line parameter. */
+        bool TextureProcessingEnabled() const { return textureProcessing; }
+
+        /// Converts texture source data to the processed form on a texture processing thread, and stores the result in the asset cache.
+        /** Does nothing if the same processed ref is already being processed, or its processing has failed during this run. The data is copied.
+            @param processedRef Asset cache ref for the processed form.
+            @param compress Whether to compress the processed form to DXT, see TextureProcessor::Process. */
+        void ProcessTexture(const QString &processedRef, const u8 *data, size_t numBytes, bool compress);
+
         /// Ogre resource group for cached asset files.
         static std::string CACHE_RESOURCE_GROUP;
 
@@ -49,6 +73,29 @@ namespace OgreRenderer
         void OnSceneRemoved(const QString &name);
 
     private:
+        friend class TextureProcessTask;
+
+        /// A texture conversion done on the texture processing threads.
+        struct PendingTextureProcess
+        {
+            QString processedRef; ///< Asset cache ref for the processed form. Only accessed on the main thread.
+            std::vector<u8> source; ///< Source image data.
+            bool compress; ///< Whether to compress to DXT.
+            std::vector<u8> processed; ///< Receives the processed form.
+            bool success; ///< Whether the source was decoded and processed.
+        };
+        typedef boost::shared_ptr<PendingTextureProcess> PendingTextureProcessPtr;
+
+        /// Called on a texture processing thread when a conversion has finished.
+        void TextureProcessFinished(const PendingTextureProcessPtr &process);
+
         RendererPtr renderer;  ///< Renderer
+        uint maxTextureSize; ///< Largest texture width or height to load, 0 if not limited.
+        bool textureProcessing; ///< Whether loaded textures are processed and cached.
+        QThreadPool textureProcessingThreads; ///< Threads which decode and process textures.
+        std::list<PendingTextureProcessPtr> finishedTextureProcesses; ///< Conversions finished by the processing threads, to be stored on the main thread.
+        QMutex finishedTextureProcessesMutex; ///< Guards finishedTextureProcesses.
+        QSet<QString> texturesInProcessing; ///< Processed refs of the conversions started but not stored yet.
+        QSet<QString> unprocessableTextures; ///< Processed refs of the conversions that failed, so that their sources are not decoded again on every load.
     };
 }
@@ -10,6 +10,7 @@
 #include "EC_Camera.h"
 #include "EC_Placeable.h"
 #include "EC_Mesh.h"
+#include "MeshBvh.h"
 #include "Scene.h"
 #include "OgreCompositionHandler.h"
 #include "Profiler.h"
@@ -30,6 +31,162 @@
 
 #include <Ogre.h>
 
+#include <QRunnable>
+
+#include <algorithm>
+
+namespace
+{
+    /// Number of rays each worker thread task of a batch raycast handles.
+    const int cRaysPerTask = 32;
+
+    /// Returns the EC_Mesh of an entity that owns an Ogre mesh entity, or null if none does.
+    EC_Mesh *MeshComponentOf(Entity *entity, Ogre::Entity *meshEntity)
+    {
+        std::vector<boost::shared_ptr<EC_Mesh> > meshes = entity->GetComponents<EC_Mesh>();
+        for(size_t i = 0; i < meshes.size(); ++i)
+            if (meshes[i]->GetEntity() == meshEntity)
+                return meshes[i].get();
+        return 0;
+    }
+
+    /// Object of the Ogre scene captured for a batch raycast.
+    struct RaycastTarget
+    {
+        Entity *entity;
+        AABB worldAABB;
+        bool infinite; ///< Whether the bounding box is infinite, in which case every ray hits it at distance 0.
+        Ogre::Entity *meshEntity; ///< Null if the object is not a mesh, in which case its bounding box is the hit.
+        const MeshBvh *bvh; ///< Raycast hierarchy of the mesh, null if the mesh has to be tested on the main thread.
+        /// Mesh component whose raycast hierarchy has not been built yet. It is built on the main thread only if a ray reaches the bounds of the mesh.
+        EC_Mesh *unbuiltBvhMesh;
+        float3x4 localToWorld;
+        float3x4 worldToLocal;
+    };
+
+    /// Closest hit of one ray of a batch raycast.
+    struct RaycastHit
+    {
+        int target; ///< Index of the hit target, -1 if none.
+        float distance;
+        float3 pos;
+        float3 normal;
+        unsigned submesh;
+        unsigned index;
+        float2 uv;
+        /// Meshes without a built raycast hierarchy whose bounding box the ray hits, as (distance, target index). Tested on the main thread.
+        std::vector<std::pair<float, int> > deferred;
+    };
+
+    /// Returns the distance at which a ray with a normalized direction enters the bounding box of a target, or -1 if it misses.
+    float RayBoxDistance(const Ray &ray, const RaycastTarget &target)
+    {
+        if (target.infinite)
+            return 0.f;
+        float tNear, tFar;
+        if (!target.worldAABB.IntersectRayAABB(ray.pos, ray.dir, tNear, tFar))
+            return -1.f;
+        return std::max(tNear, 0.f);
+    }
+
+    /// Raycasts a mesh target through its raycast hierarchy, and stores the hit if it is closer than the current hit of the ray.
+    void RaycastTargetBvh(const Ray &ray, const RaycastTarget &target, int targetIndex, RaycastHit &hit)
+    {
+        Ray localRay = ray;
+        localRay.Transform(target.worldToLocal);
+        MeshBvhHit meshHit;
+        if (!target.bvh->Raycast(localRay, meshHit))
+            return;
+        float3 worldPos = target.localToWorld.TransformPos(meshHit.pos);
+        float distance = (worldPos - ray.pos).Length();
+        if (hit.target < 0 || distance < hit.distance)
+        {
+            hit.target = targetIndex;
+            hit.distance = distance;
+            hit.pos = worldPos;
+            hit.normal = target.localToWorld.TransformDir(meshHit.normal);
+            hit.normal.Normalize();
+            hit.submesh = meshHit.subMeshIndex;
+            hit.index = meshHit.triangleIndex;
+            hit.uv = meshHit.hasUv ? meshHit.uv : float2::zero;
+        }
+    }
+
+    /// Finds the closest hit of a ray among the targets. Safe to call from worker threads, as only the captured data is read.
+    void RaycastTargets(const Ray &ray, const std::vector<RaycastTarget> &targets, RaycastHit &hit)
+    {
+        hit.target = -1;
+        hit.distance = 0.f;
+        hit.pos = float3::zero;
+        hit.normal = float3::zero;
+        hit.submesh = 0;
+        hit.index = 0;
+        hit.uv = float2::zero;
+        
+        std::vector<std::pair<float, int> > candidates;
+        for(size_t i = 0; i < targets.size(); ++i)
+        {
+            float distance = RayBoxDistance(ray, targets[i]);
+            if (distance >= 0.f)
+                candidates.push_back(std::make_pair(distance, (int)i));
+        }
+        std::sort(candidates.begin(), candidates.end());
+        
+        for(size_t i = 0; i < candidates.size(); ++i)
+        {
+            // If this bounding box is further away than our current best result, the rest can not be closer either
+            if (hit.target >= 0 && candidates[i].first > hit.distance)
+                break;
+            const RaycastTarget &target = targets[candidates[i].second];
+            if (!target.meshEntity)
+            {
+                // Not a mesh entity, fall back to just using the bounding box - ray intersection
+                if (hit.target < 0 || candidates[i].first < hit.distance)
+                {
+                    hit.target = candidates[i].second;
+                    hit.distance = candidates[i].first;
+                    hit.pos = ray.GetPoint(hit.distance);
+                    hit.normal = -ray.dir;
+                    hit.submesh = 0;
+                    hit.index = 0;
+                    hit.uv = float2::zero;
+                }
+                continue;
+            }
+            if (!target.bvh)
+            {
+                hit.deferred.push_back(candidates[i]);
+                continue;
+            }
+            
+            RaycastTargetBvh(ray, target, candidates[i].second, hit);
+        }
+    }
+
+    /// Raycasts a range of the rays of a batch on a worker thread.
+    class RaycastBatchTask : public QRunnable
+    {
+    public:
+        RaycastBatchTask(const std::vector<RaycastTarget> &targets, const std::vector<Ray> &rays, std::vector<RaycastHit> &hits, size_t first, size_t count) :
+            targets_(targets), rays_(rays), hits_(hits), first_(first), count_(count)
+        {
+        }
+        
+        void run()
+        {
+            for(size_t i = first_; i < first_ + count_; ++i)
+                RaycastTargets(rays_[i], targets_, hits_[i]);
+        }
+        
+    private:
+        const std::vector<RaycastTarget> &targets_;
+        const std::vector<Ray> &rays_;
+        std::vector<RaycastHit> &hits_;
+        size_t first_;
+        size_t count_;
+    };
+}
+
 OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
     framework_(scene->GetFramework()),
     renderer_(renderer),
@@ -70,6 +227,10 @@ OgreWorld::OgreWorld(OgreRenderer::Renderer* renderer, ScenePtr scene) :
 
 OgreWorld::~OgreWorld()
 {
+    raycastThreads_.waitForDone();
+    for(size_t i = 0; i < batchResults_.size(); ++i)
+        delete batchResults_[i];
+    
     if (rayQuery_)
         sceneManager_->destroyQuery(rayQuery_);
     
@@ -191,7 +352,11 @@ RaycastResult* OgreWorld::RaycastInternal(unsigned layerMask)
             float3 normal;
             float2 uv;
             
-            if (EC_Mesh::Raycast(meshEntity, ray, &meshClosestDistance, &subMeshIndex, &triangleIndex, &hitPoint, &normal, &uv))
+            // Raycast through the EC_Mesh owning the Ogre entity so that the mesh asset's raycast hierarchy is used
+            EC_Mesh *mesh = MeshComponentOf(entity, meshEntity);
+            bool hit = mesh ? mesh->Raycast(ray, &meshClosestDistance, &subMeshIndex, &triangleIndex, &hitPoint, &normal, &uv) :
+                EC_Mesh::Raycast(meshEntity, ray, &meshClosestDistance, &subMeshIndex, &triangleIndex, &hitPoint, &normal, &uv);
+            if (hit)
             {
                 if (closestDistance < 0.0f || meshClosestDistance < closestDistance)
                 {
@@ -228,6 +393,150 @@ RaycastResult* OgreWorld::RaycastInternal(unsigned layerMask)
     return &result_;
 }
 
+QList<RaycastResult*> OgreWorld::RaycastBatch(const QList<Ray> &rays, unsigned layerMask)
+{
+    PROFILE(OgreWorld_RaycastBatch);
+    
+    // Capture the raycastable objects once, so that all rays see the same state of the scene
+    std::vector<RaycastTarget> targets;
+    Ogre::Root::MovableObjectFactoryIterator factories = Ogre::Root::getSingleton().getMovableObjectFactoryIterator();
+    while(factories.hasMoreElements())
+    {
+        Ogre::SceneManager::MovableObjectIterator objects = sceneManager_->getMovableObjectIterator(factories.getNext()->getType());
+        while(objects.hasMoreElements())
+        {
+            Ogre::MovableObject *movable = objects.getNext();
+            /// \todo Do we want results for invisible entities?
+            if (!movable->isInScene() || !movable->isVisible())
+                continue;
+            
+            const Ogre::Any& any = movable->getUserAny();
+            if (any.isEmpty())
+                continue;
+            Entity *entity = 0;
+            try
+            {
+                entity = Ogre::any_cast<Entity*>(any);
+            }
+            catch(Ogre::InvalidParametersException &/*e*/)
+            {
+                continue;
+            }
+            
+            EC_Placeable* placeable = entity->GetComponent<EC_Placeable>().get();
+            if (placeable && !(placeable->selectionLayer.Get() & layerMask))
+                continue;
+            
+            const Ogre::AxisAlignedBox &box = movable->getWorldBoundingBox(true);
+            if (box.isNull())
+                continue;
+            
+            RaycastTarget target;
+            target.entity = entity;
+            target.infinite = box.isInfinite();
+            if (!target.infinite)
+                target.worldAABB = AABB(box);
+            target.meshEntity = dynamic_cast<Ogre::Entity*>(movable);
+            target.bvh = 0;
+            target.unbuiltBvhMesh = 0;
+            if (target.meshEntity)
+            {
+                Ogre::SceneNode *node = target.meshEntity->getParentSceneNode();
+                if (!node)
+                    continue;
+                target.localToWorld = float3x4::FromTRS(node->_getDerivedPosition(), node->_getDerivedOrientation(), node->_getDerivedScale());
+                target.worldToLocal = target.localToWorld.Inverted();
+                EC_Mesh *mesh = MeshComponentOf(entity, target.meshEntity);
+                // Only use hierarchies that already exist. Building one for every mesh in view would stall the first batch
+                if (mesh)
+                {
+                    target.bvh = mesh->RaycastBvh(false);
+                    if (!target.bvh)
+                        target.unbuiltBvhMesh = mesh;
+                }
+            }
+            targets.push_back(target);
+        }
+    }
+    
+    std::vector<Ray> worldRays(rays.size());
+    for(int i = 0; i < rays.size(); ++i)
+        worldRays[i] = Ray(rays[i].pos, rays[i].dir.Normalized());
+    std::vector<RaycastHit> hits(rays.size());
+    
+    if (rays.size() < 2 * cRaysPerTask)
+    {
+        for(size_t i = 0; i < worldRays.size(); ++i)
+            RaycastTargets(worldRays[i], targets, hits[i]);
+    }
+    else
+    {
+        for(size_t first = 0; first < worldRays.size(); first += cRaysPerTask)
+            raycastThreads_.start(new RaycastBatchTask(targets, worldRays, hits, first, std::min<size_t>(cRaysPerTask, worldRays.size() - first)));
+        raycastThreads_.waitForDone();
+    }
+    
+    // Building a raycast hierarchy and testing meshes without one lock the vertex buffers, so do them here.
+    // Only the meshes whose bounds a ray reaches before a closer hit get their hierarchy built.
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        RaycastHit &hit = hits[i];
+        for(size_t j = 0; j < hit.deferred.size(); ++j)
+        {
+            if (hit.target >= 0 && hit.deferred[j].first > hit.distance)
+                break;
+            RaycastTarget &target = targets[hit.deferred[j].second];
+            if (target.unbuiltBvhMesh)
+            {
+                target.bvh = target.unbuiltBvhMesh->RaycastBvh();
+                target.unbuiltBvhMesh = 0;
+            }
+            if (target.bvh)
+            {
+                RaycastTargetBvh(worldRays[i], target, hit.deferred[j].second, hit);
+                continue;
+            }
+            
+            float distance;
+            unsigned submesh;
+            unsigned index;
+            float3 pos;
+            float3 normal;
+            float2 uv = float2::zero;
+            if (EC_Mesh::Raycast(target.meshEntity, worldRays[i], &distance, &submesh, &index, &pos, &normal, &uv) &&
+                (hit.target < 0 || distance < hit.distance))
+            {
+                hit.target = hit.deferred[j].second;
+                hit.distance = distance;
+                hit.pos = pos;
+                hit.normal = normal;
+                hit.submesh = submesh;
+                hit.index = index;
+                hit.uv = uv;
+            }
+        }
+    }
+    
+    while(batchResults_.size() < hits.size())
+        batchResults_.push_back(new RaycastResult());
+    QList<RaycastResult*> results;
+    for(size_t i = 0; i < hits.size(); ++i)
+    {
+        const RaycastHit &hit = hits[i];
+        RaycastResult *result = batchResults_[i];
+        result->entity = hit.target >= 0 ? targets[hit.target].entity : 0;
+        result->pos = hit.pos;
+        result->normal = hit.normal;
+        result->submesh = hit.submesh;
+        result->index = hit.index;
+        result->u = hit.uv.x;
+        result->v = hit.uv.y;
+        results.push_back(result);
+    }
+    
+    return results;
+}
+
 QList<Entity*> OgreWorld::FrustumQuery(QRect &viewrect)
 {
     PROFILE(OgreWorld_FrustumQuery);
@@ -8,9 +8,13 @@
 #include "OgreModuleFwd.h"
 #include "SceneFwd.h"
 #include "Math/MathFwd.h"
+#include "Geometry/Ray.h"
 
 #include <QObject>
 #include <QList>
+#include <QThreadPool>
+
+#include <vector>
 
 #include <OgreRenderQueue.h>
 
@@ -62,6 +66,14 @@ public slots:
     /** Does raycast into the world using a ray in world space coordinates. */
     RaycastResult* Raycast(const Ray& ray, unsigned layerMask);
 
+    /// Does a batch of raycasts into the world using rays in world space, and returns a result for each ray.
+    /** The scene is captured once, and the rays are tested against the capture on worker threads using the raycast hierarchies
+        of the mesh assets. Skinned, morphed and cloned meshes are tested on the calling thread.
+        @param rays Rays in world space. The directions do not need to be normalized.
+        @param layerMask Which selection layer(s) to use (bitmask)
+        @return Results in the order of the rays. Owned by OgreWorld and valid until the next batch raycast. */
+    QList<RaycastResult*> RaycastBatch(const QList<Ray> &rays, unsigned layerMask = 0xffffffff);
+
     /// Do a frustum query to the world from viewport coordinates.
     /// \todo This function will be removed and replaced with a function Scene::Intersect.
     /** Returns the found entities as a QVariantList so that
@@ -166,6 +178,12 @@ private:
     /// Ray query result
     RaycastResult result_;
     
+    /// Batch raycast results, reused between batches
+    std::vector<RaycastResult*> batchResults_;
+    
+    /// Worker threads for batch raycasts
+    QThreadPool raycastThreads_;
+    
     /// Soft shadow gaussian listeners
     std::list<GaussianListener *> gaussianListeners_;
     
@@ -183,3 +201,6 @@ private:
     /// Debug geometry object, no depth testing
     DebugLines* debugLinesNoDepth_;
 };
+
+Q_DECLARE_METATYPE(QList<Ray>)
+Q_DECLARE_METATYPE(QList<RaycastResult*>)
@@ -31,6 +31,7 @@
 
 Q_DECLARE_METATYPE(EC_Placeable*);
 Q_DECLARE_METATYPE(EC_Camera*);
+Q_DECLARE_METATYPE(RaycastResult*);
 
 // Clamp elapsed frame time to avoid Ogre controllers going crazy
 static const float MAX_FRAME_TIME = 0.1f;
@@ -887,6 +888,8 @@ namespace OgreRenderer
     {
         qScriptRegisterQObjectMetaType<EC_Placeable*>(engine);
         qScriptRegisterQObjectMetaType<EC_Camera*>(engine);
+        qScriptRegisterSequenceMetaType<QList<Ray> >(engine);
+        qScriptRegisterSequenceMetaType<QList<RaycastResult*> >(engine);
     }
 
 }
\ No newline at end of file
@@ -4,7 +4,9 @@
 #include "DebugOperatorNew.h"
 
 #include "TextureAsset.h"
+#include "TextureProcessor.h"
 #include "OgreRenderingModule.h"
+#include "Framework.h"
 
 #include "Profiler.h"
 #include "AssetCache.h"
@@ -14,6 +16,7 @@
 #include <QRect>
 #include <QFontMetrics>
 #include <QPainter>
+#include <QFile>
 #include <QFileInfo>
 
 #include <Ogre.h>
@@ -32,6 +35,22 @@
 
 #include "MemoryLeakCheck.h"
 
+namespace
+{
+    /// Returns whether the render system can use DXT compressed textures.
+    bool IsDxtSupported()
+    {
+        Ogre::RenderSystem *renderSystem = Ogre::Root::getSingleton().getRenderSystem();
+        return renderSystem && renderSystem->getCapabilities() && renderSystem->getCapabilities()->hasCapability(Ogre::RSC_TEXTURE_COMPRESSION_DXT);
+    }
+
+    /// Returns the asset cache ref under which the processed form of texture data with the given content hash is stored.
+    QString ProcessedTextureRef(const QString &sourceHash, bool compress)
+    {
+        return QString("processedtexture://%1.%2/%3.ttex").arg(TextureProcessor::cVersion).arg(compress ? "dxt" : "bgra").arg(sourceHash);
+    }
+}
+
 TextureAsset::TextureAsset(AssetAPI *owner, const QString &type_, const QString &name_)
 :IAsset(owner, type_, name_)
 {
@@ -60,6 +79,22 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
     // We should never be here in headless mode.
     assert(!assetAPI->IsHeadless());
 
+    // The processed form of the texture is read without decoding, so prefer it over threaded loading.
+    // If it does not exist yet, it is produced on a processing thread for the next load, and this load proceeds as without processing.
+    // Sources in GPU-ready or floating point formats are loaded as they are, so they are not copied for processing.
+    OgreRenderer::OgreRenderingModule *module = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>();
+    if (assetAPI->GetAssetCache() && module && module->TextureProcessingEnabled() && TextureProcessor::CanProcessSource(data, numBytes))
+    {
+        const bool compress = IsDxtSupported();
+        const QString processedRef = ProcessedTextureRef(assetAPI->GetAssetCache()->ContentHashOfLoadedData(Name(), DiskSource(), data, numBytes), compress);
+        if (LoadProcessedTexture(processedRef))
+        {
+            assetAPI->AssetLoadCompleted(Name());
+            return true;
+        }
+        module->ProcessTexture(processedRef, data, numBytes, compress);
+    }
+
     // Asynchronous loading
     // 1. AssetAPI allows a asynch load. This is false when called from LoadFromFile(), LoadFromCache() etc.
     // 2. We have a rendering window for Ogre as Ogre::ResourceBackgroundQueue does not work otherwise. Its not properly initialized without a rendering window.
@@ -83,42 +118,22 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
     // Synchronous loading
     try
     {
-        // Convert the data into Ogre's own DataStream format.
-        std::vector<u8> tempData(data, data + numBytes);
+        // Convert the data into Ogre's own DataStream format. The stream only reads the data, so it can be used without a copy.
 #include "DisableMemoryLeakCheck.h"
-        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&tempData[0], tempData.size(), false));
+        Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream((void*)data, numBytes, false, true));
 #include "EnableMemoryLeakCheck.h"
         // Load up the image as an Ogre CPU image object.
         Ogre::Image image;
         image.load(stream);
 
-        if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
+        uint maxSize = MaxTextureSize();
+        if (maxSize > 0 && std::max(image.getWidth(), image.getHeight()) > maxSize && !Ogre::PixelUtil::isCompressed(image.getFormat()) &&
+            image.getDepth() == 1 && image.getNumFaces() == 1)
         {
-            ogreAssetName = AssetAPI::SanitateAssetRef(this->Name().toStdString()).c_str();
-            ogreTexture = Ogre::TextureManager::getSingleton().loadImage(ogreAssetName.toStdString(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, image);
-        }
-        else // If we're loading on top of an Ogre::Texture we've created before, don't lose the old Ogre::Texture object, but reuse the old.
-        {    // This will allow all existing materials to keep referring to this texture, and they'll get the updated texture image immediately.
-            ogreTexture->freeInternalResources(); 
-
-            if (image.getWidth() != ogreTexture->getWidth() || image.getHeight() != ogreTexture->getHeight() || image.getFormat() != ogreTexture->getFormat())
-            {
-                ogreTexture->setWidth(image.getWidth());
-                ogreTexture->setHeight(image.getHeight());
-                ogreTexture->setFormat(image.getFormat());
-            }
-
-            if (ogreTexture->getBuffer().isNull())
-            {
-                LogError("DeserializeFromData: Failed to create texture " + this->Name() + ": OgreTexture::getBuffer() was null!");
-                return false;
-            }
-
-            Ogre::PixelBox pixelBox(Ogre::Box(0,0, image.getWidth(), image.getHeight()), image.getFormat(), (void*)image.getData());
-            ogreTexture->getBuffer()->blitFromMemory(pixelBox);
-
-            ogreTexture->createInternalResources();
+            float scale = (float)maxSize / std::max(image.getWidth(), image.getHeight());
+            image.resize((Ogre::ushort)std::max(1.f, image.getWidth() * scale), (Ogre::ushort)std::max(1.f, image.getHeight() * scale));
         }
+        LoadImageToTexture(image);
 
         // We did a synchronous load, must call AssetLoadCompleted here.
         assetAPI->AssetLoadCompleted(Name());
@@ -131,6 +146,65 @@ bool TextureAsset::DeserializeFromData(const u8 *data, size_t numBytes, const bo
     }
 }
 
+uint TextureAsset::MaxTextureSize() const
+{
+    OgreRenderer::OgreRenderingModule *module = assetAPI->GetFramework()->GetModule<OgreRenderer::OgreRenderingModule>();
+    return module ? module->MaxTextureSize() : 0;
+}
+
+bool TextureAsset::LoadProcessedTexture(const QString &processedRef)
+{
+    QString processedFile = assetAPI->GetAssetCache()->FindInCache(processedRef);
+    if (processedFile.isEmpty())
+        return false;
+
+    PROFILE(TextureAsset_LoadProcessedTexture);
+    QFile file(processedFile);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        return false;
+    // Map the file so that only the mip levels that are uploaded are read from disk
+    const uchar *data = file.map(0, file.size());
+    if (!data)
+        return false;
+
+    bool success = false;
+    try
+    {
+        Ogre::Image image;
+        if (TextureProcessor::Read(data, (size_t)file.size(), MaxTextureSize(), image))
+        {
+            LoadImageToTexture(image);
+            success = true;
+        }
+    }
+    catch(Ogre::Exception &e)
+    {
+        LogWarning("TextureAsset: Failed to load processed texture of " + Name() + ": " + QString(e.what()));
+    }
+    file.unmap((uchar*)data);
+
+    if (!success)
+        assetAPI->GetAssetCache()->DeleteAsset(processedRef);
+    return success;
+}
+
+void TextureAsset::LoadImageToTexture(const Ogre::Image &image)
+{
+    if (ogreTexture.isNull()) // If we are creating this texture for the first time, create a new Ogre::Texture object.
+    {
+        ogreAssetName = AssetAPI::SanitateAssetRef(this->Name().toStdString()).c_str();
+        ogreTexture = Ogre::TextureManager::getSingleton().loadImage(ogreAssetName.toStdString(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, image);
+    }
+    else // If we're loading on top of an Ogre::Texture we've created before, don't lose the old Ogre::Texture object, but reuse the old.
+    {    // This will allow all existing materials to keep referring to this texture, and they'll get the updated texture image immediately.
+        ogreTexture->unload();
+        // Use the mip levels of the image if it has them, otherwise generate them like for a new texture
+        ogreTexture->setUsage(Ogre::TU_DEFAULT);
+        ogreTexture->setNumMipmaps(image.getNumMipmaps() > 0 ? image.getNumMipmaps() : Ogre::TextureManager::getSingleton().getDefaultNumMipmaps());
+        ogreTexture->loadImage(image);
+    }
+}
+
 void TextureAsset::operationCompleted(Ogre::BackgroundProcessTicket ticket, const Ogre::BackgroundProcessResult &result)
 {
     if (ticket != loadTicket_)
@@ -186,7 +260,27 @@ bool TextureAsset::SerializeTo(std::vector<u8> &data, const QString &serializati
     try
     {
         Ogre::Image newImage;
-        ogreTexture->convertToImage(newImage);
+        if (Ogre::PixelUtil::isCompressed(ogreTexture->getFormat()))
+        {
+            // The texture may have been loaded from its DXT compressed processed form. Export the source image instead, if it is available,
+            // so that the compression is not baked into the exported image.
+            std::vector<u8> source;
+            if (!DiskSource().isEmpty() && LoadFileToVector(DiskSource().toStdString().c_str(), source) && !source.empty())
+            {
+#include "DisableMemoryLeakCheck.h"
+                Ogre::DataStreamPtr stream(new Ogre::MemoryDataStream(&source[0], source.size(), false, true));
+#include "EnableMemoryLeakCheck.h"
+                newImage.load(stream);
+            }
+            else
+            {
+                Ogre::Image compressedImage;
+                ogreTexture->convertToImage(compressedImage);
+                TextureProcessor::Decompress(compressedImage.getPixelBox(), newImage);
+            }
+        }
+        else
+            ogreTexture->convertToImage(newImage);
         std::string formatExtension = serializationParameters.trimmed().toStdString();
         if (formatExtension.empty())
         {
@@ -238,6 +332,12 @@ QImage TextureAsset::ToQImage(Ogre::Texture* tex, size_t faceIndex, size_t mipma
     
     Ogre::Image ogreImage;
     tex->convertToImage(ogreImage);
+    // Textures loaded from the processed form may be DXT compressed, which QImage does not support
+    if (ogreImage.getFormat() == Ogre::PF_DXT1 || ogreImage.getFormat() == Ogre::PF_DXT5)
+    {
+        Ogre::Image compressedImage = ogreImage;
+        TextureProcessor::Decompress(compressedImage.getPixelBox(), ogreImage);
+    }
     QImage::Format fmt;
     switch(ogreImage.getFormat())
     {
@@ -12,6 +12,12 @@
 #include <OgreResourceBackgroundQueue.h>
 
 /// Represents a texture on the GPU.
+/** If texture processing is enabled with --textureprocessing, the first load of a texture also queues its conversion with TextureProcessor
+    to a GPU-ready form with a full mip chain, compressed to DXT if the render system supports it, on a processing thread of
+    OgreRenderingModule. The processed form is stored in the asset cache keyed by the content hash of the source data and the target format.
+    Later loads of the same data read the processed form from the memory-mapped cache file without decoding, and only the mip levels within
+    OgreRenderingModule::MaxTextureSize are uploaded. The first load is done as without processing, by Ogre's background queue when possible.
+    ToQImage and SerializeTo decompress textures loaded in a compressed form. */
 class OGRE_MODULE_API TextureAsset : public IAsset, Ogre::ResourceBackgroundQueue::Listener
 {
     Q_OBJECT
@@ -76,6 +82,16 @@ public:
     
     /// Convert texture to QImage, static version.
     static QImage ToQImage(Ogre::Texture* tex, size_t faceIndex = 0, size_t mipmapLevel = 0);
+
+private:
+    /// Returns the largest texture width or height to load, or 0 if not limited.
+    uint MaxTextureSize() const;
+
+    /// Loads the processed form of the texture from the asset cache, if it is there.
+    bool LoadProcessedTexture(const QString &processedRef);
+
+    /// Creates ogreTexture from an image, or loads the image to the existing ogreTexture.
+    void LoadImageToTexture(const Ogre::Image &image);
 };
 
 typedef boost::shared_ptr<TextureAsset> TextureAssetPtr;
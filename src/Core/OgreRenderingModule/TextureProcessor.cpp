@@ -0,0 +1,426 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "TextureProcessor.h"
+
+#include <OgreImage.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "MemoryLeakCheck.h"
+
+namespace
+{
+    const char cMagic[4] = { 'T', 'T', 'E', 'X' };
+    const size_t cHeaderSize = 4 + 5 * 4;
+
+    /// Appends a little-endian integer of the given number of bytes.
+    void AppendLittleEndian(std::vector<u8> &dest, u64 value, int numBytes)
+    {
+        for(int i = 0; i < numBytes; ++i)
+            dest.push_back((u8)(value >> (8 * i)));
+    }
+
+    u16 To565(int r, int g, int b)
+    {
+        return (u16)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+    }
+
+    /// Expands a 565 color to 8-bit B, G and R.
+    void From565(u16 c, int *bgr)
+    {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        bgr[0] = (b << 3) | (b >> 2);
+        bgr[1] = (g << 2) | (g >> 4);
+        bgr[2] = (r << 3) | (r >> 2);
+    }
+
+    /// Encodes the colors of a block of 16 B8G8R8A8 pixels as a DXT1 color block in 4-color mode.
+    void EncodeColorBlock(const u8 *block, std::vector<u8> &dest)
+    {
+        // Fit the endpoints to the principal axis of the colors. The bounding box of the colors per channel would
+        // pick the wrong diagonal for colors that vary in opposite directions on two channels.
+        float mean[3] = { 0.f, 0.f, 0.f };
+        for(int i = 0; i < 16; ++i)
+            for(int c = 0; c < 3; ++c)
+                mean[c] += block[i * 4 + c] / 16.f;
+        float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f }; // 00, 01, 02, 11, 12, 22
+        for(int i = 0; i < 16; ++i)
+        {
+            const float d[3] = { block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2] };
+            cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+            cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+        }
+        // Power iteration, starting from the channel with the largest variance
+        float axis[3] = { 0.f, 0.f, 0.f };
+        axis[cov[0] >= cov[3] && cov[0] >= cov[5] ? 0 : (cov[3] >= cov[5] ? 1 : 2)] = 1.f;
+        for(int iter = 0; iter < 8; ++iter)
+        {
+            const float v[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+            const float length = std::max(fabs(v[0]), std::max(fabs(v[1]), fabs(v[2])));
+            if (length < 1e-6f)
+                break;
+            for(int c = 0; c < 3; ++c)
+                axis[c] = v[c] / length;
+        }
+        const float axisLengthSq = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float minT = 0.f;
+        float maxT = 0.f;
+        for(int i = 0; i < 16; ++i)
+        {
+            const float t = ((block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2]) / axisLengthSq;
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        // Inset the endpoints slightly, which lowers the error of the interpolated colors
+        const float inset = (maxT - minT) / 16.f;
+        minT += inset;
+        maxT -= inset;
+        int minC[3];
+        int maxC[3];
+        for(int c = 0; c < 3; ++c)
+        {
+            minC[c] = std::min(255, std::max(0, (int)(mean[c] + axis[c] * minT + 0.5f)));
+            maxC[c] = std::min(255, std::max(0, (int)(mean[c] + axis[c] * maxT + 0.5f)));
+        }
+
+        u16 c0 = To565(maxC[2], maxC[1], maxC[0]);
+        u16 c1 = To565(minC[2], minC[1], minC[0]);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        u32 indices = 0;
+        if (c0 != c1)
+        {
+            int palette[4][3];
+            From565(c0, palette[0]);
+            From565(c1, palette[1]);
+            for(int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for(int i = 0; i < 16; ++i)
+            {
+                int best = 0;
+                int bestDistance = 0x7FFFFFFF;
+                for(int j = 0; j < 4; ++j)
+                {
+                    int distance = 0;
+                    for(int c = 0; c < 3; ++c)
+                    {
+                        int d = (int)block[i * 4 + c] - palette[j][c];
+                        distance += d * d;
+                    }
+                    if (distance < bestDistance)
+                    {
+                        best = j;
+                        bestDistance = distance;
+                    }
+                }
+                indices |= (u32)best << (2 * i);
+            }
+        }
+
+        AppendLittleEndian(dest, c0, 2);
+        AppendLittleEndian(dest, c1, 2);
+        AppendLittleEndian(dest, indices, 4);
+    }
+
+    /// Returns whether B8G8R8A8 pixels look like a tangent space normal map: nearly all of them decode to unit vectors facing outwards.
+    /** DXT interpolates the channels of a normal map independently, which shows as blocky lighting, so normal maps are not compressed. */
+    bool LooksLikeNormalMap(const std::vector<u8> &pixels)
+    {
+        const size_t numPixels = pixels.size() / 4;
+        size_t numNormals = 0;
+        for(size_t i = 0; i < numPixels; ++i)
+        {
+            const float x = pixels[i * 4 + 2] / 127.5f - 1.f;
+            const float y = pixels[i * 4 + 1] / 127.5f - 1.f;
+            const float z = pixels[i * 4] / 127.5f - 1.f;
+            const float lengthSq = x * x + y * y + z * z;
+            if (z > 0.f && lengthSq > 0.8f && lengthSq < 1.2f)
+                ++numNormals;
+        }
+        return numNormals >= numPixels - numPixels / 20;
+    }
+
+    /// Decodes a DXT1 color block to 16 B8G8R8A8 pixels. If the block is in 3-color mode, the fourth color is transparent black.
+    void DecodeColorBlock(const u8 *src, u8 *block, bool setAlpha)
+    {
+        const u16 c0 = (u16)(src[0] | (src[1] << 8));
+        const u16 c1 = (u16)(src[2] | (src[3] << 8));
+        int palette[4][4];
+        From565(c0, palette[0]);
+        From565(c1, palette[1]);
+        palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+        for(int c = 0; c < 3; ++c)
+        {
+            if (c0 > c1)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        if (c0 <= c1)
+            palette[3][3] = 0;
+        const u32 indices = src[4] | (src[5] << 8) | (src[6] << 16) | ((u32)src[7] << 24);
+        for(int i = 0; i < 16; ++i)
+        {
+            const int *color = palette[(indices >> (2 * i)) & 3];
+            for(int c = 0; c < 3; ++c)
+                block[i * 4 + c] = (u8)color[c];
+            if (setAlpha)
+                block[i * 4 + 3] = (u8)color[3];
+        }
+    }
+
+    /// Decodes a DXT5 alpha block to the alphas of 16 B8G8R8A8 pixels.
+    void DecodeAlphaBlock(const u8 *src, u8 *block)
+    {
+        const int a0 = src[0];
+        const int a1 = src[1];
+        int palette[8] = { a0, a1 };
+        if (a0 > a1)
+            for(int j = 1; j < 7; ++j)
+                palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+        else
+        {
+            for(int j = 1; j < 5; ++j)
+                palette[j + 1] = ((5 - j) * a0 + j * a1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        u64 indices = 0;
+        for(int i = 0; i < 6; ++i)
+            indices |= (u64)src[2 + i] << (8 * i);
+        for(int i = 0; i < 16; ++i)
+            block[i * 4 + 3] = (u8)palette[(indices >> (3 * i)) & 7];
+    }
+
+    /// Encodes the alphas of a block of 16 B8G8R8A8 pixels as a DXT5 alpha block in 8-alpha mode.
+    void EncodeAlphaBlock(const u8 *block, std::vector<u8> &dest)
+    {
+        int a0 = 0;
+        int a1 = 255;
+        for(int i = 0; i < 16; ++i)
+        {
+            a0 = std::max(a0, (int)block[i * 4 + 3]);
+            a1 = std::min(a1, (int)block[i * 4 + 3]);
+        }
+
+        u64 indices = 0;
+        if (a0 != a1)
+        {
+            int palette[8] = { a0, a1 };
+            for(int j = 1; j < 7; ++j)
+                palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+            for(int i = 0; i < 16; ++i)
+            {
+                int best = 0;
+                for(int j = 1; j < 8; ++j)
+                    if (abs(block[i * 4 + 3] - palette[j]) < abs(block[i * 4 + 3] - palette[best]))
+                        best = j;
+                indices |= (u64)best << (3 * i);
+            }
+        }
+
+        dest.push_back((u8)a0);
+        dest.push_back((u8)a1);
+        AppendLittleEndian(dest, indices, 6);
+    }
+}
+
+bool TextureProcessor::CanProcess(const Ogre::Image &image)
+{
+    Ogre::PixelFormat format = image.getFormat();
+    return format != Ogre::PF_UNKNOWN && !Ogre::PixelUtil::isCompressed(format) && !Ogre::PixelUtil::isFloatingPoint(format) &&
+        image.getDepth() == 1 && image.getNumFaces() == 1 && image.getWidth() > 0 && image.getHeight() > 0;
+}
+
+bool TextureProcessor::CanProcessSource(const u8 *data, size_t numBytes)
+{
+    static const char * const cUnprocessableMagics[] = { "DDS ", "\xABKTX", "PVR\x03", "\x76\x2F\x31\x01", "#?RA", "#?RG", cMagic };
+    if (!data || numBytes < 4)
+        return false;
+    for(size_t i = 0; i < sizeof(cUnprocessableMagics) / sizeof(cUnprocessableMagics[0]); ++i)
+        if (memcmp(data, cUnprocessableMagics[i], 4) == 0)
+            return false;
+    // Legacy PVR files have their magic after the header fields
+    if (numBytes >= 48 && memcmp(data + 44, "PVR!", 4) == 0)
+        return false;
+    return true;
+}
+
+bool TextureProcessor::Process(const Ogre::Image &image, bool compress, std::vector<u8> &dest)
+{
+    if (!CanProcess(image))
+        return false;
+
+    const size_t width = image.getWidth();
+    const size_t height = image.getHeight();
+    std::vector<std::vector<u8> > levels(1, std::vector<u8>(width * height * 4));
+    Ogre::PixelBox pixels(width, height, 1, Ogre::PF_BYTE_BGRA, &levels[0][0]);
+    Ogre::PixelUtil::bulkPixelConversion(image.getPixelBox(), pixels);
+
+    bool alpha = false;
+    for(size_t i = 3; i < levels[0].size() && !alpha; i += 4)
+        alpha = levels[0][i] != 255;
+
+    BuildMipChain(levels, width, height);
+
+    compress = compress && width % 4 == 0 && height % 4 == 0 && !LooksLikeNormalMap(levels[0]);
+    Ogre::PixelFormat format = compress ? (alpha ? Ogre::PF_DXT5 : Ogre::PF_DXT1) : Ogre::PF_BYTE_BGRA;
+
+    dest.clear();
+    dest.resize(cHeaderSize);
+    memcpy(&dest[0], cMagic, 4);
+    u32 header[5] = { cVersion, (u32)format, (u32)width, (u32)height, (u32)levels.size() };
+    memcpy(&dest[4], header, sizeof header);
+
+    size_t levelWidth = width;
+    size_t levelHeight = height;
+    for(size_t i = 0; i < levels.size(); ++i)
+    {
+        if (compress)
+            CompressLevel(&levels[i][0], levelWidth, levelHeight, alpha, dest);
+        else
+            dest.insert(dest.end(), levels[i].begin(), levels[i].end());
+        levelWidth = std::max<size_t>(1, levelWidth / 2);
+        levelHeight = std::max<size_t>(1, levelHeight / 2);
+    }
+    return true;
+}
+
+bool TextureProcessor::Read(const u8 *data, size_t numBytes, uint maxSize, Ogre::Image &image)
+{
+    if (!data || numBytes < cHeaderSize || memcmp(data, cMagic, 4) != 0)
+        return false;
+
+    u32 header[5];
+    memcpy(header, data + 4, sizeof header);
+    const Ogre::PixelFormat format = (Ogre::PixelFormat)header[1];
+    const u32 numLevels = header[4];
+    if (header[0] != cVersion || (format != Ogre::PF_DXT1 && format != Ogre::PF_DXT5 && format != Ogre::PF_BYTE_BGRA) ||
+        header[2] == 0 || header[3] == 0 || numLevels == 0 || numLevels > 32)
+        return false;
+
+    // Find the first mip level within the size limit and check that all the levels are present
+    size_t width = header[2];
+    size_t height = header[3];
+    size_t offset = cHeaderSize;
+    size_t firstOffset = 0;
+    size_t firstWidth = 0;
+    size_t firstHeight = 0;
+    u32 firstLevel = numLevels;
+    for(u32 i = 0; i < numLevels; ++i)
+    {
+        if (firstLevel == numLevels && (maxSize == 0 || std::max(width, height) <= maxSize || i == numLevels - 1))
+        {
+            firstLevel = i;
+            firstOffset = offset;
+            firstWidth = width;
+            firstHeight = height;
+        }
+        offset += Ogre::PixelUtil::getMemorySize(width, height, 1, format);
+        width = std::max<size_t>(1, width / 2);
+        height = std::max<size_t>(1, height / 2);
+    }
+    if (offset > numBytes)
+        return false;
+
+    image.loadDynamicImage((Ogre::uchar *)data + firstOffset, firstWidth, firstHeight, 1, format, false, 1, numLevels - 1 - firstLevel);
+    return true;
+}
+
+bool TextureProcessor::Decompress(const Ogre::PixelBox &src, Ogre::Image &dest)
+{
+    if ((src.format != Ogre::PF_DXT1 && src.format != Ogre::PF_DXT5) || src.getDepth() != 1 || !src.data)
+        return false;
+
+    const size_t width = src.getWidth();
+    const size_t height = src.getHeight();
+    const size_t blockSize = src.format == Ogre::PF_DXT1 ? 8 : 16;
+    Ogre::uchar *pixels = OGRE_ALLOC_T(Ogre::uchar, width * height * 4, Ogre::MEMCATEGORY_GENERAL);
+    const u8 *blocks = static_cast<const u8*>(src.data);
+    u8 block[16 * 4];
+    for(size_t by = 0; by < height; by += 4)
+        for(size_t bx = 0; bx < width; bx += 4)
+        {
+            if (src.format == Ogre::PF_DXT5)
+            {
+                DecodeAlphaBlock(blocks, block);
+                DecodeColorBlock(blocks + 8, block, false);
+            }
+            else
+                DecodeColorBlock(blocks, block, true);
+            blocks += blockSize;
+            for(size_t y = 0; y < 4 && by + y < height; ++y)
+                for(size_t x = 0; x < 4 && bx + x < width; ++x)
+                    memcpy(pixels + ((by + y) * width + bx + x) * 4, block + (y * 4 + x) * 4, 4);
+        }
+    dest.loadDynamicImage(pixels, width, height, 1, Ogre::PF_BYTE_BGRA, true);
+    return true;
+}
+
+void TextureProcessor::BuildMipChain(std::vector<std::vector<u8> > &levels, size_t width, size_t height)
+{
+    while(width > 1 || height > 1)
+    {
+        const size_t newWidth = std::max<size_t>(1, width / 2);
+        const size_t newHeight = std::max<size_t>(1, height / 2);
+        levels.push_back(std::vector<u8>(newWidth * newHeight * 4));
+        const std::vector<u8> &src = levels[levels.size() - 2];
+        std::vector<u8> &dst = levels.back();
+        // Box filter, which repeats the last row or column of an image that is only 1 pixel wide or high
+        for(size_t y = 0; y < newHeight; ++y)
+        {
+            const size_t y0 = std::min(2 * y, height - 1);
+            const size_t y1 = std::min(2 * y + 1, height - 1);
+            for(size_t x = 0; x < newWidth; ++x)
+            {
+                const size_t x0 = std::min(2 * x, width - 1);
+                const size_t x1 = std::min(2 * x + 1, width - 1);
+                for(size_t c = 0; c < 4; ++c)
+                {
+                    int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+                        src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                    dst[(y * newWidth + x) * 4 + c] = (u8)((sum + 2) / 4);
+                }
+            }
+        }
+        width = newWidth;
+        height = newHeight;
+    }
+}
+
+void TextureProcessor::CompressLevel(const u8 *pixels, size_t width, size_t height, bool alpha, std::vector<u8> &dest)
+{
+    // The mip levels below 4x4 pixels are still stored as whole blocks, which repeat the edge pixels
+    u8 block[16 * 4];
+    for(size_t by = 0; by < height; by += 4)
+        for(size_t bx = 0; bx < width; bx += 4)
+        {
+            for(size_t y = 0; y < 4; ++y)
+                for(size_t x = 0; x < 4; ++x)
+                {
+                    const u8 *src = pixels + (std::min(by + y, height - 1) * width + std::min(bx + x, width - 1)) * 4;
+                    memcpy(block + (y * 4 + x) * 4, src, 4);
+                }
+            if (alpha)
+                EncodeAlphaBlock(block, dest);
+            EncodeColorBlock(block, dest);
+        }
+}
@@ -0,0 +1,56 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "OgreModuleApi.h"
+#include "CoreTypes.h"
+
+#include <OgrePixelFormat.h>
+
+#include <vector>
+
+namespace Ogre { class Image; }
+
+/// Converts decoded textures to a GPU-ready form with a precomputed mip chain, and reads the converted form back without decoding.
+/** The conversion is thread-safe, and is run on the texture processing threads of OgreRenderingModule. The processed form is stored
+    in the asset cache, so that source images are decoded and mipmapped only once.
+    Layout, in native byte order: the bytes "TTEX", u32 version, u32 Ogre::PixelFormat, u32 width, u32 height, u32 number of mip levels,
+    followed by the pixel data of each mip level from the largest to the smallest, each level half the size of the previous one
+    as in Ogre::Image. */
+class OGRE_MODULE_API TextureProcessor
+{
+public:
+    /// Current version of the processed form.
+    static const u32 cVersion = 2;
+
+    /// Returns whether an image can be processed. Compressed images, cube maps and volume textures are loaded as they are.
+    static bool CanProcess(const Ogre::Image &image);
+
+    /// Returns whether source data may be processable, judging by its file header only, so that the data needs no decoding.
+    /** DDS, KTX and PVR files are GPU-ready formats that are loaded as they are, and OpenEXR and Radiance HDR images are floating point. */
+    static bool CanProcessSource(const u8 *data, size_t numBytes);
+
+    /// Converts an image to the processed form.
+    /** @param image Decoded source image.
+        @param compress If true, the mip levels are compressed to DXT1, or DXT5 if the image has translucent pixels.
+            Images whose size is not a multiple of 4 and images that look like normal maps are not compressed.
+        @param dest [out] The processed data.
+        @return false if the image can not be processed. */
+    static bool Process(const Ogre::Image &image, bool compress, std::vector<u8> &dest);
+
+    /// Sets up an image over processed data, skipping the mip levels larger than the given size.
+    /** The image refers to the data, so the data must outlive the image.
+        @param maxSize Largest allowed width or height, or 0 for no limit. The smallest mip level is used even if it is larger.
+        @return false if the data is not valid processed data of the current version. */
+    static bool Read(const u8 *data, size_t numBytes, uint maxSize, Ogre::Image &image);
+
+    /// Decodes a DXT1 or DXT5 compressed pixel box to a B8G8R8A8 image, for reading back compressed textures.
+    /** @return false if the pixel box is in another format. */
+    static bool Decompress(const Ogre::PixelBox &src, Ogre::Image &dest);
+
+private:
+    /// Builds the mip chain of a B8G8R8A8 image. Each level is appended to the chain, starting from the given level.
+    static void BuildMipChain(std::vector<std::vector<u8> > &levels, size_t width, size_t height);
+    /// Compresses one mip level of B8G8R8A8 pixels to DXT1 or DXT5 blocks.
+    static void CompressLevel(const u8 *pixels, size_t width, size_t height, bool alpha, std::vector<u8> &dest);
+};
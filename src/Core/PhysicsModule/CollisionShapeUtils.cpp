@@ -12,9 +12,22 @@
 
 #include <Ogre.h>
 
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cstring>
+
 namespace Physics
 {
 
+namespace
+{
+    /// Serializes the use of the hull library, which keeps intermediate results in static variables.
+    /** At namespace scope, so that it is constructed before the worker threads start. The construction of a function-local
+        static is not thread-safe on all supported compilers. */
+    QMutex hullMutex;
+}
+
 void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr)
 {
     std::vector<float3> triangles;
@@ -34,6 +47,27 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
         return;
     }
     
+    if (!GenerateConvexHullSet(vertices, ptr))
+        LogError("No vertices were generated; aborting convex hull generation");
+}
+
+void GenerateTriangleMeshShape(const std::vector<float3>& triangles, TriangleMeshShape* ptr)
+{
+    ptr->mesh_ = boost::shared_ptr<btTriangleMesh>(new btTriangleMesh());
+    for(uint i = 0; i + 2 < triangles.size(); i += 3)
+        ptr->mesh_->addTriangle(triangles[i], triangles[i+1], triangles[i+2]);
+    // Bullet can not build a hierarchy of an empty mesh
+    if (ptr->mesh_->getNumTriangles() > 0)
+        ptr->shape_ = boost::shared_ptr<btBvhTriangleMeshShape>(new btBvhTriangleMeshShape(ptr->mesh_.get(), true, true));
+}
+
+bool GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr)
+{
+    if (!vertices.size())
+        return false;
+    
+    QMutexLocker lock(&hullMutex);
+    
     StanHull::HullDesc desc;
     desc.SetHullFlag(StanHull::QF_TRIANGLES);
     desc.mVcount = vertices.size();
@@ -46,10 +80,7 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     lib.CreateConvexHull(desc, result);
 
     if (!result.mNumOutputVertices)
-    {
-        LogError("No vertices were generated; aborting convex hull generation");
-        return;
-    }
+        return false;
     
     ConvexHull hull;
     hull.position_ = float3(0,0,0);
@@ -58,6 +89,61 @@ void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr)
     ptr->hulls_.push_back(hull);
     
     lib.ReleaseResult(result);
+    return true;
+}
+
+void SerializeConvexHullSet(const ConvexHullSet& hullSet, std::vector<u8>& dest)
+{
+    // Layout: u32 number of hulls, then for each hull its position, u32 number of points and the points, all as floats.
+    std::vector<u32> words;
+    words.push_back((u32)hullSet.hulls_.size());
+    for(size_t i = 0; i < hullSet.hulls_.size(); ++i)
+    {
+        const ConvexHull& hull = hullSet.hulls_[i];
+        const int numPoints = hull.hull_ ? hull.hull_->getNumPoints() : 0;
+        words.resize(words.size() + 3);
+        memcpy(&words[words.size() - 3], &hull.position_, sizeof(float3));
+        words.push_back((u32)numPoints);
+        for(int j = 0; j < numPoints; ++j)
+        {
+            const btVector3& point = hull.hull_->getUnscaledPoints()[j];
+            const float coords[3] = { point.x(), point.y(), point.z() };
+            words.resize(words.size() + 3);
+            memcpy(&words[words.size() - 3], coords, sizeof coords);
+        }
+    }
+    dest.resize(words.size() * sizeof(u32));
+    memcpy(&dest[0], &words[0], dest.size());
+}
+
+bool DeserializeConvexHullSet(const u8* data, size_t numBytes, ConvexHullSet* ptr)
+{
+    if (!data || numBytes % sizeof(u32) != 0 || numBytes < sizeof(u32))
+        return false;
+    std::vector<u32> words(numBytes / sizeof(u32));
+    memcpy(&words[0], data, numBytes);
+    
+    size_t pos = 0;
+    const u32 numHulls = words[pos++];
+    std::vector<ConvexHull> hulls;
+    for(u32 i = 0; i < numHulls; ++i)
+    {
+        if (words.size() - pos < 4)
+            return false;
+        ConvexHull hull;
+        memcpy(&hull.position_, &words[pos], sizeof(float3));
+        pos += 3;
+        const u32 numPoints = words[pos++];
+        if (numPoints == 0 || (words.size() - pos) / 3 < numPoints)
+            return false;
+        hull.hull_ = boost::shared_ptr<btConvexHullShape>(new btConvexHullShape((const btScalar*)&words[pos], numPoints, 3 * sizeof(float)));
+        pos += numPoints * 3;
+        hulls.push_back(hull);
+    }
+    if (pos != words.size() || hulls.empty())
+        return false;
+    ptr->hulls_.swap(hulls);
+    return true;
 }
 
 void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest)
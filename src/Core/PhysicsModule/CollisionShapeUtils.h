@@ -9,6 +9,8 @@
 class btConvexHullShape;
 class btTriangleMesh;
 
+#include <vector>
+
 namespace Ogre
 {
     class Mesh;
@@ -17,10 +19,26 @@ namespace Ogre
 namespace Physics
 {
     struct ConvexHullSet;
+    struct TriangleMeshShape;
 
     void GenerateTriangleMesh(Ogre::Mesh* mesh, btTriangleMesh* ptr);
     void GetTrianglesFromMesh(Ogre::Mesh* mesh, std::vector<float3>& dest);
     void GenerateConvexHullSet(Ogre::Mesh* mesh, ConvexHullSet* ptr);
+
+    /// Builds a triangle mesh and its bounding volume hierarchy from triangle vertices, as returned by GetTrianglesFromMesh.
+    /** Does not access Ogre or log, so can be called from a worker thread. */
+    void GenerateTriangleMeshShape(const std::vector<float3>& triangles, TriangleMeshShape* ptr);
+    /// Generates a convex hull set from triangle vertices, as returned by GetTrianglesFromMesh.
+    /** Does not access Ogre or log, so can be called from a worker thread. Calls from several threads are serialized,
+        as the hull library is not reentrant.
+        @return false if no hull could be generated */
+    bool GenerateConvexHullSet(const std::vector<float3>& vertices, ConvexHullSet* ptr);
+
+    /// Serializes a convex hull set for storing in the asset cache.
+    void SerializeConvexHullSet(const ConvexHullSet& hullSet, std::vector<u8>& dest);
+    /// Deserializes a convex hull set serialized with SerializeConvexHullSet.
+    /** @return false if the data is not a valid serialized convex hull set */
+    bool DeserializeConvexHullSet(const u8* data, size_t numBytes, ConvexHullSet* ptr);
 }
 
 
@@ -7,6 +7,8 @@
 #include "Math/float3.h"
 
 class btConvexHullShape;
+class btTriangleMesh;
+class btBvhTriangleMeshShape;
 
 namespace Physics
 {
@@ -21,5 +23,12 @@ struct ConvexHullSet
 {
     std::vector<ConvexHull> hulls_;
 };
+
+/// Triangle mesh and its bounding volume hierarchy. Shared by the scaled trimesh shapes of all rigid bodies using the same mesh.
+struct TriangleMeshShape
+{
+    boost::shared_ptr<btTriangleMesh> mesh_;
+    boost::shared_ptr<btBvhTriangleMeshShape> shape_; ///< Refers to mesh_, so declared after it to be destroyed first.
+};
 /** @endcond */
 }
@@ -58,17 +58,24 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
     collisionLayer(this, "Collision Layer", -1),
     collisionMask(this, "Collision Mask", -1),
     body_(0),
+    hasPendingTransform_(false),
     world_(0),
     shape_(0),
-    childShape_(0),
     heightField_(0),
+    heightFieldMinY_(0.f),
+    heightFieldMaxY_(0.f),
+    heightFieldRevision_(0),
+    growHeightFieldRange_(false),
     disconnected_(false),
     cachedShapeType_(-1),
     cachedSize_(float3::zero)
 {
     owner_ = framework->GetModule<PhysicsModule>();
+    if (owner_)
+        connect(owner_, SIGNAL(CollisionShapeReady(const QString &)), this, SLOT(OnCollisionShapeReady(const QString &)));
     
     static AttributeMetadata shapemetadata;
+    static AttributeMetadata velocitymetadata;
     static bool metadataInitialized = false;
     if(!metadataInitialized)
     {
@@ -79,9 +86,13 @@ EC_RigidBody::EC_RigidBody(Scene* scene) :
         shapemetadata.enums[Shape_TriMesh] = "TriMesh";
         shapemetadata.enums[Shape_HeightField] = "HeightField";
         shapemetadata.enums[Shape_ConvexHull] = "ConvexHull";
+        // Velocities are replicated as half floats when the connection supports it
+        velocitymetadata.networkEncoding = AttributeMetadata::Quantized;
         metadataInitialized = true;
     }
     shapeType.SetMetadata(&shapemetadata);
+    linearVelocity.SetMetadata(&velocitymetadata);
+    angularVelocity.SetMetadata(&velocitymetadata);
 
     connect(this, SIGNAL(ParentEntitySet()), SLOT(UpdateSignals()));
     connect(this, SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), SLOT(OnAttributeUpdated(IAttribute*)));
@@ -129,6 +140,8 @@ void EC_RigidBody::SetAngularVelocity(const float3& velocity)
 
 void EC_RigidBody::ApplyForce(const float3& force, const float3& position)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -151,6 +164,8 @@ void EC_RigidBody::ApplyForce(const float3& force, const float3& position)
 
 void EC_RigidBody::ApplyTorque(const float3& torque)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -170,6 +185,8 @@ void EC_RigidBody::ApplyTorque(const float3& torque)
 
 void EC_RigidBody::ApplyImpulse(const float3& impulse, const float3& position)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -192,6 +209,8 @@ void EC_RigidBody::ApplyImpulse(const float3& impulse, const float3& position)
 
 void EC_RigidBody::ApplyTorqueImpulse(const float3& torqueImpulse)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -211,6 +230,8 @@ void EC_RigidBody::ApplyTorqueImpulse(const float3& torqueImpulse)
 
 void EC_RigidBody::Activate()
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -223,12 +244,16 @@ void EC_RigidBody::Activate()
 
 void EC_RigidBody::KeepActive()
 {
+    WaitForStep();
+    
     if (body_)
         body_->activate(true);
 }
 
 bool EC_RigidBody::IsActive()
 {
+    WaitForStep();
+    
     if (body_)
         return body_->isActive();
     else
@@ -237,6 +262,8 @@ bool EC_RigidBody::IsActive()
 
 void EC_RigidBody::ResetForces()
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -283,6 +310,9 @@ void EC_RigidBody::CheckForPlaceableAndTerrain()
         {
             terrain_ = terrain;
             connect(terrain.get(), SIGNAL(TerrainRegenerated()), this, SLOT(OnTerrainRegenerated()));
+            connect(terrain.get(), SIGNAL(HeightsChanged(int, int, int, int)), this, SLOT(OnTerrainHeightsChanged(int, int, int, int)));
+            connect(terrain.get(), SIGNAL(HeightsAboutToChange()), this, SLOT(OnTerrainHeightsAboutToChange()));
+            connect(terrain.get(), SIGNAL(destroyed()), this, SLOT(OnTerrainDestroyed()));
             connect(terrain.get(), SIGNAL(AttributeChanged(IAttribute*, AttributeChange::Type)), this, SLOT(TerrainUpdated(IAttribute*)));
         }
     }
@@ -317,11 +347,10 @@ void EC_RigidBody::CreateCollisionShape()
         shape_ = new btCapsuleShape(sizeVec.x * 0.5f, sizeVec.y * 0.5f);
         break;
     case Shape_TriMesh:
-        if (triangleMesh_)
+        if (triangleMesh_ && triangleMesh_->shape_)
         {
-            // Need to first create a bvhTriangleMeshShape, then a scaled version of it to allow for individual scaling.
-            childShape_ = new btBvhTriangleMeshShape(triangleMesh_.get(), true, true);
-            shape_ = new btScaledBvhTriangleMeshShape(static_cast<btBvhTriangleMeshShape*>(childShape_), btVector3(1.0f, 1.0f, 1.0f));
+            // The bvhTriangleMeshShape is shared, so create a scaled version of it to allow for individual scaling.
+            shape_ = new btScaledBvhTriangleMeshShape(triangleMesh_->shape_.get(), btVector3(1.0f, 1.0f, 1.0f));
         }
         break;
     case Shape_HeightField:
@@ -340,6 +369,8 @@ void EC_RigidBody::CreateCollisionShape()
 
 void EC_RigidBody::RemoveCollisionShape()
 {
+    WaitForStep();
+    
     if (shape_)
     {
         if (body_)
@@ -347,11 +378,6 @@ void EC_RigidBody::RemoveCollisionShape()
         delete shape_;
         shape_ = 0;
     }
-    if (childShape_)
-    {
-        delete childShape_;
-        childShape_ = 0;
-    }
     if (heightField_)
     {
         delete heightField_;
@@ -383,6 +409,8 @@ void EC_RigidBody::CreateBody()
 
 void EC_RigidBody::ReaddBody()
 {
+    WaitForStep();
+    
     if ((!world_) || (!ParentEntity()) || (!body_))
         return;
     
@@ -409,6 +437,8 @@ void EC_RigidBody::RemoveBody()
     if ((body_) && (world_))
     {
         world_->GetWorld()->removeRigidBody(body_);
+        world_->ForgetBody(this);
+        hasPendingTransform_ = false;
         delete body_;
         body_ = 0;
     }
@@ -416,6 +446,13 @@ void EC_RigidBody::RemoveBody()
 
 void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 {
+    // During a step on the physics thread, use the transform captured before the step
+    if (world_ && world_->stepping_)
+    {
+        worldTrans = kinematicTransform_;
+        return;
+    }
+    
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable)
         return;
@@ -429,6 +466,18 @@ void EC_RigidBody::getWorldTransform(btTransform &worldTrans) const
 
 void EC_RigidBody::setWorldTransform(const btTransform &worldTrans)
 {
+    // During a step on the physics thread, buffer the transform for PhysicsWorld to apply on the main thread
+    if (world_ && world_->stepping_)
+    {
+        pendingTransform_ = worldTrans;
+        if (!hasPendingTransform_)
+        {
+            hasPendingTransform_ = true;
+            world_->AddPendingTransform(this);
+        }
+        return;
+    }
+    
     // Cannot modify server-authoritative physics object, rather get the transform changes through placeable attributes
     if (!HasAuthority())
         return;
@@ -482,6 +531,75 @@ void EC_RigidBody::OnTerrainRegenerated()
         CreateCollisionShape();
 }
 
+void EC_RigidBody::OnTerrainHeightsChanged(int x, int y, int width, int height)
+{
+    if (shapeType.Get() != Shape_HeightField)
+        return;
+    
+    PROFILE(EC_RigidBody_OnTerrainHeightsChanged);
+    
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (!terrain)
+        return;
+    
+    // The heightfield reads the heights of the terrain in place, so only a reallocated or requantized height field needs a new shape
+    const TerrainHeightField& field = terrain->HeightField();
+    if (!heightField_ || field.Revision() != heightFieldRevision_)
+    {
+        CreateCollisionShape();
+        return;
+    }
+    
+    // The height range sets the bounds and the placement of the heightfield, so an edit outside it also needs a new shape
+    for(int z = std::max(0, y); z < std::min(field.Height(), y + height); ++z)
+        for(int i = std::max(0, x); i < std::min(field.Width(), x + width); ++i)
+        {
+            float value = field.Get(i, z);
+            if (value < heightFieldMinY_ || value > heightFieldMaxY_)
+            {
+                growHeightFieldRange_ = true;
+                CreateCollisionShape();
+                return;
+            }
+        }
+    
+    if (!body_ || !world_)
+        return;
+    
+    // Drop the cached contacts against the old surface, and wake up the bodies that were touching the terrain so that they react to the change
+    btDiscreteDynamicsWorld* world = world_->GetWorld();
+    btBroadphaseProxy* proxy = body_->getBroadphaseHandle();
+    if (!proxy)
+        return;
+    btOverlappingPairCache* pairCache = world->getBroadphase()->getOverlappingPairCache();
+    btBroadphasePairArray& pairs = pairCache->getOverlappingPairArray();
+    for(int i = 0; i < pairs.size(); ++i)
+    {
+        btBroadphaseProxy* other = 0;
+        if (pairs[i].m_pProxy0 == proxy)
+            other = pairs[i].m_pProxy1;
+        else if (pairs[i].m_pProxy1 == proxy)
+            other = pairs[i].m_pProxy0;
+        if (other)
+            static_cast<btCollisionObject*>(other->m_clientObject)->activate();
+    }
+    pairCache->cleanProxyFromPairs(proxy, world->getDispatcher());
+}
+
+void EC_RigidBody::OnTerrainHeightsAboutToChange()
+{
+    // The heightfield shape reads the heights of the terrain during the step
+    if (heightField_)
+        WaitForStep();
+}
+
+void EC_RigidBody::OnTerrainDestroyed()
+{
+    terrain_.reset();
+    if (shapeType.Get() == Shape_HeightField)
+        CreateCollisionShape();
+}
+
 void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
 {
     OgreMeshAsset *meshAsset = dynamic_cast<OgreMeshAsset*>(asset.get());
@@ -489,18 +607,20 @@ void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
         LogError("EC_RigidBody::OnCollisionMeshAssetLoaded: Mesh asset load finished for asset \"" +
             asset->Name() + "\", but Ogre::Mesh pointer was null!");
 
-    Ogre::Mesh *mesh = meshAsset->ogreMesh.get();
+    Ogre::Mesh *mesh = meshAsset ? meshAsset->ogreMesh.get() : 0;
 
     if (mesh)
     {
+        // If the shape is still being generated, OnCollisionShapeReady calls this again when it is done
+        collisionMeshAsset_ = asset;
         if (shapeType.Get() == Shape_TriMesh)
         {
-            triangleMesh_ = owner_->GetTriangleMeshFromOgreMesh(mesh);
+            triangleMesh_ = owner_->GetTriangleMeshShape(meshAsset);
             CreateCollisionShape();
         }
         if (shapeType.Get() == Shape_ConvexHull)
         {
-            convexHullSet_ = owner_->GetConvexHullSetFromOgreMesh(mesh);
+            convexHullSet_ = owner_->GetConvexHullSet(meshAsset);
             CreateCollisionShape();
         }
 
@@ -509,8 +629,17 @@ void EC_RigidBody::OnCollisionMeshAssetLoaded(AssetPtr asset)
     }
 }
 
+void EC_RigidBody::OnCollisionShapeReady(const QString &meshName)
+{
+    AssetPtr asset = collisionMeshAsset_.lock();
+    if (asset && asset->Name() == meshName && (shapeType.Get() == Shape_TriMesh || shapeType.Get() == Shape_ConvexHull))
+        OnCollisionMeshAssetLoaded(asset);
+}
+
 void EC_RigidBody::OnAttributeUpdated(IAttribute* attribute)
 {
+    WaitForStep();
+    
     if (disconnected_)
         return;
     
@@ -605,6 +734,8 @@ void EC_RigidBody::OnAttributeUpdated(IAttribute* attribute)
 
 void EC_RigidBody::PlaceableUpdated(IAttribute* attribute)
 {
+    WaitForStep();
+    
     // Do not respond to our own change
     if ((disconnected_) || (!body_))
         return;
@@ -630,10 +761,24 @@ void EC_RigidBody::OnAboutToUpdate()
     EC_Placeable* placeable = placeable_.lock().get();
     if (placeable && !placeable->parentRef.Get().IsEmpty() && placeable->IsAttached())
         UpdatePosRotFromPlaceable();
+    
+    // Bullet reads the transforms of kinematic bodies during the step, which on the physics thread has to use a copy
+    if (placeable && body_ && body_->isKinematicObject() && world_->GetThreadedStepping())
+    {
+        kinematicTransform_.setOrigin(placeable->WorldPosition());
+        kinematicTransform_.setRotation(placeable->WorldOrientation());
+    }
+    
+    // The terrain may have reallocated or requantized its heights without regenerating, which the heightfield must not read stale
+    EC_Terrain* terrain = terrain_.lock().get();
+    if (heightField_ && terrain && terrain->HeightField().Revision() != heightFieldRevision_)
+        CreateCollisionShape();
 }
 
 void EC_RigidBody::SetRotation(const float3& rotation)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -662,6 +807,8 @@ void EC_RigidBody::SetRotation(const float3& rotation)
 
 void EC_RigidBody::Rotate(const float3& rotation)
 {
+    WaitForStep();
+    
     // Cannot modify server-authoritative physics object
     if (!HasAuthority())
         return;
@@ -690,6 +837,8 @@ void EC_RigidBody::Rotate(const float3& rotation)
 
 float3 EC_RigidBody::GetLinearVelocity()
 {
+    WaitForStep();
+    
     if (body_)
         return body_->getLinearVelocity();
     else 
@@ -698,6 +847,8 @@ float3 EC_RigidBody::GetLinearVelocity()
 
 float3 EC_RigidBody::GetAngularVelocity()
 {
+    WaitForStep();
+    
     if (body_)
         return RadToDeg(body_->getAngularVelocity());
     else
@@ -706,12 +857,26 @@ float3 EC_RigidBody::GetAngularVelocity()
 
 void EC_RigidBody::GetAabbox(float3 &outAabbMin, float3 &outAabbMax)
 {
+    WaitForStep();
+    
     btVector3 aabbMin, aabbMax;
     body_->getAabb(aabbMin, aabbMax);
     outAabbMin.Set(aabbMin.x(), aabbMin.y(), aabbMin.z());
     outAabbMax.Set(aabbMax.x(), aabbMax.y(), aabbMax.z());
 }
 
+btRigidBody* EC_RigidBody::GetRigidBody() const
+{
+    WaitForStep();
+    return body_;
+}
+
+void EC_RigidBody::WaitForStep() const
+{
+    if (world_)
+        world_->WaitForStep();
+}
+
 bool EC_RigidBody::HasAuthority() const
 {
     if ((!world_) || ((world_->IsClient()) && (!ParentEntity()->IsLocal())))
@@ -722,6 +887,8 @@ bool EC_RigidBody::HasAuthority() const
 
 AABB EC_RigidBody::ShapeAABB() const
 {
+    WaitForStep();
+    
     btVector3 aabbMin, aabbMax;
     body_->getAabb(aabbMin, aabbMax);
     return AABB(aabbMin, aabbMax);
@@ -761,6 +928,8 @@ void EC_RigidBody::RequestMesh()
 
 void EC_RigidBody::UpdateScale()
 {
+    WaitForStep();
+    
    float3 sizeVec = size.Get();
     // Sanitize the size
     if (sizeVec.x < 0)
@@ -786,41 +955,61 @@ void EC_RigidBody::UpdateScale()
 
 void EC_RigidBody::CreateHeightFieldFromTerrain()
 {
+    const bool growRange = growHeightFieldRange_;
+    growHeightFieldRange_ = false;
     CheckForPlaceableAndTerrain();
     
     EC_Terrain* terrain = terrain_.lock().get();
     if (!terrain)
         return;
     
-    int width = terrain->PatchWidth() * EC_Terrain::cPatchSize;
-    int height = terrain->PatchHeight() * EC_Terrain::cPatchSize;
+    const TerrainHeightField& field = terrain->HeightField();
+    int width = field.Width();
+    int height = field.Height();
     
     if ((!width) || (!height))
         return;
     
-    heightValues_.resize(width * height);
-    
+    // Bullet reads the heights of the terrain in place. It reads a 16-bit value q as q * heightScale, so the offset of the quantization moves the shape instead.
     float xzSpacing = 1.0f;
-    float ySpacing = 1.0f;
-    float minY = 1000000000;
-    float maxY = -1000000000;
-    for(uint z = 0; z < (uint)height; ++z)
-        for(uint x = 0; x < (uint)width; ++x)
+    float heightScale = 1.0f;
+    float heightOffset = 0.0f;
+    float minY;
+    float maxY;
+    PHY_ScalarType dataType = PHY_FLOAT;
+    if (field.GetFormat() == TerrainHeightField::Format_Short)
+    {
+        dataType = PHY_SHORT;
+        heightScale = field.Scale();
+        heightOffset = field.Offset();
+        maxY = TerrainHeightField::cMaxQuantized * heightScale;
+        minY = -maxY;
+    }
+    else
+    {
+        // Leave room around the heights, so that editing the terrain does not need a new shape at every change
+        field.GetRange(minY, maxY);
+        if (growRange)
         {
-            float value = terrain->GetPoint(x, z);
-            if (value < minY)
-                minY = value;
-            if (value > maxY)
-                maxY = value;
-            heightValues_[z * width + x] = value;
+            // An edit left the previous range. Keep it in the new one, so that the range grows by the slack at every rebuild
+            // and a long stroke needs only a few new shapes, like TerrainHeightField::Quantize does for the quantization range.
+            minY = std::min(minY, heightFieldMinY_);
+            maxY = std::max(maxY, heightFieldMaxY_);
         }
-
+        float slack = std::max(1.0f, (maxY - minY) * 0.25f);
+        minY -= slack;
+        maxY += slack;
+    }
+    
     float3 scale = terrain->nodeTransformation.Get().scale;
-    float3 bbMin(0, minY, 0);
-    float3 bbMax(xzSpacing * (width - 1), maxY, xzSpacing * (height - 1));
+    float3 bbMin(0, heightOffset + minY, 0);
+    float3 bbMax(xzSpacing * (width - 1), heightOffset + maxY, xzSpacing * (height - 1));
     float3 bbCenter = scale.Mul((bbMin + bbMax) * 0.5f);
     
-    heightField_ = new btHeightfieldTerrainShape(width, height, &heightValues_[0], ySpacing, minY, maxY, 1, PHY_FLOAT, false);
+    heightField_ = new btHeightfieldTerrainShape(width, height, const_cast<void*>(field.Data()), heightScale, minY, maxY, 1, dataType, false);
+    heightFieldMinY_ = heightOffset + minY;
+    heightFieldMaxY_ = heightOffset + maxY;
+    heightFieldRevision_ = field.Revision();
     
     /** \todo EC_Terrain uses its own transform that is independent of the placeable. It is not nice to support, since rest of EC_RigidBody assumes
         the transform is in the placeable. Right now, we only support position & scaling. Here, we also counteract Bullet's nasty habit to center 
@@ -890,6 +1079,8 @@ void EC_RigidBody::GetProperties(btVector3& localInertia, float& m, int& collisi
 
 void EC_RigidBody::UpdatePosRotFromPlaceable()
 {
+    WaitForStep();
+    
     EC_Placeable* placeable = placeable_.lock().get();
     if (!placeable || !body_)
         return;
@@ -900,6 +1091,8 @@ void EC_RigidBody::UpdatePosRotFromPlaceable()
     btTransform& worldTrans = body_->getWorldTransform();
     worldTrans.setOrigin(position);
     worldTrans.setRotation(orientation);
+    // The placeable is now ahead of a transform from the physics thread that has not been applied yet
+    hasPendingTransform_ = false;
     
     // When we forcibly set the physics transform, also set the interpolation transform to prevent jerky motion
     btTransform interpTrans = body_->getInterpolationWorldTransform();
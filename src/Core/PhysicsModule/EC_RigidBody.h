@@ -16,7 +16,6 @@
 
 class btRigidBody;
 class btCollisionShape;
-class btTriangleMesh;
 class btHeightfieldTerrainShape;
 
 class EC_Placeable;
@@ -27,6 +26,7 @@ namespace Physics
     class PhysicsModule;
     class PhysicsWorld;
     struct ConvexHullSet;
+    struct TriangleMeshShape;
 }
 
 /// Physics rigid body entity component
@@ -311,7 +311,8 @@ public slots:
     */
     void GetAabbox(float3 &outAabbMin, float3 &outAabbMax);
 
-    btRigidBody* GetRigidBody() const { return body_; }
+    /// Return the Bullet body. Waits for a simulation step running on the physics thread to finish first.
+    btRigidBody* GetRigidBody() const;
     
     /// Return whether have authority. On the client, returns false for non-local objects.
     bool HasAuthority() const;
@@ -344,9 +345,21 @@ private slots:
     /// Called when EC_Terrain has been regenerated
     void OnTerrainRegenerated();
 
+    /// Called when the heights of a region of EC_Terrain have been edited. Keeps the heightfield shape if it covers the new heights.
+    void OnTerrainHeightsChanged(int x, int y, int width, int height);
+
+    /// Called before EC_Terrain changes its heights, which the heightfield shape reads in place
+    void OnTerrainHeightsAboutToChange();
+
+    /// Called when EC_Terrain has been destroyed
+    void OnTerrainDestroyed();
+
     /// Called when collision mesh has been downloaded.
     void OnCollisionMeshAssetLoaded(AssetPtr asset);
 
+    /// Called when PhysicsModule has generated a collision shape for a mesh.
+    void OnCollisionShapeReady(const QString &meshName);
+
 private:
     /// (Re)create the collisionshape
     void CreateCollisionShape();
@@ -383,6 +396,9 @@ private:
     /// Calculate mass, shape & static/dynamic-classification dependant properties
     void GetProperties(btVector3& localInertia, float& m, int& collisionFlags);
     
+    /// Wait for a simulation step running on the physics thread to finish, so that the Bullet body and shape can be accessed
+    void WaitForStep() const;
+    
     /// Emit a physics collision. Called from PhysicsWorld
     void EmitPhysicsCollision(Entity* otherEntity, const float3& position, const float3& normal, float distance, float impulse, bool newCollision);
     
@@ -398,10 +414,17 @@ private:
     /// Bullet body
     btRigidBody* body_;
     
+    /// Transform set by a step on the physics thread, applied to the placeable by PhysicsWorld on the next frame
+    btTransform pendingTransform_;
+    
+    /// Whether pendingTransform_ is waiting to be applied
+    bool hasPendingTransform_;
+    
+    /// Placeable transform of a kinematic body captured before a step on the physics thread, as the placeable can not be read during the step
+    btTransform kinematicTransform_;
+    
     /// Bullet collision shape
     btCollisionShape* shape_;
-    /// Bullet collision child shape. This is needed to use btScaledBvhTriangleMeshShape
-    btCollisionShape* childShape_;
     
     /// Physics world. May be 0 if the scene does not have a physics world. In that case most of EC_RigidBody's functionality is a no-op
     Physics::PhysicsWorld* world_;
@@ -415,8 +438,11 @@ private:
     /// Cached shapesize (last created)
     float3 cachedSize_;
 
-    /// Bullet triangle mesh
-    boost::shared_ptr<btTriangleMesh> triangleMesh_;
+    /// Collision mesh asset the trimesh or convex hull shape is generated from
+    AssetWeakPtr collisionMeshAsset_;
+    
+    /// Bullet triangle mesh and its hierarchy, shared with the other rigid bodies using the same mesh
+    boost::shared_ptr<Physics::TriangleMeshShape> triangleMesh_;
     
     /// Convex hull set
     boost::shared_ptr<Physics::ConvexHullSet> convexHullSet_;
@@ -424,8 +450,15 @@ private:
     /// Bullet heightfield shape. Note: this is always put inside a compound shape (shape_)
     btHeightfieldTerrainShape* heightField_;
     
-    /// Heightfield values, for the case the shape is a heightfield.
-    std::vector<float> heightValues_;
+    /// Height range the heightfield was created with. Edits of the terrain within it do not need a new shape.
+    float heightFieldMinY_;
+    float heightFieldMaxY_;
+    
+    /// Revision of the terrain height field the heightfield was created with. The heightfield reads the terrain heights in place.
+    u32 heightFieldRevision_;
+    
+    /// Whether the next heightfield is created over a range that also contains the current one, as an edit left the current range.
+    bool growHeightFieldRange_;
 };
 
 
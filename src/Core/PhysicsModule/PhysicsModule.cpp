@@ -10,6 +10,8 @@
 #include "EC_RigidBody.h"
 #include "EC_VolumeTrigger.h"
 #include "OgreRenderingModule.h"
+#include "OgreWorld.h"
+#include "OgreMeshAsset.h"
 #include "EC_Mesh.h"
 #include "EC_Placeable.h"
 #include "EC_Terrain.h"
@@ -21,12 +23,18 @@
 #include "Renderer.h"
 #include "ConsoleAPI.h"
 #include "IComponentFactory.h"
+#include "AssetAPI.h"
+#include "AssetCache.h"
+#include "LoggingFunctions.h"
 #include "QScriptEngineHelpers.h"
 
 #include <btBulletDynamicsCommon.h>
 
 #include <QtScript>
 #include <QTreeWidgetItem>
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QFile>
 
 #include <Ogre.h>
 
@@ -39,21 +47,60 @@ Q_DECLARE_METATYPE(PhysicsRaycastResult*);
 namespace Physics
 {
 
+/// Version of the convex hull sets stored in the asset cache. Bump when the hull generation or serialization changes.
+static const int cConvexHullSetCacheVersion = 1;
+
+/// Generates a collision shape on a worker thread.
+class CollisionShapeRunnable : public QRunnable
+{
+public:
+    CollisionShapeRunnable(PhysicsModule *module, const PhysicsModule::CollisionShapeTaskPtr &task) :
+        module_(module),
+        task_(task)
+    {
+    }
+
+    void run()
+    {
+        // Do not log here, as logging is not thread-safe. Failures are reported on the main thread.
+        if (task_->convexHullSet)
+            task_->success = GenerateConvexHullSet(task_->triangles, task_->convexHullSet.get());
+        else
+        {
+            GenerateTriangleMeshShape(task_->triangles, task_->triangleMesh.get());
+            task_->success = task_->triangleMesh->shape_ != 0;
+        }
+        module_->CollisionShapeTaskFinished(task_);
+    }
+
+private:
+    PhysicsModule *module_;
+    PhysicsModule::CollisionShapeTaskPtr task_;
+};
+
 PhysicsModule::PhysicsModule()
 :IModule("Physics"),
 defaultPhysicsUpdatePeriod_(1.0f / 60.0f),
-defaultMaxSubSteps_(6) // If fps is below 10, we start to slow down physics
+defaultMaxSubSteps_(6), // If fps is below 10, we start to slow down physics
+defaultBroadphase_(PhysicsWorld::Broadphase_DynamicAabbTree),
+defaultSolverIterations_(0),
+defaultThreadedStepping_(false)
 {
 }
 
 PhysicsModule::~PhysicsModule()
 {
+    // The worker threads access this object, so wait for them before it is destroyed
+    collisionShapeThreads_.waitForDone();
 }
 
 void PhysicsModule::Load()
 {
     framework_->Scene()->RegisterComponentFactory(ComponentFactoryPtr(new GenericComponentFactory<EC_RigidBody>));
     framework_->Scene()->RegisterComponentFactory(ComponentFactoryPtr(new GenericComponentFactory<EC_VolumeTrigger>));
+    
+    // Register also to the Qt meta type system, so that PhysicsWorld::RaycastBatch can be invoked from Python.
+    qRegisterMetaType<QList<PhysicsRaycastResult*> >("QList<PhysicsRaycastResult*>");
 }
 
 void PhysicsModule::Initialize()
@@ -91,6 +138,26 @@ void PhysicsModule::Initialize()
         if (ok && steps > 0)
             SetDefaultMaxSubSteps(steps);
     }
+    if (framework_->HasCommandLineParameter("--physicsbroadphase"))
+    {
+        QString broadphase = framework_->CommandLineParameters("--physicsbroadphase")[0].toLower();
+        if (broadphase == "dbvt")
+            defaultBroadphase_ = PhysicsWorld::Broadphase_DynamicAabbTree;
+        else if (broadphase == "sap")
+            defaultBroadphase_ = PhysicsWorld::Broadphase_SweepAndPrune;
+        else if (broadphase == "simple")
+            defaultBroadphase_ = PhysicsWorld::Broadphase_Simple;
+        else
+            LogWarning("Unknown physics broadphase \"" + broadphase + "\", using dbvt.");
+    }
+    if (framework_->HasCommandLineParameter("--physicssolveriterations"))
+    {
+        bool ok;
+        int iterations = framework_->CommandLineParameters("--physicssolveriterations")[0].toInt(&ok);
+        if (ok && iterations > 0)
+            defaultSolverIterations_ = iterations;
+    }
+    defaultThreadedStepping_ = framework_->HasCommandLineParameter("--physicsthread");
 }
 
 void PhysicsModule::Uninitialize()
@@ -160,6 +227,8 @@ void PhysicsModule::AutoCollisionMesh()
 void PhysicsModule::Update(f64 frametime)
 {
     PROFILE(PhysicsModule_Update);
+    ProcessFinishedCollisionShapes();
+    
     // Loop all the physics worlds and update them.
     PhysicsWorldMap::iterator i = physicsWorlds_.begin();
     while(i != physicsWorlds_.end())
@@ -178,10 +247,13 @@ void PhysicsModule::OnSceneAdded(const QString& name)
         return;
     }
     
-    boost::shared_ptr<PhysicsWorld> newWorld(new PhysicsWorld(scene, !scene->IsAuthority()));
+    boost::shared_ptr<PhysicsWorld> newWorld(new PhysicsWorld(scene, !scene->IsAuthority(), (PhysicsWorld::BroadphaseType)defaultBroadphase_));
     newWorld->SetGravity(scene->UpVector() * -9.81f);
     newWorld->SetPhysicsUpdatePeriod(defaultPhysicsUpdatePeriod_);
     newWorld->SetMaxSubSteps(defaultMaxSubSteps_);
+    if (defaultSolverIterations_ > 0)
+        newWorld->SetSolverIterations(defaultSolverIterations_);
+    newWorld->SetThreadedStepping(defaultThreadedStepping_);
     physicsWorlds_[scene.get()] = newWorld;
     scene->setProperty(PhysicsWorld::PropertyName(), QVariant::fromValue<QObject*>(newWorld.get()));
 }
@@ -215,48 +287,149 @@ void PhysicsModule::OnScriptEngineCreated(QScriptEngine* engine)
     qScriptRegisterQObjectMetaType<Physics::PhysicsModule*>(engine);
     qScriptRegisterQObjectMetaType<Physics::PhysicsWorld*>(engine);
     qScriptRegisterQObjectMetaType<PhysicsRaycastResult*>(engine);
+    qScriptRegisterSequenceMetaType<QList<Ray> >(engine);
+    qScriptRegisterSequenceMetaType<QList<PhysicsRaycastResult*> >(engine);
 }
 
-boost::shared_ptr<btTriangleMesh> PhysicsModule::GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh)
+PhysicsModule::MeshCollisionShapes &PhysicsModule::CollisionShapesOf(OgreMeshAsset* asset)
 {
-    boost::shared_ptr<btTriangleMesh> ptr;
-    if (!mesh)
-        return ptr;
-    
-    // Check if has already been converted
-    TriangleMeshMap::const_iterator iter = triangleMeshes_.find(mesh->getName());
-    if (iter != triangleMeshes_.end())
-        return iter->second;
+    CollisionShapeMap::iterator iter = collisionShapes_.find(asset->Name());
+    if (iter == collisionShapes_.end())
+    {
+        // The geometry of the asset changes when it is reloaded, so forget the shapes when it is unloaded
+        connect(asset, SIGNAL(Unloaded(IAsset*)), this, SLOT(OnMeshAssetUnloaded(IAsset*)), Qt::UniqueConnection);
+        iter = collisionShapes_.insert(std::make_pair(asset->Name(), MeshCollisionShapes())).first;
+    }
+    return iter->second;
+}
+
+boost::shared_ptr<TriangleMeshShape> PhysicsModule::GetTriangleMeshShape(OgreMeshAsset* asset)
+{
+    if (!asset || asset->ogreMesh.isNull())
+        return boost::shared_ptr<TriangleMeshShape>();
     
-    // Create new, then interrogate the Ogre mesh
-#include "DisableMemoryLeakCheck.h"
-    ptr = boost::shared_ptr<btTriangleMesh>(new btTriangleMesh());
-#include "EnableMemoryLeakCheck.h"
-    GenerateTriangleMesh(mesh, ptr.get());
+    // Check if has already been converted or is being converted
+    MeshCollisionShapes &shapes = CollisionShapesOf(asset);
+    if (shapes.triangleMesh || shapes.triangleMeshTask)
+        return shapes.triangleMesh;
     
-    triangleMeshes_[mesh->getName()] = ptr;
+    // The vertex buffers can only be read on the main thread, the rest is done on a worker thread
+    CollisionShapeTaskPtr task(new CollisionShapeTask());
+    task->meshName = asset->Name();
+    task->triangleMesh = boost::shared_ptr<TriangleMeshShape>(new TriangleMeshShape());
+    task->success = false;
+    GetTrianglesFromMesh(asset->ogreMesh.get(), task->triangles);
+    shapes.triangleMeshTask = task;
+    collisionShapeThreads_.start(new CollisionShapeRunnable(this, task));
     
-    return ptr;
+    return shapes.triangleMesh;
 }
 
-boost::shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh)
+boost::shared_ptr<ConvexHullSet> PhysicsModule::GetConvexHullSet(OgreMeshAsset* asset)
 {
-    boost::shared_ptr<ConvexHullSet> ptr;
-    if (!mesh)
-        return ptr;
+    if (!asset || asset->ogreMesh.isNull())
+        return boost::shared_ptr<ConvexHullSet>();
     
-    // Check if has already been converted
-    ConvexHullSetMap::const_iterator iter = convexHullSets_.find(mesh->getName());
-    if (iter != convexHullSets_.end())
-        return iter->second;
+    // Check if has already been converted or is being converted
+    MeshCollisionShapes &shapes = CollisionShapesOf(asset);
+    if (shapes.convexHullSet || shapes.convexHullSetTask)
+        return shapes.convexHullSet;
     
-    // Create new, then interrogate the Ogre mesh
-    ptr = boost::shared_ptr<ConvexHullSet>(new ConvexHullSet());
-    GenerateConvexHullSet(mesh, ptr.get());
+    CollisionShapeTaskPtr task(new CollisionShapeTask());
+    task->meshName = asset->Name();
+    task->convexHullSet = boost::shared_ptr<ConvexHullSet>(new ConvexHullSet());
+    task->success = false;
+    GetTrianglesFromMesh(asset->ogreMesh.get(), task->triangles);
+    if (task->triangles.empty())
+    {
+        LogError("Mesh " + asset->Name() + " had no triangles; aborting convex hull generation");
+        shapes.convexHullSet = task->convexHullSet;
+        return shapes.convexHullSet;
+    }
+    
+    // Use a hull set generated on an earlier run from the same geometry, if it is in the asset cache
+    AssetCache *cache = framework_->Asset()->GetAssetCache();
+    if (cache)
+    {
+        task->cacheRef = QString("collisionshape://hull.%1/%2.hull").arg(cConvexHullSetCacheVersion)
+            .arg(AssetCache::ComputeContentHash((const u8*)&task->triangles[0], task->triangles.size() * sizeof(float3)));
+        QString cachedFile = cache->FindInCache(task->cacheRef);
+        if (!cachedFile.isEmpty())
+        {
+            QFile file(cachedFile);
+            QByteArray data;
+            if (file.open(QIODevice::ReadOnly))
+                data = file.readAll();
+            if (DeserializeConvexHullSet((const u8*)data.constData(), (size_t)data.size(), task->convexHullSet.get()))
+            {
+                shapes.convexHullSet = task->convexHullSet;
+                return shapes.convexHullSet;
+            }
+            cache->DeleteAsset(task->cacheRef);
+        }
+    }
+    
+    shapes.convexHullSetTask = task;
+    collisionShapeThreads_.start(new CollisionShapeRunnable(this, task));
+    
+    return shapes.convexHullSet;
+}
+
+void PhysicsModule::CollisionShapeTaskFinished(const CollisionShapeTaskPtr &task)
+{
+    QMutexLocker lock(&finishedCollisionShapesMutex_);
+    finishedCollisionShapes_.push_back(task);
+}
 
-    convexHullSets_[mesh->getName()] = ptr;
+void PhysicsModule::ProcessFinishedCollisionShapes()
+{
+    std::list<CollisionShapeTaskPtr> finished;
+    {
+        QMutexLocker lock(&finishedCollisionShapesMutex_);
+        finished.swap(finishedCollisionShapes_);
+    }
     
-    return ptr;
+    for(std::list<CollisionShapeTaskPtr>::iterator iter = finished.begin(); iter != finished.end(); ++iter)
+    {
+        const CollisionShapeTaskPtr &task = *iter;
+        // Skip the result if the mesh has been unloaded while the shape was being generated
+        CollisionShapeMap::iterator shapes = collisionShapes_.find(task->meshName);
+        if (shapes == collisionShapes_.end())
+            continue;
+        
+        if (task->convexHullSet)
+        {
+            if (shapes->second.convexHullSetTask != task)
+                continue;
+            shapes->second.convexHullSetTask.reset();
+            shapes->second.convexHullSet = task->convexHullSet;
+            if (!task->success)
+                LogError("No vertices were generated for mesh " + task->meshName + "; aborting convex hull generation");
+            else if (!task->cacheRef.isEmpty() && framework_->Asset()->GetAssetCache())
+            {
+                std::vector<u8> data;
+                SerializeConvexHullSet(*task->convexHullSet, data);
+                framework_->Asset()->GetAssetCache()->StoreAsset(&data[0], data.size(), task->cacheRef);
+            }
+        }
+        else
+        {
+            if (shapes->second.triangleMeshTask != task)
+                continue;
+            shapes->second.triangleMeshTask.reset();
+            // A failed triangle mesh is kept too, so that it is not generated again. It has no hierarchy, so no shape is created from it.
+            shapes->second.triangleMesh = task->triangleMesh;
+            if (!task->success)
+                LogError("Mesh " + task->meshName + " had no triangles; can not create a triangle mesh collision shape");
+        }
+        
+        emit CollisionShapeReady(task->meshName);
+    }
+}
+
+void PhysicsModule::OnMeshAssetUnloaded(IAsset *asset)
+{
+    collisionShapes_.erase(asset->Name());
 }
 
 #ifdef PROFILING
@@ -5,9 +5,15 @@
 #include "PhysicsModuleApi.h"
 #include "IModule.h"
 #include "SceneFwd.h"
+#include "AssetFwd.h"
+#include "Math/float3.h"
 
 #include <set>
+#include <list>
+#include <vector>
 #include <QObject>
+#include <QThreadPool>
+#include <QMutex>
 
 namespace Ogre
 {
@@ -18,6 +24,7 @@ class btVector3;
 class btTriangleMesh;
 class QScriptEngine;
 class EC_RigidBody;
+class OgreMeshAsset;
 
 #ifdef PROFILING
 class QTreeWidgetItem;
@@ -27,6 +34,7 @@ namespace Physics
 {
 
 struct ConvexHullSet;
+struct TriangleMeshShape;
 class PhysicsWorld;
 
 /// Provides physics rendering by utilizing Bullet.
@@ -43,13 +51,22 @@ public:
     void Update(f64 frametime);
     void Uninitialize();
    
-    /// Get a Bullet triangle mesh corresponding to an Ogre mesh.
-    /** If already has been generated, returns the previously created one */
-    boost::shared_ptr<btTriangleMesh> GetTriangleMeshFromOgreMesh(Ogre::Mesh* mesh);
-
-    /// Get a Bullet convex hull set (using minimum recursion, not very accurate but fast) corresponding to an Ogre mesh.
-    /** If already has been generated, returns the previously created one */
-    boost::shared_ptr<ConvexHullSet> GetConvexHullSetFromOgreMesh(Ogre::Mesh* mesh);
+    /// Get a Bullet triangle mesh and its bounding volume hierarchy corresponding to a mesh asset.
+    /** If already has been generated, returns the previously created one. Otherwise starts generating it on a worker thread
+        and returns null, and CollisionShapeReady is emitted when it is done. The shape is shared by all rigid bodies using the asset,
+        which scale it individually. */
+    boost::shared_ptr<TriangleMeshShape> GetTriangleMeshShape(OgreMeshAsset* asset);
+
+    /// Get a Bullet convex hull set (using minimum recursion, not very accurate but fast) corresponding to a mesh asset.
+    /** If already has been generated, returns the previously created one. Otherwise starts generating it on a worker thread
+        and returns null, and CollisionShapeReady is emitted when it is done. Generated hull sets are stored in the asset cache
+        by the hash of the mesh geometry, so that they are not generated again on later runs. */
+    boost::shared_ptr<ConvexHullSet> GetConvexHullSet(OgreMeshAsset* asset);
+
+signals:
+    /// A collision shape generated on a worker thread is ready.
+    /** @param meshName Name of the mesh asset the shape was generated from. */
+    void CollisionShapeReady(const QString &meshName);
 
 public slots:
     /// Toggles physics debug geometry
@@ -88,21 +105,65 @@ private slots:
     /// Scene is about to be removed
     void OnSceneRemoved(const QString &name);
 
+    /// Forgets the collision shapes of a mesh asset, as its geometry is about to change.
+    void OnMeshAssetUnloaded(IAsset *asset);
+
 private:
+    /// Collision shape generation of a mesh, run on a worker thread.
+    struct CollisionShapeTask
+    {
+        QString meshName;
+        QString cacheRef; ///< Asset cache ref for storing the generated convex hull set. Empty for triangle meshes.
+        std::vector<float3> triangles; ///< Triangle vertices of the mesh.
+        boost::shared_ptr<TriangleMeshShape> triangleMesh; ///< Generated triangle mesh, if this is a triangle mesh task.
+        boost::shared_ptr<ConvexHullSet> convexHullSet; ///< Generated convex hull set, if this is a convex hull task.
+        bool success;
+    };
+    typedef boost::shared_ptr<CollisionShapeTask> CollisionShapeTaskPtr;
+    friend class CollisionShapeRunnable;
+
+    /// Collision shapes generated or being generated from a mesh asset.
+    struct MeshCollisionShapes
+    {
+        boost::shared_ptr<TriangleMeshShape> triangleMesh;
+        boost::shared_ptr<ConvexHullSet> convexHullSet;
+        CollisionShapeTaskPtr triangleMeshTask; ///< Null if not being generated.
+        CollisionShapeTaskPtr convexHullSetTask; ///< Null if not being generated.
+    };
+
+    /// Returns the collision shape entry of a mesh asset, creating it if necessary.
+    MeshCollisionShapes &CollisionShapesOf(OgreMeshAsset* asset);
+
+    /// Called on a worker thread when collision shape generation has finished.
+    void CollisionShapeTaskFinished(const CollisionShapeTaskPtr &task);
+
+    /// Takes the collision shapes finished by the worker threads into use.
+    void ProcessFinishedCollisionShapes();
+
+
     typedef std::map<Scene*, boost::shared_ptr<Physics::PhysicsWorld> > PhysicsWorldMap;
     /// Map of physics worlds assigned to scenes
     PhysicsWorldMap physicsWorlds_;
     
-    typedef std::map<std::string, boost::shared_ptr<btTriangleMesh> > TriangleMeshMap;
-    /// Bullet triangle meshes generated from Ogre meshes
-    TriangleMeshMap triangleMeshes_;
-
-    typedef std::map<std::string, boost::shared_ptr<ConvexHullSet> > ConvexHullSetMap;
-    /// Bullet convex hull sets generated from Ogre meshes
-    ConvexHullSetMap convexHullSets_;
+    typedef std::map<QString, MeshCollisionShapes> CollisionShapeMap;
+    /// Bullet collision shapes generated from mesh assets, by asset name
+    CollisionShapeMap collisionShapes_;
+    
+    /// Worker threads for generating collision shapes
+    QThreadPool collisionShapeThreads_;
+    /// Collision shape tasks finished by the worker threads, to be taken into use on the main thread
+    std::list<CollisionShapeTaskPtr> finishedCollisionShapes_;
+    /// Guards finishedCollisionShapes_
+    QMutex finishedCollisionShapesMutex_;
     
     float defaultPhysicsUpdatePeriod_;
     int defaultMaxSubSteps_;
+    /// Broadphase of new physics worlds, a PhysicsWorld::BroadphaseType
+    int defaultBroadphase_;
+    /// Constraint solver iterations of new physics worlds, or 0 for the Bullet default
+    int defaultSolverIterations_;
+    /// Whether new physics worlds step on the physics thread
+    bool defaultThreadedStepping_;
 };
 
 #ifdef PROFILING
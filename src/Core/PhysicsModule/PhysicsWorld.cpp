@@ -15,17 +15,51 @@
 #include "Geometry/LineSegment.h"
 
 #include <Ogre.h>
+#include <QRunnable>
+
+#include <algorithm>
+
 #include "MemoryLeakCheck.h"
 
 namespace Physics
 {
 
+namespace
+{
+    /// Half extent of the world bounds of the sweep and prune broadphase. Objects outside the bounds still collide, but slowly.
+    const float cSweepAndPruneExtent = 10000.0f;
+    /// Maximum number of objects in the sweep and prune and simple broadphases.
+    const unsigned cMaxBroadphaseObjects = 65536;
+    
+    /// Steps a Bullet world on the physics thread.
+    class StepTask : public QRunnable
+    {
+    public:
+        StepTask(btDiscreteDynamicsWorld *world, float frametime, int maxSubSteps, float fixedTimeStep) :
+            world_(world), frametime_(frametime), maxSubSteps_(maxSubSteps), fixedTimeStep_(fixedTimeStep)
+        {
+        }
+        
+        virtual void run()
+        {
+            PROFILE(PhysicsWorld_StepThread);
+            world_->stepSimulation(frametime_, maxSubSteps_, fixedTimeStep_);
+        }
+        
+    private:
+        btDiscreteDynamicsWorld *world_;
+        float frametime_;
+        int maxSubSteps_;
+        float fixedTimeStep_;
+    };
+}
+
 void TickCallback(btDynamicsWorld *world, btScalar timeStep)
 {
     static_cast<Physics::PhysicsWorld*>(world->getWorldUserInfo())->ProcessPostTick(timeStep);
 }
 
-PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
+PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient, BroadphaseType broadphase) :
     scene_(scene),
     collisionConfiguration_(0),
     collisionDispatcher_(0),
@@ -39,11 +73,27 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
     drawDebugGeometry_(false),
     drawDebugManuallySet_(false),
     debugDrawMode_(0),
-    cachedOgreWorld_(0)
+    cachedOgreWorld_(0),
+    threadedStepping_(false),
+    stepping_(false)
 {
+    stepThread_.setMaxThreadCount(1);
+    
     collisionConfiguration_ = new btDefaultCollisionConfiguration();
     collisionDispatcher_ = new btCollisionDispatcher(collisionConfiguration_);
-    broadphase_ = new btDbvtBroadphase();
+    switch(broadphase)
+    {
+    case Broadphase_SweepAndPrune:
+        broadphase_ = new bt32BitAxisSweep3(btVector3(-cSweepAndPruneExtent, -cSweepAndPruneExtent, -cSweepAndPruneExtent),
+            btVector3(cSweepAndPruneExtent, cSweepAndPruneExtent, cSweepAndPruneExtent), cMaxBroadphaseObjects);
+        break;
+    case Broadphase_Simple:
+        broadphase_ = new btSimpleBroadphase(cMaxBroadphaseObjects);
+        break;
+    default:
+        broadphase_ = new btDbvtBroadphase();
+        break;
+    }
     solver_ = new btSequentialImpulseConstraintSolver();
     world_ = new btDiscreteDynamicsWorld(collisionDispatcher_, broadphase_, solver_, collisionConfiguration_);
     world_->setDebugDrawer(this);
@@ -52,6 +102,11 @@ PhysicsWorld::PhysicsWorld(ScenePtr scene, bool isClient) :
 
 PhysicsWorld::~PhysicsWorld()
 {
+    WaitForStep();
+    
+    for(size_t i = 0; i < batchResults_.size(); ++i)
+        delete batchResults_[i];
+    
     delete world_;
     world_ = 0;
     
@@ -82,23 +137,55 @@ void PhysicsWorld::SetMaxSubSteps(int steps)
         maxSubSteps_ = steps;
 }
 
+void PhysicsWorld::SetSolverIterations(int iterations)
+{
+    if (iterations > 0)
+        GetWorld()->getSolverInfo().m_numIterations = iterations;
+}
+
+int PhysicsWorld::GetSolverIterations() const
+{
+    return GetWorld()->getSolverInfo().m_numIterations;
+}
+
+void PhysicsWorld::SetThreadedStepping(bool enable)
+{
+    // A step already running finishes normally, and its results are applied on the next frame
+    WaitForStep();
+    threadedStepping_ = enable;
+}
+
 void PhysicsWorld::SetGravity(const float3& gravity)
 {
-    world_->setGravity(gravity);
+    GetWorld()->setGravity(gravity);
 }
 
 float3 PhysicsWorld::GetGravity() const
 {
-    return world_->getGravity();
+    return GetWorld()->getGravity();
 }
 
 btDiscreteDynamicsWorld* PhysicsWorld::GetWorld() const
 {
+    WaitForStep();
     return world_;
 }
 
+void PhysicsWorld::WaitForStep() const
+{
+    if (!stepping_)
+        return;
+    
+    PROFILE(PhysicsWorld_WaitForStep);
+    stepThread_.waitForDone();
+    stepping_ = false;
+}
+
 void PhysicsWorld::Simulate(f64 frametime)
 {
+    // Apply the results of the previous frame's step even if the simulation has been stopped since
+    FinishStep();
+    
     if (!runPhysics_)
         return;
     
@@ -106,11 +193,64 @@ void PhysicsWorld::Simulate(f64 frametime)
     
     emit AboutToUpdate((float)frametime);
     
+    if (threadedStepping_)
+    {
+        // Draw the debug geometry of the previous step now, as the world can not be accessed until the next frame
+        UpdateDebugGeometry();
+        stepping_ = true;
+        stepThread_.start(new StepTask(world_, (float)frametime, maxSubSteps_, physicsUpdatePeriod_));
+        return;
+    }
+    
     {
         PROFILE(Bullet_stepSimulation); ///\note Do not delete or rename this PROFILE() block. The DebugStats profiler uses this string as a label to know where to inject the Bullet internal profiling data.
         world_->stepSimulation((float)frametime, maxSubSteps_, physicsUpdatePeriod_);
     }
     
+    UpdateDebugGeometry();
+}
+
+void PhysicsWorld::FinishStep()
+{
+    WaitForStep();
+    
+    if (!pendingSubSteps_.empty())
+        EmitPendingContacts();
+    
+    if (pendingTransforms_.empty())
+        return;
+    
+    PROFILE(PhysicsWorld_ApplyTransforms);
+    // Applying a transform may change other bodies through the scene, so take the list first
+    std::vector<EC_RigidBody*> bodies;
+    bodies.swap(pendingTransforms_);
+    for(size_t i = 0; i < bodies.size(); ++i)
+    {
+        EC_RigidBody* body = bodies[i];
+        if (!body->hasPendingTransform_)
+            continue;
+        body->hasPendingTransform_ = false;
+        body->setWorldTransform(body->pendingTransform_);
+    }
+}
+
+void PhysicsWorld::AddPendingTransform(EC_RigidBody* body)
+{
+    pendingTransforms_.push_back(body);
+}
+
+void PhysicsWorld::ForgetBody(EC_RigidBody* body)
+{
+    pendingTransforms_.erase(std::remove(pendingTransforms_.begin(), pendingTransforms_.end(), body), pendingTransforms_.end());
+    
+    btCollisionObject* object = body->body_;
+    for(size_t i = 0; i < pendingContacts_.size(); ++i)
+        if (pendingContacts_[i].objectA == object || pendingContacts_[i].objectB == object)
+            pendingContacts_[i].objectA = pendingContacts_[i].objectB = 0;
+}
+
+void PhysicsWorld::UpdateDebugGeometry()
+{
     // Automatically enable debug geometry if at least one debug-enabled rigidbody. Automatically disable if no debug-enabled rigidbodies
     // However, do not do this if user has used the physicsdebug console command
     if (!drawDebugManuallySet_)
@@ -128,14 +268,23 @@ void PhysicsWorld::Simulate(f64 frametime)
 void PhysicsWorld::ProcessPostTick(float substeptime)
 {
     PROFILE(PhysicsWorld_ProcessPostTick);
-    // Check contacts and send collision signals for them
+    RecordContacts(substeptime);
+    
+    // On the physics thread the signals are emitted when the step has finished, as the receivers live in the main thread
+    if (!stepping_)
+        EmitPendingContacts();
+}
+
+void PhysicsWorld::RecordContacts(float substeptime)
+{
+    // Check contacts and record them for the collision signals
     int numManifolds = collisionDispatcher_->getNumManifolds();
     
     std::set<std::pair<btCollisionObject*, btCollisionObject*> > currentCollisions;
     
     if (numManifolds > 0)
     {
-        PROFILE(PhysicsWorld_SendCollisions);
+        PROFILE(PhysicsWorld_RecordContacts);
         
         for(int i = 0; i < numManifolds; ++i)
         {
@@ -152,23 +301,6 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
             else
                 objectPair = std::make_pair(objectB, objectA);
             
-            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(objectA->getUserPointer());
-            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(objectB->getUserPointer());
-            
-            // We are only interested in collisions where both EC_RigidBody components are known
-            if (!bodyA || !bodyB)
-            {
-                LogError("Inconsistent Bullet physics scene state! An object exists in the physics scene which does not have an associated EC_RigidBody!");
-                continue;
-            }
-            // Also, both bodies should have valid parent entities
-            Entity* entityA = bodyA->ParentEntity();
-            Entity* entityB = bodyB->ParentEntity();
-            if (!entityA || !entityB)
-            {
-                LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
-                continue;
-            }
             // Check that at least one of the bodies is active
             if (!objectA->isActive() && !objectB->isActive())
                 continue;
@@ -179,17 +311,15 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
             {
                 btManifoldPoint& point = contactManifold->getContactPoint(j);
                 
-                float3 position = point.m_positionWorldOnB;
-                float3 normal = point.m_normalWorldOnB;
-                float distance = point.m_distance1;
-                float impulse = point.m_appliedImpulse;
-                
-                {
-                    PROFILE(PhysicsWorld_emit_PhysicsCollision);
-                    emit PhysicsCollision(entityA, entityB, position, normal, distance, impulse, newCollision);
-                }
-                bodyA->EmitPhysicsCollision(entityB, position, normal, distance, impulse, newCollision);
-                bodyB->EmitPhysicsCollision(entityA, position, normal, distance, impulse, newCollision);
+                Contact contact;
+                contact.objectA = objectA;
+                contact.objectB = objectB;
+                contact.position = point.m_positionWorldOnB;
+                contact.normal = point.m_normalWorldOnB;
+                contact.distance = point.m_distance1;
+                contact.impulse = point.m_appliedImpulse;
+                contact.newCollision = newCollision;
+                pendingContacts_.push_back(contact);
                 
                 // Report newCollision = true only for the first contact, in case there are several contacts, and application does some logic depending on it
                 // (for example play a sound -> avoid multiple sounds being played)
@@ -201,11 +331,57 @@ void PhysicsWorld::ProcessPostTick(float substeptime)
     }
     
     previousCollisions_ = currentCollisions;
+    pendingSubSteps_.push_back(std::make_pair(substeptime, pendingContacts_.size()));
+}
+
+void PhysicsWorld::EmitPendingContacts()
+{
+    PROFILE(PhysicsWorld_SendCollisions);
     
+    // Receivers may remove bodies, which discards their contacts, but does not change the size of the list
+    size_t contactIndex = 0;
+    for(size_t i = 0; i < pendingSubSteps_.size(); ++i)
     {
-        PROFILE(PhysicsWorld_ProcessPostTick_Updated);
-        emit Updated(substeptime);
+        for(; contactIndex < pendingSubSteps_[i].second; ++contactIndex)
+        {
+            const Contact contact = pendingContacts_[contactIndex];
+            if (!contact.objectA || !contact.objectB)
+                continue;
+            
+            EC_RigidBody* bodyA = static_cast<EC_RigidBody*>(contact.objectA->getUserPointer());
+            EC_RigidBody* bodyB = static_cast<EC_RigidBody*>(contact.objectB->getUserPointer());
+            
+            // We are only interested in collisions where both EC_RigidBody components are known
+            if (!bodyA || !bodyB)
+            {
+                LogError("Inconsistent Bullet physics scene state! An object exists in the physics scene which does not have an associated EC_RigidBody!");
+                continue;
+            }
+            // Also, both bodies should have valid parent entities
+            Entity* entityA = bodyA->ParentEntity();
+            Entity* entityB = bodyB->ParentEntity();
+            if (!entityA || !entityB)
+            {
+                LogError("Inconsistent Bullet physics scene state! A parentless EC_RigidBody exists in the physics scene!");
+                continue;
+            }
+            
+            {
+                PROFILE(PhysicsWorld_emit_PhysicsCollision);
+                emit PhysicsCollision(entityA, entityB, contact.position, contact.normal, contact.distance, contact.impulse, contact.newCollision);
+            }
+            bodyA->EmitPhysicsCollision(entityB, contact.position, contact.normal, contact.distance, contact.impulse, contact.newCollision);
+            bodyB->EmitPhysicsCollision(entityA, contact.position, contact.normal, contact.distance, contact.impulse, contact.newCollision);
+        }
+        
+        {
+            PROFILE(PhysicsWorld_ProcessPostTick_Updated);
+            emit Updated(pendingSubSteps_[i].first);
+        }
     }
+    
+    pendingContacts_.clear();
+    pendingSubSteps_.clear();
 }
 
 PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup, int collisionmask)
@@ -220,7 +396,7 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
     rayCallback.m_collisionFilterGroup = collisiongroup;
     rayCallback.m_collisionFilterMask = collisionmask;
     
-    world_->rayTest(rayCallback.m_rayFromWorld, rayCallback.m_rayToWorld, rayCallback);
+    GetWorld()->rayTest(rayCallback.m_rayFromWorld, rayCallback.m_rayToWorld, rayCallback);
     
     result.entity = 0;
     result.distance = 0;
@@ -241,6 +417,47 @@ PhysicsRaycastResult* PhysicsWorld::Raycast(const float3& origin, const float3&
     return &result;
 }
 
+QList<PhysicsRaycastResult*> PhysicsWorld::RaycastBatch(const QList<Ray> &rays, float maxdistance, int collisiongroup, int collisionmask)
+{
+    PROFILE(PhysicsWorld_RaycastBatch);
+    
+    WaitForStep();
+    
+    while(batchResults_.size() < (size_t)rays.size())
+        batchResults_.push_back(new PhysicsRaycastResult());
+    
+    // Bullet's broadphase raycast uses a shared traversal stack, so the rays are cast one after another
+    QList<PhysicsRaycastResult*> results;
+    for(int i = 0; i < rays.size(); ++i)
+    {
+        const float3 origin = rays[i].pos;
+        btCollisionWorld::ClosestRayResultCallback rayCallback(origin, origin + maxdistance * rays[i].dir.Normalized());
+        rayCallback.m_collisionFilterGroup = collisiongroup;
+        rayCallback.m_collisionFilterMask = collisionmask;
+        
+        world_->rayTest(rayCallback.m_rayFromWorld, rayCallback.m_rayToWorld, rayCallback);
+        
+        PhysicsRaycastResult *result = batchResults_[i];
+        result->entity = 0;
+        result->distance = 0;
+        if (rayCallback.hasHit())
+        {
+            result->pos = rayCallback.m_hitPointWorld;
+            result->normal = rayCallback.m_hitNormalWorld;
+            result->distance = (result->pos - origin).Length();
+            if (rayCallback.m_collisionObject)
+            {
+                EC_RigidBody* body = static_cast<EC_RigidBody*>(rayCallback.m_collisionObject->getUserPointer());
+                if (body)
+                    result->entity = body->ParentEntity();
+            }
+        }
+        results.push_back(result);
+    }
+    
+    return results;
+}
+
 void PhysicsWorld::SetDrawDebugGeometry(bool enable)
 {
     if (scene_.expired() || !scene_.lock()->ViewEnabled() || drawDebugGeometry_ == enable)
@@ -269,7 +486,7 @@ void PhysicsWorld::DrawDebugGeometry()
         return;
     
     // Get all lines of the physics world
-    world_->debugDrawWorld();
+    GetWorld()->debugDrawWorld();
 }
 
 void PhysicsWorld::reportErrorWarning(const char* warningString)
@@ -7,12 +7,16 @@
 #include "PhysicsModuleApi.h"
 #include "Math/float3.h"
 #include "Math/MathFwd.h"
+#include "Geometry/Ray.h"
 
 #include <LinearMath/btIDebugDraw.h>
 
 #include <set>
+#include <vector>
 #include <QObject>
 #include <QVector>
+#include <QList>
+#include <QThreadPool>
 
 #include <boost/enable_shared_from_this.hpp>
 
@@ -63,15 +67,31 @@ class PHYSICS_MODULE_API PhysicsWorld : public QObject, public btIDebugDraw, pub
     friend class ::EC_RigidBody;
     
 public:
-    PhysicsWorld(ScenePtr scene, bool isClient);
+    /// Broadphase collision detection algorithms
+    enum BroadphaseType
+    {
+        Broadphase_DynamicAabbTree = 0, ///< Dynamic AABB trees (btDbvtBroadphase). Suits scenes with many moving objects. The default.
+        Broadphase_SweepAndPrune, ///< Incremental sweep and prune within fixed world bounds (bt32BitAxisSweep3). Suits mostly static scenes.
+        Broadphase_Simple ///< Brute force testing of all pairs (btSimpleBroadphase). Only for very small scenes and debugging.
+    };
+    
+    PhysicsWorld(ScenePtr scene, bool isClient, BroadphaseType broadphase = Broadphase_DynamicAabbTree);
     virtual ~PhysicsWorld();
     
     /// Step the physics world. May trigger several internal simulation substeps, according to the deltatime given.
+    /** With threaded stepping, first finishes the step started on the previous frame and applies its results,
+        then starts the step of this frame on the physics thread and returns without waiting for it. */
     void Simulate(f64 frametime);
     
     /// Process collision from an internal sub-step (Bullet post-tick callback)
     void ProcessPostTick(float substeptime);
     
+    /// Waits until a step running on the physics thread has finished. No-op if no step is running.
+    /** The Bullet world and bodies must not be accessed while a step runs, so every access from the main thread has to wait first.
+        GetWorld() and the functions of PhysicsWorld and EC_RigidBody do this themselves. The results of the step are
+        applied to the scene on the next Simulate(). */
+    void WaitForStep() const;
+    
     /// Dynamic scene property name
     static const char* PropertyName() { return "physics"; }
     
@@ -112,6 +132,21 @@ public slots:
     /// Return amount of maximum physics substeps on a single frame.
     int GetMaxSubSteps() const { return maxSubSteps_; }
     
+    /// Set number of constraint solver iterations per substep. More iterations give more accurate stacking and joints with more CPU usage. By default 10.
+    /** @param iterations Number of solver iterations */
+    void SetSolverIterations(int iterations);
+    
+    /// Return number of constraint solver iterations per substep.
+    int GetSolverIterations() const;
+    
+    /// Enable/disable stepping the simulation on a dedicated physics thread, in parallel with the rest of the frame.
+    /** With threaded stepping the scene lags the simulation by one frame: transforms and collision signals
+        of a step are applied at the start of the next frame's Simulate(). Disabled by default. */
+    void SetThreadedStepping(bool enable);
+    
+    /// Return whether the simulation is stepped on the physics thread
+    bool GetThreadedStepping() const { return threadedStepping_; }
+    
     /// Set gravity that affects all moving objects of the physics world
     /** @param gravity Gravity vector */
     void SetGravity(const float3& gravity);
@@ -125,10 +160,19 @@ public slots:
         @return result PhysicsRaycastResult structure */
     PhysicsRaycastResult* Raycast(const float3& origin, const float3& direction, float maxdistance, int collisiongroup = -1, int collisionmask = -1);
     
+    /// Raycasts a batch of rays to the world. Returns the closest result of each ray, in the same order as the rays.
+    /** All rays are tested against the same state of the world, without returning to the main loop in between.
+        @param rays Rays to cast. The directions will be normalized automatically
+        @param maxdistance Length of each ray
+        @param collisiongroup Collision layer. Default has all bits set.
+        @param collisionmask Collision mask. Default has all bits set.
+        @return Results of the rays. The result objects are owned by the physics world and reused by the next batch raycast. */
+    QList<PhysicsRaycastResult*> RaycastBatch(const QList<Ray> &rays, float maxdistance, int collisiongroup = -1, int collisionmask = -1);
+    
     /// Return gravity
     float3 GetGravity() const;
     
-    /// Return the Bullet world object
+    /// Return the Bullet world object. Waits for a step running on the physics thread to finish first.
     btDiscreteDynamicsWorld* GetWorld() const;
     
     /// Return whether the physics world is for a client scene. Client scenes only simulate local entities' motion on their own.
@@ -169,6 +213,36 @@ signals:
     void Updated(float frametime);
     
 private:
+    /// Contact point recorded in a simulation substep, to be emitted as collision signals
+    struct Contact
+    {
+        btCollisionObject* objectA; ///< Null if the contact has been discarded because one of the bodies was removed
+        btCollisionObject* objectB;
+        float3 position;
+        float3 normal;
+        float distance;
+        float impulse;
+        bool newCollision;
+    };
+    
+    /// Records the contacts of the current collisions to pendingContacts_, and ends the substep in pendingSubSteps_
+    void RecordContacts(float substeptime);
+    
+    /// Emits the collision and Updated signals of the recorded substeps
+    void EmitPendingContacts();
+    
+    /// Waits for the step running on the physics thread and applies its transforms and collision signals to the scene
+    void FinishStep();
+    
+    /// Buffers a transform set by the physics thread, to be applied by FinishStep(). Called by EC_RigidBody from the physics thread.
+    void AddPendingTransform(EC_RigidBody* body);
+    
+    /// Discards the pending transform and contacts of a rigid body whose Bullet body is being destroyed
+    void ForgetBody(EC_RigidBody* body);
+    
+    /// Draw debug geometry if needed, enabling or disabling it automatically from the debug-enabled rigidbodies
+    void UpdateDebugGeometry();
+    
     /// Bullet collision config
     btCollisionConfiguration* collisionConfiguration_;
     /// Bullet collision dispatcher
@@ -214,5 +288,28 @@ private:
     
     /// Debug draw-enabled rigidbodies. Note: these pointers are never dereferenced, it is just used for counting
     std::set<EC_RigidBody*> debugRigidBodies_;
+    
+    /// Result objects of RaycastBatch, reused between batches
+    std::vector<PhysicsRaycastResult*> batchResults_;
+    
+    /// Whether to step on the physics thread
+    bool threadedStepping_;
+    
+    /// Whether a step is running on the physics thread. Written only by the main thread, while no step is running.
+    mutable bool stepping_;
+    
+    /// Physics thread. Runs at most one step at a time
+    mutable QThreadPool stepThread_;
+    
+    /// Contacts of the substeps not yet emitted
+    std::vector<Contact> pendingContacts_;
+    
+    /// Substeps not yet emitted, as pairs of substep length and the end of the substep's contacts in pendingContacts_
+    std::vector<std::pair<float, size_t> > pendingSubSteps_;
+    
+    /// Rigid bodies with a transform from the physics thread not yet applied
+    std::vector<EC_RigidBody*> pendingTransforms_;
 };
 }
+
+Q_DECLARE_METATYPE(QList<PhysicsRaycastResult*>)
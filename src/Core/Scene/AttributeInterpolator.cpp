@@ -0,0 +1,397 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AttributeInterpolator.h"
+#include "IAttribute.h"
+#include "IComponent.h"
+#include "Transform.h"
+#include "Color.h"
+#include "Math/Quat.h"
+#include "Math/float2.h"
+#include "Math/float4.h"
+
+#include "MemoryLeakCheck.h"
+
+/// Interpolations of one attribute type. The common per-slot data is kept here, the values in the typed subclasses.
+class AttributeInterpolator::Store
+{
+public:
+    virtual ~Store() {}
+
+    /// Grows or shrinks the value arrays to the number of slots.
+    virtual void ResizeValues(size_t size) = 0;
+    /// Moves the values of a slot to another slot.
+    virtual void MoveValues(size_t from, size_t to) = 0;
+    /// Sets the values of a slot: the start value from the current value of its attribute and the end value from @c endValue.
+    /** If @c snap is true, the attribute is first set to the end value. */
+    virtual void SetValues(size_t index, const IAttribute *endValue, bool snap) = 0;
+    /// Copies the end value of a slot to an attribute of the same type.
+    virtual void CopyEndValue(size_t index, IAttribute *dest) const = 0;
+    /// Computes the values of all slots at their interpolation factors, then sets them to the attributes whose factor is not negative.
+    virtual void Apply() = 0;
+
+    std::vector<IAttribute *> attributes;
+    std::vector<ComponentWeakPtr> components; ///< Checked before the raw attribute pointers are accessed.
+    std::vector<float> times;
+    std::vector<float> lengths;
+    std::vector<float> factors; ///< Interpolation factor of the current update, negative if the attribute is not set.
+};
+
+namespace
+{
+    /// Interpolated representation of a Transform. The rotation is converted from Euler angles once when an interpolation starts.
+    struct TransformValue
+    {
+        float3 pos;
+        Quat rot;
+        float3 scale;
+    };
+
+    /// Linear interpolation which may also extrapolate, t > 1.
+    template<typename V>
+    inline V InterpolateValue(const V &a, const V &b, float t)
+    {
+        return a + (b - a) * t;
+    }
+
+    /// Normalized lerp along the shorter arc.
+    inline Quat InterpolateValue(const Quat &a, const Quat &b, float t)
+    {
+        float s = a.Dot(b) < 0.f ? -t : t;
+        Quat q(a.x + (b.x * s - a.x * t), a.y + (b.y * s - a.y * t), a.z + (b.z * s - a.z * t), a.w + (b.w * s - a.w * t));
+        return q.Normalized();
+    }
+
+    /// Colors are not extrapolated, as the components would leave their range.
+    inline Color InterpolateValue(const Color &a, const Color &b, float t)
+    {
+        if (t > 1.f)
+            t = 1.f;
+        return Color(a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t, a.a + (b.a - a.a) * t);
+    }
+
+    inline TransformValue InterpolateValue(const TransformValue &a, const TransformValue &b, float t)
+    {
+        TransformValue v;
+        v.pos = a.pos + (b.pos - a.pos) * t;
+        v.rot = InterpolateValue(a.rot, b.rot, t);
+        v.scale = a.scale + (b.scale - a.scale) * t;
+        return v;
+    }
+
+    template<typename T>
+    inline const T &ToInterpolated(const T &value) { return value; }
+
+    inline TransformValue ToInterpolated(const Transform &value)
+    {
+        TransformValue v;
+        v.pos = value.pos;
+        v.rot = value.Orientation();
+        v.scale = value.scale;
+        return v;
+    }
+
+    template<typename T>
+    inline const T &FromInterpolated(const T &value) { return value; }
+
+    inline Transform FromInterpolated(const TransformValue &value)
+    {
+        Transform t;
+        t.pos = value.pos;
+        t.SetOrientation(value.rot);
+        t.scale = value.scale;
+        return t;
+    }
+
+    /// Store of an attribute type T which is interpolated as V.
+    template<typename T, typename V = T>
+    class ValueStore : public AttributeInterpolator::Store
+    {
+    public:
+        virtual void ResizeValues(size_t size)
+        {
+            starts.resize(size);
+            ends.resize(size);
+            endValues.resize(size);
+            values.resize(size);
+        }
+
+        virtual void MoveValues(size_t from, size_t to)
+        {
+            starts[to] = starts[from];
+            ends[to] = ends[from];
+            endValues[to] = endValues[from];
+        }
+
+        virtual void SetValues(size_t index, const IAttribute *endValue, bool snap)
+        {
+            Attribute<T> *attr = static_cast<Attribute<T> *>(attributes[index]);
+            endValues[index] = static_cast<const Attribute<T> *>(endValue)->Get();
+            if (snap)
+                attr->Set(endValues[index], AttributeChange::LocalOnly);
+            starts[index] = ToInterpolated(attr->Get());
+            ends[index] = ToInterpolated(endValues[index]);
+        }
+
+        virtual void CopyEndValue(size_t index, IAttribute *dest) const
+        {
+            static_cast<Attribute<T> *>(dest)->Set(endValues[index], AttributeChange::Disconnected);
+        }
+
+        virtual void Apply()
+        {
+            const size_t size = attributes.size();
+            for(size_t i = 0; i < size; ++i)
+                values[i] = InterpolateValue(starts[i], ends[i], factors[i] > 0.f ? factors[i] : 0.f);
+            for(size_t i = 0; i < size; ++i)
+                if (factors[i] >= 0.f)
+                    static_cast<Attribute<T> *>(attributes[i])->Set(FromInterpolated(values[i]), AttributeChange::LocalOnly);
+        }
+
+    private:
+        std::vector<V> starts;
+        std::vector<V> ends;
+        std::vector<T> endValues; ///< Exact end values, as V may not represent them exactly.
+        std::vector<V> values;
+    };
+
+    /// Store of the attribute types without a typed store, which interpolates with IAttribute::Interpolate.
+    class CloneStore : public AttributeInterpolator::Store
+    {
+    public:
+        virtual ~CloneStore()
+        {
+            ResizeValues(0);
+        }
+
+        virtual void ResizeValues(size_t size)
+        {
+            for(size_t i = size; i < starts.size(); ++i)
+            {
+                delete starts[i];
+                delete ends[i];
+            }
+            starts.resize(size, 0);
+            ends.resize(size, 0);
+        }
+
+        virtual void MoveValues(size_t from, size_t to)
+        {
+            std::swap(starts[to], starts[from]);
+            std::swap(ends[to], ends[from]);
+        }
+
+        virtual void SetValues(size_t index, const IAttribute *endValue, bool snap)
+        {
+            IAttribute *attr = attributes[index];
+            IAttribute *source = const_cast<IAttribute *>(endValue);
+            if (snap)
+                attr->CopyValue(source, AttributeChange::LocalOnly);
+            if (!starts[index])
+            {
+                starts[index] = attr->Clone();
+                ends[index] = attr->Clone();
+            }
+            starts[index]->CopyValue(attr, AttributeChange::Disconnected);
+            ends[index]->CopyValue(source, AttributeChange::Disconnected);
+        }
+
+        virtual void CopyEndValue(size_t index, IAttribute *dest) const
+        {
+            dest->CopyValue(ends[index], AttributeChange::Disconnected);
+        }
+
+        virtual void Apply()
+        {
+            for(size_t i = 0; i < attributes.size(); ++i)
+                if (factors[i] >= 0.f)
+                    attributes[i]->Interpolate(starts[i], ends[i], factors[i] < 1.f ? factors[i] : 1.f, AttributeChange::LocalOnly);
+        }
+
+    private:
+        std::vector<IAttribute *> starts;
+        std::vector<IAttribute *> ends;
+    };
+}
+
+AttributeInterpolator::AttributeInterpolator() :
+    stores_(cNumAttributeTypes, (Store *)0),
+    maxExtrapolation_(0.f)
+{
+}
+
+AttributeInterpolator::~AttributeInterpolator()
+{
+    for(size_t i = 0; i < stores_.size(); ++i)
+        delete stores_[i];
+}
+
+AttributeInterpolator::Store *AttributeInterpolator::StoreForType(u32 typeId)
+{
+    if (typeId >= stores_.size())
+        stores_.resize(typeId + 1, 0);
+    if (!stores_[typeId])
+    {
+        switch(typeId)
+        {
+        case cAttributeReal: stores_[typeId] = new ValueStore<float>(); break;
+        case cAttributeFloat2: stores_[typeId] = new ValueStore<float2>(); break;
+        case cAttributeFloat3: stores_[typeId] = new ValueStore<float3>(); break;
+        case cAttributeFloat4: stores_[typeId] = new ValueStore<float4>(); break;
+        case cAttributeColor: stores_[typeId] = new ValueStore<Color>(); break;
+        case cAttributeQuat: stores_[typeId] = new ValueStore<Quat>(); break;
+        case cAttributeTransform: stores_[typeId] = new ValueStore<Transform, TransformValue>(); break;
+        default: stores_[typeId] = new CloneStore(); break;
+        }
+    }
+    return stores_[typeId];
+}
+
+bool AttributeInterpolator::Start(IAttribute *attr, const IAttribute *endValue, float length)
+{
+    LocationMap::iterator i = locations_.find(attr);
+    if (i != locations_.end())
+    {
+        Store *store = i->second.store;
+        size_t index = i->second.index;
+        store->times[index] = 0.f;
+        store->lengths[index] = length;
+        store->SetValues(index, endValue, false);
+        return true;
+    }
+
+    Store *store = StoreForType(attr->TypeId());
+    size_t index = store->attributes.size();
+    store->attributes.push_back(attr);
+    store->components.push_back(attr->Owner()->shared_from_this());
+    store->times.push_back(0.f);
+    store->lengths.push_back(length);
+    store->factors.push_back(-1.f);
+    store->ResizeValues(index + 1);
+    store->SetValues(index, endValue, true);
+
+    Location location = { store, index };
+    locations_[attr] = location;
+    return false;
+}
+
+bool AttributeInterpolator::End(IAttribute *attr)
+{
+    LocationMap::iterator i = locations_.find(attr);
+    if (i == locations_.end())
+        return false;
+    RemoveSlot(i->second.store, i->second.index);
+    return true;
+}
+
+bool AttributeInterpolator::EndValue(IAttribute *attr, IAttribute *dest) const
+{
+    LocationMap::const_iterator i = locations_.find(attr);
+    if (i == locations_.end() || !dest || dest->TypeId() != attr->TypeId())
+        return false;
+    i->second.store->CopyEndValue(i->second.index, dest);
+    return true;
+}
+
+void AttributeInterpolator::EndAll()
+{
+    for(size_t i = 0; i < stores_.size(); ++i)
+    {
+        delete stores_[i];
+        stores_[i] = 0;
+    }
+    locations_.clear();
+}
+
+void AttributeInterpolator::RemoveSlot(Store *store, size_t index)
+{
+    locations_.erase(store->attributes[index]);
+
+    size_t last = store->attributes.size() - 1;
+    if (index != last)
+    {
+        store->attributes[index] = store->attributes[last];
+        store->components[index] = store->components[last];
+        store->times[index] = store->times[last];
+        store->lengths[index] = store->lengths[last];
+        store->factors[index] = store->factors[last];
+        store->MoveValues(last, index);
+        locations_[store->attributes[index]].index = index;
+    }
+
+    store->attributes.pop_back();
+    store->components.pop_back();
+    store->times.pop_back();
+    store->lengths.pop_back();
+    store->factors.pop_back();
+    store->ResizeValues(last);
+}
+
+void AttributeInterpolator::SetMaxExtrapolation(float fraction)
+{
+    maxExtrapolation_ = fraction < 0.f ? 0.f : (fraction > 0.9f ? 0.9f : fraction);
+}
+
+void AttributeInterpolator::Update(float frametime)
+{
+    const float maxFactor = 1.f + maxExtrapolation_;
+
+    for(size_t s = 0; s < stores_.size(); ++s)
+    {
+        Store *store = stores_[s];
+        if (!store || store->attributes.empty())
+            continue;
+
+        // Interpolations are kept alive for 2x their length, though the value is set only until the end value
+        // (or the extrapolation limit) is reached. This is for the continuous/discontinuous update detection in Start().
+        // Removing a slot moves the last one in its place, so iterate backwards.
+        for(size_t i = store->attributes.size() - 1; i < store->attributes.size(); --i)
+        {
+            // Check that the component still exists ie. it's safe to access the attribute
+            if (store->components[i].expired())
+            {
+                RemoveSlot(store, i);
+                continue;
+            }
+
+            float length = store->lengths[i];
+            float previousTime = store->times[i];
+            float time = previousTime + frametime;
+            store->times[i] = time;
+            float t = time / length;
+
+            if (maxExtrapolation_ <= 0.f)
+            {
+                if (previousTime <= length)
+                    store->factors[i] = t < 1.f ? t : 1.f;
+                else if (time >= length * 2.f)
+                    RemoveSlot(store, i);
+                else
+                    store->factors[i] = -1.f;
+            }
+            else
+            {
+                // Extrapolate up to the limit, then return to the end value by the time the interpolation expires
+                if (t <= maxFactor)
+                    store->factors[i] = t;
+                else
+                {
+                    float back = maxFactor - maxExtrapolation_ * (t - maxFactor) / (2.f - maxFactor);
+                    store->factors[i] = back > 1.f ? back : 1.f;
+                }
+            }
+        }
+
+        store->Apply();
+
+        // With extrapolation, the last value was set above before the interpolation expires
+        if (maxExtrapolation_ > 0.f)
+        {
+            for(size_t i = store->attributes.size() - 1; i < store->attributes.size(); --i)
+                if (store->times[i] >= store->lengths[i] * 2.f)
+                    RemoveSlot(store, i);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+
+#include <boost/unordered_map.hpp>
+#include <vector>
+
+class IAttribute;
+
+/// Running attribute interpolations of a scene.
+/** Interpolations are stored by attribute type in dense arrays of start and end values. Starting an interpolation does not allocate
+    once the arrays have grown (except for the rarely interpolated int, uint and QPoint attributes, which fall back to attribute clones),
+    finding and ending one is a hash lookup, and each update first computes the values of a whole type in one pass and then sets them
+    to the attributes. Quaternion rotations, also those of Transforms, are interpolated with normalized lerp.
+
+    When extrapolation is enabled, an interpolation continues past its end value for a fraction of its length if the next
+    update is late, then returns to the end value over the rest of the time it is kept alive.
+
+    Owned by Scene, see Scene::StartAttributeInterpolation. */
+class AttributeInterpolator
+{
+public:
+    AttributeInterpolator();
+    ~AttributeInterpolator();
+
+    /// Starts interpolating an attribute to the value of @c endValue over @c length seconds.
+    /** If the attribute is already interpolating, the new interpolation starts from its current value. Otherwise the attribute is
+        first set to the end value, so that the next update is detected as a continuous one and is interpolated normally.
+        @param attr Attribute inside a component. The caller must have checked that the attribute is valid for interpolation.
+        @param endValue Attribute of the same type holding the end value. Not stored.
+        @return true if the attribute was already interpolating */
+    bool Start(IAttribute *attr, const IAttribute *endValue, float length);
+
+    /// Ends the interpolation of an attribute. The last set value will remain.
+    /** @return true if the attribute was interpolating */
+    bool End(IAttribute *attr);
+
+    /// Copies the end value of a running interpolation to @c dest, which must be of the same type.
+    /** @return false if the attribute is not interpolating */
+    bool EndValue(IAttribute *attr, IAttribute *dest) const;
+
+    /// Ends all interpolations.
+    void EndAll();
+
+    /// Advances all interpolations and sets the interpolated values with AttributeChange::LocalOnly.
+    void Update(float frametime);
+
+    /// Returns the number of running interpolations.
+    size_t Count() const { return locations_.size(); }
+
+    /// Sets how far past the end value an interpolation may be extrapolated, as a fraction of its length, clamped to [0, 0.9]. 0 disables.
+    void SetMaxExtrapolation(float fraction);
+
+    /// Returns the extrapolation limit as a fraction of the interpolation length.
+    float MaxExtrapolation() const { return maxExtrapolation_; }
+
+    class Store;
+
+private:
+    /// Location of an interpolation: its store and the slot in it.
+    struct Location
+    {
+        Store *store;
+        size_t index;
+    };
+    typedef boost::unordered_map<IAttribute *, Location> LocationMap;
+
+    /// Returns the store for an attribute type, creating it on first use.
+    Store *StoreForType(u32 typeId);
+
+    /// Removes a slot by moving the last slot of the store in its place.
+    void RemoveSlot(Store *store, size_t index);
+
+    std::vector<Store *> stores_; ///< Stores by attribute type id, null if not created yet.
+    LocationMap locations_; ///< Interpolating attributes.
+    float maxExtrapolation_;
+};
@@ -28,6 +28,13 @@ public:
         Interpolate
     };
 
+    /// Network encoding of the attribute.
+    enum NetworkEncoding
+    {
+        FullPrecision, ///< The attribute is replicated as IAttribute::ToBinary writes it.
+        Quantized ///< Compact, lossy encoding of Transform and float3 attributes, used when both peers support it.
+    };
+
     /// Contains all information needed to create QPushButtons to ECEditor.
     struct ButtonInfo
     {
@@ -58,7 +65,7 @@ public:
     typedef std::map<int, std::string> EnumDescMap_t;
 
     /// Default constructor.
-    AttributeMetadata() : interpolation(None), designable(true) {}
+    AttributeMetadata() : interpolation(None), networkEncoding(FullPrecision), designable(true) {}
 
     /// Constructor.
     /** @param desc Description.
@@ -76,6 +83,7 @@ public:
         step(step_),
         enums(enum_desc),
         interpolation(interpolation_),
+        networkEncoding(FullPrecision),
         designable(designable_)
     {
     }
@@ -104,6 +112,9 @@ public:
     /// Interpolation mode for clients.
     InterpolationMode interpolation;
 
+    /// Network encoding of the attribute.
+    NetworkEncoding networkEncoding;
+
     /// Mapping of enumeration's signatures (in readable form) and actual values.
     EnumDescMap_t enums;
 
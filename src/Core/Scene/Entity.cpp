@@ -17,6 +17,7 @@
 
 #include <kNet/DataSerializer.h>
 #include <kNet/DataDeserializer.h>
+#include <kNet/NetException.h>
 
 #include "MemoryLeakCheck.h"
 
@@ -333,6 +334,11 @@ ComponentPtr Entity::GetComponentById(entity_id_t id) const
 
 ComponentPtr Entity::GetComponent(const QString &type_name) const
 {
+    u32 typeId = framework_ ? framework_->Scene()->GetComponentTypeId(type_name) : 0;
+    if (typeId)
+        return GetComponent(typeId);
+
+    // Not a registered component type, fall back to comparing the type names
     for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
         if (i->second->TypeName() == type_name)
             return i->second;
@@ -360,6 +366,10 @@ Entity::ComponentVector Entity::GetComponents(const QString &type_name) const
 
 ComponentPtr Entity::GetComponent(const QString &type_name, const QString& name) const
 {
+    u32 typeId = framework_ ? framework_->Scene()->GetComponentTypeId(type_name) : 0;
+    if (typeId)
+        return GetComponent(typeId, name);
+
     for (ComponentMap::const_iterator i = components_.begin(); i != components_.end(); ++i)
         if (i->second->TypeName() == type_name && i->second->Name() == name)
             return i->second;
@@ -416,13 +426,27 @@ void Entity::SerializeToBinary(kNet::DataSerializer &dst) const
             dst.AddString(i->second->Name().toStdString());
             dst.Add<u8>(i->second->IsReplicated() ? 1 : 0);
             
-            // Write each component to a separate buffer, then write out its size first, so we can skip unknown components
+            // Write each component to a separate buffer, then write out its size first, so we can skip unknown components.
+            // The serializer throws a NetException when the buffer runs out, so start from 64KB and retry with a larger buffer until the component fits.
+            // Component data has no size known up front, as attributes such as strings and variant lists are variable-sized.
             QByteArray comp_bytes;
-            // Assume 64KB max per component for now
             comp_bytes.resize(64 * 1024);
-            kNet::DataSerializer comp_dest(comp_bytes.data(), comp_bytes.size());
-            i->second->SerializeToBinary(comp_dest);
-            comp_bytes.resize(comp_dest.BytesFilled());
+            for(;;)
+            {
+                try
+                {
+                    kNet::DataSerializer comp_dest(comp_bytes.data(), comp_bytes.size());
+                    i->second->SerializeToBinary(comp_dest);
+                    comp_bytes.resize(comp_dest.BytesFilled());
+                    break;
+                }
+                catch(kNet::NetException &)
+                {
+                    if (comp_bytes.size() >= 64 * 1024 * 1024)
+                        throw;
+                    comp_bytes.resize(comp_bytes.size() * 2);
+                }
+            }
             
             dst.Add<u32>(comp_bytes.size());
             dst.AddArray<u8>((const u8*)comp_bytes.data(), comp_bytes.size());
@@ -39,7 +39,8 @@ public:
         Invalid = 0, ///< Invalid.
         Local = 1, ///< Executed locally.
         Server = 2, ///< Executed on server.
-        Peers = 4 ///< Executed on peers.
+        Peers = 4, ///< Executed on peers.
+        Sender = 8 ///< Executed on the client that sent the action being handled. Only has an effect on the server while it handles an action sent by a client.
     };
 
     /// Used to to store logical OR combinations of execution types.
@@ -376,11 +376,15 @@ void IComponent::EmitAttributeChanged(IAttribute* attribute, AttributeChange::Ty
         change = updateMode;
     assert(change != AttributeChange::Default);
 
+    // Keep the scene's attribute indexes up to date also when no signals are sent
+    Scene* scene = ParentScene();
+    if (scene)
+        scene->UpdateAttributeIndexes(attribute);
+
     if (change == AttributeChange::Disconnected)
         return; // No signals
     
     // Trigger scenemanager signal
-    Scene* scene = ParentScene();
     if (scene)
         scene->EmitAttributeChanged(this, attribute, change);
     
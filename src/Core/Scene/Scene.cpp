@@ -12,6 +12,8 @@
 #include "EC_Name.h"
 #include "AttributeMetadata.h"
 #include "ChangeRequest.h"
+#include "AttributeInterpolator.h"
+#include "SceneBinaryFormat.h"
 
 #include "Framework.h"
 #include "AssetAPI.h"
@@ -31,19 +33,41 @@
 #include <boost/regex.hpp>
 
 #include <utility>
+#include <algorithm>
 #include "MemoryLeakCheck.h"
 
 using namespace kNet;
 
+namespace
+{
+    /// Returns the value of an attribute as a key of an attribute index.
+    QString AttributeIndexKey(const IAttribute *attribute)
+    {
+        if (attribute->TypeId() == cAttributeString)
+            return static_cast<const Attribute<QString> *>(attribute)->Get();
+        return QString::fromStdString(attribute->ToString());
+    }
+}
+
 Scene::Scene(const QString &name, Framework *framework, bool viewEnabled, bool authority) :
     name_(name),
     framework_(framework),
     interpolating_(false),
-    authority_(authority)
+    authority_(authority),
+    interpolator_(new AttributeInterpolator()),
+    progressiveLoadIndex_(0),
+    progressiveLoadBatch_(0),
+    progressiveLoadUseIds_(false),
+    progressiveLoadChange_(AttributeChange::Default),
+    nameIndex_(0)
 {
     // In headless mode only view disabled-scenes can be created
     viewEnabled_ = framework->IsHeadless() ? false : viewEnabled_ = viewEnabled;
 
+    // The name index is always present for GetEntityByName and IsUniqueName
+    nameIndex_ = &attributeIndexes_[std::make_pair(EC_Name::TypeIdStatic(), QString("name"))];
+    nameIndex_->refCount = 1;
+
     // Connect to frame update to handle signalling entities created on this frame
     connect(framework->Frame(), SIGNAL(Updated(float)), this, SLOT(OnUpdated(float)));
 }
@@ -56,6 +80,8 @@ Scene::~Scene()
     RemoveAllEntities(false);
     
     emit Removed(this);
+    
+    delete interpolator_;
 }
 
 EntityPtr Scene::CreateLocalEntity(const QStringList &components, AttributeChange::Type change, bool componentsReplicated)
@@ -123,12 +149,16 @@ EntityPtr Scene::GetEntity(entity_id_t id) const
 
 EntityPtr Scene::GetEntityByName(const QString &name) const
 {
-    EntityMap::const_iterator it = entities_.begin();
-    while(it != entities_.end())
+    QHash<QString, AttributeValueEntities>::const_iterator nameIt = nameIndex_->entities.find(name);
+    if (nameIt == nameIndex_->entities.end())
+        return EntityPtr();
+    
+    // The index also holds entities which are still being created, so return the first one that is in the scene
+    for(AttributeValueEntities::const_iterator it = nameIt->begin(); it != nameIt->end(); ++it)
     {
-        if (it->second->Name() == name)
-            return it->second;
-        ++it;
+        EntityMap::const_iterator entityIt = entities_.find(it->first);
+        if (entityIt != entities_.end())
+            return entityIt->second;
     }
     
     return EntityPtr();
@@ -136,20 +166,173 @@ EntityPtr Scene::GetEntityByName(const QString &name) const
 
 bool Scene::IsUniqueName(const QString& name) const
 {
+    QHash<QString, AttributeValueEntities>::const_iterator nameIt = nameIndex_->entities.find(name);
+    if (nameIt == nameIndex_->entities.end())
+        return true;
+    
     int count = 0;
-    EntityMap::const_iterator it = entities_.begin();
-    while(it != entities_.end())
+    for(AttributeValueEntities::const_iterator it = nameIt->begin(); it != nameIt->end(); ++it)
     {
-        if (it->second->Name() == name)
+        if (entities_.find(it->first) != entities_.end())
             ++count;
         if (count > 1)
             return false;
-        ++it;
     }
     
     return true;
 }
 
+bool Scene::RegisterAttributeIndex(const QString &componentTypeName, const QString &attributeName)
+{
+    u32 typeId = framework_->Scene()->GetComponentTypeId(componentTypeName);
+    if (!typeId)
+    {
+        LogError("Scene::RegisterAttributeIndex: Unknown component type " + componentTypeName);
+        return false;
+    }
+    
+    AttributeIndex &index = attributeIndexes_[std::make_pair(typeId, attributeName)];
+    if (index.refCount++ > 0)
+        return true;
+    
+    // Index the existing components of the type
+    ComponentTypeIndex::const_iterator typeIt = componentTypeIndex_.find(typeId);
+    if (typeIt == componentTypeIndex_.end())
+        return true;
+    for(ComponentTypeEntities::const_iterator it = typeIt->second.begin(); it != typeIt->second.end(); ++it)
+    {
+        EntityMap::const_iterator entityIt = entities_.find(it->first);
+        if (entityIt == entities_.end())
+            continue;
+        const Entity::ComponentMap &components = entityIt->second->Components();
+        for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+        {
+            if (i->second->TypeId() != typeId)
+                continue;
+            IAttribute *attribute = i->second->GetAttribute(attributeName);
+            if (attribute)
+                AddToAttributeIndex(index, it->first, attribute);
+        }
+    }
+    return true;
+}
+
+void Scene::UnregisterAttributeIndex(const QString &componentTypeName, const QString &attributeName)
+{
+    u32 typeId = framework_->Scene()->GetComponentTypeId(componentTypeName);
+    AttributeIndexMap::iterator indexIt = attributeIndexes_.find(std::make_pair(typeId, attributeName));
+    if (indexIt == attributeIndexes_.end() || &indexIt->second == nameIndex_)
+        return;
+    if (--indexIt->second.refCount > 0)
+        return;
+    
+    for(QHash<IAttribute *, IndexedAttribute>::iterator it = indexedAttributes_.begin(); it != indexedAttributes_.end();)
+    {
+        if (it->index == &indexIt->second)
+            it = indexedAttributes_.erase(it);
+        else
+            ++it;
+    }
+    attributeIndexes_.erase(indexIt);
+}
+
+bool Scene::HasAttributeIndex(const QString &componentTypeName, const QString &attributeName) const
+{
+    return FindAttributeIndex(componentTypeName, attributeName) != 0;
+}
+
+EntityList Scene::FindEntitiesByAttribute(const QString &componentTypeName, const QString &attributeName, const QString &value) const
+{
+    std::list<EntityPtr> entities;
+    const AttributeIndex *index = FindAttributeIndex(componentTypeName, attributeName);
+    if (!index)
+        return entities;
+    
+    QHash<QString, AttributeValueEntities>::const_iterator valueIt = index->entities.find(value);
+    if (valueIt == index->entities.end())
+        return entities;
+    for(AttributeValueEntities::const_iterator it = valueIt->begin(); it != valueIt->end(); ++it)
+    {
+        EntityMap::const_iterator entityIt = entities_.find(it->first);
+        if (entityIt != entities_.end())
+            entities.push_back(entityIt->second);
+    }
+    
+    return entities;
+}
+
+const Scene::AttributeIndex *Scene::FindAttributeIndex(const QString &componentTypeName, const QString &attributeName) const
+{
+    u32 typeId = framework_->Scene()->GetComponentTypeId(componentTypeName);
+    AttributeIndexMap::const_iterator indexIt = attributeIndexes_.find(std::make_pair(typeId, attributeName));
+    return indexIt != attributeIndexes_.end() ? &indexIt->second : 0;
+}
+
+void Scene::AddToAttributeIndex(AttributeIndex &index, entity_id_t entityId, IAttribute *attribute)
+{
+    RemoveFromAttributeIndex(attribute);
+    IndexedAttribute &indexed = indexedAttributes_[attribute];
+    indexed.index = &index;
+    indexed.entityId = entityId;
+    indexed.value = AttributeIndexKey(attribute);
+    ++index.entities[indexed.value][entityId];
+}
+
+void Scene::RemoveFromAttributeIndex(IAttribute *attribute)
+{
+    QHash<IAttribute *, IndexedAttribute>::iterator indexedIt = indexedAttributes_.find(attribute);
+    if (indexedIt == indexedAttributes_.end())
+        return;
+    
+    QHash<QString, AttributeValueEntities> &entities = indexedIt->index->entities;
+    QHash<QString, AttributeValueEntities>::iterator valueIt = entities.find(indexedIt->value);
+    if (valueIt != entities.end())
+    {
+        AttributeValueEntities::iterator it = valueIt->find(indexedIt->entityId);
+        if (it != valueIt->end() && --it->second == 0)
+        {
+            valueIt->erase(it);
+            if (valueIt->empty())
+                entities.erase(valueIt);
+        }
+    }
+    indexedAttributes_.erase(indexedIt);
+}
+
+void Scene::AddToAttributeIndexes(entity_id_t entityId, IComponent *comp)
+{
+    u32 typeId = comp->TypeId();
+    for(AttributeIndexMap::iterator it = attributeIndexes_.lower_bound(std::make_pair(typeId, QString())); it != attributeIndexes_.end() && it->first.first == typeId; ++it)
+    {
+        IAttribute *attribute = comp->GetAttribute(it->first.second);
+        if (attribute)
+            AddToAttributeIndex(it->second, entityId, attribute);
+    }
+}
+
+void Scene::RemoveFromAttributeIndexes(IComponent *comp)
+{
+    u32 typeId = comp->TypeId();
+    for(AttributeIndexMap::iterator it = attributeIndexes_.lower_bound(std::make_pair(typeId, QString())); it != attributeIndexes_.end() && it->first.first == typeId; ++it)
+    {
+        IAttribute *attribute = comp->GetAttribute(it->first.second);
+        if (attribute)
+            RemoveFromAttributeIndex(attribute);
+    }
+}
+
+void Scene::UpdateAttributeIndexes(IAttribute* attribute)
+{
+    QHash<IAttribute *, IndexedAttribute>::iterator indexedIt = indexedAttributes_.find(attribute);
+    if (indexedIt == indexedAttributes_.end())
+        return;
+    
+    QString value = AttributeIndexKey(attribute);
+    if (value == indexedIt->value)
+        return;
+    AddToAttributeIndex(*indexedIt->index, indexedIt->entityId, attribute);
+}
+
 void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
 {
     if (old_id == new_id)
@@ -168,6 +351,15 @@ void Scene::ChangeEntityId(entity_id_t old_id, entity_id_t new_id)
     old_entity->SetNewId(new_id);
     entities_.erase(old_id);
     entities_[new_id] = old_entity;
+
+    const Entity::ComponentMap &components = old_entity->Components();
+    for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+    {
+        RemoveFromComponentTypeIndex(old_id, i->second->TypeId());
+        AddToComponentTypeIndex(new_id, i->second->TypeId());
+        RemoveFromAttributeIndexes(i->second.get());
+        AddToAttributeIndexes(new_id, i->second.get());
+    }
 }
 
 void Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
@@ -179,6 +371,13 @@ void Scene::RemoveEntity(entity_id_t id, AttributeChange::Type change)
         
         EmitEntityRemoved(del_entity.get(), change);
 
+        const Entity::ComponentMap &components = del_entity->Components();
+        for(Entity::ComponentMap::const_iterator i = components.begin(); i != components.end(); ++i)
+        {
+            RemoveFromComponentTypeIndex(id, i->second->TypeId());
+            RemoveFromAttributeIndexes(i->second.get());
+        }
+
         entities_.erase(it);
         // If entity somehow manages to live, at least it doesn't belong to the scene anymore
         del_entity->SetScene(0);
@@ -202,6 +401,10 @@ void Scene::RemoveAllEntities(bool send_events, AttributeChange::Type change)
         ++it;
     }
     entities_.clear();
+    componentTypeIndex_.clear();
+    indexedAttributes_.clear();
+    for(AttributeIndexMap::iterator i = attributeIndexes_.begin(); i != attributeIndexes_.end(); ++i)
+        i->second.entities.clear();
     if (send_events)
         emit SceneCleared(this);
     
@@ -223,12 +426,17 @@ entity_id_t Scene::NextFreeIdLocal()
 
 EntityList Scene::GetEntitiesWithComponent(const QString &typeName, const QString &name) const
 {
+    u32 typeId = framework_->Scene()->GetComponentTypeId(typeName);
+    if (typeId)
+        return GetEntitiesWithComponent(typeId, name);
+
+    // The type is not registered to SceneAPI, so the components can not be looked up by type id
     std::list<EntityPtr> entities;
     EntityMap::const_iterator it = entities_.begin();
     while(it != entities_.end())
     {
         EntityPtr entity = it->second;
-        if ((name.isEmpty() && entity->GetComponent(typeName)) || entity->GetComponent(name))
+        if ((name.isEmpty() && entity->GetComponent(typeName)) || (!name.isEmpty() && entity->GetComponent(typeName, name)))
             entities.push_back(entity);
         ++it;
     }
@@ -236,6 +444,46 @@ EntityList Scene::GetEntitiesWithComponent(const QString &typeName, const QStrin
     return entities;
 }
 
+EntityList Scene::GetEntitiesWithComponent(u32 typeId, const QString &name) const
+{
+    std::list<EntityPtr> entities;
+    ComponentTypeIndex::const_iterator typeIt = componentTypeIndex_.find(typeId);
+    if (typeIt == componentTypeIndex_.end())
+        return entities;
+
+    for(ComponentTypeEntities::const_iterator it = typeIt->second.begin(); it != typeIt->second.end(); ++it)
+    {
+        EntityMap::const_iterator entityIt = entities_.find(it->first);
+        if (entityIt == entities_.end())
+            continue;
+        if (name.isEmpty() || entityIt->second->GetComponent(typeId, name))
+            entities.push_back(entityIt->second);
+    }
+
+    return entities;
+}
+
+void Scene::AddToComponentTypeIndex(entity_id_t entityId, u32 typeId)
+{
+    ++componentTypeIndex_[typeId][entityId];
+}
+
+void Scene::RemoveFromComponentTypeIndex(entity_id_t entityId, u32 typeId)
+{
+    ComponentTypeIndex::iterator typeIt = componentTypeIndex_.find(typeId);
+    if (typeIt == componentTypeIndex_.end())
+        return;
+    ComponentTypeEntities::iterator it = typeIt->second.find(entityId);
+    if (it == typeIt->second.end())
+        return;
+    if (--it->second == 0)
+    {
+        typeIt->second.erase(it);
+        if (typeIt->second.empty())
+            componentTypeIndex_.erase(typeIt);
+    }
+}
+
 EntityList Scene::GetAllEntities() const
 {
     std::list<EntityPtr> entities;
@@ -251,6 +499,10 @@ EntityList Scene::GetAllEntities() const
 
 void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    // Keep the component type index up to date regardless of the change type
+    AddToComponentTypeIndex(entity->Id(), comp->TypeId());
+    AddToAttributeIndexes(entity->Id(), comp);
+
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -260,6 +512,9 @@ void Scene::EmitComponentAdded(Entity* entity, IComponent* comp, AttributeChange
 
 void Scene::EmitComponentRemoved(Entity* entity, IComponent* comp, AttributeChange::Type change)
 {
+    RemoveFromComponentTypeIndex(entity->Id(), comp->TypeId());
+    RemoveFromAttributeIndexes(comp);
+
     if (change == AttributeChange::Disconnected)
         return;
     if (change == AttributeChange::Default)
@@ -281,6 +536,13 @@ void Scene::EmitAttributeAdded(IComponent* comp, IAttribute* attribute, Attribut
     // "Stealth" addition (disconnected changetype) is not supported. Always signal.
     if ((!comp) || (!attribute))
         return;
+    Entity *entity = comp->ParentEntity();
+    if (entity)
+    {
+        AttributeIndexMap::iterator indexIt = attributeIndexes_.find(std::make_pair(comp->TypeId(), attribute->Name()));
+        if (indexIt != attributeIndexes_.end())
+            AddToAttributeIndex(indexIt->second, entity->Id(), attribute);
+    }
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
     emit AttributeAdded(comp, attribute, change);
@@ -291,6 +553,7 @@ void Scene::EmitAttributeRemoved(IComponent* comp, IAttribute* attribute, Attrib
     // "Stealth" removal (disconnected changetype) is not supported. Always signal.
     if ((!comp) || (!attribute))
         return;
+    RemoveFromAttributeIndex(attribute);
     if (change == AttributeChange::Default)
         change = comp->UpdateMode();
     emit AttributeRemoved(comp, attribute, change);
@@ -485,51 +748,77 @@ bool Scene::SaveSceneXML(const QString& filename, bool saveTemporary, bool saveL
 
 QList<Entity *> Scene::LoadSceneBinary(const QString& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
-    QList<Entity *> ret;
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
+    SceneBinaryReader reader(filename);
+    if (!reader.IsValid())
     {
-        LogError("Failed to open file " + filename + " when loading scene binary.");
-        return ret;
+        LogError("Failed to load scene binary " + filename + ": " + reader.ErrorString());
+        return QList<Entity *>();
     }
 
-    ///\todo Use Latin 1?
-    QByteArray bytes = file.readAll();
-    file.close();
+    if (clearScene)
+        RemoveAllEntities(true, change);
+
+    return CreateContentFromBinary(reader, 0, reader.NumEntities(), useEntityIDsFromFile, change);
+}
 
-    if (!bytes.size())
+QList<Entity *> Scene::LoadSceneBinaryEntities(const QString& filename, const std::vector<entity_id_t> &ids, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+    SceneBinaryReader reader(filename);
+    if (!reader.IsValid())
     {
-        LogError("File " + filename + " contained 0 bytes when loading scene binary.");
-        return ret;
+        LogError("Failed to load scene binary " + filename + ": " + reader.ErrorString());
+        return QList<Entity *>();
+    }
+
+    std::vector<size_t> indices;
+    indices.reserve(ids.size());
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        int index = reader.FindEntity(ids[i]);
+        if (index >= 0)
+            indices.push_back(index);
+        else
+            LogWarning("Entity " + QString::number(ids[i]) + " does not exist in scene binary " + filename);
+    }
+
+    return CreateContentFromBinary(reader, indices, useEntityIDsFromFile, change);
+}
+
+bool Scene::LoadSceneBinaryProgressive(const QString& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change, int entitiesPerFrame)
+{
+    if (progressiveLoad_)
+    {
+        LogError("Cannot load scene binary " + filename + " progressively: a progressive load is already in progress.");
+        return false;
+    }
+
+    boost::shared_ptr<SceneBinaryReader> reader(new SceneBinaryReader(filename));
+    if (!reader->IsValid())
+    {
+        LogError("Failed to load scene binary " + filename + ": " + reader->ErrorString());
+        return false;
     }
 
     if (clearScene)
         RemoveAllEntities(true, change);
 
-    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+    progressiveLoad_ = reader;
+    progressiveLoadIndex_ = 0;
+    progressiveLoadBatch_ = entitiesPerFrame > 0 ? entitiesPerFrame : 1;
+    progressiveLoadUseIds_ = useEntityIDsFromFile;
+    progressiveLoadChange_ = change;
+    return true;
 }
 
 bool Scene::SaveSceneBinary(const QString& filename, bool getTemporary, bool getLocal)
 {
-    QByteArray bytes;
-    // Assume 4MB max for now
-    bytes.resize(4 * 1024 * 1024);
-    DataSerializer dest(bytes.data(), bytes.size());
-    
-    // Count number of entities we accept
-    uint num_entities = 0;
-    for(EntityMap::iterator iter = entities_.begin(); iter != entities_.end(); ++iter)
+    // Write one entity at a time, so that the size of the scene is not limited by a buffer
+    SceneBinaryWriter writer(filename);
+    if (!writer.IsOpen())
     {
-        bool serialize = true;
-        if (iter->second->IsLocal() && !getLocal)
-            serialize = false;
-        if (iter->second->IsTemporary() && !getTemporary)
-            serialize = false;
-        if (serialize)
-            ++num_entities;
+        LogError("Failed to open file " + filename + " for writing when saving scene binary.");
+        return false;
     }
-    
-    dest.Add<u32>(num_entities);
 
     for(EntityMap::iterator iter = entities_.begin(); iter != entities_.end(); ++iter)
     {
@@ -538,23 +827,19 @@ bool Scene::SaveSceneBinary(const QString& filename, bool getTemporary, bool get
             serialize = false;
         if (iter->second->IsTemporary() && !getTemporary)
             serialize = false;
-        if (serialize)
-            iter->second->SerializeToBinary(dest);
-    }
-    
-    bytes.resize(dest.BytesFilled());
-    QFile scenefile(filename);
-    if (scenefile.open(QFile::WriteOnly))
-    {
-        scenefile.write(bytes);
-        scenefile.close();
-        return true;
+        if (serialize && !writer.WriteEntity(*iter->second))
+        {
+            LogError("Failed to write " + iter->second->ToString() + " when saving scene binary " + filename + ".");
+            return false;
+        }
     }
-    else
+
+    if (!writer.Finish())
     {
-        LogError("Could not open file " + filename + " for writing when saving scene binary");
+        LogError("Failed to write the entity table when saving scene binary " + filename + ".");
         return false;
     }
+    return true;
 }
 
 QList<Entity *> Scene::CreateContentFromXml(const QString &xml,  bool useEntityIDsFromFile, AttributeChange::Type change)
@@ -664,99 +949,61 @@ QList<Entity *> Scene::CreateContentFromXml(const QDomDocument &xml, bool useEnt
 
 QList<Entity *> Scene::CreateContentFromBinary(const QString &filename, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
+    SceneBinaryReader reader(filename);
+    if (!reader.IsValid())
     {
-        LogError("Failed to open file " + filename + " when loading scene binary.");
+        LogError("Failed to load scene binary " + filename + ": " + reader.ErrorString());
         return QList<Entity*>();
     }
 
-    QByteArray bytes = file.readAll();
-    file.close();
-    
-    if (!bytes.size())
+    return CreateContentFromBinary(reader, 0, reader.NumEntities(), useEntityIDsFromFile, change);
+}
+
+QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+    assert(data);
+    assert(numBytes > 0);
+    SceneBinaryReader reader(data, numBytes > 0 ? numBytes : 0);
+    if (!reader.IsValid())
     {
-        LogError("File " + filename + "contained 0 bytes when loading scene binary.");
+        LogError("Failed to create scene content from binary: " + reader.ErrorString());
         return QList<Entity*>();
     }
 
-    return CreateContentFromBinary(bytes.data(), bytes.size(), useEntityIDsFromFile, change);
+    return CreateContentFromBinary(reader, 0, reader.NumEntities(), useEntityIDsFromFile, change);
 }
 
-QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, bool useEntityIDsFromFile, AttributeChange::Type change)
+QList<Entity *> Scene::CreateContentFromBinary(const SceneBinaryReader &reader, size_t first, size_t count, bool useEntityIDsFromFile, AttributeChange::Type change)
+{
+    std::vector<size_t> indices;
+    indices.reserve(count);
+    for(size_t i = first; i < first + count && i < reader.NumEntities(); ++i)
+        indices.push_back(i);
+    return CreateContentFromBinary(reader, indices, useEntityIDsFromFile, change);
+}
+
+QList<Entity *> Scene::CreateContentFromBinary(const SceneBinaryReader &reader, const std::vector<size_t> &indices, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
     std::vector<EntityWeakPtr> entities;
-    assert(data);
-    assert(numBytes > 0);
-    try
+    entities.reserve(indices.size());
+    for(size_t i = 0; i < indices.size(); ++i)
     {
-        DataDeserializer source(data, numBytes);
-        
-        uint num_entities = source.Read<u32>();
-        for(uint i = 0; i < num_entities; ++i)
+        const SceneBinaryEntityRecord &record = reader.EntityRecord(indices[i]);
+        try
         {
-            entity_id_t id = source.Read<u32>();
-            bool replicated = source.Read<u8>() ? true : false;
-            if (!useEntityIDsFromFile || id == 0)
-                id = replicated ? NextFreeId() : NextFreeIdLocal();
-
-            if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene.
-            {
-                LogDebug("Scene::CreateContentFromBinary: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
-                LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) + "might not replicate properly!");
-                RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
-            }
-
-            EntityPtr entity = CreateEntity(id);
+            EntityPtr entity = CreateEntityFromBinary(reader.EntityData(indices[i]), record.size, useEntityIDsFromFile);
             if (!entity)
             {
                 LogError("Failed to create entity, stopping scene load!");
-                return QList<Entity*>(); // If entity creation fails, stream desync is more than likely so stop right here
-            }
-            
-            uint num_components = source.Read<u32>();
-            for(uint i = 0; i < num_components; ++i)
-            {
-                u32 typeId = source.Read<u32>(); ///\todo VLE this!
-                QString name = QString::fromStdString(source.ReadString());
-                bool compReplicated = source.Read<u8>() ? true : false;
-                uint data_size = source.Read<u32>();
-                
-                // Read the component data into a separate byte array, then deserialize from there.
-                // This way the whole stream should not desync even if something goes wrong
-                QByteArray comp_bytes;
-                comp_bytes.resize(data_size);
-                if (data_size)
-                    source.ReadArray<u8>((u8*)comp_bytes.data(), comp_bytes.size());
-                
-                try
-                {
-                    ComponentPtr new_comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated);
-                    if (new_comp)
-                    {
-                        if (data_size)
-                        {
-                            DataDeserializer comp_source(comp_bytes.data(), comp_bytes.size());
-                            // Trigger no signal yet when scene is in incoherent state
-                            new_comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
-                        }
-                    }
-                    else
-                        LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
-                }
-                catch(...)
-                {
-                    LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
-                }
+                break;
             }
-
             entities.push_back(entity);
         }
-    }
-    catch(...)
-    {
-        // Note: if exception happens, no change signals are emitted
-        return QList<Entity *>();
+        catch(...)
+        {
+            // Each entity is read from its own chunk, so a corrupt entity does not desync the rest
+            LogError("Failed to read entity " + QString::number(record.id) + " from scene binary, skipping it.");
+        }
     }
 
     // Now that we have each entity spawned to the scene, trigger all the signals for EntityCreated/ComponentChanged messages.
@@ -782,6 +1029,77 @@ QList<Entity *> Scene::CreateContentFromBinary(const char *data, int numBytes, b
     return ret;
 }
 
+EntityPtr Scene::CreateEntityFromBinary(const char *data, size_t numBytes, bool useEntityIDsFromFile)
+{
+    DataDeserializer source(data, numBytes);
+    
+    entity_id_t id = source.Read<u32>();
+    bool replicated = source.Read<u8>() ? true : false;
+    uint num_components = source.Read<u32>();
+    size_t pos = numBytes - source.BitsLeft() / 8;
+    if (!useEntityIDsFromFile || id == 0)
+        id = replicated ? NextFreeId() : NextFreeIdLocal();
+
+    if (HasEntity(id)) // If the entity we are about to add conflicts in ID with an existing entity in the scene.
+    {
+        LogDebug("Scene::CreateContentFromBinary: Destroying previous entity with id " + QString::number(id) + " to avoid conflict with new created entity with the same id.");
+        LogError("Warning: Invoking buggy behavior: Object with id " + QString::number(id) + "might not replicate properly!");
+        RemoveEntity(id, AttributeChange::Replicate); ///<@todo Consider do we want to always use Replicate
+    }
+
+    EntityPtr entity = CreateEntity(id);
+    if (!entity)
+        return entity;
+    
+    for(uint i = 0; i < num_components; ++i)
+    {
+        if (pos >= numBytes)
+        {
+            LogError("Truncated component data in " + entity->ToString() + " when loading scene binary.");
+            break;
+        }
+        
+        DataDeserializer header(data + pos, numBytes - pos);
+        u32 typeId = header.Read<u32>(); ///\todo VLE this!
+        QString name = QString::fromStdString(header.ReadString());
+        bool compReplicated = header.Read<u8>() ? true : false;
+        uint data_size = header.Read<u32>();
+        pos = numBytes - header.BitsLeft() / 8;
+        if (data_size > numBytes - pos)
+        {
+            LogError("Truncated component data in " + entity->ToString() + " when loading scene binary.");
+            break;
+        }
+        
+        // Deserialize the component from its own part of the entity data.
+        // This way the whole stream should not desync even if something goes wrong
+        const char *comp_data = data + pos;
+        pos += data_size;
+        
+        try
+        {
+            ComponentPtr new_comp = entity->GetOrCreateComponent(typeId, name, AttributeChange::Default, compReplicated);
+            if (new_comp)
+            {
+                if (data_size)
+                {
+                    DataDeserializer comp_source(comp_data, data_size);
+                    // Trigger no signal yet when scene is in incoherent state
+                    new_comp->DeserializeFromBinary(comp_source, AttributeChange::Disconnected);
+                }
+            }
+            else
+                LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+        }
+        catch(...)
+        {
+            LogError("Failed to load component \"" + framework_->Scene()->GetComponentTypeName(typeId) + "\"!");
+        }
+    }
+    
+    return entity;
+}
+
 QList<Entity *> Scene::CreateContentFromSceneDesc(const SceneDesc &desc, bool useEntityIDsFromFile, AttributeChange::Type change)
 {
     QList<Entity *> ret;
@@ -1075,39 +1393,45 @@ SceneDesc Scene::CreateSceneDescFromBinary(const QString &filename) const
 
     sceneDesc.filename = filename;
 
-    ///\todo Use Latin 1 encoding?
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
+    SceneBinaryReader reader(filename);
+    if (!reader.IsValid())
     {
-        LogError("Failed to open file " + filename + " when trying to create scene description.");
+        LogError("Failed to read " + filename + " when trying to create scene description: " + reader.ErrorString());
         return sceneDesc;
     }
 
-    QByteArray bytes = file.readAll();
-    file.close();
-
-    return CreateSceneDescFromBinary(bytes, sceneDesc);
+    return CreateSceneDescFromBinary(reader, sceneDesc);
 }
 
 SceneDesc Scene::CreateSceneDescFromBinary(QByteArray &data, SceneDesc &sceneDesc) const
 {
-    QByteArray bytes = data;
-    if (!bytes.size())
+    if (!data.size())
     {
         LogError("File " + sceneDesc.filename + " contained 0 bytes when trying to create scene description.");
         return sceneDesc;
     }
 
+    SceneBinaryReader reader(data.constData(), data.size());
+    if (!reader.IsValid())
+    {
+        LogError("Failed to read " + sceneDesc.filename + " when trying to create scene description: " + reader.ErrorString());
+        return sceneDesc;
+    }
+
+    return CreateSceneDescFromBinary(reader, sceneDesc);
+}
+
+SceneDesc Scene::CreateSceneDescFromBinary(const SceneBinaryReader &reader, SceneDesc &sceneDesc) const
+{
     try
     {
-        DataDeserializer source(bytes.data(), bytes.size());
-        
-        uint num_entities = source.Read<u32>();
-        for(uint i = 0; i < num_entities; ++i)
+        for(size_t i = 0; i < reader.NumEntities(); ++i)
         {
+            DataDeserializer source(reader.EntityData(i), reader.EntityRecord(i).size);
             EntityDesc entityDesc;
             entity_id_t id = source.Read<u32>();
             entityDesc.id = QString::number((int)id);
+            entityDesc.local = source.Read<u8>() ? false : true;
 
             uint num_components = source.Read<u32>();
             for(uint i = 0; i < num_components; ++i)
@@ -1232,63 +1556,51 @@ bool Scene::StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue,
     if (!endvalue)
         return false;
     
+    bool success = StartAttributeInterpolation(attr, *endvalue, length);
+    delete endvalue;
+    return success;
+}
+
+bool Scene::StartAttributeInterpolation(IAttribute* attr, const IAttribute& endValue, float length)
+{
     IComponent* comp = attr ? attr->Owner() : 0;
     Entity* entity = comp ? comp->ParentEntity() : 0;
     Scene* scene = entity ? entity->ParentScene() : 0;
     
     if ((length <= 0.0f) || (!attr) || (!attr->Metadata()) || (attr->Metadata()->interpolation == AttributeMetadata::None) ||
-        (!comp) || (!entity) || (!scene) || (scene != this))
-    {
-        delete endvalue;
+        (!comp) || (!entity) || (!scene) || (scene != this) || (endValue.TypeId() != attr->TypeId()))
         return false;
-    }
-    
-    // End previous interpolation if existed
-    bool previous = EndAttributeInterpolation(attr);
     
-    // If previous interpolation does not exist, perform a direct snapping to the end value
-    // but still start an interpolation period, so that on the next update we detect that an interpolation is going on,
+    // If a previous interpolation does not exist, the interpolator performs a direct snapping to the end value
+    // but still starts an interpolation period, so that on the next update we detect that an interpolation is going on,
     // and will interpolate normally
-    if (!previous)
-        attr->CopyValue(endvalue, AttributeChange::LocalOnly);
-    
-    AttributeInterpolation newInterp;
-    newInterp.comp = comp->shared_from_this();
-    newInterp.dest = attr;
-    newInterp.start = attr->Clone();
-    newInterp.end = endvalue;
-    newInterp.length = length;
-    
-    interpolations_.push_back(newInterp);
+    interpolator_->Start(attr, &endValue, length);
     return true;
 }
 
+bool Scene::AttributeInterpolationEndValue(IAttribute* attr, IAttribute* dest) const
+{
+    return interpolator_->EndValue(attr, dest);
+}
+
+void Scene::SetAttributeExtrapolation(float fraction)
+{
+    interpolator_->SetMaxExtrapolation(fraction);
+}
+
+float Scene::AttributeExtrapolation() const
+{
+    return interpolator_->MaxExtrapolation();
+}
+
 bool Scene::EndAttributeInterpolation(IAttribute* attr)
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        if (interp.dest == attr)
-        {
-            delete interp.start;
-            delete interp.end;
-            interpolations_.erase(interpolations_.begin() + i);
-            return true;
-        }
-    }
-    return false;
+    return interpolator_->End(attr);
 }
 
 void Scene::EndAllAttributeInterpolations()
 {
-    for(uint i = 0; i < interpolations_.size(); ++i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        delete interp.start;
-        delete interp.end;
-    }
-    
-    interpolations_.clear();
+    interpolator_->EndAll();
 }
 
 void Scene::UpdateAttributeInterpolations(float frametime)
@@ -1296,50 +1608,27 @@ void Scene::UpdateAttributeInterpolations(float frametime)
     PROFILE(Scene_UpdateInterpolation);
     
     interpolating_ = true;
-    
-    for(uint i = interpolations_.size() - 1; i < interpolations_.size(); --i)
-    {
-        AttributeInterpolation& interp = interpolations_[i];
-        bool finished = false;
-        
-        // Check that the component still exists ie. it's safe to access the attribute
-        if (!interp.comp.expired())
-        {
-            // Allow the interpolation to persist for 2x time, though we are no longer setting the value
-            // This is for the continuous/discontinuous update detection in StartAttributeInterpolation()
-            if (interp.time <= interp.length)
-            {
-                interp.time += frametime;
-                float t = interp.time / interp.length;
-                if (t > 1.0f)
-                    t = 1.0f;
-                interp.dest->Interpolate(interp.start, interp.end, t, AttributeChange::LocalOnly);
-            }
-            else
-            {
-                interp.time += frametime;
-                if (interp.time >= interp.length * 2.0f)
-                    finished = true;
-            }
-        }
-        else
-            // Component pointer has expired, abort this interpolation
-            finished = true;
-        
-        // Remove interpolation (& delete start/endpoints) when done
-        if (finished)
-        {
-            delete interp.start;
-            delete interp.end;
-            interpolations_.erase(interpolations_.begin() + i);
-        }
-    }
-
+    interpolator_->Update(frametime);
     interpolating_ = false;
 }
 
 void Scene::OnUpdated(float frameTime)
 {
+    // Continue a progressive binary scene load
+    if (progressiveLoad_)
+    {
+        // Keep the reader alive even if a signal handler starts a new load
+        boost::shared_ptr<SceneBinaryReader> reader = progressiveLoad_;
+        size_t first = progressiveLoadIndex_;
+        size_t count = std::min((size_t)progressiveLoadBatch_, reader->NumEntities() - first);
+        progressiveLoadIndex_ += count;
+        if (progressiveLoadIndex_ >= reader->NumEntities())
+            progressiveLoad_.reset();
+        
+        CreateContentFromBinary(*reader, first, count, progressiveLoadUseIds_, progressiveLoadChange_);
+        emit BinaryLoadProgress((int)(first + count), (int)reader->NumEntities());
+    }
+    
     // Signal queued entity creations now
     for (unsigned i = 0; i < entitiesCreatedThisFrame_.size(); ++i)
     {
@@ -13,6 +13,7 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QHash>
 
 #include <boost/enable_shared_from_this.hpp>
 
@@ -20,19 +21,8 @@ class Framework;
 class SceneAPI;
 class UserConnection;
 class QDomDocument;
-
-/// Container for an ongoing attribute interpolation
-struct AttributeInterpolation
-{
-    AttributeInterpolation() : dest(0), start(0), end(0), time(0.0f), length(0.0f) {}
-    ///\todo The raw IAttribute pointers are unsafe. Access to them must be guarded by first checking if the component weak pointer has not expired.
-    IAttribute* dest;
-    IAttribute* start;
-    IAttribute* end;
-    ComponentWeakPtr comp;
-    float time;
-    float length;
-};
+class AttributeInterpolator;
+class SceneBinaryReader;
 
 /// A collection of entities which form an observable world.
 /** Acts as a factory for all entities.
@@ -94,7 +84,34 @@ public:
         @param old_id Old id of the existing entity
         @param new_id New id to set */
     void ChangeEntityId(entity_id_t old_id, entity_id_t new_id);
-    
+
+    /// Returns list of entities with a specific component present.
+    /** Looks up the entities from the component type index, without iterating the whole scene.
+        @param typeId Type id of the component
+        @param name Name of the component, optional. */
+    EntityList GetEntitiesWithComponent(u32 typeId, const QString &name = "") const;
+
+    /// Returns list of entities with a specific component present.
+    template <class T>
+    EntityList GetEntitiesWithComponent(const QString &name = "") const { return GetEntitiesWithComponent(T::TypeIdStatic(), name); }
+
+    /// Loads only the entities with the given IDs from a binary file, using the entity table of the file.
+    /** @param filename File name
+        @param ids IDs of the entities in the file. IDs that do not exist in the file are skipped with a warning.
+        @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file, see LoadSceneBinary.
+        @param change Change type that will be used for the new entities
+        @return List of created entities. */
+    QList<Entity *> LoadSceneBinaryEntities(const QString& filename, const std::vector<entity_id_t> &ids, bool useEntityIDsFromFile, AttributeChange::Type change);
+
+    /// Creates scene content from a range of the entities of an opened binary scene.
+    /** @param reader Reader of the binary scene.
+        @param first Index of the first entity in the reader.
+        @param count Number of entities to create.
+        @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file, see LoadSceneBinary.
+        @param change Change type that will be used for the new entities
+        @return List of created entities. */
+    QList<Entity *> CreateContentFromBinary(const SceneBinaryReader &reader, size_t first, size_t count, bool useEntityIDsFromFile, AttributeChange::Type change);
+
 public slots:
     /// Creates new entity that contains the specified components.
     /** Entities should never be created directly, but instead created with this function.
@@ -123,17 +140,37 @@ public slots:
     /// Starts an attribute interpolation
     /** @param attr Attribute inside a static-structured component.
         @param endvalue Same kind of attribute holding the endpoint value. You must dynamically allocate this yourself, but Scene
-               will always take care of deleting it.
+               will always take care of deleting it. Prefer the overload taking a reference, which does not need the allocation.
         @param length Time length
         @return true if successful (attribute must be in interpolated mode (set in metadata), must be in component, component 
                 must be static-structured, component must be in an entity which is in a scene, scene must be us) */
     bool StartAttributeInterpolation(IAttribute* attr, IAttribute* endvalue, float length);
 
+    /// Starts an attribute interpolation
+    /** @param attr Attribute inside a static-structured component.
+        @param endValue Same kind of attribute holding the endpoint value. The value is copied, so the attribute can be reused.
+        @param length Time length
+        @return true if successful, see the overload above */
+    bool StartAttributeInterpolation(IAttribute* attr, const IAttribute& endValue, float length);
+
     /// Ends an attribute interpolation. The last set value will remain.
     /** @param attr Attribute inside a static-structured component.
         @return true if an interpolation existed */
     bool EndAttributeInterpolation(IAttribute* attr);
 
+    /// Copies the end value of a running attribute interpolation.
+    /** @param attr Attribute inside a static-structured component.
+        @param dest Same kind of attribute to copy the end value to.
+        @return false if the attribute is not interpolating */
+    bool AttributeInterpolationEndValue(IAttribute* attr, IAttribute* dest) const;
+
+    /// Sets how far attribute interpolations are extrapolated when the next update is late, as a fraction of the update interval.
+    /** After the limit, the value returns to the last received one. 0 (default) disables extrapolation. Max 0.9. */
+    void SetAttributeExtrapolation(float fraction);
+
+    /// Returns the attribute extrapolation limit as a fraction of the update interval.
+    float AttributeExtrapolation() const;
+
     /// Ends all attribute interpolations
     void EndAllAttributeInterpolations();
 
@@ -207,6 +244,25 @@ public slots:
     /// Returns whether name is unique within the scene, ie. is only encountered once, or not at all.
     bool IsUniqueName(const QString& name) const;
 
+    /// Registers an index of entities by the value of an attribute, so that they can be looked up with FindEntitiesByAttribute.
+    /** The index is kept up to date on component and attribute changes. Registering the same index again increments its reference count.
+        The index on the name attribute of EC_Name is always present and is used by GetEntityByName and IsUniqueName.
+        @param componentTypeName Type name of the component, which must be registered to SceneAPI.
+        @param attributeName Name (ID) of the attribute, for example "group" of an EC_DynamicComponent.
+        @return false if the component type is unknown */
+    bool RegisterAttributeIndex(const QString &componentTypeName, const QString &attributeName);
+
+    /// Releases an attribute index registered with RegisterAttributeIndex. The index is removed when it is no longer referenced.
+    void UnregisterAttributeIndex(const QString &componentTypeName, const QString &attributeName);
+
+    /// Returns whether an index is registered for an attribute.
+    bool HasAttributeIndex(const QString &componentTypeName, const QString &attributeName) const;
+
+    /// Returns the entities which have a component whose attribute has the given value, using a registered attribute index.
+    /** @param value Value of the attribute in its string form, see IAttribute::ToString.
+        @note Returns an empty list if no index is registered for the attribute. */
+    EntityList FindEntitiesByAttribute(const QString &componentTypeName, const QString &attributeName, const QString &value) const;
+
     /// Returns true if entity with the specified id exists in this scene, false otherwise
     bool HasEntity(entity_id_t id) const { return (entities_.find(id) != entities_.end()); }
 
@@ -241,6 +297,9 @@ public slots:
         @param change Change signalling mode */
     void EmitAttributeChanged(IComponent* comp, IAttribute* attribute, AttributeChange::Type change);
 
+    /// Updates the attribute indexes for a changed attribute value. Called by IComponent on every change, also disconnected ones.
+    void UpdateAttributeIndexes(IAttribute* attribute);
+
     /// Emits notification of an attribute having been created. Called by IComponent's with dynamic structure
     /** @param comp Component pointer
         @param attribute Attribute pointer
@@ -324,8 +383,22 @@ public slots:
         @return List of created entities. */
     QList<Entity *> LoadSceneBinary(const QString& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change);
 
+    /// Loads the scene from a binary file over several frames, a number of entities each frame.
+    /** Lets a server start serving a large scene before all of it has been created. BinaryLoadProgress is emitted after each frame's entities.
+        @param filename File name
+        @param clearScene Do we want to clear the existing scene.
+        @param useEntityIDsFromFile If true, the created entities will use the Entity IDs from the original file, see LoadSceneBinary.
+        @param change Change type that will be used, when removing the old scene, and deserializing the new
+        @param entitiesPerFrame Number of entities to create each frame.
+        @return true if the file was opened and the load started. Only one progressive load can run at a time. */
+    bool LoadSceneBinaryProgressive(const QString& filename, bool clearScene, bool useEntityIDsFromFile, AttributeChange::Type change, int entitiesPerFrame);
+
+    /// Returns whether a progressive binary scene load is running.
+    bool IsLoadingProgressively() const { return progressiveLoad_.get() != 0; }
+
     /// Save the scene to binary
-    /** @param filename File name
+    /** The file is written one entity at a time, in the chunked format described in SceneBinaryFormat.h.
+        @param filename File name
         @param saveTemporary Are temporary entities wanted to be included.
         @param saveLocal Are local entities wanted to be included.
         @return true if successful */
@@ -422,6 +495,11 @@ signals:
     /** @note Entity::IsTemporary() information might not be accurate yet, as it depends on the method that was used to create the entity. */
     void EntityCreated(Entity* entity, AttributeChange::Type change);
 
+    /// Emitted after each frame of a progressive binary scene load, see LoadSceneBinaryProgressive.
+    /** @param numLoaded Number of entities read from the file so far.
+        @param numTotal Number of entities in the file. The load has finished when numLoaded equals numTotal. */
+    void BinaryLoadProgress(int numLoaded, int numTotal);
+
     /// Signal when an entity deleted
     void EntityRemoved(Entity* entity, AttributeChange::Type change);
 
@@ -471,6 +549,63 @@ private:
     bool viewEnabled_; ///< View enabled -flag.
     bool interpolating_; ///< Currently doing interpolation-flag.
     bool authority_; ///< Authority -flag
-    std::vector<AttributeInterpolation> interpolations_; ///< Running attribute interpolations.
+    AttributeInterpolator *interpolator_; ///< Running attribute interpolations.
+    boost::shared_ptr<SceneBinaryReader> progressiveLoad_; ///< Binary scene being loaded progressively, null if none.
+    size_t progressiveLoadIndex_; ///< Index of the next entity to load progressively.
+    int progressiveLoadBatch_; ///< Number of entities to load progressively each frame.
+    bool progressiveLoadUseIds_; ///< Whether the progressively loaded entities use the IDs from the file.
+    AttributeChange::Type progressiveLoadChange_; ///< Change type of the progressive load.
     std::vector<std::pair<EntityWeakPtr, AttributeChange::Type> > entitiesCreatedThisFrame_; ///< Entities to signal for creation at frame end.
+
+    /// Entities which have components of a type, and the number of such components in each entity.
+    typedef std::map<entity_id_t, uint> ComponentTypeEntities;
+    /// Component type index: component type id -> entities having components of the type.
+    typedef std::map<u32, ComponentTypeEntities> ComponentTypeIndex;
+    ComponentTypeIndex componentTypeIndex_; ///< Entities by component type, updated on component addition and removal.
+
+    /// Adds a component to the component type index.
+    void AddToComponentTypeIndex(entity_id_t entityId, u32 typeId);
+    /// Removes a component from the component type index.
+    void RemoveFromComponentTypeIndex(entity_id_t entityId, u32 typeId);
+
+    /// Entities which have an attribute value, and the number of such attributes in each entity.
+    typedef ComponentTypeEntities AttributeValueEntities;
+    /// Index of entities by the value of one attribute of a component type.
+    struct AttributeIndex
+    {
+        AttributeIndex() : refCount(0) {}
+        int refCount; ///< Number of registrations.
+        QHash<QString, AttributeValueEntities> entities; ///< Entities by attribute value in string form.
+    };
+    /// Attribute indexes by component type id and attribute name.
+    typedef std::map<std::pair<u32, QString>, AttributeIndex> AttributeIndexMap;
+    AttributeIndexMap attributeIndexes_; ///< Registered attribute indexes.
+    AttributeIndex *nameIndex_; ///< Index of the name attribute of EC_Name.
+
+    /// Indexed attribute: its index, and the entity and value under which it is currently indexed.
+    struct IndexedAttribute
+    {
+        AttributeIndex *index;
+        entity_id_t entityId;
+        QString value;
+    };
+    QHash<IAttribute *, IndexedAttribute> indexedAttributes_; ///< Attributes currently in an attribute index.
+
+    /// Returns an attribute index, or null if not registered.
+    const AttributeIndex *FindAttributeIndex(const QString &componentTypeName, const QString &attributeName) const;
+    /// Adds an attribute to an attribute index under its current value.
+    void AddToAttributeIndex(AttributeIndex &index, entity_id_t entityId, IAttribute *attribute);
+    /// Removes an attribute from the attribute index it is in, if any.
+    void RemoveFromAttributeIndex(IAttribute *attribute);
+    /// Adds the attributes of a component to the attribute indexes registered for its type.
+    void AddToAttributeIndexes(entity_id_t entityId, IComponent *comp);
+    /// Removes the attributes of a component from the attribute indexes registered for its type.
+    void RemoveFromAttributeIndexes(IComponent *comp);
+
+    /// Creates scene content from the entities of a binary scene at the given indices, and emits the creation signals.
+    QList<Entity *> CreateContentFromBinary(const SceneBinaryReader &reader, const std::vector<size_t> &indices, bool useEntityIDsFromFile, AttributeChange::Type change);
+    /// Creates an entity and its components from its serialized data, without emitting signals. Returns null if the entity could not be created.
+    EntityPtr CreateEntityFromBinary(const char *data, size_t numBytes, bool useEntityIDsFromFile);
+    /// Fills a scene description from a binary scene.
+    SceneDesc CreateSceneDescFromBinary(const SceneBinaryReader &reader, SceneDesc &sceneDesc) const;
 };
@@ -0,0 +1,285 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "SceneBinaryFormat.h"
+#include "Entity.h"
+
+#include <kNet/DataDeserializer.h>
+#include <kNet/DataSerializer.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+    const char cMagic[4] = { 'T', 'B', 'I', 'N' };
+    const size_t cHeaderSize = 4 + 4 + 4 + 4 + 8;
+    const size_t cEntityRecordSize = 4 + 8 + 4;
+    /// Initial size of the entity serialization buffer. Doubled until an entity fits, up to cMaxEntitySize.
+    const int cInitialEntityBufferSize = 256 * 1024;
+    const int cMaxEntitySize = 256 * 1024 * 1024;
+
+    /// Returns the number of bytes a deserializer over @c size bytes has consumed.
+    size_t BytesRead(const DataDeserializer &source, size_t size)
+    {
+        return size - source.BitsLeft() / 8;
+    }
+}
+
+SceneBinaryWriter::SceneBinaryWriter(const QString &filename) :
+    file_(filename),
+    failed_(false)
+{
+    if (!file_.open(QFile::WriteOnly | QFile::Truncate))
+        return;
+    failed_ = !WriteHeader(0);
+}
+
+SceneBinaryWriter::~SceneBinaryWriter()
+{
+    if (file_.isOpen())
+        Finish();
+}
+
+bool SceneBinaryWriter::WriteHeader(u64 tableOffset)
+{
+    char header[cHeaderSize];
+    DataSerializer dest(header, sizeof header);
+    dest.AddArray<u8>((const u8 *)cMagic, 4);
+    dest.Add<u32>(cVersion);
+    dest.Add<u32>((u32)entities_.size());
+    dest.Add<u32>(0);
+    dest.Add<u64>(tableOffset);
+    return file_.write(header, dest.BytesFilled()) == (qint64)dest.BytesFilled();
+}
+
+bool SceneBinaryWriter::WriteEntity(const Entity &entity)
+{
+    if (!IsOpen())
+        return false;
+
+    if (buffer_.size() < cInitialEntityBufferSize)
+        buffer_.resize(cInitialEntityBufferSize);
+
+    // The serializer throws when the buffer runs out, so retry with a larger buffer until the entity fits
+    size_t size = 0;
+    for(;;)
+    {
+        try
+        {
+            DataSerializer dest(buffer_.data(), buffer_.size());
+            entity.SerializeToBinary(dest);
+            size = dest.BytesFilled();
+            break;
+        }
+        catch(...)
+        {
+            if (buffer_.size() >= cMaxEntitySize)
+            {
+                failed_ = true;
+                return false;
+            }
+            buffer_.resize(buffer_.size() * 2);
+        }
+    }
+
+    SceneBinaryEntityRecord record;
+    record.id = entity.Id();
+    record.offset = (u64)file_.pos();
+    record.size = (u32)size;
+    if (file_.write(buffer_.data(), size) != (qint64)size)
+    {
+        failed_ = true;
+        return false;
+    }
+    entities_.push_back(record);
+    return true;
+}
+
+bool SceneBinaryWriter::Finish()
+{
+    if (!file_.isOpen())
+        return false;
+
+    if (!failed_)
+    {
+        u64 tableOffset = (u64)file_.pos();
+        QByteArray table;
+        table.resize((int)(entities_.size() * cEntityRecordSize));
+        if (!entities_.empty())
+        {
+            DataSerializer dest(table.data(), table.size());
+            for(size_t i = 0; i < entities_.size(); ++i)
+            {
+                dest.Add<u32>(entities_[i].id);
+                dest.Add<u64>(entities_[i].offset);
+                dest.Add<u32>(entities_[i].size);
+            }
+        }
+        failed_ = file_.write(table) != table.size() || !file_.seek(0) || !WriteHeader(tableOffset);
+    }
+
+    file_.close();
+    return !failed_;
+}
+
+SceneBinaryReader::SceneBinaryReader(const QString &filename) :
+    file_(filename),
+    data_(0),
+    size_(0),
+    version_(0),
+    valid_(false)
+{
+    if (!file_.open(QIODevice::ReadOnly))
+    {
+        error_ = "Failed to open file " + filename;
+        return;
+    }
+
+    size_ = (size_t)file_.size();
+    if (size_)
+    {
+        // Map the file so that only the pages of the entities actually read are loaded. Fall back to reading the whole file.
+        const uchar *mapped = file_.map(0, file_.size());
+        if (mapped)
+            data_ = (const char *)mapped;
+        else
+        {
+            bytes_ = file_.readAll();
+            data_ = bytes_.constData();
+            size_ = (size_t)bytes_.size();
+        }
+    }
+
+    Index();
+}
+
+SceneBinaryReader::SceneBinaryReader(const char *data, size_t size) :
+    data_(data),
+    size_(size),
+    version_(0),
+    valid_(false)
+{
+    Index();
+}
+
+void SceneBinaryReader::Index()
+{
+    if (!data_ || !size_)
+    {
+        error_ = "Scene data is empty";
+        return;
+    }
+
+    try
+    {
+        if (size_ >= cHeaderSize && !memcmp(data_, cMagic, 4))
+            valid_ = IndexVersion2();
+        else
+            valid_ = IndexVersion1();
+    }
+    catch(...)
+    {
+        valid_ = false;
+    }
+
+    if (!valid_)
+    {
+        if (error_.isEmpty())
+            error_ = "Scene data is truncated or corrupt";
+        entities_.clear();
+        return;
+    }
+
+    idIndex_.reserve(entities_.size());
+    for(size_t i = 0; i < entities_.size(); ++i)
+        idIndex_.push_back(std::make_pair(entities_[i].id, i));
+    std::sort(idIndex_.begin(), idIndex_.end());
+}
+
+bool SceneBinaryReader::IndexVersion2()
+{
+    DataDeserializer header(data_ + 4, cHeaderSize - 4);
+    version_ = header.Read<u32>();
+    if (version_ != SceneBinaryWriter::cVersion)
+    {
+        error_ = "Unsupported scene binary version " + QString::number(version_);
+        return false;
+    }
+    u32 numEntities = header.Read<u32>();
+    header.Read<u32>(); // Reserved
+    u64 tableOffset = header.Read<u64>();
+    if (tableOffset < cHeaderSize || tableOffset > size_ || (size_ - tableOffset) / cEntityRecordSize < numEntities)
+        return false;
+
+    entities_.resize(numEntities);
+    if (!numEntities)
+        return true;
+
+    DataDeserializer table(data_ + tableOffset, numEntities * cEntityRecordSize);
+    for(u32 i = 0; i < numEntities; ++i)
+    {
+        SceneBinaryEntityRecord &record = entities_[i];
+        record.id = table.Read<u32>();
+        record.offset = table.Read<u64>();
+        record.size = table.Read<u32>();
+        if (record.offset < cHeaderSize || record.offset > tableOffset || tableOffset - record.offset < record.size)
+            return false;
+    }
+    return true;
+}
+
+bool SceneBinaryReader::IndexVersion1()
+{
+    // Version 1 has no entity table, so walk through the entities and component headers to find the sizes of the entities
+    version_ = 1;
+    DataDeserializer source(data_, size_);
+    u32 numEntities = source.Read<u32>();
+    size_t pos = BytesRead(source, size_);
+    for(u32 i = 0; i < numEntities; ++i)
+    {
+        if (pos >= size_)
+            return false;
+        SceneBinaryEntityRecord record;
+        record.offset = pos;
+        DataDeserializer entityHeader(data_ + pos, size_ - pos);
+        record.id = entityHeader.Read<u32>();
+        entityHeader.Read<u8>(); // Replicated
+        u32 numComponents = entityHeader.Read<u32>();
+        pos += BytesRead(entityHeader, size_ - pos);
+
+        for(u32 j = 0; j < numComponents; ++j)
+        {
+            if (pos >= size_)
+                return false;
+            DataDeserializer compHeader(data_ + pos, size_ - pos);
+            compHeader.Read<u32>(); // Type ID
+            compHeader.ReadString(); // Name
+            compHeader.Read<u8>(); // Replicated
+            u32 dataSize = compHeader.Read<u32>();
+            pos += BytesRead(compHeader, size_ - pos);
+            if (dataSize > size_ - pos)
+                return false;
+            pos += dataSize;
+        }
+
+        record.size = (u32)(pos - record.offset);
+        entities_.push_back(record);
+    }
+    return true;
+}
+
+int SceneBinaryReader::FindEntity(entity_id_t id) const
+{
+    std::vector<std::pair<entity_id_t, size_t> >::const_iterator i =
+        std::lower_bound(idIndex_.begin(), idIndex_.end(), std::make_pair(id, (size_t)0));
+    if (i == idIndex_.end() || i->first != id)
+        return -1;
+    return (int)i->second;
+}
@@ -0,0 +1,110 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "CoreTypes.h"
+#include "SceneFwd.h"
+
+#include <QFile>
+#include <QByteArray>
+
+#include <vector>
+
+/// Location of an entity in a binary scene file.
+struct SceneBinaryEntityRecord
+{
+    entity_id_t id;
+    u64 offset; ///< Offset of the entity data from the start of the file.
+    u32 size; ///< Size of the entity data in bytes.
+};
+
+/** @defgroup SceneBinaryFormat Binary scene format (.tbin)
+    Version 2 of the format is chunked, so that it can be written one entity at a time and read in parts:
+    - Header: the bytes "TBIN", u32 version, u32 number of entities, u32 reserved, u64 offset of the entity table.
+    - Entity data chunks, each as written by Entity::SerializeToBinary.
+    - Entity table: for each entity, u32 entity ID, u64 offset and u32 size of its data chunk.
+
+    Version 1 files, which start with the u32 number of entities followed by the entity data, are still read.
+    @ingroup Scene_group */
+
+/// Writes a binary scene file incrementally, so that only one entity at a time is held in memory.
+/** @ingroup SceneBinaryFormat */
+class SceneBinaryWriter
+{
+public:
+    /// Opens the file for writing and writes a placeholder header.
+    explicit SceneBinaryWriter(const QString &filename);
+    /// Calls Finish() if it has not been called.
+    ~SceneBinaryWriter();
+
+    /// Current version of the format.
+    static const u32 cVersion = 2;
+
+    /// Returns whether the file is open and no write has failed.
+    bool IsOpen() const { return file_.isOpen() && !failed_; }
+
+    /// Serializes an entity and appends it to the file.
+    bool WriteEntity(const Entity &entity);
+
+    /// Writes the entity table and the final header, and closes the file.
+    bool Finish();
+
+    /// Returns the number of entities written.
+    size_t NumEntities() const { return entities_.size(); }
+
+private:
+    bool WriteHeader(u64 tableOffset);
+
+    QFile file_;
+    QByteArray buffer_; ///< Reused for serializing each entity, grows as needed.
+    std::vector<SceneBinaryEntityRecord> entities_;
+    bool failed_;
+};
+
+/// Reads a binary scene file through its entity table, so that entities can be deserialized one at a time or selectively.
+/** The file is memory-mapped when possible, otherwise read to memory. A version 1 file is scanned once to build the table.
+    @ingroup SceneBinaryFormat */
+class SceneBinaryReader
+{
+public:
+    /// Opens and indexes a file.
+    explicit SceneBinaryReader(const QString &filename);
+    /// Indexes binary scene data in memory. The data must outlive the reader.
+    SceneBinaryReader(const char *data, size_t size);
+
+    /// Returns whether the data was indexed successfully. Otherwise ErrorString() describes the problem.
+    bool IsValid() const { return valid_; }
+
+    /// Returns the description of the error if the data could not be indexed.
+    const QString &ErrorString() const { return error_; }
+
+    /// Returns the version of the format the data is in.
+    u32 Version() const { return version_; }
+
+    /// Returns the number of entities.
+    size_t NumEntities() const { return entities_.size(); }
+
+    /// Returns the location of an entity by index.
+    const SceneBinaryEntityRecord &EntityRecord(size_t index) const { return entities_[index]; }
+
+    /// Returns the serialized data of an entity by index, as written by Entity::SerializeToBinary.
+    const char *EntityData(size_t index) const { return data_ + entities_[index].offset; }
+
+    /// Returns the index of the entity with the given ID in the file, or -1 if it does not exist.
+    int FindEntity(entity_id_t id) const;
+
+private:
+    void Index();
+    bool IndexVersion1();
+    bool IndexVersion2();
+
+    QFile file_;
+    QByteArray bytes_; ///< File contents if the file could not be mapped.
+    const char *data_;
+    size_t size_;
+    u32 version_;
+    std::vector<SceneBinaryEntityRecord> entities_;
+    std::vector<std::pair<entity_id_t, size_t> > idIndex_; ///< Entity indices sorted by ID.
+    bool valid_;
+    QString error_;
+};
@@ -0,0 +1,259 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "AttributeQuantization.h"
+#include "IAttribute.h"
+#include "AttributeMetadata.h"
+#include "Transform.h"
+
+#include "kNet/DataSerializer.h"
+#include "kNet/DataDeserializer.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "MemoryLeakCheck.h"
+
+namespace TundraLogic
+{
+
+namespace
+{
+    /// Converts a float to a half-precision float. Values too small for a normalized half are flushed to zero,
+    /// and values too large for a half, including infinities and NaNs, are clamped to the largest half.
+    u16 FloatToHalf(float f)
+    {
+        u32 bits;
+        memcpy(&bits, &f, sizeof bits);
+        u16 sign = (u16)((bits >> 16) & 0x8000);
+        int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+        u32 mantissa = bits & 0x7fffff;
+        if (exponent <= 0)
+            return sign;
+        if (exponent >= 31)
+            return sign | 0x7bff;
+
+        // Round to nearest
+        mantissa += 0x1000;
+        if (mantissa & 0x800000)
+        {
+            mantissa = 0;
+            if (++exponent >= 31)
+                return sign | 0x7bff;
+        }
+        return sign | (u16)(exponent << 10) | (u16)(mantissa >> 13);
+    }
+
+    float HalfToFloat(u16 h)
+    {
+        u32 exponent = (h >> 10) & 0x1f;
+        u32 bits = (u32)(h & 0x8000) << 16;
+        if (exponent != 0)
+            bits |= ((exponent - 15 + 127) << 23) | ((u32)(h & 0x3ff) << 13);
+        float f;
+        memcpy(&f, &bits, sizeof f);
+        return f;
+    }
+
+    const u32 cMaxPosition = (1u << AttributeQuantization::cPositionBits) - 1;
+    const u32 cMaxRotation = (1u << AttributeQuantization::cRotationBits) - 1;
+    const float cSqrt2 = 1.41421356f;
+}
+
+AttributeQuantization::AttributeQuantization() :
+    worldMin_(-4096.f, -4096.f, -4096.f),
+    worldMax_(4096.f, 4096.f, 4096.f)
+{
+}
+
+void AttributeQuantization::SetWorldBounds(const float3 &minPos, const float3 &maxPos)
+{
+    worldMin_ = minPos;
+    worldMax_ = maxPos;
+}
+
+bool AttributeQuantization::IsQuantized(const IAttribute *attr)
+{
+    if (!attr || !attr->Metadata() || attr->Metadata()->networkEncoding != AttributeMetadata::Quantized)
+        return false;
+    u32 typeId = attr->TypeId();
+    return typeId == cAttributeTransform || typeId == cAttributeFloat3;
+}
+
+u8 AttributeQuantization::ChangedFields(const Transform &a, const Transform &b)
+{
+    // Compare exactly, so that a series of small changes is not lost
+    u8 fields = 0;
+    if (a.pos.x != b.pos.x || a.pos.y != b.pos.y || a.pos.z != b.pos.z)
+        fields |= TransformPosition;
+    if (a.rot.x != b.rot.x || a.rot.y != b.rot.y || a.rot.z != b.rot.z)
+        fields |= TransformRotation;
+    if (a.scale.x != b.scale.x || a.scale.y != b.scale.y || a.scale.z != b.scale.z)
+        fields |= TransformScale;
+    return fields;
+}
+
+void AttributeQuantization::Write(kNet::DataSerializer &dest, const IAttribute *attr, u8 fields) const
+{
+    switch(attr->TypeId())
+    {
+    case cAttributeTransform:
+        WriteTransform(dest, static_cast<const Attribute<Transform> *>(attr)->Get(), fields);
+        break;
+    case cAttributeFloat3:
+    {
+        float3 value = static_cast<const Attribute<float3> *>(attr)->Get();
+        u16 halves[3] = { FloatToHalf(value.x), FloatToHalf(value.y), FloatToHalf(value.z) };
+        bool zero = !(halves[0] & 0x7fff) && !(halves[1] & 0x7fff) && !(halves[2] & 0x7fff);
+        dest.Add<kNet::bit>(zero ? 1 : 0);
+        if (!zero)
+            for(int i = 0; i < 3; ++i)
+                dest.AppendBits(halves[i], 16);
+        break;
+    }
+    default:
+        attr->ToBinary(dest);
+        break;
+    }
+}
+
+void AttributeQuantization::Read(kNet::DataDeserializer &source, IAttribute *attr) const
+{
+    switch(attr->TypeId())
+    {
+    case cAttributeTransform:
+    {
+        Attribute<Transform> *transformAttr = static_cast<Attribute<Transform> *>(attr);
+        Transform value = transformAttr->Get();
+        ReadTransform(source, value);
+        transformAttr->Set(value, AttributeChange::Disconnected);
+        break;
+    }
+    case cAttributeFloat3:
+    {
+        float3 value = float3::zero;
+        if (!source.Read<kNet::bit>())
+        {
+            value.x = HalfToFloat((u16)source.ReadBits(16));
+            value.y = HalfToFloat((u16)source.ReadBits(16));
+            value.z = HalfToFloat((u16)source.ReadBits(16));
+        }
+        static_cast<Attribute<float3> *>(attr)->Set(value, AttributeChange::Disconnected);
+        break;
+    }
+    default:
+        attr->FromBinary(source, AttributeChange::Disconnected);
+        break;
+    }
+}
+
+void AttributeQuantization::WriteTransform(kNet::DataSerializer &dest, const Transform &value, u8 fields) const
+{
+    dest.AppendBits(fields & TransformAllFields, 3);
+
+    if (fields & TransformPosition)
+    {
+        const float3 extent = worldMax_ - worldMin_;
+        bool inBounds = true;
+        for(int i = 0; i < 3; ++i)
+            if (!(extent[i] > 0.f) || !(value.pos[i] >= worldMin_[i]) || !(value.pos[i] <= worldMax_[i]))
+                inBounds = false;
+
+        dest.Add<kNet::bit>(inBounds ? 1 : 0);
+        if (inBounds)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                u32 q = (u32)((value.pos[i] - worldMin_[i]) / extent[i] * cMaxPosition + 0.5f);
+                dest.AppendBits(q < cMaxPosition ? q : cMaxPosition, cPositionBits);
+            }
+        }
+        else
+        {
+            dest.Add<float>(value.pos.x);
+            dest.Add<float>(value.pos.y);
+            dest.Add<float>(value.pos.z);
+        }
+    }
+
+    if (fields & TransformRotation)
+    {
+        // Smallest three: send the index of the largest quaternion component and the three others, which are within +-1/sqrt(2).
+        // The largest component is reconstructed from the unit length, and its sign is made positive by negating the quaternion.
+        Quat q = value.Orientation();
+        q.Normalize();
+        const float *c = q.ptr();
+        int largest = 0;
+        for(int i = 1; i < 4; ++i)
+            if (fabs(c[i]) > fabs(c[largest]))
+                largest = i;
+        float sign = c[largest] < 0.f ? -1.f : 1.f;
+
+        dest.AppendBits(largest, 2);
+        for(int i = 0; i < 4; ++i)
+        {
+            if (i == largest)
+                continue;
+            float normalized = (c[i] * sign * cSqrt2 + 1.f) * 0.5f;
+            normalized = normalized < 0.f ? 0.f : (normalized > 1.f ? 1.f : normalized);
+            dest.AppendBits((u32)(normalized * cMaxRotation + 0.5f), cRotationBits);
+        }
+    }
+
+    if (fields & TransformScale)
+    {
+        dest.Add<float>(value.scale.x);
+        dest.Add<float>(value.scale.y);
+        dest.Add<float>(value.scale.z);
+    }
+}
+
+void AttributeQuantization::ReadTransform(kNet::DataDeserializer &source, Transform &value) const
+{
+    u8 fields = (u8)source.ReadBits(3);
+
+    if (fields & TransformPosition)
+    {
+        if (source.Read<kNet::bit>())
+        {
+            const float3 extent = worldMax_ - worldMin_;
+            for(int i = 0; i < 3; ++i)
+                value.pos[i] = worldMin_[i] + (float)source.ReadBits(cPositionBits) / cMaxPosition * extent[i];
+        }
+        else
+        {
+            value.pos.x = source.Read<float>();
+            value.pos.y = source.Read<float>();
+            value.pos.z = source.Read<float>();
+        }
+    }
+
+    if (fields & TransformRotation)
+    {
+        int largest = (int)source.ReadBits(2);
+        float c[4];
+        float sumSq = 0.f;
+        for(int i = 0; i < 4; ++i)
+        {
+            if (i == largest)
+                continue;
+            c[i] = ((float)source.ReadBits(cRotationBits) / cMaxRotation * 2.f - 1.f) / cSqrt2;
+            sumSq += c[i] * c[i];
+        }
+        c[largest] = sqrt(sumSq < 1.f ? 1.f - sumSq : 0.f);
+        Quat q(c[0], c[1], c[2], c[3]);
+        q.Normalize();
+        value.SetOrientation(q);
+    }
+
+    if (fields & TransformScale)
+    {
+        value.scale.x = source.Read<float>();
+        value.scale.y = source.Read<float>();
+        value.scale.z = source.Read<float>();
+    }
+}
+
+}
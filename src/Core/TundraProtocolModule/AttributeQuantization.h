@@ -0,0 +1,79 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "TundraLogicModuleApi.h"
+#include "CoreTypes.h"
+#include "Math/float3.h"
+
+class IAttribute;
+class Transform;
+
+namespace kNet
+{
+    class DataSerializer;
+    class DataDeserializer;
+}
+
+namespace TundraLogic
+{
+
+/// Sub-fields of a Transform attribute, sent as dirty bits in the quantized encoding.
+enum TransformField
+{
+    TransformPosition = 1,
+    TransformRotation = 2,
+    TransformScale = 4,
+    TransformAllFields = 7
+};
+
+/// Compact, lossy network encoding of the attributes whose metadata requests AttributeMetadata::Quantized.
+/** Transform: a bitmask of the sub-fields that follow. Position is quantized to cPositionBits per axis relative to the world bounds,
+    and falls back to full floats outside them. Rotation is sent as the three smallest components of the orientation quaternion,
+    cRotationBits each. Scale is sent as full floats. Sub-fields that are not sent keep their previous value on the receiver.
+    float3: a zero flag, followed by half-precision floats if the vector is nonzero. Suited for velocities.
+    Attributes of other types are written with IAttribute::ToBinary.
+
+    Both peers must use the same world bounds, so the server sends its bounds to the client on login. */
+class TUNDRALOGIC_MODULE_API AttributeQuantization
+{
+public:
+    /// Constructs with the default world bounds of [-4096, 4096] on each axis.
+    AttributeQuantization();
+
+    /// Bits per axis of a position inside the world bounds.
+    static const int cPositionBits = 21;
+    /// Bits per quaternion component of a rotation.
+    static const int cRotationBits = 12;
+
+    /// Sets the world bounds positions are quantized in.
+    void SetWorldBounds(const float3 &minPos, const float3 &maxPos);
+
+    /// Returns the minimum corner of the world bounds.
+    const float3 &WorldMin() const { return worldMin_; }
+
+    /// Returns the maximum corner of the world bounds.
+    const float3 &WorldMax() const { return worldMax_; }
+
+    /// Returns whether an attribute uses the quantized encoding when the peer supports it.
+    static bool IsQuantized(const IAttribute *attr);
+
+    /// Returns the sub-fields that differ between two transforms as TransformField bits.
+    static u8 ChangedFields(const Transform &a, const Transform &b);
+
+    /// Writes an attribute. Of a Transform, only the sub-fields in @c fields are written.
+    void Write(kNet::DataSerializer &dest, const IAttribute *attr, u8 fields = TransformAllFields) const;
+
+    /// Reads an attribute written with Write() and sets it with AttributeChange::Disconnected.
+    /** Transform sub-fields that were not written keep the value @c attr has. */
+    void Read(kNet::DataDeserializer &source, IAttribute *attr) const;
+
+private:
+    void WriteTransform(kNet::DataSerializer &dest, const Transform &value, u8 fields) const;
+    void ReadTransform(kNet::DataDeserializer &source, Transform &value) const;
+
+    float3 worldMin_;
+    float3 worldMax_;
+};
+
+}
@@ -242,6 +242,8 @@ void Client::CheckLogin()
         {
             loginstate_ = ConnectionEstablished;
             MsgLogin msg;
+            // Offer the quantized attribute encoding to the server
+            SetLoginProperty("quantizedattributes", owner_->GetSyncManager()->IsQuantizationEnabled() ? "1" : "0");
             emit AboutToConnect(); // This signal is used as a 'function call'. Any interested party can fill in
             // new content to the login properties of the client object, which will then be sent out on the line below.
             msg.loginData = StringToBuffer(LoginPropertiesAsXml().toStdString());
@@ -297,7 +299,18 @@ void Client::HandleKristalliMessage(MessageConnection* source, message_id_t id,
     {
     case cLoginReplyMessage:
         {
-            MsgLoginReply msg(data, numBytes);
+            MsgLoginReply msg;
+            kNet::DataDeserializer dd(data, numBytes);
+            try
+            {
+                msg.DeserializeFrom(dd);
+            }
+            catch(kNet::NetException &)
+            {
+                // Servers of older versions end the message before quantizationBounds, which is then left empty
+                if (numBytes != 1 + 1 + 2 + msg.loginReplyData.size())
+                    throw;
+            }
             HandleLoginReply(source, msg);
         }
         break;
@@ -325,6 +338,13 @@ void Client::HandleLoginReply(MessageConnection* source, const MsgLoginReply& ms
         client_id_ = msg.userID;
         ::LogInfo("Logged in successfully");
         
+        // The server sends the world bounds if it accepted the quantized attribute encoding
+        const std::vector<float>& bounds = msg.quantizationBounds;
+        if (bounds.size() == 6)
+            owner_->GetSyncManager()->SetServerQuantization(true, float3(bounds[0], bounds[1], bounds[2]), float3(bounds[3], bounds[4], bounds[5]));
+        else
+            owner_->GetSyncManager()->SetServerQuantization(false, float3::zero, float3::zero);
+        
         // Note: create scene & send info of login success only on first connection, not on reconnect
         if (!reconnect_)
         {
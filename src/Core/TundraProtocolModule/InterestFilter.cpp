@@ -0,0 +1,40 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#include "StableHeaders.h"
+#include "DebugOperatorNew.h"
+
+#include "InterestFilter.h"
+#include "Entity.h"
+#include "EC_Placeable.h"
+
+#include "MemoryLeakCheck.h"
+
+namespace TundraLogic
+{
+
+DistanceInterestFilter::DistanceInterestFilter(float radius, float removeRadiusScale) :
+    radius_(radius),
+    removeRadiusScale_(removeRadiusScale < 1.0f ? 1.0f : removeRadiusScale)
+{
+}
+
+void DistanceInterestFilter::SetRadius(float radius)
+{
+    radius_ = radius;
+}
+
+bool DistanceInterestFilter::IsRelevant(UserConnection* /*user*/, Entity* observer, Entity* entity, bool clientHasEntity)
+{
+    if (!observer || !entity || observer == entity)
+        return true;
+
+    EC_Placeable* observerPlaceable = observer->GetComponent<EC_Placeable>().get();
+    EC_Placeable* placeable = entity->GetComponent<EC_Placeable>().get();
+    if (!observerPlaceable || !placeable)
+        return true;
+
+    float radius = clientHasEntity ? radius_ * removeRadiusScale_ : radius_;
+    return placeable->WorldPosition().DistanceSq(observerPlaceable->WorldPosition()) <= radius * radius;
+}
+
+}
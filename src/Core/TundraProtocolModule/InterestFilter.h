@@ -0,0 +1,58 @@
+// For conditions of distribution and use, see copyright notice in license.txt
+
+#pragma once
+
+#include "TundraLogicModuleApi.h"
+
+#include <boost/shared_ptr.hpp>
+
+class Entity;
+class UserConnection;
+
+namespace TundraLogic
+{
+
+/// Decides which entities are replicated to a user connection (interest management).
+/** SyncManager consults the filter on the server when it processes a user's sync state, and periodically rescans the scene
+    so that entities are created on the client when they become relevant and removed from it when they no longer are.
+    Implement this interface and set it with SyncManager::SetInterestFilter to plug in a custom relevance policy. */
+class TUNDRALOGIC_MODULE_API InterestFilter
+{
+public:
+    virtual ~InterestFilter() {}
+
+    /// Returns whether an entity should exist on the client of a user.
+    /** @param user User connection being processed.
+        @param observer The user's observer entity (usually the avatar), or null if the user has not got one.
+        @param entity Entity to test.
+        @param clientHasEntity Whether the entity currently exists on the client. Allows implementing hysteresis,
+               so that entities on the border of relevance are not created and removed repeatedly. */
+    virtual bool IsRelevant(UserConnection* user, Entity* observer, Entity* entity, bool clientHasEntity) = 0;
+};
+
+typedef boost::shared_ptr<InterestFilter> InterestFilterPtr;
+
+/// Interest filter which replicates entities within a radius of the user's observer entity.
+/** Distances are measured between the world positions of the EC_Placeable components. Entities without EC_Placeable
+    are always relevant, as are all entities for users that have no observer entity set. */
+class TUNDRALOGIC_MODULE_API DistanceInterestFilter : public InterestFilter
+{
+public:
+    /// Constructor
+    /** @param radius Distance within which entities are created on the client.
+        @param removeRadiusScale An entity the client already has is removed only when it is farther than radius * removeRadiusScale. */
+    explicit DistanceInterestFilter(float radius, float removeRadiusScale = 1.1f);
+
+    virtual bool IsRelevant(UserConnection* user, Entity* observer, Entity* entity, bool clientHasEntity);
+
+    /// Sets the interest radius
+    void SetRadius(float radius);
+    /// Returns the interest radius
+    float Radius() const { return radius_; }
+
+private:
+    float radius_;
+    float removeRadiusScale_;
+};
+
+}
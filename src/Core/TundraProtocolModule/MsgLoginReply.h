@@ -39,10 +39,11 @@ struct MsgLoginReply
 	u8 success;
 	u8 userID;
 	std::vector<s8> loginReplyData;
+	std::vector<float> quantizationBounds;
 
 	inline size_t Size() const
 	{
-		return 1 + 1 + 2 + loginReplyData.size()*1;
+		return 1 + 1 + 2 + loginReplyData.size()*1 + 1 + quantizationBounds.size()*4;
 	}
 
 	inline void SerializeTo(kNet::DataSerializer &dst) const
@@ -52,6 +53,9 @@ struct MsgLoginReply
 		dst.Add<u16>(loginReplyData.size());
 		if (loginReplyData.size() > 0)
 			dst.AddArray<s8>(&loginReplyData[0], loginReplyData.size());
+		dst.Add<u8>(quantizationBounds.size());
+		if (quantizationBounds.size() > 0)
+			dst.AddArray<float>(&quantizationBounds[0], quantizationBounds.size());
 	}
 
 	inline void DeserializeFrom(kNet::DataDeserializer &src)
@@ -61,6 +65,9 @@ struct MsgLoginReply
 		loginReplyData.resize(src.Read<u16>());
 		if (loginReplyData.size() > 0)
 			src.ReadArray<s8>(&loginReplyData[0], loginReplyData.size());
+		quantizationBounds.resize(src.Read<u8>());
+		if (quantizationBounds.size() > 0)
+			src.ReadArray<float>(&quantizationBounds[0], quantizationBounds.size());
 	}
 
 };
@@ -323,6 +323,16 @@ void Server::HandleLogin(kNet::MessageConnection* source, const MsgLogin& msg)
     // Tell syncmanager of the new user
     owner_->GetSyncManager()->NewUserConnected(user);
     
+    // Tell the client the world bounds of the quantized attribute encoding if the syncmanager accepted it
+    if (user->syncState && user->syncState->quantizeAttributes)
+    {
+        const AttributeQuantization& quantization = owner_->GetSyncManager()->Quantization();
+        for (int i = 0; i < 3; ++i)
+            reply.quantizationBounds.push_back(quantization.WorldMin()[i]);
+        for (int i = 0; i < 3; ++i)
+            reply.quantizationBounds.push_back(quantization.WorldMax()[i]);
+    }
+    
     // Tell all server-side application code that a new user has successfully connected.
     // Ask them to fill the contents of a UserConnectedResponseData structure. This will
     // be sent to the client so that the scripts and applications on the client system can configure themselves.
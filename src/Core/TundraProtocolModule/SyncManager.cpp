@@ -18,12 +18,14 @@
 #include "AttributeMetadata.h"
 #include "LoggingFunctions.h"
 #include "Profiler.h"
+#include "EC_Placeable.h"
 
 #include "SceneAPI.h"
 
 #include <kNet.h>
 
 #include <cstring>
+#include <algorithm>
 
 #include "MemoryLeakCheck.h"
 
@@ -33,6 +35,22 @@ kNet::MessageConnection* currentSender = 0;
 namespace TundraLogic
 {
 
+/// When no bandwidth limit is set, a connection is considered saturated when it has more outbound messages pending than this
+static const size_t cSaturatedMessageCount = 64;
+/// Minimum byte budget of a sync tick, so that updates always progress
+static const int cMinByteBudget = 1024;
+/// Priority increase per second since the entity was last sent
+static const float cAgePriority = 4.0f;
+/// Priority increase per change since the entity was last sent
+static const float cChangePriority = 0.25f;
+/// Distance at which the priority of an entity is halved
+static const float cPriorityHalfDistance = 20.0f;
+
+static bool EntitySyncStatePriorityGreater(const EntitySyncState* lhs, const EntitySyncState* rhs)
+{
+    return lhs->priority > rhs->priority;
+}
+
 void SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds)
 {
     //std::cout << "Queuing message " << id << " size " << ds.BytesFilled() << std::endl;
@@ -42,9 +60,31 @@ void SyncManager::QueueMessage(kNet::MessageConnection* connection, kNet::messag
     msg->inOrder = inOrder;
     msg->priority = 100; // Fixed priority as in those defined with xml
     connection->EndAndQueueMessage(msg);
+    queuedBytes_ += ds.BytesFilled();
 }
 
 void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
+{
+    // The full update is the same for every connection, so serialize it only once per sync tick
+    Entity* entity = comp->ParentEntity();
+    SerializationKey key(entity ? entity->Id() : 0, comp->Id());
+    std::map<SerializationKey, int>& cache = fullUpdateCache_[quantizeAttributes_ ? 1 : 0];
+    std::map<SerializationKey, int>::const_iterator i = cache.find(key);
+    if (i != cache.end())
+    {
+        const SerializedComponentData& data = serializedEntries_[i->second];
+        ds.AddArray<u8>(&serializedData_[data.offset], data.size);
+        ++numSerializationsReused_;
+        return;
+    }
+    
+    kNet::DataSerializer fullDs(fullUpdateBuffer_, 64 * 1024);
+    SerializeComponentFullUpdate(fullDs, comp);
+    cache[key] = AddSerializedData(fullUpdateBuffer_, fullDs.BytesFilled(), 0, -1);
+    ds.AddArray<u8>((unsigned char*)fullUpdateBuffer_, fullDs.BytesFilled());
+}
+
+void SyncManager::SerializeComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp)
 {
     //std::cout << "Writing component fullupdate id " << comp->Id() << " typeid " << comp->TypeId() << std::endl;
     // Component identification
@@ -59,7 +99,7 @@ void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
     unsigned numStaticAttrs = comp->NumStaticAttributes();
     const AttributeVector& attrs = comp->Attributes();
     for (uint i = 0; i < numStaticAttrs; ++i)
-        attrs[i]->ToBinary(attrDs);
+        WriteAttribute(attrDs, attrs[i]);
     
     // Dynamic-structured attributes (use EOF to detect so do not need to send their amount)
     for (unsigned i = numStaticAttrs; i < attrs.size(); ++i)
@@ -78,11 +118,195 @@ void SyncManager::WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPt
     ds.AddArray<u8>((unsigned char*)attrDataBuffer_, attrDs.BytesFilled());
 }
 
+const SyncManager::SerializedComponentData& SyncManager::SerializeAttributeEdits(entity_id_t entityId, IComponent* comp)
+{
+    // Connections whose dirty bits for the component match share the same data
+    u8 dirtyAttributes[32];
+    memset(dirtyAttributes, 0, sizeof dirtyAttributes);
+    for (unsigned i = 0; i < changedAttributes_.size(); ++i)
+        dirtyAttributes[changedAttributes_[i] >> 3] |= (1 << (changedAttributes_[i] & 7));
+    
+    SerializationKey key(entityId, comp->Id());
+    std::map<SerializationKey, int>& cache = editUpdateCache_[quantizeAttributes_ ? 1 : 0];
+    int first = -1;
+    std::map<SerializationKey, int>::const_iterator it = cache.find(key);
+    if (it != cache.end())
+    {
+        first = it->second;
+        for (int i = first; i >= 0; i = serializedEntries_[i].next)
+        {
+            if (!memcmp(serializedEntries_[i].dirtyAttributes, dirtyAttributes, sizeof dirtyAttributes) && serializedEntries_[i].dirtyFields == changedFields_)
+            {
+                ++numSerializationsReused_;
+                return serializedEntries_[i];
+            }
+        }
+    }
+    
+    const AttributeVector& attrs = comp->Attributes();
+    
+    // Create a nested dataserializer for the actual attribute data, so we can skip components
+    kNet::DataSerializer attrDataDs(attrDataBuffer_, 16 * 1024);
+    
+    // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
+    unsigned bitsMethod1 = changedAttributes_.size() * 8 + 8;
+    unsigned bitsMethod2 = attrs.size();
+    // Method 1: indices
+    if (bitsMethod1 <= bitsMethod2)
+    {
+        attrDataDs.Add<kNet::bit>(0);
+        attrDataDs.Add<u8>(changedAttributes_.size());
+        for (unsigned i = 0; i < changedAttributes_.size(); ++i)
+        {
+            attrDataDs.Add<u8>(changedAttributes_[i]);
+            WriteAttribute(attrDataDs, attrs[changedAttributes_[i]], ChangedFields(changedAttributes_[i]));
+        }
+    }
+    // Method 2: bitmask
+    else
+    {
+        attrDataDs.Add<kNet::bit>(1);
+        for (unsigned i = 0; i < attrs.size(); ++i)
+        {
+            if (dirtyAttributes[i >> 3] & (1 << (i & 7)))
+            {
+                attrDataDs.Add<kNet::bit>(1);
+                WriteAttribute(attrDataDs, attrs[i], ChangedFields(i));
+            }
+            else
+                attrDataDs.Add<kNet::bit>(0);
+        }
+    }
+    
+    int index = AddSerializedData(attrDataBuffer_, attrDataDs.BytesFilled(), dirtyAttributes, first);
+    serializedEntries_[index].dirtyFields = changedFields_;
+    cache[key] = index;
+    return serializedEntries_[index];
+}
+
+u8 SyncManager::ChangedFields(u8 attrIndex) const
+{
+    for (size_t i = 0; i < changedFields_.size(); ++i)
+        if (changedFields_[i].first == attrIndex)
+            return changedFields_[i].second;
+    return TransformAllFields;
+}
+
+void SyncManager::WriteAttribute(kNet::DataSerializer& ds, const IAttribute* attr, u8 fields)
+{
+    if (quantizeAttributes_ && AttributeQuantization::IsQuantized(attr))
+        quantization_.Write(ds, attr, fields);
+    else
+        attr->ToBinary(ds);
+}
+
+void SyncManager::ReadAttribute(kNet::DataDeserializer& ds, IAttribute* attr, bool quantized)
+{
+    if (quantized && AttributeQuantization::IsQuantized(attr))
+        quantization_.Read(ds, attr);
+    else
+        attr->FromBinary(ds, AttributeChange::Disconnected);
+}
+
+u8 SyncManager::UpdateReplicatedTransform(entity_id_t entityId, IComponent* comp, IAttribute* attr)
+{
+    const Transform& value = static_cast<Attribute<Transform>*>(attr)->Get();
+    AttributeKey key(SerializationKey(entityId, comp->Id()), attr->Index());
+    std::map<AttributeKey, Transform>::iterator i = replicatedTransforms_.find(key);
+    if (i == replicatedTransforms_.end())
+    {
+        // Not seen before, so the receivers may have any value
+        replicatedTransforms_[key] = value;
+        return TransformAllFields;
+    }
+    u8 fields = AttributeQuantization::ChangedFields(i->second, value);
+    i->second = value;
+    return fields;
+}
+
+void SyncManager::SetReplicatedTransform(entity_id_t entityId, IComponent* comp, IAttribute* attr, const IAttribute* value)
+{
+    if (attr->TypeId() == cAttributeTransform && value->TypeId() == cAttributeTransform && AttributeQuantization::IsQuantized(attr))
+        replicatedTransforms_[AttributeKey(SerializationKey(entityId, comp->Id()), attr->Index())] = static_cast<const Attribute<Transform>*>(value)->Get();
+}
+
+void SyncManager::ForgetReplicatedTransforms(entity_id_t entityId, component_id_t compId)
+{
+    if (replicatedTransforms_.empty())
+        return;
+    std::map<AttributeKey, Transform>::iterator i = replicatedTransforms_.lower_bound(AttributeKey(SerializationKey(entityId, compId), 0));
+    while (i != replicatedTransforms_.end() && i->first.first.first == entityId && (!compId || i->first.first.second == compId))
+        replicatedTransforms_.erase(i++);
+}
+
+IAttribute* SyncManager::InterpolationEndValue(Scene* scene, IAttribute* attr)
+{
+    u32 typeId = attr->TypeId();
+    if (typeId >= interpolationEndValues_.size())
+        interpolationEndValues_.resize(typeId + 1, 0);
+    IAttribute*& endValue = interpolationEndValues_[typeId];
+    if (!endValue)
+        endValue = attr->Clone();
+    
+    // The metadata decides whether the value is read with the quantized encoding
+    endValue->SetMetadata(attr->Metadata());
+    // Quantized Transforms may leave out unchanged sub-fields, so start from the end value of a running interpolation
+    if (!scene->AttributeInterpolationEndValue(attr, endValue))
+        endValue->CopyValue(attr, AttributeChange::Disconnected);
+    return endValue;
+}
+
+void SyncManager::SetServerQuantization(bool enabled, const float3& minPos, const float3& maxPos)
+{
+    server_syncstate_.quantizeAttributes = enabled;
+    if (enabled)
+        quantization_.SetWorldBounds(minPos, maxPos);
+}
+
+int SyncManager::AddSerializedData(const char* data, size_t size, const u8* dirtyAttributes, int next)
+{
+    SerializedComponentData entry;
+    if (dirtyAttributes)
+        memcpy(entry.dirtyAttributes, dirtyAttributes, sizeof entry.dirtyAttributes);
+    else
+        memset(entry.dirtyAttributes, 0, sizeof entry.dirtyAttributes);
+    entry.offset = serializedData_.size();
+    entry.size = size;
+    entry.next = next;
+    serializedData_.insert(serializedData_.end(), (const u8*)data, (const u8*)data + size);
+    serializedEntries_.push_back(entry);
+    ++numSerializations_;
+    return (int)serializedEntries_.size() - 1;
+}
+
+void SyncManager::ClearSerializationCache()
+{
+    // Keep the capacity of the buffers for the next tick
+    serializedData_.clear();
+    serializedEntries_.clear();
+    for (int i = 0; i < 2; ++i)
+    {
+        fullUpdateCache_[i].clear();
+        editUpdateCache_[i].clear();
+    }
+    numSerializations_ = 0;
+    numSerializationsReused_ = 0;
+}
+
 SyncManager::SyncManager(TundraLogicModule* owner) :
     owner_(owner),
     framework_(owner->GetFramework()),
     updatePeriod_(1.0f / 30.0f),
-    updateAcc_(0.0)
+    updateAcc_(0.0),
+    maxBandwidth_(0),
+    queuedBytes_(0),
+    numSerializations_(0),
+    numSerializationsReused_(0),
+    interestUpdatePeriod_(0.25f),
+    interestAcc_(0.0f),
+    quantizationEnabled_(true),
+    quantizeAttributes_(false),
+    extrapolation_(0.0f)
 {
     KristalliProtocol::KristalliProtocolModule *kristalli = framework_->GetModule<KristalliProtocol::KristalliProtocolModule>();
     connect(kristalli, SIGNAL(NetworkMessageReceived(kNet::MessageConnection *, kNet::message_id_t, const char *, size_t)), 
@@ -91,6 +315,8 @@ SyncManager::SyncManager(TundraLogicModule* owner) :
 
 SyncManager::~SyncManager()
 {
+    for (unsigned i = 0; i < interpolationEndValues_.size(); ++i)
+        delete interpolationEndValues_[i];
 }
 
 void SyncManager::SetUpdatePeriod(float period)
@@ -101,6 +327,103 @@ void SyncManager::SetUpdatePeriod(float period)
     updatePeriod_ = period;
 }
 
+void SyncManager::SetMaxBandwidth(int bytesPerSecond)
+{
+    maxBandwidth_ = bytesPerSecond > 0 ? bytesPerSecond : 0;
+}
+
+void SyncManager::PrintSyncStats()
+{
+    std::vector<std::pair<QString, SceneSyncState*> > states;
+    if (owner_->IsServer())
+    {
+        UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+        for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+            if ((*i)->syncState)
+                states.push_back(std::make_pair("Connection " + QString::number((*i)->userID), (*i)->syncState.get()));
+    }
+    else
+        states.push_back(std::make_pair(QString("Server"), &server_syncstate_));
+    
+    LogInfo("Components serialized on the last sync tick: " + QString::number(numSerializations_) +
+        ", serializations shared between connections: " + QString::number(numSerializationsReused_));
+    if (states.empty())
+        LogInfo("No scene sync states.");
+    for(size_t i = 0; i < states.size(); ++i)
+    {
+        const SceneSyncStats& stats = states[i].second->stats;
+        LogInfo(states[i].first + ": queued entities " + QString::number(stats.queuedEntities) +
+            ", deferred entities " + QString::number(stats.deferredEntities) +
+            ", bytes sent " + QString::number(stats.bytesSent) +
+            ", bytes deferred " + QString::number(stats.bytesDeferred) +
+            ", byte budget " + (stats.byteBudget >= 0 ? QString::number(stats.byteBudget) : QString("unlimited")) +
+            ", oldest update age " + QString::number(stats.oldestUpdateAge, 'f', 3) + " s");
+    }
+}
+
+void SyncManager::BenchmarkSyncState(int numUsers, int numEntities, int numTicks)
+{
+    if (numUsers <= 0 || numEntities <= 0 || numTicks <= 0)
+    {
+        LogError("BenchmarkSyncState: the number of users, entities and ticks must be positive.");
+        return;
+    }
+    
+    const component_id_t cNumComponents = 3;
+    std::vector<SceneSyncState> states(numUsers);
+    
+    // Start with every entity created on every client
+    for (int u = 0; u < numUsers; ++u)
+    {
+        for (int e = 1; e <= numEntities; ++e)
+            for (component_id_t c = 1; c <= cNumComponents; ++c)
+                states[u].MarkComponentDirty(e, c);
+        while (EntitySyncState* entityState = states[u].PopDirtyQueue())
+            entityState->DirtyProcessed();
+    }
+    
+    kNet::tick_t markTicks = 0;
+    kNet::tick_t drainTicks = 0;
+    size_t numDrainedComponents = 0;
+    for (int t = 0; t < numTicks; ++t)
+    {
+        // Mark in the same order as the scene change handlers: each change is marked for every user in turn
+        kNet::tick_t start = kNet::Clock::Tick();
+        for (int e = 1; e <= numEntities; ++e)
+            for (int u = 0; u < numUsers; ++u)
+                states[u].MarkAttributeDirty(e, 1 + e % cNumComponents, (u8)(t & 7));
+        for (int e = 1 + t % 100; e <= numEntities; e += 100)
+            for (int u = 0; u < numUsers; ++u)
+                states[u].RemoveFromQueue(e);
+        kNet::tick_t marked = kNet::Clock::Tick();
+        markTicks += kNet::Clock::TicksInBetween(marked, start);
+        
+        for (int u = 0; u < numUsers; ++u)
+        {
+            while (EntitySyncState* entityState = states[u].PopDirtyQueue())
+            {
+                for (size_t c = 0; c < entityState->components.size(); ++c)
+                    if (entityState->components[c].isInQueue)
+                        ++numDrainedComponents;
+                entityState->DirtyProcessed();
+            }
+        }
+        drainTicks += kNet::Clock::TicksInBetween(kNet::Clock::Tick(), marked);
+    }
+    
+    LogInfo("Sync state benchmark with " + QString::number(numUsers) + " users, " + QString::number(numEntities) + " entities, " +
+        QString::number(numTicks) + " ticks: mark " + QString::number(kNet::Clock::TicksToMillisecondsD(markTicks) / numTicks, 'f', 3) +
+        " ms/tick, drain " + QString::number(kNet::Clock::TicksToMillisecondsD(drainTicks) / numTicks, 'f', 3) + " ms/tick, " +
+        QString::number(numDrainedComponents) + " components drained.");
+}
+
+void SyncManager::SetInterestFilter(InterestFilterPtr filter)
+{
+    interestFilter_ = filter;
+    // Rescan on the next update
+    interestAcc_ = interestUpdatePeriod_;
+}
+
 void SyncManager::RegisterToScene(ScenePtr scene)
 {
     // Disconnect from previous scene if not expired
@@ -110,6 +433,7 @@ void SyncManager::RegisterToScene(ScenePtr scene)
         disconnect(previous.get(), 0, this, 0);
         server_syncstate_.Clear();
     }
+    replicatedTransforms_.clear();
     
     scene_.reset();
     
@@ -121,6 +445,7 @@ void SyncManager::RegisterToScene(ScenePtr scene)
     
     scene_ = scene;
     Scene* sceneptr = scene.get();
+    sceneptr->SetAttributeExtrapolation(extrapolation_);
     
     connect(sceneptr, SIGNAL( AttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ),
         SLOT( OnAttributeChanged(IComponent*, IAttribute*, AttributeChange::Type) ));
@@ -205,6 +530,8 @@ void SyncManager::NewUserConnected(UserConnection* user)
     
     // Mark all entities in the sync state as new so we will send them
     user->syncState = boost::shared_ptr<SceneSyncState>(new SceneSyncState());
+    // Use the quantized attribute encoding if the client offered it on login
+    user->syncState->quantizeAttributes = quantizationEnabled_ && user->GetProperty("quantizedattributes") == "1";
     for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
     {
         EntityPtr entity = iter->second;
@@ -241,6 +568,23 @@ void SyncManager::OnAttributeChanged(IComponent* comp, IAttribute* attr, Attribu
     if ((!entity) || (entity->IsLocal()))
         return;
     
+    // For quantized Transforms, track the changed sub-fields so that the unchanged ones can be left out
+    if (attr->TypeId() == cAttributeTransform && AttributeQuantization::IsQuantized(attr))
+    {
+        u8 fields = UpdateReplicatedTransform(entity->Id(), comp, attr);
+        if (isServer)
+        {
+            UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
+            for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
+                if ((*i)->syncState) (*i)->syncState->MarkAttributeFieldsDirty(entity->Id(), comp->Id(), attr->Index(), fields);
+        }
+        else
+        {
+            server_syncstate_.MarkAttributeFieldsDirty(entity->Id(), comp->Id(), attr->Index(), fields);
+        }
+        return;
+    }
+    
     if (isServer)
     {
         UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
@@ -339,6 +683,7 @@ void SyncManager::OnComponentRemoved(Entity* entity, IComponent* comp, Attribute
     assert(entity && comp);
     if (!entity || !comp)
         return;
+    ForgetReplicatedTransforms(entity->Id(), comp->Id());
     if ((change != AttributeChange::Replicate) || (comp->IsLocal()))
         return;
     if (entity->IsLocal())
@@ -372,7 +717,7 @@ void SyncManager::OnEntityCreated(Entity* entity, AttributeChange::Type change)
             if ((*i)->syncState)
             {
                 (*i)->syncState->MarkEntityDirty(entity->Id());
-                if ((*i)->syncState->entities[entity->Id()].removed)
+                if ((*i)->syncState->FindEntity(entity->Id())->removed)
                 {
                     LogWarning("An entity with ID " + QString::number(entity->Id()) + " is queued to be deleted, but a new entity \"" + 
                         entity->Name() + "\" is to be added to the scene!");
@@ -391,6 +736,7 @@ void SyncManager::OnEntityRemoved(Entity* entity, AttributeChange::Type change)
     assert(entity);
     if (!entity)
         return;
+    ForgetReplicatedTransforms(entity->Id(), 0);
     if (change != AttributeChange::Replicate)
         return;
     if (entity->IsLocal())
@@ -441,6 +787,18 @@ void SyncManager::OnActionTriggered(Entity *entity, const QString &action, const
         owner_->GetClient()->GetConnection()->Send(msg);
     }
 
+    if (isServer && (type & EntityAction::Sender) != 0 && (type & EntityAction::Peers) == 0)
+    {
+        // Reply to the client whose action is being handled. Its own action handling has not yet cleared the sender.
+        Server *server = owner_->GetServer().get();
+        UserConnection *sender = server ? server->GetActionSender() : 0;
+        if (sender && sender->properties["authenticated"] == "true" && sender->connection)
+        {
+            msg.executionType = (u8)EntityAction::Local; // Propagate as local action.
+            sender->connection->Send(msg);
+        }
+    }
+
     if (isServer && (type & EntityAction::Peers) != 0)
     {
         msg.executionType = (u8)EntityAction::Local; // Propagate as local actions.
@@ -483,6 +841,7 @@ void SyncManager::Update(f64 frametime)
 {
     PROFILE(SyncManager_Update);
     
+    interestAcc_ += (float)frametime;
     updateAcc_ += (float)frametime;
     if (updateAcc_ < updatePeriod_)
         return;
@@ -494,23 +853,118 @@ void SyncManager::Update(f64 frametime)
     if (!scene)
         return;
     
+    // Serialized data can be reused only within a tick, as the attributes change between ticks
+    ClearSerializationCache();
+    
     if (owner_->IsServer())
     {
+        // Rescan the interest of each user periodically, as the observers and entities move without their sync states getting dirty
+        bool updateInterest = false;
+        if (interestFilter_ && interestAcc_ >= interestUpdatePeriod_)
+        {
+            interestAcc_ = 0.0f;
+            updateInterest = true;
+        }
+        
         // If we are server, process all authenticated users
         UserConnectionList& users = owner_->GetKristalliModule()->GetUserConnections();
         for(UserConnectionList::iterator i = users.begin(); i != users.end(); ++i)
-            if ((*i)->syncState) ProcessSyncState((*i)->connection, (*i)->syncState.get());
+        {
+            if (!(*i)->syncState)
+                continue;
+            if (updateInterest)
+                UpdateInterest((*i).get());
+            ProcessSyncState((*i)->connection, (*i)->syncState.get(), (*i).get());
+        }
     }
     else
     {
         // If we are client, process just the server sync state
         kNet::MessageConnection* connection = owner_->GetKristalliModule()->GetMessageConnection();
         if (connection)
-            ProcessSyncState(connection, &server_syncstate_);
+            ProcessSyncState(connection, &server_syncstate_, 0);
     }
 }
 
-void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state)
+void SyncManager::UpdateInterest(UserConnection* user)
+{
+    PROFILE(SyncManager_UpdateInterest);
+    
+    ScenePtr scene = scene_.lock();
+    SceneSyncState* state = user->syncState.get();
+    if (!scene || !state || !interestFilter_)
+        return;
+    
+    Entity* observer = user->observerEntityId ? scene->GetEntity(user->observerEntityId).get() : 0;
+    for(Scene::iterator iter = scene->begin(); iter != scene->end(); ++iter)
+    {
+        Entity* entity = iter->second.get();
+        if (entity->IsLocal())
+            continue;
+        EntitySyncState* entityState = state->FindEntity(entity->Id());
+        if (!entityState)
+        {
+            // Entity came into interest: queue its creation
+            if (interestFilter_->IsRelevant(user, observer, entity, false))
+                state->MarkEntityDirty(entity->Id());
+        }
+        else if (!entityState->isNew && !entityState->removed)
+        {
+            // Entity went out of interest: queue its removal from the client
+            if (!interestFilter_->IsRelevant(user, observer, entity, true))
+                state->MarkEntityRemoved(entity->Id());
+        }
+    }
+}
+
+int SyncManager::ByteBudget(kNet::MessageConnection* destination) const
+{
+    int budget = -1;
+    if (maxBandwidth_ > 0)
+        budget = (int)(maxBandwidth_ * updatePeriod_);
+    else if (destination->NumOutboundMessagesPending() > cSaturatedMessageCount)
+        budget = (int)(destination->BytesOutPerSec() * updatePeriod_);
+    
+    if (budget >= 0 && budget < cMinByteBudget)
+        budget = cMinByteBudget;
+    return budget;
+}
+
+void SyncManager::CalculatePriorities(SceneSyncState* state, Entity* observer)
+{
+    PROFILE(SyncManager_CalculatePriorities);
+    
+    ScenePtr scene = scene_.lock();
+    EC_Placeable* observerPlaceable = observer ? observer->GetComponent<EC_Placeable>().get() : 0;
+    float3 observerPos = observerPlaceable ? observerPlaceable->WorldPosition() : float3::zero;
+    kNet::tick_t now = kNet::Clock::Tick();
+    
+    for (EntitySyncState* i = state->DirtyQueueFront(); i; i = state->NextInDirtyQueue(*i))
+    {
+        EntitySyncState& entityState = *i;
+        // Removals are cheap and free resources on the receiving end: send them first
+        if (entityState.removed)
+        {
+            entityState.priority = FLOAT_INF;
+            continue;
+        }
+        
+        kNet::tick_t since = entityState.lastSendTime ? entityState.lastSendTime : entityState.dirtyTime;
+        float age = (float)kNet::Clock::TimespanToSecondsD(since, now);
+        float priority = (1.0f + age * cAgePriority) * (1.0f + entityState.numChanges * cChangePriority);
+        
+        if (observerPlaceable)
+        {
+            EntityPtr entity = scene->GetEntity(entityState.id);
+            EC_Placeable* placeable = entity ? entity->GetComponent<EC_Placeable>().get() : 0;
+            if (placeable)
+                priority /= 1.0f + placeable->WorldPosition().Distance(observerPos) / cPriorityHalfDistance;
+        }
+        entityState.priority = priority;
+    }
+}
+
+void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state, UserConnection* user)
 {
     PROFILE(SyncManager_ProcessSyncState);
     
@@ -529,14 +983,43 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
     ScenePtr scene = scene_.lock();
     int numMessagesSent = 0;
     bool isServer = owner_->IsServer();
+    quantizeAttributes_ = state->quantizeAttributes;
+    
+    // Interest management is only done on the server
+    InterestFilter* filter = (isServer && user) ? interestFilter_.get() : 0;
+    Entity* observer = (isServer && user && user->observerEntityId) ? scene->GetEntity(user->observerEntityId).get() : 0;
+    
+    // If the connection has a byte budget for this tick, process the dirty entities in priority order,
+    // and defer the rest to the next tick once the budget is used up.
+    int byteBudget = ByteBudget(destination);
+    bool prioritize = byteBudget >= 0 && state->DirtyQueueSize() > 1;
+    if (prioritize)
+        CalculatePriorities(state, observer);
+    sendQueue_.clear();
+    while (EntitySyncState* entityState = state->PopDirtyQueue())
+        sendQueue_.push_back(entityState);
+    if (prioritize)
+        std::stable_sort(sendQueue_.begin(), sendQueue_.end(), EntitySyncStatePriorityGreater);
+    
+    SceneSyncStats& stats = state->stats;
+    stats.deferredEntities = 0;
+    stats.bytesDeferred = 0;
+    stats.byteBudget = byteBudget;
+    const size_t startBytes = queuedBytes_;
     
     // Process the state's dirty entity queue.
-    /// \todo Limit and prioritize the data sent. For now the whole queue is processed, regardless of whether the connection is being saturated.
-    while (!state->dirtyQueue.empty())
+    for (size_t n = 0; n < sendQueue_.size(); ++n)
     {
-        EntitySyncState& entityState = *state->dirtyQueue.front();
-        state->dirtyQueue.pop_front();
-        entityState.isInQueue = false;
+        EntitySyncState& entityState = *sendQueue_[n];
+        if (byteBudget >= 0 && queuedBytes_ - startBytes >= (size_t)byteBudget)
+        {
+            // Budget used up, keep the entity queued for the next tick
+            state->PushToDirtyQueue(entityState);
+            ++stats.deferredEntities;
+            stats.bytesDeferred += entityState.lastSendBytes;
+            continue;
+        }
+        const size_t entityStartBytes = queuedBytes_;
         
         EntityPtr entity = scene->GetEntity(entityState.id);
         bool removeState = false;
@@ -552,6 +1035,18 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             // Make sure we don't send data for local entities, or unacked entities after the create
             if (entity->IsLocal() || (!entityState.isNew && entity->IsUnacked()))
                 continue;
+            
+            if (filter && !entityState.removed && !filter->IsRelevant(user, observer, entity.get(), !entityState.isNew))
+            {
+                // If the client does not have the entity, forget the state. It is recreated when the entity comes into interest
+                if (entityState.isNew)
+                {
+                    state->RemoveEntity(entityState.id);
+                    continue;
+                }
+                // Else remove the entity from the client
+                entityState.removed = true;
+            }
         }
         
         // Remove entity
@@ -564,8 +1059,8 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 // The delete has been processed. Do not remember it anymore, but requeue the state for creation
                 entityState.removed = false;
                 removeState = false;
-                state->dirtyQueue.push_back(&entityState);
-                entityState.isInQueue = true;
+                state->PushToDirtyQueue(entityState);
+                entityState.dirtyTime = kNet::Clock::Tick();
             }
             else
                 removeState = true;
@@ -610,6 +1105,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             
             // The create has been processed fully. Clear dirty flags.
             state->MarkEntityProcessed(entity->Id());
+            entityState.lastSendBytes = queuedBytes_ - entityStartBytes;
         }
         else if (entity)
         {
@@ -620,11 +1116,14 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             kNet::DataSerializer createAttrsDs(createAttrsBuffer_, 16 * 1024);
             kNet::DataSerializer editAttrsDs(editAttrsBuffer_, 64 * 1024);
             
-            while (!entityState.dirtyQueue.empty())
+            // Iterate the dirty components backwards, as removing a component state moves the last one in its place
+            for (size_t c = entityState.components.size(); c-- > 0 && entityState.numDirtyComponents > 0;)
             {
-                ComponentSyncState& compState = *entityState.dirtyQueue.front();
-                entityState.dirtyQueue.pop_front();
+                ComponentSyncState& compState = entityState.components[c];
+                if (!compState.isInQueue)
+                    continue;
                 compState.isInQueue = false;
+                --entityState.numDirtyComponents;
                 
                 ComponentPtr comp = entity->GetComponentById(compState.id);
                 bool removeCompState = false;
@@ -675,11 +1174,11 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                 {
                     const AttributeVector& attrs = comp->Attributes();
                     
-                    for (std::map<u8, bool>::iterator i = compState.newAndRemovedAttributes.begin(); i != compState.newAndRemovedAttributes.end(); ++i)
+                    for (std::vector<std::pair<u8, bool> >::iterator i = compState.newAndRemovedAttributes.begin(); i != compState.newAndRemovedAttributes.end(); ++i)
                     {
                         u8 attrIndex = i->first;
                         // Clear the corresponding dirty flags, so that we don't redundantly send attribute edited data.
-                        compState.dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+                        compState.ClearAttributeDirty(attrIndex);
                         
                         if (i->second)
                         {
@@ -722,6 +1221,7 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                     
                     // Now, if remaining dirty bits exist, they must be sent in the edit attributes message. These are the majority of our network data.
                     changedAttributes_.clear();
+                    changedFields_.clear();
                     unsigned numBytes = (attrs.size() + 7) >> 3;
                     for (unsigned i = 0; i < numBytes; ++i)
                     {
@@ -734,7 +1234,15 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                                 {
                                     u8 attrIndex = i * 8 + j;
                                     if (attrIndex < attrs.size() && attrs[attrIndex])
+                                    {
                                         changedAttributes_.push_back(attrIndex);
+                                        if (quantizeAttributes_ && !compState.dirtyFields.empty())
+                                        {
+                                            u8 fields = compState.DirtyFields(attrIndex);
+                                            if (fields != 0xff)
+                                                changedFields_.push_back(std::make_pair(attrIndex, fields));
+                                        }
+                                    }
                                     else
                                         LogError("Attribute change for a nonexisting attribute index " + QString::number(attrIndex) + " was queued for component " + comp->TypeName() + " in " + entity->ToString() + ". Discarding.");
                                 }
@@ -751,51 +1259,20 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
                         }
                         editAttrsDs.AddVLE<kNet::VLE8_16_32>(compState.id & UniqueIdGenerator::LAST_REPLICATED_ID);
                         
-                        // Create a nested dataserializer for the actual attribute data, so we can skip components
-                        kNet::DataSerializer attrDataDs(attrDataBuffer_, 16 * 1024);
-                        
-                        // There are changed attributes. Check if it is more optimal to send attribute indices, or the whole bitmask
-                        unsigned bitsMethod1 = changedAttributes_.size() * 8 + 8;
-                        unsigned bitsMethod2 = attrs.size();
-                        // Method 1: indices
-                        if (bitsMethod1 <= bitsMethod2)
-                        {
-                            attrDataDs.Add<kNet::bit>(0);
-                            attrDataDs.Add<u8>(changedAttributes_.size());
-                            for (unsigned i = 0; i < changedAttributes_.size(); ++i)
-                            {
-                                attrDataDs.Add<u8>(changedAttributes_[i]);
-                                attrs[changedAttributes_[i]]->ToBinary(attrDataDs);
-                            }
-                        }
-                        // Method 2: bitmask
-                        else
-                        {
-                            attrDataDs.Add<kNet::bit>(1);
-                            for (unsigned i = 0; i < attrs.size(); ++i)
-                            {
-                                if (compState.dirtyAttributes[i >> 3] & (1 << (i & 7)))
-                                {
-                                    attrDataDs.Add<kNet::bit>(1);
-                                    attrs[i]->ToBinary(attrDataDs);
-                                }
-                                else
-                                    attrDataDs.Add<kNet::bit>(0);
-                            }
-                        }
-                        
-                        // Add the attribute data array to the main serializer
-                        editAttrsDs.AddVLE<kNet::VLE8_16_32>(attrDataDs.BytesFilled());
-                        editAttrsDs.AddArray<u8>((unsigned char*)attrDataBuffer_, attrDataDs.BytesFilled());
+                        // Add the attribute data array to the main serializer. It is serialized once per sync tick and shared between connections
+                        const SerializedComponentData& data = SerializeAttributeEdits(entityState.id, comp.get());
+                        editAttrsDs.AddVLE<kNet::VLE8_16_32>(data.size);
+                        editAttrsDs.AddArray<u8>(&serializedData_[data.offset], data.size);
                         
                         // Now zero out all remaining dirty bits
                         for (unsigned i = 0; i < numBytes; ++i)
                             compState.dirtyAttributes[i] = 0;
+                        compState.dirtyFields.clear();
                     }
                 }
                 
                 if (removeCompState)
-                    entityState.components.erase(compState.id);
+                    entityState.RemoveComponent(compState.id);
             }
             
             // Send the messages which have data
@@ -827,11 +1304,20 @@ void SyncManager::ProcessSyncState(kNet::MessageConnection* destination, SceneSy
             
             // The entity has been processed fully. Clear dirty flags.
             state->MarkEntityProcessed(entity->Id());
+            entityState.lastSendBytes = queuedBytes_ - entityStartBytes;
         }
         
         if (removeState)
-            state->entities.erase(entityState.id);
+            state->RemoveEntity(entityState.id);
     }
+    sendQueue_.clear();
+    
+    stats.queuedEntities = state->DirtyQueueSize();
+    stats.bytesSent = queuedBytes_ - startBytes;
+    stats.oldestUpdateAge = 0.0f;
+    kNet::tick_t now = kNet::Clock::Tick();
+    for (EntitySyncState* i = state->DirtyQueueFront(); i; i = state->NextInDirtyQueue(*i))
+        stats.oldestUpdateAge = std::max(stats.oldestUpdateAge, (float)kNet::Clock::TimespanToSecondsD(i->dirtyTime, now));
     //if (numMessagesSent)
     //    std::cout << "Sent " << numMessagesSent << " scenesync messages" << std::endl;
 }
@@ -946,7 +1432,7 @@ void SyncManager::HandleCreateEntity(kNet::MessageConnection* source, const char
         unsigned numStaticAttrs = comp->NumStaticAttributes();
         const AttributeVector& attrs = comp->Attributes();
         for (uint i = 0; i < numStaticAttrs; ++i)
-            attrs[i]->FromBinary(attrDs, AttributeChange::Disconnected);
+            ReadAttribute(attrDs, attrs[i], state->quantizeAttributes);
         
         // Create any dynamic attributes
         while (attrDs.BitsLeft() > 2 * 8)
@@ -1069,7 +1555,7 @@ void SyncManager::HandleCreateComponents(kNet::MessageConnection* source, const
         unsigned numStaticAttrs = comp->NumStaticAttributes();
         const AttributeVector& attrs = comp->Attributes();
         for (uint i = 0; i < numStaticAttrs; ++i)
-            attrs[i]->FromBinary(attrDs, AttributeChange::Disconnected);
+            ReadAttribute(attrDs, attrs[i], state->quantizeAttributes);
         
         // Create any dynamic attributes
         while (attrDs.BitsLeft() > 2 * 8)
@@ -1138,8 +1624,7 @@ void SyncManager::HandleRemoveEntity(kNet::MessageConnection* source, const char
     
     scene->RemoveEntity(entityID, change);
     // Delete from the sender's syncstate so that we don't echo the delete back needlessly
-    state->RemoveFromQueue(entityID); // Be sure to erase from dirty queue so that we don't invoke UDB
-    state->entities.erase(entityID);
+    state->RemoveEntity(entityID); // Also erases from the dirty queue
 }
 
 void SyncManager::HandleRemoveComponents(kNet::MessageConnection* source, const char* data, size_t numBytes)
@@ -1183,11 +1668,9 @@ void SyncManager::HandleRemoveComponents(kNet::MessageConnection* source, const
         }
         entity->RemoveComponent(comp, change);
         // Delete from the sender's syncstate, so that we don't echo the delete back needlessly
-        if (state->entities.find(entityID) != state->entities.end())
-        {
-            state->entities[entityID].RemoveFromQueue(compID); // Be sure to erase from dirty queue so that we don't invoke UDB
-            state->entities[entityID].components.erase(compID);
-        }
+        EntitySyncState* entityState = state->FindEntity(entityID);
+        if (entityState)
+            entityState->RemoveComponent(compID);
     }
 }
 
@@ -1262,7 +1745,7 @@ void SyncManager::HandleCreateAttributes(kNet::MessageConnection* source, const
         attr->FromBinary(ds, AttributeChange::Disconnected);
         
         // Remove the corresponding add command from the sender's syncstate, so that the attribute add is not echoed back
-        state->entities[entityID].components[compID].newAndRemovedAttributes.erase(attrIndex);
+        state->GetOrCreateEntity(entityID).GetOrCreateComponent(compID).ClearAttributeCreatedOrRemoved(attrIndex);
     }
     
     // Signal attribute changes after creating and reading all
@@ -1272,7 +1755,7 @@ void SyncManager::HandleCreateAttributes(kNet::MessageConnection* source, const
         u8 attrIndex = addedAttrs[i]->Index();
         owner->EmitAttributeChanged(addedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
-        state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        state->GetOrCreateEntity(entityID).GetOrCreateComponent(owner->Id()).ClearAttributeDirty(attrIndex);
     }
 }
 
@@ -1320,7 +1803,7 @@ void SyncManager::HandleRemoveAttributes(kNet::MessageConnection* source, const
         
         comp->RemoveAttribute(attrIndex, change);
         // Remove the corresponding remove command from the sender's syncstate, so that the attribute remove is not echoed back
-        state->entities[entityID].components[compID].newAndRemovedAttributes.erase(attrIndex);
+        state->GetOrCreateEntity(entityID).GetOrCreateComponent(compID).ClearAttributeCreatedOrRemoved(attrIndex);
     }
 }
 
@@ -1349,12 +1832,12 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
     
     // Record the update time for calculating the update interval
     float updateInterval = updatePeriod_; // Default update interval if state not found or interval not measured yet
-    std::map<entity_id_t, EntitySyncState>::iterator it = state->entities.find(entityID);
-    if (it != state->entities.end())
+    EntitySyncState* entityState = state->FindEntity(entityID);
+    if (entityState)
     {
-        it->second.UpdateReceived();
-        if (it->second.avgUpdateInterval > 0.0f)
-            updateInterval = it->second.avgUpdateInterval;
+        entityState->UpdateReceived();
+        if (entityState->avgUpdateInterval > 0.0f)
+            updateInterval = entityState->avgUpdateInterval;
     }
     // Add a fudge factor in case there is jitter in packet receipt or the server is too taxed
     updateInterval *= 1.25f;
@@ -1409,14 +1892,17 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
                 bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
                 if (!interpolate)
                 {
-                    attr->FromBinary(attrDs, AttributeChange::Disconnected);
+                    ReadAttribute(attrDs, attr, state->quantizeAttributes);
                     changedAttrs.push_back(attr);
+                    if (!isServer)
+                        SetReplicatedTransform(entityID, comp.get(), attr, attr);
                 }
                 else
                 {
-                    IAttribute* endValue = attr->Clone();
-                    endValue->FromBinary(attrDs, AttributeChange::Disconnected);
-                    scene->StartAttributeInterpolation(attr, endValue, updateInterval);
+                    IAttribute* endValue = InterpolationEndValue(scene.get(), attr);
+                    ReadAttribute(attrDs, endValue, state->quantizeAttributes);
+                    scene->StartAttributeInterpolation(attr, *endValue, updateInterval);
+                    SetReplicatedTransform(entityID, comp.get(), attr, endValue);
                 }
             }
         }
@@ -1437,14 +1923,17 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
                     bool interpolate = (!isServer && attr->Metadata() && attr->Metadata()->interpolation == AttributeMetadata::Interpolate);
                     if (!interpolate)
                     {
-                        attr->FromBinary(attrDs, AttributeChange::Disconnected);
+                        ReadAttribute(attrDs, attr, state->quantizeAttributes);
                         changedAttrs.push_back(attr);
+                        if (!isServer)
+                            SetReplicatedTransform(entityID, comp.get(), attr, attr);
                     }
                     else
                     {
-                        IAttribute* endValue = attr->Clone();
-                        endValue->FromBinary(attrDs, AttributeChange::Disconnected);
-                        scene->StartAttributeInterpolation(attr, endValue, updateInterval);
+                        IAttribute* endValue = InterpolationEndValue(scene.get(), attr);
+                        ReadAttribute(attrDs, endValue, state->quantizeAttributes);
+                        scene->StartAttributeInterpolation(attr, *endValue, updateInterval);
+                        SetReplicatedTransform(entityID, comp.get(), attr, endValue);
                     }
                 }
             }
@@ -1458,7 +1947,7 @@ void SyncManager::HandleEditAttributes(kNet::MessageConnection* source, const ch
         u8 attrIndex = changedAttrs[i]->Index();
         owner->EmitAttributeChanged(changedAttrs[i], change);
         // Remove the dirty bit from sender's syncstate so that we do not echo the change back
-        state->entities[entityID].components[owner->Id()].dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        state->GetOrCreateEntity(entityID).GetOrCreateComponent(owner->Id()).ClearAttributeDirty(attrIndex);
     }
 }
 
@@ -1485,14 +1974,12 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
     entity_id_t senderEntityID = ds.ReadVLE<kNet::VLE8_16_32>() | UniqueIdGenerator::FIRST_UNACKED_ID;
     entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
     scene->ChangeEntityId(senderEntityID, entityID);
-    state->RemoveFromQueue(senderEntityID); // Make sure we don't have stale pointers in the dirty queue
-    state->entities[entityID] = state->entities[senderEntityID]; // Copy the sync state to the new ID
-    state->entities[entityID].id = entityID; // Must remember to change ID manually
-    state->entities.erase(senderEntityID);
+    state->RemoveFromQueue(senderEntityID); // The entity is requeued below with the new component IDs
+    state->ChangeEntityId(senderEntityID, entityID);
     
     //std::cout << "CreateEntityReply, entity " << senderEntityID << " -> " << entityID << std::endl;
     
-    EntitySyncState& entityState = state->entities[entityID];
+    EntitySyncState& entityState = state->GetOrCreateEntity(entityID);
     
     EntityPtr entity = scene->GetEntity(entityID);
     if (!entity)
@@ -1510,9 +1997,7 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
         //std::cout << "CreateEntityReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.ChangeComponentId(senderCompID, compID);
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
@@ -1522,10 +2007,10 @@ void SyncManager::HandleCreateEntityReply(kNet::MessageConnection* source, const
     // Send notification
     scene->EmitEntityAcked(entity.get(), senderEntityID);
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (size_t i = 0; i < entityState.components.size(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, entityState.components[i].id);
     }
 }
 
@@ -1550,8 +2035,8 @@ void SyncManager::HandleCreateComponentsReply(kNet::MessageConnection* source, c
     kNet::DataDeserializer ds(data, numBytes);
     unsigned sceneID = ds.ReadVLE<kNet::VLE8_16_32>(); ///\todo Dummy ID. Lookup scene once multiscene is properly supported
     entity_id_t entityID = ds.ReadVLE<kNet::VLE8_16_32>();
-    state->RemoveFromQueue(entityID); // Make sure we don't have stale pointers in the dirty queue
-    EntitySyncState& entityState = state->entities[entityID];
+    state->RemoveFromQueue(entityID); // The entity is requeued below with the new component IDs
+    EntitySyncState& entityState = state->GetOrCreateEntity(entityID);
     
     EntityPtr entity = scene->GetEntity(entityID);
     if (!entity)
@@ -1569,19 +2054,17 @@ void SyncManager::HandleCreateComponentsReply(kNet::MessageConnection* source, c
         //std::cout << "CreateComponentReply, component " << senderCompID << " -> " << compID << std::endl;
         
         entity->ChangeComponentId(senderCompID, compID);
-        entityState.components[compID] = entityState.components[senderCompID]; // Copy the sync state to the new ID
-        entityState.components[compID].id = compID; // Must remember to change ID manually
-        entityState.components.erase(senderCompID);
+        entityState.ChangeComponentId(senderCompID, compID);
         
         // Send notification
         IComponent* comp = entity->GetComponentById(compID).get();
         scene->EmitComponentAcked(comp, senderCompID);
     }
     
-    for (std::map<component_id_t, ComponentSyncState>::iterator i = entityState.components.begin(); i != entityState.components.end(); ++i)
+    for (size_t i = 0; i < entityState.components.size(); ++i)
     {
         // Now mark every component dirty so they will be inspected for changes on the next update
-        state->MarkComponentDirty(entityID, i->first);
+        state->MarkComponentDirty(entityID, entityState.components[i].id);
     }
 }
 
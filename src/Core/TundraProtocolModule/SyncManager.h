@@ -5,6 +5,9 @@
 #include "IComponent.h"
 #include "Entity.h"
 #include "SyncState.h"
+#include "InterestFilter.h"
+#include "AttributeQuantization.h"
+#include "Transform.h"
 
 #include <QObject>
 #include <map>
@@ -46,6 +49,35 @@ public:
     
     /// Create new replication state for user and dirty it (server operation only)
     void NewUserConnected(UserConnection* user);
+    
+    /// Set the interest filter which decides the entities replicated to each user (server operation only). Null replicates everything.
+    void SetInterestFilter(InterestFilterPtr filter);
+    
+    /// Get the interest filter, null if none
+    InterestFilterPtr GetInterestFilter() const { return interestFilter_; }
+    
+    /// Enable or disable the quantized attribute encoding. Enabled by default
+    /** Affects connections made after the call. The client offers the encoding at login, and the server accepts it if it is enabled on both. */
+    void SetQuantizationEnabled(bool enable) { quantizationEnabled_ = enable; }
+    
+    /// Return whether the quantized attribute encoding is enabled
+    bool IsQuantizationEnabled() const { return quantizationEnabled_; }
+    
+    /// Set the world bounds positions are quantized in (server operation only). Must be set before users connect
+    void SetQuantizationBounds(const float3& minPos, const float3& maxPos) { quantization_.SetWorldBounds(minPos, maxPos); }
+    
+    /// Return the quantized attribute encoding settings
+    const AttributeQuantization& Quantization() const { return quantization_; }
+    
+    /// Set whether the server accepted the quantized attribute encoding on login, and the world bounds it uses (client operation only)
+    void SetServerQuantization(bool enabled, const float3& minPos, const float3& maxPos);
+    
+    /// Set how far interpolated attributes are extrapolated when an update is late, as a fraction of the update interval (client operation only)
+    /** Applied to the scene on RegisterToScene. 0 (default) disables extrapolation. */
+    void SetExtrapolation(float fraction) { extrapolation_ = fraction; }
+    
+    /// Return the extrapolation limit as a fraction of the update interval
+    float Extrapolation() const { return extrapolation_; }
         
 public slots:
     /// Set update period (seconds)
@@ -54,6 +86,25 @@ public slots:
     /// Get update period
     float GetUpdatePeriod() { return updatePeriod_; }
     
+    /// Set the maximum outbound scene sync bandwidth per connection (bytes per second)
+    /** When the limit is 0, the byte budget of a sync tick is derived from kNet's measured outbound rate when the connection
+        is saturated, and is unlimited otherwise. When the budget is used up, the remaining dirty entities are deferred to the next tick
+        in priority order, which is based on the distance to the observer entity, time since last update and amount of changes. */
+    void SetMaxBandwidth(int bytesPerSecond);
+    
+    /// Get the maximum outbound scene sync bandwidth per connection (bytes per second), 0 if not limited
+    int GetMaxBandwidth() const { return maxBandwidth_; }
+    
+    /// Print the scene sync statistics of each connection to the console
+    void PrintSyncStats();
+    
+    /// Measure the cost of marking and draining dirty sync state for a number of users and entities, and print the results to the console
+    /** Every tick, one attribute of every entity changes for every user, some entities are removed from the dirty queues, and the queues are drained.
+        @param numUsers Number of user syncstates
+        @param numEntities Number of entities, each with three components
+        @param numTicks Number of ticks to run */
+    void BenchmarkSyncState(int numUsers, int numEntities, int numTicks);
+    
 private slots:
     /// Trigger EC sync because of component attributes changing
     void OnAttributeChanged(IComponent* comp, IAttribute* attr, AttributeChange::Type change);
@@ -91,8 +142,60 @@ private:
     void QueueMessage(kNet::MessageConnection* connection, kNet::message_id_t id, bool reliable, bool inOrder, kNet::DataSerializer& ds);
     
     /// Craft a component full update, with all static and dynamic attributes.
+    /** The update is serialized once per sync tick and reused for the rest of the connections. */
     void WriteComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
     
+    /// Serialize a component full update.
+    void SerializeComponentFullUpdate(kNet::DataSerializer& ds, ComponentPtr comp);
+    
+    /// Write an attribute, with the quantized encoding if the sync state being processed uses it and the attribute's metadata requests it
+    /** @param fields Sub-fields to write of a quantized Transform */
+    void WriteAttribute(kNet::DataSerializer& ds, const IAttribute* attr, u8 fields = TransformAllFields);
+    
+    /// Read an attribute written with WriteAttribute
+    /** @param quantized Whether the sender uses the quantized encoding */
+    void ReadAttribute(kNet::DataDeserializer& ds, IAttribute* attr, bool quantized);
+    
+    /// Return the sub-fields of a quantized Transform attribute that changed since its last replicated change, and remember the new value
+    u8 UpdateReplicatedTransform(entity_id_t entityId, IComponent* comp, IAttribute* attr);
+    
+    /// Remember a received value of a quantized Transform attribute as its last replicated value
+    /** Used on the client, so that its own later changes are compared to the value the server has, and not to the last value the client sent.
+        @param value The received value. May be an interpolation end value instead of attr itself. */
+    void SetReplicatedTransform(entity_id_t entityId, IComponent* comp, IAttribute* attr, const IAttribute* value);
+    
+    /// Forget the replicated Transform values of an entity's component, or of all its components if compId is 0
+    void ForgetReplicatedTransforms(entity_id_t entityId, component_id_t compId);
+    
+    /// Return a reusable attribute of the same type as attr, holding the end value of its running interpolation or its current value
+    IAttribute* InterpolationEndValue(Scene* scene, IAttribute* attr);
+    
+    /// Attribute data of a component serialized on the current sync tick
+    struct SerializedComponentData
+    {
+        u8 dirtyAttributes[32]; ///< Changed attributes the data was serialized for. Zero for full updates
+        std::vector<std::pair<u8, u8> > dirtyFields; ///< Changed sub-fields of quantized attributes the data was serialized for
+        size_t offset; ///< Offset of the data in serializedData_
+        size_t size; ///< Size of the data in bytes
+        int next; ///< Index of the next entry serialized for the same component with different changed attributes, -1 if none
+    };
+    
+    /// Identifies a component in the serialization cache: entity ID and component ID
+    typedef std::pair<entity_id_t, component_id_t> SerializationKey;
+    
+    /// Return the attribute data of an edit attributes message for the attributes in changedAttributes_ and the sub-fields in changedFields_.
+    /** Serializes the data on the first call for each component and set of changed attributes on a sync tick, and returns the same data after that. */
+    const SerializedComponentData& SerializeAttributeEdits(entity_id_t entityId, IComponent* comp);
+    
+    /// Return the changed sub-fields of an attribute in changedFields_, or all sub-fields if not found
+    u8 ChangedFields(u8 attrIndex) const;
+    
+    /// Copy serialized data to the serialization cache and return the index of its entry
+    int AddSerializedData(const char* data, size_t size, const u8* dirtyAttributes, int next);
+    
+    /// Clear the serialization cache. Called at the start of each sync tick
+    void ClearSerializationCache();
+    
     /// Handle entity action message.
     void HandleEntityAction(kNet::MessageConnection* source, MsgEntityAction& msg);
     /// Handle create entity message.
@@ -115,10 +218,22 @@ private:
     void HandleCreateComponentsReply(kNet::MessageConnection* source, const char* data, size_t numBytes);
     
     /// Process one sync state for changes in the scene
-    /** \todo For now, sends all changed entities/components. In the future, this shall be subject to interest management
+    /** Dirty entities which are not relevant to the user according to the interest filter are not sent, and the ones
+        the client already has are removed from it.
         @param destination MessageConnection where to send the messages
-        @param state Syncstate to process */
-    void ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state);
+        @param state Syncstate to process
+        @param user User whose syncstate is processed, or null when processing the server syncstate on the client */
+    void ProcessSyncState(kNet::MessageConnection* destination, SceneSyncState* state, UserConnection* user);
+    
+    /// Return the byte budget for the next sync tick to a connection, or -1 if unlimited
+    int ByteBudget(kNet::MessageConnection* destination) const;
+    
+    /// Calculate the send priorities of the entities in a sync state's dirty queue
+    /** @param observer Observer entity for calculating distances, or null if none */
+    void CalculatePriorities(SceneSyncState* state, Entity* observer);
+    
+    /// Rescan the scene with the interest filter, queueing creation of entities that became relevant to the user and removal of those that did not
+    void UpdateInterest(UserConnection* user);
     
     /// Validate the scene manipulation action. If returns false, it is ignored
     /** @param source Where the action came from
@@ -146,19 +261,63 @@ private:
     /// Time accumulator for update
     float updateAcc_;
     
+    /// Maximum outbound bandwidth per connection in bytes per second, 0 = derived from the connection
+    int maxBandwidth_;
+    /// Running count of bytes queued for sending, for measuring the bytes a sync tick uses
+    size_t queuedBytes_;
+    /// Entities being processed on the current sync tick
+    std::vector<EntitySyncState*> sendQueue_;
+    
+    /// Serialized component data of the current sync tick
+    std::vector<u8> serializedData_;
+    /// Entries of the serialized data
+    std::vector<SerializedComponentData> serializedEntries_;
+    /// Serialized full updates by component, separately for the full precision [0] and quantized [1] encodings
+    std::map<SerializationKey, int> fullUpdateCache_[2];
+    /// First serialized edit update by component, by encoding. The rest are chained through SerializedComponentData::next
+    std::map<SerializationKey, int> editUpdateCache_[2];
+    /// Number of component serializations done on the last sync tick
+    unsigned numSerializations_;
+    /// Number of times serialized component data was reused on the last sync tick
+    unsigned numSerializationsReused_;
+    
+    /// Interest filter, null if all entities are replicated to all users
+    InterestFilterPtr interestFilter_;
+    /// Time period for rescanning the scene with the interest filter, default 1/4th of a second
+    float interestUpdatePeriod_;
+    /// Time accumulator for interest rescan
+    float interestAcc_;
+    
     /// Server sync state (client only)
     SceneSyncState server_syncstate_;
     
+    /// Quantized attribute encoding settings
+    AttributeQuantization quantization_;
+    /// Whether the quantized attribute encoding is offered (client) or accepted (server)
+    bool quantizationEnabled_;
+    /// Whether the sync state being processed uses the quantized encoding
+    bool quantizeAttributes_;
+    /// Identifies an attribute: entity ID and component ID, and attribute index
+    typedef std::pair<SerializationKey, u8> AttributeKey;
+    /// Last replicated values of quantized Transform attributes, for finding the changed sub-fields. On the client, updated also from the received changes
+    std::map<AttributeKey, Transform> replicatedTransforms_;
+    /// Reusable attributes for reading interpolation end values, by attribute type ID
+    std::vector<IAttribute*> interpolationEndValues_;
+    /// Attribute extrapolation limit applied to the scene
+    float extrapolation_;
+    
     /// Fixed buffers for crafting messages
     char createEntityBuffer_[64 * 1024];
     char createCompsBuffer_[64 * 1024];
     char editAttrsBuffer_[64 * 1024];
     char createAttrsBuffer_[16 * 1024];
+    char fullUpdateBuffer_[64 * 1024];
     char attrDataBuffer_[16 * 1024];
     char removeCompsBuffer_[1024];
     char removeEntityBuffer_[1024];
     char removeAttrsBuffer_[1024];
     std::vector<u8> changedAttributes_;
+    std::vector<std::pair<u8, u8> > changedFields_;
 };
 
 }
@@ -5,37 +5,90 @@
 #include "CoreTypes.h"
 
 #include "kNet/PolledTimer.h"
+#include "kNet/Clock.h"
 
-#include <list>
+#include <deque>
 #include <map>
-#include <set>
+#include <vector>
+#include <utility>
 
 /// Component's per-user network sync state
 struct ComponentSyncState
 {
-    ComponentSyncState() :
+    explicit ComponentSyncState(component_id_t id_ = 0) :
         removed(false),
         isNew(true),
         isInQueue(false),
-        id(0)
+        id(id_)
     {
         for (unsigned i = 0; i < 32; ++i)
             dirtyAttributes[i] = 0;
     }
     
+    /// Marks an attribute dirty with all of its sub-fields
     void MarkAttributeDirty(u8 attrIndex)
     {
         dirtyAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        RemoveDirtyFields(attrIndex);
+    }
+    
+    /// Marks an attribute dirty, and accumulates the sub-fields of it that have changed
+    /** If the attribute is already dirty with all of its sub-fields, it stays so. */
+    void MarkAttributeFieldsDirty(u8 attrIndex, u8 fields)
+    {
+        const bool wasDirty = IsAttributeDirty(attrIndex);
+        dirtyAttributes[attrIndex >> 3] |= (1 << (attrIndex & 7));
+        std::vector<std::pair<u8, u8> >::iterator i = dirtyFields.begin();
+        while (i != dirtyFields.end() && i->first < attrIndex)
+            ++i;
+        if (i != dirtyFields.end() && i->first == attrIndex)
+            i->second |= fields;
+        else if (!wasDirty)
+            dirtyFields.insert(i, std::make_pair(attrIndex, fields));
+    }
+    
+    /// Clears the dirty state of an attribute, for example when the change came from the peer itself
+    void ClearAttributeDirty(u8 attrIndex)
+    {
+        dirtyAttributes[attrIndex >> 3] &= ~(1 << (attrIndex & 7));
+        RemoveDirtyFields(attrIndex);
+    }
+    
+    bool IsAttributeDirty(u8 attrIndex) const
+    {
+        return (dirtyAttributes[attrIndex >> 3] & (1 << (attrIndex & 7))) != 0;
+    }
+    
+    /// Returns the changed sub-fields of a dirty attribute, or all bits set if they have not been tracked
+    u8 DirtyFields(u8 attrIndex) const
+    {
+        for (size_t i = 0; i < dirtyFields.size(); ++i)
+            if (dirtyFields[i].first == attrIndex)
+                return dirtyFields[i].second;
+        return 0xff;
     }
     
     void MarkAttributeCreated(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = true;
+        SetAttributeCreatedOrRemoved(attrIndex, true);
     }
     
     void MarkAttributeRemoved(u8 attrIndex)
     {
-        newAndRemovedAttributes[attrIndex] = false;
+        SetAttributeCreatedOrRemoved(attrIndex, false);
+    }
+    
+    /// Forget a pending create or remove of a dynamic attribute
+    void ClearAttributeCreatedOrRemoved(u8 attrIndex)
+    {
+        for (size_t i = 0; i < newAndRemovedAttributes.size(); ++i)
+        {
+            if (newAndRemovedAttributes[i].first == attrIndex)
+            {
+                newAndRemovedAttributes.erase(newAndRemovedAttributes.begin() + i);
+                return;
+            }
+        }
     }
     
     void DirtyProcessed()
@@ -43,92 +96,175 @@ struct ComponentSyncState
         for (unsigned i = 0; i < 32; ++i)
             dirtyAttributes[i] = 0;
         newAndRemovedAttributes.clear();
+        dirtyFields.clear();
         isNew = false;
     }
     
     u8 dirtyAttributes[32]; ///< Dirty attributes bitfield. A maximum of 256 attributes are supported.
-    std::map<u8, bool> newAndRemovedAttributes; ///< Dynamic attributes by index that have been removed or created since last update. True = create, false = delete
+    /// Dynamic attributes by index that have been removed or created since last update. True = create, false = delete
+    /** Kept as a plain vector, as it is only used by dynamic components and is almost always empty. */
+    std::vector<std::pair<u8, bool> > newAndRemovedAttributes;
+    /// Changed sub-fields of dirty attributes that are sent with the quantized encoding, sorted by attribute index. Usually empty or has one entry.
+    std::vector<std::pair<u8, u8> > dirtyFields;
     component_id_t id; ///< Component ID. Duplicated here intentionally to allow recognizing the component without the parent map.
     bool removed; ///< The component has been removed since last update
     bool isNew; ///< The client does not have the component and it must be serialized in full
-    bool isInQueue; ///< The component is already in the entity's dirty queue
+    bool isInQueue; ///< The component is dirty and must be inspected when the entity is processed
+
+private:
+    void RemoveDirtyFields(u8 attrIndex)
+    {
+        for (size_t i = 0; i < dirtyFields.size(); ++i)
+        {
+            if (dirtyFields[i].first == attrIndex)
+            {
+                dirtyFields.erase(dirtyFields.begin() + i);
+                return;
+            }
+        }
+    }
+    
+    void SetAttributeCreatedOrRemoved(u8 attrIndex, bool created)
+    {
+        for (size_t i = 0; i < newAndRemovedAttributes.size(); ++i)
+        {
+            if (newAndRemovedAttributes[i].first == attrIndex)
+            {
+                newAndRemovedAttributes[i].second = created;
+                return;
+            }
+        }
+        newAndRemovedAttributes.push_back(std::make_pair(attrIndex, created));
+    }
 };
 
 /// Entity's per-user network sync state
+/** The component states are stored inline in a small array which is searched linearly, as entities typically have only a few components.
+    Instead of a separate dirty queue, the dirty components are flagged with isInQueue and counted in numDirtyComponents. */
 struct EntitySyncState
 {
+    static const u32 cNoSlot = 0xffffffff;
+    
     EntitySyncState() :
         removed(false),
         isNew(true),
         isInQueue(false),
         id(0),
-        avgUpdateInterval(0.0f)
+        avgUpdateInterval(0.0f),
+        dirtyTime(0),
+        lastSendTime(0),
+        numChanges(0),
+        lastSendBytes(0),
+        priority(0.0f),
+        numDirtyComponents(0),
+        slot(cNoSlot),
+        prevDirty(cNoSlot),
+        nextDirty(cNoSlot)
     {
     }
     
-    void RemoveFromQueue(component_id_t id)
+    /// Return a component's sync state, or null if it does not exist
+    ComponentSyncState* FindComponent(component_id_t id)
     {
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
-        if (i != components.end())
+        for (size_t i = 0; i < components.size(); ++i)
+            if (components[i].id == id)
+                return &components[i];
+        return 0;
+    }
+    
+    /// Return a component's sync state, creating it if it does not exist
+    /** @note Creating a component state may invalidate pointers to the other component states of this entity. */
+    ComponentSyncState& GetOrCreateComponent(component_id_t id)
+    {
+        ComponentSyncState* compState = FindComponent(id);
+        if (compState)
+            return *compState;
+        components.push_back(ComponentSyncState(id));
+        return components.back();
+    }
+    
+    /// Remove a component's sync state
+    /** @note The last component state is moved in place of the removed one. */
+    void RemoveComponent(component_id_t id)
+    {
+        for (size_t i = 0; i < components.size(); ++i)
         {
-            if (i->second.isInQueue)
+            if (components[i].id == id)
             {
-                for (std::list<ComponentSyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.erase(j);
-                        break;
-                    }
-                }
-                i->second.isInQueue = false;
+                if (components[i].isInQueue)
+                    --numDirtyComponents;
+                if (i + 1 < components.size())
+                    components[i] = components.back();
+                components.pop_back();
+                return;
             }
         }
     }
     
-    void MarkComponentDirty(component_id_t id)
+    /// Change the ID of a component's sync state, after the server has assigned the final ID. Replaces any existing state with the new ID.
+    void ChangeComponentId(component_id_t oldId, component_id_t newId)
+    {
+        if (oldId == newId || !FindComponent(oldId))
+            return;
+        RemoveComponent(newId);
+        FindComponent(oldId)->id = newId;
+    }
+    
+    void RemoveFromQueue(component_id_t id)
+    {
+        ComponentSyncState* compState = FindComponent(id);
+        if (compState && compState->isInQueue)
+        {
+            compState->isInQueue = false;
+            --numDirtyComponents;
+        }
+    }
+    
+    ComponentSyncState& MarkComponentDirty(component_id_t id)
     {
-        ComponentSyncState& compState = components[id]; // Creates new if did not exist
-        if (!compState.id)
-            compState.id = id;
+        ++numChanges;
+        ComponentSyncState& compState = GetOrCreateComponent(id);
         if (!compState.isInQueue)
         {
-            dirtyQueue.push_back(&compState);
             compState.isInQueue = true;
+            ++numDirtyComponents;
         }
+        return compState;
     }
     
     void MarkComponentRemoved(component_id_t id)
     {
         // If user did not have the component in the first place, do nothing
-        std::map<component_id_t, ComponentSyncState>::iterator i = components.find(id);
-        if (i == components.end())
+        ComponentSyncState* compState = FindComponent(id);
+        if (!compState)
             return;
         // If component is marked new, it was not sent yet and can be simply removed from the sync state
-        if (i->second.isNew)
+        if (compState->isNew)
         {
-            RemoveFromQueue(id);
-            components.erase(id);
+            RemoveComponent(id);
             return;
         }
         // Else mark as removed and queue the update
-        i->second.removed = true;
-        if (!i->second.isInQueue)
+        ++numChanges;
+        compState->removed = true;
+        if (!compState->isInQueue)
         {
-            dirtyQueue.push_back(&i->second);
-            i->second.isInQueue = true;
+            compState->isInQueue = true;
+            ++numDirtyComponents;
         }
     }
     
     void DirtyProcessed()
     {
-        for (std::map<component_id_t, ComponentSyncState>::iterator i = components.begin(); i != components.end(); ++i)
+        for (size_t i = 0; i < components.size(); ++i)
         {
-            i->second.DirtyProcessed();
-            i->second.isInQueue = false;
+            components[i].DirtyProcessed();
+            components[i].isInQueue = false;
         }
-        dirtyQueue.clear();
+        numDirtyComponents = 0;
         isNew = false;
+        numChanges = 0;
+        lastSendTime = kNet::Clock::Tick();
     }
     
     void UpdateReceived()
@@ -145,8 +281,7 @@ struct EntitySyncState
             avgUpdateInterval = 0.5 * time + 0.5 * avgUpdateInterval;
     }
     
-    std::list<ComponentSyncState*> dirtyQueue; ///< Dirty components
-    std::map<component_id_t, ComponentSyncState> components; ///< Component syncstates
+    std::vector<ComponentSyncState> components; ///< Component syncstates
     entity_id_t id; ///< Entity ID. Duplicated here intentionally to allow recognizing the entity without the parent map.
     bool removed; ///< The entity has been removed since last update
     bool isNew; ///< The client does not have the entity and it must be serialized in full
@@ -154,139 +289,299 @@ struct EntitySyncState
     
     kNet::PolledTimer updateTimer; ///< Last update received timer
     float avgUpdateInterval; ///< Average network update interval in seconds
+    
+    kNet::tick_t dirtyTime; ///< Time when the entity entered the dirty queue
+    kNet::tick_t lastSendTime; ///< Time when the entity was last processed, 0 if never
+    unsigned numChanges; ///< Number of component and attribute changes since last processed, used as the change magnitude
+    unsigned lastSendBytes; ///< Bytes queued when the entity was last processed, used to estimate the size of a deferred update
+    float priority; ///< Send priority, recalculated on each sync tick when the connection has a byte budget
+    
+    unsigned numDirtyComponents; ///< Number of component syncstates with isInQueue set
+    u32 slot; ///< Index of this state in the scene syncstate's storage
+    u32 prevDirty; ///< Slot of the previous entity in the scene's dirty queue
+    u32 nextDirty; ///< Slot of the next entity in the scene's dirty queue
+};
+
+/// Scene sync statistics of a connection, updated on each sync tick
+struct SceneSyncStats
+{
+    SceneSyncStats() :
+        queuedEntities(0),
+        deferredEntities(0),
+        bytesSent(0),
+        bytesDeferred(0),
+        byteBudget(-1),
+        oldestUpdateAge(0.0f)
+    {
+    }
+    
+    unsigned queuedEntities; ///< Entities in the dirty queue after the tick
+    unsigned deferredEntities; ///< Entities deferred to the next tick because the byte budget was used up
+    unsigned bytesSent; ///< Bytes queued for sending on the tick
+    unsigned bytesDeferred; ///< Estimated size of the deferred updates in bytes
+    int byteBudget; ///< Byte budget of the tick, -1 if unlimited
+    float oldestUpdateAge; ///< Age of the oldest pending update in seconds
 };
 
 /// Scene's per-user network sync state
+/** The entity states are stored in slots which are reused after removal. Replicated entity IDs are allocated sequentially,
+    so their slots are looked up from a directly indexed table; other IDs (unacked and local) go through a map.
+    The storage is chunked so that the states never move, and the dirty queue is an intrusive doubly linked list through the slots,
+    which makes queueing and removal from the queue O(1) without allocations. */
 struct SceneSyncState
 {
-    std::list<EntitySyncState*> dirtyQueue; ///< Dirty entities
-    std::map<entity_id_t, EntitySyncState> entities; ///< Entity syncstates
+    static const u32 cNoSlot = EntitySyncState::cNoSlot;
+    /// Entity IDs below this are looked up from the directly indexed table
+    static const entity_id_t cMaxDirectId = 1 << 20;
+    
+    SceneSyncState() :
+        quantizeAttributes(false),
+        dirtyHead(cNoSlot),
+        dirtyTail(cNoSlot),
+        numDirty(0)
+    {
+    }
+    
+    SceneSyncStats stats; ///< Statistics of the last sync tick
+    bool quantizeAttributes; ///< The peer has negotiated the quantized attribute encoding, see AttributeQuantization. Not affected by Clear()
     
     void Clear()
     {
-        dirtyQueue.clear();
-        entities.clear();
+        slots.clear();
+        freeSlots.clear();
+        directSlots.clear();
+        otherSlots.clear();
+        dirtyHead = dirtyTail = cNoSlot;
+        numDirty = 0;
+        stats = SceneSyncStats();
+    }
+    
+    /// Return an entity's sync state, or null if it does not exist
+    EntitySyncState* FindEntity(entity_id_t id)
+    {
+        u32 slot = SlotOf(id);
+        return slot != cNoSlot ? &slots[slot] : 0;
+    }
+    
+    /// Return an entity's sync state, creating it if it does not exist
+    EntitySyncState& GetOrCreateEntity(entity_id_t id)
+    {
+        u32 slot = SlotOf(id);
+        if (slot != cNoSlot)
+            return slots[slot];
+        
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slot = (u32)slots.size();
+            slots.push_back(EntitySyncState());
+        }
+        EntitySyncState& entityState = slots[slot];
+        entityState.id = id;
+        entityState.slot = slot;
+        SetSlotOf(id, slot);
+        return entityState;
+    }
+    
+    /// Remove an entity's sync state, also from the dirty queue
+    void RemoveEntity(entity_id_t id)
+    {
+        u32 slot = SlotOf(id);
+        if (slot == cNoSlot)
+            return;
+        if (slots[slot].isInQueue)
+            Unlink(slots[slot]);
+        slots[slot] = EntitySyncState();
+        freeSlots.push_back(slot);
+        SetSlotOf(id, cNoSlot);
+    }
+    
+    /// Change the ID of an entity's sync state, after the server has assigned the final ID. Replaces any existing state with the new ID.
+    void ChangeEntityId(entity_id_t oldId, entity_id_t newId)
+    {
+        u32 slot = SlotOf(oldId);
+        if (oldId == newId || slot == cNoSlot)
+            return;
+        RemoveEntity(newId);
+        SetSlotOf(oldId, cNoSlot);
+        SetSlotOf(newId, slot);
+        slots[slot].id = newId;
+    }
+    
+    /// Return the number of entities in the dirty queue
+    size_t DirtyQueueSize() const { return numDirty; }
+    
+    /// Return the first entity in the dirty queue, or null if the queue is empty
+    EntitySyncState* DirtyQueueFront() { return dirtyHead != cNoSlot ? &slots[dirtyHead] : 0; }
+    
+    /// Return the entity following an entity in the dirty queue, or null if it is the last one
+    EntitySyncState* NextInDirtyQueue(const EntitySyncState& entityState) { return entityState.nextDirty != cNoSlot ? &slots[entityState.nextDirty] : 0; }
+    
+    /// Add an entity to the back of the dirty queue, unless it is already queued
+    void PushToDirtyQueue(EntitySyncState& entityState)
+    {
+        if (entityState.isInQueue)
+            return;
+        entityState.prevDirty = dirtyTail;
+        entityState.nextDirty = cNoSlot;
+        if (dirtyTail != cNoSlot)
+            slots[dirtyTail].nextDirty = entityState.slot;
+        else
+            dirtyHead = entityState.slot;
+        dirtyTail = entityState.slot;
+        entityState.isInQueue = true;
+        ++numDirty;
+    }
+    
+    /// Remove and return the first entity of the dirty queue, or null if the queue is empty
+    EntitySyncState* PopDirtyQueue()
+    {
+        EntitySyncState* entityState = DirtyQueueFront();
+        if (entityState)
+            Unlink(*entityState);
+        return entityState;
     }
     
     void RemoveFromQueue(entity_id_t id)
     {
-        std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-        if (i != entities.end())
+        EntitySyncState* entityState = FindEntity(id);
+        if (entityState && entityState->isInQueue)
         {
-            if (i->second.isInQueue)
-            {
-                for (std::list<EntitySyncState*>::iterator j = dirtyQueue.begin(); j != dirtyQueue.end(); ++j)
-                {
-                    if ((*j) == &i->second)
-                    {
-                        dirtyQueue.erase(j);
-                        break;
-                    }
-                }
-                i->second.isInQueue = false;
-                for (std::map<component_id_t, ComponentSyncState>::iterator j = i->second.components.begin(); j != i->second.components.end(); ++j)
-                    j->second.isInQueue = false;
-                i->second.dirtyQueue.clear();
-            }
+            Unlink(*entityState);
+            for (size_t i = 0; i < entityState->components.size(); ++i)
+                entityState->components[i].isInQueue = false;
+            entityState->numDirtyComponents = 0;
         }
     }
     
     void MarkEntityProcessed(entity_id_t id)
     {
-        EntitySyncState& entityState = entities[id];
-        if (!entityState.id)
-            entityState.id = id;
-        entityState.DirtyProcessed();
+        GetOrCreateEntity(id).DirtyProcessed();
     }
     
     void MarkComponentProcessed(entity_id_t id, component_id_t compId)
     {
-        EntitySyncState& entityState = entities[id];
-        if (!entityState.id)
-            entityState.id = id;
-        ComponentSyncState& compState = entityState.components[compId];
-        if (!compState.id)
-            compState.id = compId;
-        compState.DirtyProcessed();
+        GetOrCreateEntity(id).GetOrCreateComponent(compId).DirtyProcessed();
     }
     
-    void MarkEntityDirty(entity_id_t id)
+    EntitySyncState& MarkEntityDirty(entity_id_t id)
     {
-        EntitySyncState& entityState = entities[id]; // Creates new if did not exist
-        if (!entityState.id)
-            entityState.id = id;
+        EntitySyncState& entityState = GetOrCreateEntity(id); // Creates new if did not exist
         if (!entityState.isInQueue)
         {
-            dirtyQueue.push_back(&entityState);
-            entityState.isInQueue = true;
+            PushToDirtyQueue(entityState);
+            entityState.dirtyTime = kNet::Clock::Tick();
         }
+        return entityState;
     }
     
     void MarkEntityRemoved(entity_id_t id)
     {
         // If user did not have the entity in the first place, do nothing
-        std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-        if (i == entities.end())
+        EntitySyncState* entityState = FindEntity(id);
+        if (!entityState)
             return;
         // If entity is marked new, it was not sent yet and can be simply removed from the sync state
-        if (i->second.isNew)
+        if (entityState->isNew)
         {
-            RemoveFromQueue(id);
-            entities.erase(id);
+            RemoveEntity(id);
             return;
         }
         // Else mark as removed and queue the update
-        i->second.removed = true;
-        if (!i->second.isInQueue)
+        entityState->removed = true;
+        if (!entityState->isInQueue)
         {
-            dirtyQueue.push_back(&i->second);
-            i->second.isInQueue = true;
+            PushToDirtyQueue(*entityState);
+            entityState->dirtyTime = kNet::Clock::Tick();
         }
     }
     
     void MarkComponentDirty(entity_id_t id, component_id_t compId)
     {
-        MarkEntityDirty(id);
-        EntitySyncState& entityState = entities[id]; // Creates new if did not exist
-        if (!entityState.id)
-            entityState.id = id;
-        entityState.MarkComponentDirty(compId);
+        MarkEntityDirty(id).MarkComponentDirty(compId);
     }
     
     void MarkComponentRemoved(entity_id_t id, component_id_t compId)
     {
         // If user did not have the entity or component in the first place, do nothing
-        std::map<entity_id_t, EntitySyncState>::iterator i = entities.find(id);
-        if (i == entities.end())
+        EntitySyncState* entityState = FindEntity(id);
+        if (!entityState)
             return;
         MarkEntityDirty(id);
-        i->second.MarkComponentRemoved(compId);
+        entityState->MarkComponentRemoved(compId);
     }
     
     void MarkAttributeDirty(entity_id_t id, component_id_t compId, u8 attrIndex)
     {
-        MarkEntityDirty(id);
-        EntitySyncState& entityState = entities[id];
-        entityState.MarkComponentDirty(compId);
-        ComponentSyncState& compState = entityState.components[compId];
-        compState.MarkAttributeDirty(attrIndex);
+        MarkEntityDirty(id).MarkComponentDirty(compId).MarkAttributeDirty(attrIndex);
+    }
+    
+    void MarkAttributeFieldsDirty(entity_id_t id, component_id_t compId, u8 attrIndex, u8 fields)
+    {
+        MarkEntityDirty(id).MarkComponentDirty(compId).MarkAttributeFieldsDirty(attrIndex, fields);
     }
     
     void MarkAttributeCreated(entity_id_t id, component_id_t compId, u8 attrIndex)
     {
-        MarkEntityDirty(id);
-        EntitySyncState& entityState = entities[id];
-        entityState.MarkComponentDirty(compId);
-        ComponentSyncState& compState = entityState.components[compId];
-        compState.MarkAttributeCreated(attrIndex);
+        MarkEntityDirty(id).MarkComponentDirty(compId).MarkAttributeCreated(attrIndex);
     }
     
     void MarkAttributeRemoved(entity_id_t id, component_id_t compId, u8 attrIndex)
     {
-        MarkEntityDirty(id);
-        EntitySyncState& entityState = entities[id];
-        entityState.MarkComponentDirty(compId);
-        ComponentSyncState& compState = entityState.components[compId];
-        compState.MarkAttributeRemoved(attrIndex);
+        MarkEntityDirty(id).MarkComponentDirty(compId).MarkAttributeRemoved(attrIndex);
+    }
+
+private:
+    u32 SlotOf(entity_id_t id) const
+    {
+        if (id < cMaxDirectId)
+            return id < directSlots.size() ? directSlots[id] : cNoSlot;
+        std::map<entity_id_t, u32>::const_iterator i = otherSlots.find(id);
+        return i != otherSlots.end() ? i->second : cNoSlot;
     }
+    
+    void SetSlotOf(entity_id_t id, u32 slot)
+    {
+        if (id < cMaxDirectId)
+        {
+            if (id >= directSlots.size())
+            {
+                if (slot == cNoSlot)
+                    return;
+                directSlots.resize(id + 1, (u32)cNoSlot);
+            }
+            directSlots[id] = slot;
+        }
+        else if (slot != cNoSlot)
+            otherSlots[id] = slot;
+        else
+            otherSlots.erase(id);
+    }
+    
+    void Unlink(EntitySyncState& entityState)
+    {
+        if (entityState.prevDirty != cNoSlot)
+            slots[entityState.prevDirty].nextDirty = entityState.nextDirty;
+        else
+            dirtyHead = entityState.nextDirty;
+        if (entityState.nextDirty != cNoSlot)
+            slots[entityState.nextDirty].prevDirty = entityState.prevDirty;
+        else
+            dirtyTail = entityState.prevDirty;
+        entityState.prevDirty = entityState.nextDirty = cNoSlot;
+        entityState.isInQueue = false;
+        --numDirty;
+    }
+    
+    std::deque<EntitySyncState> slots; ///< Entity syncstates. A deque so that the states do not move when slots are added
+    std::vector<u32> freeSlots; ///< Slots of removed entity syncstates, reused first
+    std::vector<u32> directSlots; ///< Slot by entity ID for IDs below cMaxDirectId
+    std::map<entity_id_t, u32> otherSlots; ///< Slot by entity ID for the rest (unacked and local IDs)
+    u32 dirtyHead; ///< First slot in the dirty queue
+    u32 dirtyTail; ///< Last slot in the dirty queue
+    size_t numDirty; ///< Number of entities in the dirty queue
 };
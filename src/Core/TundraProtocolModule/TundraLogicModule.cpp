@@ -183,6 +183,14 @@ void TundraLogicModule::Initialize()
         "Replace-mode can be optionally disabled. Usage: importscene(filename,clearScene=false,replace=true)",
         this, SLOT(ImportScene(QString, bool, bool)));
 
+    framework_->Console()->RegisterCommand("syncstats",
+        "Prints the scene sync statistics of each connection: queued entities, deferred updates and the age of the oldest pending update.",
+        syncManager_.get(), SLOT(PrintSyncStats()));
+
+    framework_->Console()->RegisterCommand("syncstatebenchmark",
+        "Measures marking and draining dirty scene sync state. Usage: syncstatebenchmark(users,entities,ticks)",
+        syncManager_.get(), SLOT(BenchmarkSyncState(int, int, int)));
+
     framework_->Console()->RegisterCommand("importmesh",
         "Imports a single mesh as a new entity. Position can be specified optionally."
         "Usage: importmesh(filename,x=0,y=0,z=0,xrot=0,yrot=0,zrot=0,xscale=1,yscale=1,zscale=1,inspectForMaterialsAndSkeleton=true)",
@@ -235,6 +243,68 @@ void TundraLogicModule::Initialize()
                 LogError("--netrate parameter is not a valid integer.");
         }
     }
+    
+    if (framework_->HasCommandLineParameter("--netbandwidth"))
+    {
+        QStringList bandwidthParam = framework_->CommandLineParameters("--netbandwidth");
+        if (bandwidthParam.size() > 0)
+        {
+            bool ok;
+            int bandwidth = bandwidthParam.first().toInt(&ok);
+            if (ok && bandwidth > 0)
+                syncManager_->SetMaxBandwidth(bandwidth * 1024);
+            else
+                LogError("--netbandwidth parameter is not a valid integer.");
+        }
+    }
+    
+    if (framework_->HasCommandLineParameter("--interestradius"))
+    {
+        QStringList radiusParam = framework_->CommandLineParameters("--interestradius");
+        if (radiusParam.size() > 0)
+        {
+            bool ok;
+            float radius = radiusParam.first().toFloat(&ok);
+            if (ok && radius > 0.f)
+                syncManager_->SetInterestFilter(InterestFilterPtr(new DistanceInterestFilter(radius)));
+            else
+                LogError("--interestradius parameter is not a valid positive number.");
+        }
+    }
+    
+    if (framework_->HasCommandLineParameter("--netfullprecision"))
+        syncManager_->SetQuantizationEnabled(false);
+    
+    if (framework_->HasCommandLineParameter("--networldbounds"))
+    {
+        QStringList boundsParam = framework_->CommandLineParameters("--networldbounds");
+        if (boundsParam.size() > 0)
+        {
+            QStringList values = boundsParam.first().split(',');
+            float bounds[6];
+            bool ok = values.size() == 6;
+            for(int i = 0; ok && i < 6; ++i)
+                bounds[i] = values[i].trimmed().toFloat(&ok);
+            if (ok && bounds[0] < bounds[3] && bounds[1] < bounds[4] && bounds[2] < bounds[5])
+                syncManager_->SetQuantizationBounds(float3(bounds[0], bounds[1], bounds[2]), float3(bounds[3], bounds[4], bounds[5]));
+            else
+                LogError("--networldbounds parameter is not of the form minX,minY,minZ,maxX,maxY,maxZ.");
+        }
+    }
+    
+    if (framework_->HasCommandLineParameter("--netextrapolation"))
+    {
+        QStringList extrapolationParam = framework_->CommandLineParameters("--netextrapolation");
+        if (extrapolationParam.size() > 0)
+        {
+            bool ok;
+            float fraction = extrapolationParam.first().toFloat(&ok);
+            if (ok && fraction >= 0.f)
+                syncManager_->SetExtrapolation(fraction);
+            else
+                LogError("--netextrapolation parameter is not a valid non-negative number.");
+        }
+    }
 }
 
 void TundraLogicModule::Uninitialize()
@@ -344,7 +414,7 @@ void TundraLogicModule::LoadStartupScene()
             if (!useBinary)
                 scene->LoadSceneXML(startupScene, false/*clearScene*/, false/*replaceOnConflict*/, AttributeChange::Default);
             else
-                scene->LoadSceneBinary(startupScene, false/*clearScene*/, false/*replaceOnConflict*/, AttributeChange::Default);
+                LoadStartupSceneBinary(scene, startupScene, false/*clearScene*/);
         }
     }
 }
@@ -362,12 +432,31 @@ void TundraLogicModule::StartupSceneLoaded(AssetPtr asset)
         if (!useBinary)
             scene->LoadSceneXML(sceneDiskSource, true/*clearScene*/, false/*replaceOnConflict*/, AttributeChange::Default);
         else
-            scene->LoadSceneBinary(sceneDiskSource, true/*clearScene*/, false/*replaceOnConflict*/, AttributeChange::Default);
+            LoadStartupSceneBinary(scene, sceneDiskSource, true/*clearScene*/);
     }
     else
         LogError("Could not resolve disk source for loaded scene file " + asset->Name());
 }
 
+void TundraLogicModule::LoadStartupSceneBinary(Scene *scene, const QString &filename, bool clearScene)
+{
+    // With --progressiveload, the server starts serving while the rest of the scene is created over the following frames
+    QStringList batchParam = framework_->CommandLineParameters("--progressiveload");
+    if (batchParam.size() > 0)
+    {
+        bool ok;
+        int entitiesPerFrame = batchParam.first().toInt(&ok);
+        if (ok && entitiesPerFrame > 0)
+        {
+            scene->LoadSceneBinaryProgressive(filename, clearScene, false/*replaceOnConflict*/, AttributeChange::Default, entitiesPerFrame);
+            return;
+        }
+        LogError("--progressiveload parameter is not a valid positive integer, loading the whole scene at once.");
+    }
+    
+    scene->LoadSceneBinary(filename, clearScene, false/*replaceOnConflict*/, AttributeChange::Default);
+}
+
 void TundraLogicModule::StartupSceneTransferFailed(IAssetTransfer *transfer, QString reason)
 {
     LogError("Failed to load startup scene from " + transfer->SourceUrl() + " reason: " + reason);
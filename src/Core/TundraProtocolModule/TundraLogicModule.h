@@ -6,6 +6,8 @@
 #include "TundraLogicModuleApi.h"
 #include "AssetFwd.h"
 
+class Scene;
+
 namespace kNet
 {
     class MessageConnection;
@@ -92,6 +94,9 @@ private:
 
     /// Loads the startup scene
     void LoadStartupScene();
+    
+    /// Loads a binary startup scene, progressively if --progressiveload was specified.
+    void LoadStartupSceneBinary(Scene *scene, const QString &filename, bool clearScene);
 
     boost::shared_ptr<SyncManager> syncManager_; ///< Sync manager
     boost::shared_ptr<Client> client_; ///< Client
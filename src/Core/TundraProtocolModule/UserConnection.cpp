@@ -3,6 +3,7 @@
 #include "StableHeaders.h"
 #include "UserConnection.h"
 #include "Entity.h"
+#include "SyncState.h"
 
 #include "DebugOperatorNew.h"
 
@@ -48,6 +49,31 @@ QString UserConnection::GetProperty(const QString& key) const
         return empty;
 }
 
+void UserConnection::SetObserverEntityId(uint id)
+{
+    observerEntityId = id;
+}
+
+uint UserConnection::ObserverEntityId() const
+{
+    return observerEntityId;
+}
+
+QVariantMap UserConnection::GetSyncStats() const
+{
+    QVariantMap map;
+    if (!syncState)
+        return map;
+    const SceneSyncStats& stats = syncState->stats;
+    map["queuedEntities"] = stats.queuedEntities;
+    map["deferredEntities"] = stats.deferredEntities;
+    map["bytesSent"] = stats.bytesSent;
+    map["bytesDeferred"] = stats.bytesDeferred;
+    map["byteBudget"] = stats.byteBudget;
+    map["oldestUpdateAge"] = stats.oldestUpdateAge;
+    return map;
+}
+
 void UserConnection::DenyConnection(const QString &reason)
 {
     properties["authenticated"] = "false";
@@ -3,11 +3,13 @@
 #pragma once
 
 #include "KristalliProtocolModuleApi.h"
+#include "CoreTypes.h"
 #include "kNet.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
 #include <QObject>
+#include <QVariant>
 
 namespace kNet
 {
@@ -27,7 +29,8 @@ public:
     Q_PROPERTY (int id READ GetConnectionID)
     
     UserConnection() :
-        userID(0)
+        userID(0),
+        observerEntityId(0)
     {
     }
     
@@ -41,6 +44,8 @@ public:
     std::map<QString, QString> properties;
     /// Scene sync state, created and used by the SyncManager
     boost::shared_ptr<SceneSyncState> syncState;
+    /// ID of the entity (usually the avatar) from whose viewpoint the interest filter decides what to replicate. 0 = none
+    entity_id_t observerEntityId;
     
 public slots:
     /// Execute an action on an entity, sent only to the specific user
@@ -61,6 +66,17 @@ public slots:
     /// Get a property
     QString GetProperty(const QString& key) const;
     
+    /// Set the observer entity ID used by the server's interest management
+    void SetObserverEntityId(uint id);
+    
+    /// Get the observer entity ID, 0 if not set
+    uint ObserverEntityId() const;
+    
+    /// Get the scene sync statistics of the connection
+    /** The map contains queuedEntities, deferredEntities, bytesSent, bytesDeferred, byteBudget (-1 = unlimited)
+        and oldestUpdateAge (seconds) of the last sync tick. */
+    QVariantMap GetSyncStats() const;
+    
     /// Deny connection. Call as a response to server.UserAboutToConnect() if necessary
     void DenyConnection(const QString& reason);
     
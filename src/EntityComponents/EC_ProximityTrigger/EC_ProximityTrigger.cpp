@@ -51,7 +51,7 @@ void EC_ProximityTrigger::Update(float timeStep)
     if (!placeable)
         return;
     
-    EntityList otherTriggers = scene->GetEntitiesWithComponent(EC_ProximityTrigger::TypeNameStatic());
+    EntityList otherTriggers = scene->GetEntitiesWithComponent<EC_ProximityTrigger>();
     for(EntityList::iterator i = otherTriggers.begin(); i != otherTriggers.end(); ++i)
     {
         Entity* otherEntity = (*i).get();